@@ -0,0 +1,266 @@
+#include <iostream>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <functional>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#include "KernelUtil.h"
+using namespace std;
+
+/* ***********************************************************************
+ * KernelBench:
+ * Compare the throughput of the DN-to-TOA conversion paths on this host:
+ * the arithmetic kernel for each instruction set the CPU supports, and
+ * the per-band lookup table. Rows of synthetic DNs are converted over and
+ * over and the best of several timed repetitions is reported, in ns per
+ * pixel and millions of pixels per second. Last, the scene-mean solar
+ * zenith is compared against per-pixel zenith angles from a solar grid
+ * (-g grid), and the overhead of the grid is reported.
+ *
+ * The sweep mode converts one buffer over and over for working sets from
+ * L1-resident to DRAM-resident (DNs plus both outputs), for the original
+ * per-pixel formula, the fused scalar kernel, each vector kernel and the
+ * lookup table. It reports ns per pixel and bytes moved per TSC cycle,
+ * and where each kernel turns from compute-bound to memory-bound.
+ *
+ *   $ make bench
+ *   $ bin/kernel_bench [columns] [rows]
+ *   $ bin/kernel_bench sweep [largest working set, MB]
+ */
+
+// the coefficients of a WorldView-3 coastal band, near-nadir scene
+static BandCoefficients BenchCoefficients() {
+  return MakeBandCoefficients( "BAND_C",1.397474e-02,4.05e-02,1743.81,0.9877,0.6109 );
+}
+
+template<typename F>
+static double TimeRows( F Convert, size_t Rows, int Repetitions ) {
+  /* best wall time (seconds) of Repetitions passes over Rows rows */
+  double Best = 1e30;
+  for( int r=0; r<Repetitions; r++ ) {
+    auto Start = std::chrono::steady_clock::now();
+    for( size_t row=0; row<Rows; row++ ) Convert( row );
+    std::chrono::duration<double> Elapsed = std::chrono::steady_clock::now()-Start;
+    if( Elapsed.count()<Best ) Best = Elapsed.count();
+  }
+  return Best;
+}
+
+static SolarZenithGrid BenchGrid( size_t Cols, size_t Rows ) {
+  /* a grid whose scale drifts by about 1% across and along the scene */
+  SolarZenithGrid Grid;
+  Grid.Spacing  = 512;
+  Grid.NodeRows = std::max( 2,( (int)Rows-1 )/Grid.Spacing+2 );
+  Grid.NodeCols = std::max( 2,( (int)Cols-1 )/Grid.Spacing+2 );
+  for( int r=0; r<Grid.NodeRows; r++ ) {
+    for( int c=0; c<Grid.NodeCols; c++ ) {
+      Grid.Scale.push_back( 1.0f+0.01f*(float)c/Grid.NodeCols+0.002f*(float)r/Grid.NodeRows );
+    }
+  }
+  return Grid;
+}
+
+static void Report( const char* Name, int Bits, double Seconds, size_t Pixels ) {
+  printf("    %-16s %2d-bit  %8.3f ns/pixel  %9.1f MPix/s\n",Name,Bits,
+    1e9*Seconds/(double)Pixels,(double)Pixels/Seconds/1e6 );
+}
+
+static void ConvertRowOriginal( const unsigned short* DN, size_t N, const BandCoefficients& C,
+  unsigned short NoDataValue, float* Radiances, float* Reflectances ) {
+  /* *********************************************************************
+   * The per-pixel formula the kernels replaced: a divide per radiance and
+   * the whole reflectance expression, cosine included, per pixel.
+   */
+  for( size_t i=0; i<N; i++ ) {
+    float Radiance = (float)((float)DN[i]*C.AbsCalFactor )/C.EffectiveBandwidth;
+    float Reflectance = (float)(( Radiance*( C.EarthSunDistance*C.EarthSunDistance )*M_PI )/
+      ( C.SolarIrradiance*cos( C.SolarZenithAngle )));
+    if( DN[i] == NoDataValue ) {
+      Radiance    = -9999.0f;
+      Reflectance = -9999.0f;
+    }
+    Radiances[i]    = Radiance;
+    Reflectances[i] = Reflectance;
+  }
+}
+
+static inline uint64_t TimestampCounter() {
+  /* TSC ticks, or 0 where there is no TSC (bytes/cycle is then not shown) */
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return 0;
+#endif
+}
+
+// one kernel of the sweep: converts N pixels from the start of the buffers
+struct SweepKernel {
+  String Name;
+  KernelISA ISA;
+  std::function<void( size_t )> Convert;
+};
+
+static String WorkingSetName( size_t Bytes ) {
+  char Name[32];
+  if( Bytes<( 1u<<20 )) snprintf( Name,sizeof(Name),"%zu KB",Bytes>>10 );
+  else                  snprintf( Name,sizeof(Name),"%zu MB",Bytes>>20 );
+  return Name;
+}
+
+static int Sweep( size_t MaxBytes ) {
+  /* *********************************************************************
+   * Per working set (1K pixels doubling up to MaxBytes of 16-bit DNs and
+   * two float outputs, 10 bytes a pixel) and kernel: convert the same N
+   * pixels at least 3 times and about 32 Mpixels in all, best of three
+   * such batches after a warm-up pass. A kernel is called memory-bound
+   * from the first working set where it takes 1.5x its ns/pixel in L1.
+   */
+  const size_t BytesPerPixel = sizeof(unsigned short)+2*sizeof(float);
+  size_t MaxPixels = std::max( (size_t)1024,MaxBytes/BytesPerPixel );
+  BandCoefficients Coefficients = BenchCoefficients();
+  KernelISA Detected = DetectKernelISA();
+
+  std::mt19937 Generator( 42 );
+  std::uniform_int_distribution<int> Distribution( 0,2047 );
+  std::vector<unsigned short> DN( MaxPixels );
+  for( size_t i=0; i<DN.size(); i++ ) DN[i] = (unsigned short)Distribution( Generator );
+  std::vector<float> Radiances( MaxPixels ), Reflectances( MaxPixels );
+  BandLookupTable Table = BuildBandLookupTable( Coefficients,11,true,0 );
+
+  std::vector<SweepKernel> Kernels;
+  Kernels.push_back({ "original",KERNEL_SCALAR,[&]( size_t N ) {
+    ConvertRowOriginal( DN.data(),N,Coefficients,0,Radiances.data(),Reflectances.data() ); }});
+  for( int ISA=KERNEL_SCALAR; ISA<=(int)Detected; ISA++ ) {
+    Kernels.push_back({ "fused/"+String( KernelISAName( (KernelISA)ISA )),(KernelISA)ISA,[&]( size_t N ) {
+      ConvertRowToTOA( DN.data(),N,Coefficients,true,(unsigned short)0,
+        Radiances.data(),Reflectances.data() ); }});
+  }
+  Kernels.push_back({ "lut",Detected,[&]( size_t N ) {
+    ConvertRowLookup( DN.data(),N,Table,Radiances.data(),Reflectances.data() ); }});
+
+  printf("  kernel sweep: 11-bit DNs, %zu bytes/pixel moved, up to %s, best of 3\n",
+    BytesPerPixel,WorkingSetName( MaxPixels*BytesPerPixel ).c_str() );
+#ifdef _SC_LEVEL1_DCACHE_SIZE
+  printf("  caches: L1d %ld KB, L2 %ld KB, L3 %ld KB\n",sysconf( _SC_LEVEL1_DCACHE_SIZE )>>10,
+    sysconf( _SC_LEVEL2_CACHE_SIZE )>>10,sysconf( _SC_LEVEL3_CACHE_SIZE )>>10 );
+#endif
+
+  std::vector<size_t> Sizes;
+  for( size_t N=1024; N<=MaxPixels; N*=2 ) Sizes.push_back( N );
+  std::vector<std::vector<double>> Nanoseconds( Kernels.size() ), BytesPerCycle( Kernels.size() );
+  for( size_t k=0; k<Kernels.size(); k++ ) {
+    SetKernelISA( Kernels[k].ISA );
+    for( size_t N: Sizes ) {
+      size_t Passes = std::max( (size_t)3,( (size_t)32<<20 )/N );
+      Kernels[k].Convert( N );
+      double BestSeconds = 1e30;
+      uint64_t BestTicks = 0;
+      for( int r=0; r<3; r++ ) {
+        uint64_t Ticks = TimestampCounter();
+        auto Start = std::chrono::steady_clock::now();
+        for( size_t p=0; p<Passes; p++ ) Kernels[k].Convert( N );
+        std::chrono::duration<double> Elapsed = std::chrono::steady_clock::now()-Start;
+        Ticks = TimestampCounter()-Ticks;
+        if( Elapsed.count()<BestSeconds ) {
+          BestSeconds = Elapsed.count();
+          BestTicks   = Ticks;
+        }
+      }
+      double Pixels = (double)N*Passes;
+      Nanoseconds[k].push_back( 1e9*BestSeconds/Pixels );
+      BytesPerCycle[k].push_back( BestTicks>0 ? Pixels*BytesPerPixel/(double)BestTicks : 0.0 );
+    }
+  }
+  SetKernelISA( Detected );
+
+  for( int Table=0; Table<2; Table++ ) {
+    printf("\n    %-12s",Table == 0 ? "ns/pixel" : "bytes/cycle" );
+    for( const SweepKernel& Kernel: Kernels ) printf(" %14s",Kernel.Name.c_str() );
+    printf("\n");
+    for( size_t s=0; s<Sizes.size(); s++ ) {
+      printf("    %-12s",WorkingSetName( Sizes[s]*BytesPerPixel ).c_str() );
+      for( size_t k=0; k<Kernels.size(); k++ ) {
+        printf(" %14.3f",Table == 0 ? Nanoseconds[k][s] : BytesPerCycle[k][s] );
+      }
+      printf("\n");
+    }
+  }
+
+  printf("\n");
+  for( size_t k=0; k<Kernels.size(); k++ ) {
+    double L1 = *std::min_element( Nanoseconds[k].begin(),Nanoseconds[k].begin()+std::min( (size_t)3,Sizes.size() ));
+    size_t s = 0;
+    while( s<Sizes.size() && Nanoseconds[k][s]<1.5*L1 ) s++;
+    if( s<Sizes.size() ) {
+      printf("    %-14s memory-bound from %s (%.3f ns/pixel, %.3f in L1)\n",Kernels[k].Name.c_str(),
+        WorkingSetName( Sizes[s]*BytesPerPixel ).c_str(),Nanoseconds[k][s],L1 );
+    } else {
+      printf("    %-14s compute-bound at every working set (%.3f ns/pixel in L1)\n",
+        Kernels[k].Name.c_str(),L1 );
+    }
+  }
+  return 0;
+}
+
+int main( int argc, char* argv[] ) {
+  if( argc>1 && strcmp( argv[1],"sweep" ) == 0 ) {
+    size_t MaxMB = ( argc>2 ) ? (size_t)atol(argv[2]) : 256;
+    return Sweep( MaxMB<<20 );
+  }
+  size_t Cols = ( argc>1 ) ? (size_t)atol(argv[1]) : 9000;
+  size_t Rows = ( argc>2 ) ? (size_t)atol(argv[2]) : 512;
+  const int Repetitions = 5;
+  BandCoefficients Coefficients = BenchCoefficients();
+  KernelISA Detected = DetectKernelISA();
+
+  printf("  kernel benchmark: %zu columns x %zu rows, best of %d\n",Cols,Rows,Repetitions );
+  printf("  detected instruction set: %s\n",KernelISAName( Detected ));
+
+  std::vector<float> Radiances( Cols ), Reflectances( Cols );
+  for( int Bits: { 11,16 } ) {
+
+    // a block of random DNs of the given bit depth, with some NoData (0)
+    std::mt19937 Generator( 42 );
+    std::uniform_int_distribution<int> Distribution( 0,(1<<Bits)-1 );
+    std::vector<unsigned short> DN( Cols*Rows );
+    for( size_t i=0; i<DN.size(); i++ ) DN[i] = (unsigned short)Distribution( Generator );
+
+    for( int ISA=KERNEL_SCALAR; ISA<=(int)Detected; ISA++ ) {
+      SetKernelISA( (KernelISA)ISA );
+      double Seconds = TimeRows( [&]( size_t row ) {
+        ConvertRowToTOA( DN.data()+row*Cols,Cols,Coefficients,true,(unsigned short)0,
+          Radiances.data(),Reflectances.data() );
+      },Rows,Repetitions );
+      Report( ( "arith/"+String(KernelISAName( (KernelISA)ISA )) ).c_str(),Bits,Seconds,Cols*Rows );
+    }
+
+    SetKernelISA( Detected );
+    BandLookupTable Table = BuildBandLookupTable( Coefficients,Bits,true,0 );
+    double Seconds = TimeRows( [&]( size_t row ) {
+      ConvertRowLookup( DN.data()+row*Cols,Cols,Table,Radiances.data(),Reflectances.data() );
+    },Rows,Repetitions );
+    Report( "lut",Bits,Seconds,Cols*Rows );
+
+    // scene-mean zenith against per-pixel zenith from a solar grid
+    SolarZenithGrid Grid = BenchGrid( Cols,Rows );
+    double MeanSeconds = TimeRows( [&]( size_t row ) {
+      ConvertRowToTOA( DN.data()+row*Cols,Cols,Coefficients,true,(unsigned short)0,
+        Radiances.data(),Reflectances.data() );
+    },Rows,Repetitions );
+    double GridSeconds = TimeRows( [&]( size_t row ) {
+      ConvertRowToTOAGrid( DN.data()+row*Cols,Cols,0,(int)row,Coefficients,Grid,true,
+        (unsigned short)0,Radiances.data(),Reflectances.data() );
+    },Rows,Repetitions );
+    Report( "zenith/mean",Bits,MeanSeconds,Cols*Rows );
+    Report( "zenith/grid",Bits,GridSeconds,Cols*Rows );
+    printf("    %-16s %2d-bit  %+7.1f %%\n","grid overhead",Bits,100.0*( GridSeconds/MeanSeconds-1.0 ));
+  }
+  return 0;
+}
@@ -0,0 +1,102 @@
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <stdio.h>
+#include <unistd.h>
+#include "pugixml.hpp"
+#include "Misc.h"
+#include "TOAUtil.h"
+using namespace std;
+
+/* ***********************************************************************
+ * MetadataBench:
+ * Time loading the band calibrations from a DG XML file, before and
+ * after memory-mapped parsing: the old path (pugixml load_file, a DOM of
+ * the whole document with the default flags) against ReadSceneCalibration
+ * (mmap, IMD subtree only, in place, minimal flags). Without an XML file
+ * a synthetic one is written to /tmp, with per-line ephemeris and
+ * attitude lists the size of a long strip's.
+ *
+ *   $ make bench
+ *   $ bin/metadata_bench [file.XML] [repetitions]
+ */
+
+static String WriteSyntheticXML( int EphemerisLines ) {
+  /* a WV03-like XML: the IMD first, then the EPH and ATT point lists */
+  String Filename = "/tmp/metadata_bench_"+std::to_string( getpid() )+".XML";
+  std::ofstream XML( Filename );
+  XML << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<isd>\n  <IMD>\n";
+  XML << "    <VERSION>AA</VERSION>\n    <IMAGE>\n      <SATID>WV03</SATID>\n    </IMAGE>\n";
+  const char* Bands[] = { "BAND_C","BAND_B","BAND_G","BAND_Y","BAND_R","BAND_RE","BAND_N","BAND_N2" };
+  for( const char* Band: Bands ) {
+    XML << "    <" << Band << ">\n      <ULLON>-1.0e+02</ULLON>\n"
+        << "      <ABSCALFACTOR>1.397474000000000e-02</ABSCALFACTOR>\n"
+        << "      <EFFECTIVEBANDWIDTH>4.050000000000000e-02</EFFECTIVEBANDWIDTH>\n"
+        << "    </" << Band << ">\n";
+  }
+  XML << "  </IMD>\n  <EPH>\n    <EPHEMLISTList>\n";
+  for( int i=0; i<EphemerisLines; i++ ) {
+    XML << "      <EPHEMLIST>" << i << " 1.234567890000000e+06 -4.567890123000000e+06"
+        << " 4.987654321000000e+06 1.23e+03 -4.56e+03 7.89e+03 1.0e-06 1.0e-06 1.0e-06"
+        << " 1.0e-06 1.0e-06 1.0e-06</EPHEMLIST>\n";
+  }
+  XML << "    </EPHEMLISTList>\n  </EPH>\n  <ATT>\n    <ATTLISTList>\n";
+  for( int i=0; i<EphemerisLines; i++ ) {
+    XML << "      <ATTLIST>" << i << " 1.2e-01 -3.4e-01 5.6e-01 7.8e-01 1.0e-08 1.0e-08"
+        << " 1.0e-08 1.0e-08 1.0e-08 1.0e-08 1.0e-08 1.0e-08 1.0e-08 1.0e-08</ATTLIST>\n";
+  }
+  XML << "    </ATTLISTList>\n  </ATT>\n</isd>\n";
+  return Filename;
+}
+
+template<typename F>
+static double BestSeconds( F Load, int Repetitions ) {
+  /* best wall time (seconds) of Repetitions loads */
+  double Best = 1e30;
+  for( int r=0; r<Repetitions; r++ ) {
+    auto Start = std::chrono::steady_clock::now();
+    Load();
+    std::chrono::duration<double> Elapsed = std::chrono::steady_clock::now()-Start;
+    if( Elapsed.count()<Best ) Best = Elapsed.count();
+  }
+  return Best;
+}
+
+int main( int argc, char* argv[] ) {
+  bool Synthetic  = ( argc<2 );
+  String Filename = Synthetic ? WriteSyntheticXML( 200000 ) : String( argv[1] );
+  int Repetitions = ( argc>2 ) ? atoi(argv[2]) : 10;
+  MappedFile Probe( Filename );
+  printf("  metadata benchmark: %s (%.1f MB), best of %d\n",Filename.c_str(),
+    (double)Probe.GetSize()/1e6,Repetitions );
+
+  // before: a DOM of the whole document, then the same walk over the IMD
+  size_t DOMBands = 0;
+  double DOMSeconds = BestSeconds( [&]() {
+    pugi::xml_document Document;
+    if( !Document.load_file( Filename.c_str() )) {
+      printf("  unable to parse %s\n",Filename.c_str() );
+      exit(1);
+    }
+    pugi::xml_node IMD = Document.child("isd").child("IMD");
+    DOMBands = 0;
+    for( pugi::xml_node Child: IMD.children() ) {
+      if( String( Child.name() ).compare( 0,5,"BAND_" ) != 0 ) continue;
+      stod( String( Child.child("ABSCALFACTOR").child_value() ));
+      stod( String( Child.child("EFFECTIVEBANDWIDTH").child_value() ));
+      DOMBands++;
+    }
+  },Repetitions );
+
+  // after: memory-mapped, IMD subtree only
+  size_t MappedBands = 0;
+  double MappedSeconds = BestSeconds( [&]() {
+    MappedBands = ReadSceneCalibration( Filename.c_str() ).Bands.size();
+  },Repetitions );
+
+  printf("    %-24s %9.3f ms  (%zu bands)\n","load_file, full DOM",1e3*DOMSeconds,DOMBands );
+  printf("    %-24s %9.3f ms  (%zu bands)\n","mmap, IMD subtree",1e3*MappedSeconds,MappedBands );
+  printf("    speedup %.1fx\n",DOMSeconds/std::max( MappedSeconds,1e-12 ));
+  if( Synthetic ) std::remove( Filename.c_str() );
+  return 0;
+}
@@ -0,0 +1,382 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <map>
+#include <vector>
+#include <getopt.h>
+#include <fcntl.h>
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "SyntheticScene.h"
+#include "SceneUtil.h"
+#include "ImageUtil.h"
+#include "BatchUtil.h"
+#include "Misc.h"
+using namespace std;
+
+/* ***********************************************************************
+ * SceneBench:
+ * End-to-end benchmark of bin/toa on synthetic scenes (see
+ * SyntheticScene.cpp), over the cross product of sizes, band counts,
+ * pixel types, formats, block layouts and compressions. For each scene:
+ *
+ *   full      bin/toa run as a child process with -P: wall time, MPix/s,
+ *             peak RSS, bytes read and written, and the read, compute
+ *             and write throughput of its stage profile;
+ *   metadata  LoadSceneMetadata() in this process, best of five;
+ *   read      every band read in native type in this process (warm
+ *             cache: the scene was just written or read).
+ *
+ * Results are printed, optionally written as JSON lines (-o), and
+ * compared against a baseline file (-b): a metric worse than its
+ * baseline by more than the tolerance (-e, percent) is a regression and
+ * makes the exit status non-zero. -u writes the results into a baseline.
+ *
+ *   $ make scene_bench
+ *   $ bin/scene_bench -n 1,4,8,16 -F ntf,tif -u bench/scene_baseline.tsv
+ *   $ bin/scene_bench -n 1,4,8,16 -F ntf,tif -b bench/scene_baseline.tsv
+ */
+
+// a metric of a case and whether larger values are better
+struct BenchMetric {
+  const char* Name;
+  bool HigherIsBetter;
+};
+
+static const BenchMetric Metrics[] = {
+  { "full_mpix_per_s",    true  },
+  { "peak_rss_mb",        false },
+  { "bytes_read_mb",      false },
+  { "bytes_written_mb",   false },
+  { "read_mpix_per_s",    true  },
+  { "compute_mpix_per_s", true  },
+  { "write_mpix_per_s",   true  },
+  { "metadata_ms",        false },
+  { "isolated_read_mpix_per_s", true }
+};
+static const int MetricCount = sizeof(Metrics)/sizeof(Metrics[0]);
+
+typedef std::map<String,double> CaseResult;
+typedef std::map<String,CaseResult> BenchResults;
+
+static void usage() {
+  cout << "\n";
+  cout << "  USAGE: bin/scene_bench [-t {toa binary}] [-d {scene directory}] [-s N[,N...]]\n";
+  cout << "         [-n 1,4,8,16] [-y UInt16[,Byte,Int16,UInt32,Float32]] [-F ntf[,tif]]\n";
+  cout << "         [-l default[,512...]] [-z NONE[,DEFLATE,ZSTD,JPEG2000...]] [-a \"toa options\"]\n";
+  cout << "         [-R N] [-o {results jsonl}] [-b {baseline}] [-u {baseline}] [-e percent] [-k]\n";
+  cout << "\n";
+  cout << "    -t toa binary to run. Default: bin/toa\n";
+  cout << "    -d directory of the synthetic scenes, kept between runs (same spec, same scene).\n";
+  cout << "       Default: /tmp/toa_scene_bench\n";
+  cout << "    -s scene sizes (N x N pixels). Default: 4096\n";
+  cout << "    -n band counts. Default: 1,4,8,16\n";
+  cout << "    -y pixel types. Default: UInt16\n";
+  cout << "    -F formats. Default: ntf,tif\n";
+  cout << "    -l block layouts: default (the driver's) or N x N blocks. Default: 512\n";
+  cout << "    -z input compressions (GTiff COMPRESS; NITF takes NONE or JPEG2000). Default: NONE\n";
+  cout << "    -a further options passed to every toa run, e.g. \"-p tiles -j 8\"\n";
+  cout << "    -R toa runs per scene; the fastest is kept. Default: 1\n";
+  cout << "    -o file to write one JSON line of results per scene to\n";
+  cout << "    -b baseline to compare against; exit status 1 on a regression\n";
+  cout << "    -u baseline to write the results into (other scenes in it are kept)\n";
+  cout << "    -e regression tolerance in percent. Default: 10\n";
+  cout << "    -k keep the toa outputs and logs next to the scenes\n";
+  cout << "\n";
+  exit(1);
+}
+
+static double ProfileNumber( const String& JSON, const String& Key, const String& Stage="" ) {
+  /* *********************************************************************
+   * A number from the JSON profile bin/toa writes with -P: a top-level
+   * key, or a key of one stage (see SceneProfile::ToJSON()). 0 if absent.
+   */
+  size_t Start = 0;
+  if( !Stage.empty() ) {
+    Start = JSON.find( "\""+Stage+"\": {" );
+    if( Start == String::npos ) return 0.0;
+  }
+  size_t At = JSON.find( "\""+Key+"\": ",Start );
+  if( At == String::npos ) return 0.0;
+  return atof( JSON.c_str()+At+Key.size()+4 );
+}
+
+static bool RunToa( const std::vector<String>& Args, const String& LogFilename,
+  double& Seconds, double& PeakRSSMB ) {
+  /* *********************************************************************
+   * Run bin/toa with its output in a log, and return its wall time and
+   * peak resident set. Free heap is returned to the system before the
+   * fork, since the child's peak RSS starts from this process's.
+   */
+  std::vector<char*> Argv;
+  for( const String& Arg: Args ) Argv.push_back( const_cast<char*>( Arg.c_str() ));
+  Argv.push_back( nullptr );
+
+  malloc_trim( 0 );
+  auto Start = std::chrono::steady_clock::now();
+  pid_t Child = fork();
+  if( Child<0 ) return false;
+  if( Child == 0 ) {
+    int Log = open( LogFilename.c_str(),O_WRONLY|O_CREAT|O_TRUNC,0644 );
+    if( Log>=0 ) {
+      dup2( Log,STDOUT_FILENO );
+      dup2( Log,STDERR_FILENO );
+    }
+    execv( Argv[0],Argv.data() );
+    _exit( 127 );
+  }
+  int Status = 0;
+  struct rusage Usage;
+  if( wait4( Child,&Status,0,&Usage )<0 ) return false;
+  Seconds   = std::chrono::duration<double>( std::chrono::steady_clock::now()-Start ).count();
+  PeakRSSMB = (double)Usage.ru_maxrss/1024.0;
+  return WIFEXITED( Status ) && WEXITSTATUS( Status ) == 0;
+}
+
+static double IsolatedReadMPix( const String& ImageFilename ) {
+  /* *********************************************************************
+   * Read every band of the image in native type, in strips of whole
+   * blocks of about 8 Mpixels, one RasterIO per strip: the read stage
+   * without conversion or writes. Returns MPix/s over all bands.
+   */
+  GDALDatasetPtr Dataset( (GDALDataset*)GDALOpen( ImageFilename.c_str(),GA_ReadOnly ));
+  if( !Dataset ) return 0.0;
+  int Rows = Dataset->GetRasterYSize(), Cols = Dataset->GetRasterXSize();
+  int Bands = Dataset->GetRasterCount();
+  GDALDataType Type = Dataset->GetRasterBand( 1 )->GetRasterDataType();
+  int BlockCols = 0, BlockRows = 0;
+  Dataset->GetRasterBand( 1 )->GetBlockSize( &BlockCols,&BlockRows );
+  BlockRows = std::max( 1,BlockRows );
+  int StripRows = std::max( 1,(int)( WINDOW_PIXEL_BUDGET/( (size_t)Cols*Bands )/BlockRows ))*BlockRows;
+  StripRows = std::min( StripRows,Rows );
+  std::vector<unsigned char> Buffer( (size_t)StripRows*Cols*Bands*GDALGetDataTypeSizeBytes( Type ));
+
+  auto Start = std::chrono::steady_clock::now();
+  for( int Row=0; Row<Rows; Row+=StripRows ) {
+    int Height = std::min( StripRows,Rows-Row );
+    if( Dataset->RasterIO( GF_Read,0,Row,Cols,Height,Buffer.data(),Cols,Height,Type,Bands,
+        nullptr,0,0,0 ) != CE_None ) return 0.0;
+  }
+  double Seconds = std::chrono::duration<double>( std::chrono::steady_clock::now()-Start ).count();
+  return (double)Rows*Cols*Bands/std::max( Seconds,1e-9 )/1e6;
+}
+
+static double MetadataMilliseconds( const SyntheticScene& Scene ) {
+  /* best of five LoadSceneMetadata() calls, without a metadata cache */
+  double Best = 1e30;
+  for( int r=0; r<5; r++ ) {
+    auto Start = std::chrono::steady_clock::now();
+    SceneMetadata Metadata = LoadSceneMetadata( Scene.ImageFilename,Scene.IMDFilename,Scene.XMLFilename );
+    Metadata.Dataset.reset();
+    Best = std::min( Best,std::chrono::duration<double>( std::chrono::steady_clock::now()-Start ).count() );
+  }
+  return 1e3*Best;
+}
+
+static CaseResult BenchScene( const SyntheticScene& Scene, const String& Toa,
+  const std::vector<String>& ToaOptions, int Repetitions, bool Keep ) {
+  /* *********************************************************************
+   * The full run (fastest of Repetitions) and the isolated stages of one
+   * scene. A failed run throws, with the log kept for a look.
+   */
+  String Base         = Scene.ImageFilename.substr( 0,Scene.ImageFilename.length()-4 );
+  String ProfileFile  = Base+".profile.json";
+  String LogFile      = Base+".log";
+  std::vector<String> Args = { Toa,"-f",Scene.ImageFilename,"-i",Scene.IMDFilename,
+    "-x",Scene.XMLFilename,"-P",ProfileFile };
+  Args.insert( Args.end(),ToaOptions.begin(),ToaOptions.end() );
+
+  CaseResult Result;
+  double BestSeconds = 1e30;
+  for( int r=0; r<Repetitions; r++ ) {
+    double Seconds = 0.0, PeakRSSMB = 0.0;
+    if( !RunToa( Args,LogFile,Seconds,PeakRSSMB )) {
+      throw std::runtime_error( "  ERROR (fatal): toa failed, see: "+LogFile );
+    }
+    if( Seconds>=BestSeconds ) continue;
+    BestSeconds = Seconds;
+    std::ifstream File( ProfileFile );
+    std::stringstream Text;
+    Text << File.rdbuf();
+    String JSON = Text.str();
+    double Pixels = ProfileNumber( JSON,"pixels" );
+    Result["full_seconds"]       = Seconds;
+    Result["full_mpix_per_s"]    = Pixels/Seconds/1e6;
+    Result["peak_rss_mb"]        = PeakRSSMB;
+    Result["bytes_read_mb"]      = ProfileNumber( JSON,"bytes_read" )/1e6;
+    Result["bytes_written_mb"]   = ProfileNumber( JSON,"bytes_written" )/1e6;
+    Result["read_mpix_per_s"]    = ProfileNumber( JSON,"mpix_per_s","read" );
+    Result["compute_mpix_per_s"] = ProfileNumber( JSON,"mpix_per_s","compute" );
+    Result["write_mpix_per_s"]   = ProfileNumber( JSON,"mpix_per_s","write" );
+  }
+  if( !Keep ) {
+    std::remove( ( Base+"_TOA_RADIANCES.TIF" ).c_str() );
+    std::remove( ( Base+"_TOA_REFLECTANCES.TIF" ).c_str() );
+    std::remove( ProfileFile.c_str() );
+    std::remove( LogFile.c_str() );
+  }
+  Result["metadata_ms"] = MetadataMilliseconds( Scene );
+  Result["isolated_read_mpix_per_s"] = IsolatedReadMPix( Scene.ImageFilename );
+  return Result;
+}
+
+static BenchResults ReadBaseline( const String& Filename ) {
+  /* "case<TAB>metric<TAB>value" lines; # starts a comment */
+  BenchResults Baseline;
+  std::ifstream File( Filename );
+  String Line;
+  while( std::getline( File,Line )) {
+    if( Line.empty() || Line[0] == '#' ) continue;
+    std::stringstream Fields( Line );
+    String Case, Metric;
+    double Value;
+    if( Fields >> Case >> Metric >> Value ) Baseline[Case][Metric] = Value;
+  }
+  return Baseline;
+}
+
+static void WriteBaseline( const String& Filename, const BenchResults& Results ) {
+  /* merge the results into the baseline, replacing the scenes that ran */
+  BenchResults Baseline = ReadBaseline( Filename );
+  for( const auto& Case: Results ) Baseline[Case.first] = Case.second;
+  std::ofstream File( Filename );
+  if( !File ) throw std::runtime_error( "  ERROR (fatal): unable to write baseline: "+Filename );
+  File << "# scene_bench baseline: case, metric, value (see bench/SceneBench.cpp)\n";
+  File.precision( 6 );
+  for( const auto& Case: Baseline ) {
+    for( int m=0; m<MetricCount; m++ ) {
+      auto Value = Case.second.find( Metrics[m].Name );
+      if( Value == Case.second.end() ) continue;
+      File << Case.first << "\t" << Metrics[m].Name << "\t" << Value->second << "\n";
+    }
+  }
+}
+
+static int CompareBaseline( const BenchResults& Results, const BenchResults& Baseline, double Tolerance ) {
+  /* *********************************************************************
+   * Print every metric with a baseline next to it and flag those worse
+   * by more than Tolerance (a fraction). Returns the number flagged.
+   */
+  int Regressions = 0;
+  printf("\n  against the baseline (tolerance %.0f%%):\n",100.0*Tolerance );
+  for( const auto& Case: Results ) {
+    auto Base = Baseline.find( Case.first );
+    if( Base == Baseline.end() ) {
+      printf("    %-44s no baseline\n",Case.first.c_str() );
+      continue;
+    }
+    for( int m=0; m<MetricCount; m++ ) {
+      auto Value = Case.second.find( Metrics[m].Name );
+      auto Old   = Base->second.find( Metrics[m].Name );
+      if( Value == Case.second.end() || Old == Base->second.end() || Old->second<=0.0 ) continue;
+      double Change = ( Value->second-Old->second )/Old->second;
+      bool Worse = Metrics[m].HigherIsBetter ? ( Change<-Tolerance ) : ( Change>Tolerance );
+      if( Worse ) Regressions++;
+      printf("    %-44s %-26s %10.2f %10.2f %+7.1f%%%s\n",Case.first.c_str(),Metrics[m].Name,
+        Old->second,Value->second,100.0*Change,Worse ? "  REGRESSION" : "" );
+    }
+  }
+  printf("  %d regression%s\n",Regressions,Regressions == 1 ? "" : "s" );
+  return Regressions;
+}
+
+int main( int argc, char* argv[] ) {
+  String Toa = "bin/toa", Directory = "/tmp/toa_scene_bench";
+  String ResultsFilename, BaselineFilename, UpdateFilename;
+  std::vector<int> Sizes = { 4096 }, BandCounts = { 1,4,8,16 }, Layouts = { 512 };
+  std::vector<GDALDataType> Types = { GDT_UInt16 };
+  std::vector<String> Formats = { "NITF","GTiff" }, Compressions = { "NONE" }, ToaOptions;
+  int Repetitions = 1;
+  double Tolerance = 0.10;
+  bool Keep = false;
+
+  int opt = 0;
+  while(( opt = getopt( argc,argv,":t:d:s:n:y:F:l:z:a:R:o:b:u:e:kh" )) != -1 ) {
+    switch( opt ) {
+      case 't': Toa = optarg; break;
+      case 'd': Directory = optarg; break;
+      case 's': if( !ParseIntList( optarg,Sizes )) usage(); break;
+      case 'n': if( !ParseIntList( optarg,BandCounts )) usage(); break;
+      case 'y': if( !ParseDataTypeList( optarg,Types )) usage(); break;
+      case 'F': if( !ParseFormatList( optarg,Formats )) usage(); break;
+      case 'l': if( !ParseIntList( optarg,Layouts )) usage(); break;
+      case 'z': Compressions = SplitList( optarg ); break;
+      case 'a': {
+        std::stringstream Options( optarg );
+        String Option;
+        while( Options >> Option ) ToaOptions.push_back( Option );
+        break;
+      }
+      case 'R': Repetitions = std::max( 1,atoi( optarg )); break;
+      case 'o': ResultsFilename = optarg; break;
+      case 'b': BaselineFilename = optarg; break;
+      case 'u': UpdateFilename = optarg; break;
+      case 'e': Tolerance = atof( optarg )/100.0; break;
+      case 'k': Keep = true; break;
+      default: usage();
+    }
+  }
+  if( !file_exists( Toa )) {
+    printf("  toa binary not found: %s (build it with make)\n",Toa.c_str() );
+    return 1;
+  }
+  mkdir( Directory.c_str(),0755 );
+  InitializeGDAL();
+
+  std::ofstream ResultsFile;
+  if( !ResultsFilename.empty() ) ResultsFile.open( ResultsFilename );
+  BenchResults Results;
+  int Failed = 0;
+  printf("  %-44s %9s %9s %9s %9s %9s %9s %9s\n","scene","MPix/s","RSS MB","read MB",
+    "write MB","read/s","compute/s","write/s" );
+  for( int Size: Sizes )
+  for( int Bands: BandCounts )
+  for( GDALDataType Type: Types )
+  for( const String& Format: Formats )
+  for( int Layout: Layouts )
+  for( const String& Compression: Compressions ) {
+    SyntheticSceneSpec Spec;
+    Spec.Format      = Format;
+    Spec.Rows        = Size;
+    Spec.Cols        = Size;
+    Spec.Bands       = Bands;
+    Spec.DataType    = Type;
+    Spec.BlockSize   = Layout;
+    Spec.Compression = Compression;
+    String Name = SyntheticSceneName( Spec );
+    try {
+      SyntheticScene Scene = WriteSyntheticScene( Spec,Directory );
+      CaseResult Result = BenchScene( Scene,Toa,ToaOptions,Repetitions,Keep );
+      Results[Name] = Result;
+      printf("  %-44s %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f\n",Name.c_str(),
+        Result["full_mpix_per_s"],Result["peak_rss_mb"],Result["bytes_read_mb"],
+        Result["bytes_written_mb"],Result["read_mpix_per_s"],Result["compute_mpix_per_s"],
+        Result["write_mpix_per_s"] );
+      if( ResultsFile ) {
+        ResultsFile << "{\"scene\": " << JSONString( Name );
+        for( const auto& Metric: Result ) ResultsFile << ", \"" << Metric.first << "\": " << Metric.second;
+        ResultsFile << "}" << std::endl;
+      }
+    } catch( const std::exception& e ) {
+      printf("  %-44s FAILED: %s\n",Name.c_str(),trim( String( e.what() )).c_str() );
+      Failed++;
+    }
+  }
+  printf("  (MPix/s of the full run; read/compute/write in MPix/s from its stage profile)\n");
+
+  int Regressions = 0;
+  if( !BaselineFilename.empty() ) {
+    Regressions = CompareBaseline( Results,ReadBaseline( BaselineFilename ),Tolerance );
+  }
+  if( !UpdateFilename.empty() ) {
+    WriteBaseline( UpdateFilename,Results );
+    printf("  baseline written: %s\n",UpdateFilename.c_str() );
+  }
+  return ( Failed>0 || Regressions>0 ) ? 1 : 0;
+}
@@ -0,0 +1,79 @@
+#include <iostream>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include "SyntheticScene.h"
+#include "ImageUtil.h"
+#include "Misc.h"
+using namespace std;
+
+/* ***********************************************************************
+ * SceneGen:
+ * Write one synthetic scene (image, IMD and XML, see SyntheticScene.cpp)
+ * for trying bin/toa without licensed data, and print the command that
+ * converts it.
+ *
+ *   $ make scene_bench
+ *   $ bin/scene_gen -d /tmp/scenes -F ntf -r 8192 -c 8192 -n 8 -y UInt16 -l 1024
+ */
+
+static void usage() {
+  cout << "\n";
+  cout << "  USAGE: bin/scene_gen -d {directory} [-F {ntf|tif}] [-r rows] [-c cols] [-n bands]\n";
+  cout << "         [-y {Byte|UInt16|Int16|UInt32|Float32}] [-l {default|N}] [-z compression] [-w]\n";
+  cout << "\n";
+  cout << "    defaults: ntf, 4096 x 4096, 8 bands, UInt16, 512 x 512 blocks, NONE.\n";
+  cout << "    -z is a GTiff COMPRESS value, or NONE/JPEG2000 for NITF. -w overwrites an\n";
+  cout << "    existing scene of the same spec.\n";
+  cout << "\n";
+  exit(1);
+}
+
+int main( int argc, char* argv[] ) {
+  String Directory;
+  SyntheticSceneSpec Spec;
+  Spec.BlockSize = 512;
+  bool Overwrite = false;
+  std::vector<String> Formats;
+  std::vector<GDALDataType> Types;
+  std::vector<int> Values;
+
+  int opt = 0;
+  while(( opt = getopt( argc,argv,":d:F:r:c:n:y:l:z:wh" )) != -1 ) {
+    switch( opt ) {
+      case 'd': Directory = optarg; break;
+      case 'F':
+        if( !ParseFormatList( optarg,Formats ) || Formats.size() != 1 ) usage();
+        Spec.Format = Formats[0];
+        break;
+      case 'r': Spec.Rows  = atoi( optarg ); break;
+      case 'c': Spec.Cols  = atoi( optarg ); break;
+      case 'n': Spec.Bands = atoi( optarg ); break;
+      case 'y':
+        if( !ParseDataTypeList( optarg,Types ) || Types.size() != 1 ) usage();
+        Spec.DataType = Types[0];
+        break;
+      case 'l':
+        if( !ParseIntList( optarg,Values ) || Values.size() != 1 ) usage();
+        Spec.BlockSize = Values[0];
+        break;
+      case 'z': Spec.Compression = optarg; break;
+      case 'w': Overwrite = true; break;
+      default: usage();
+    }
+  }
+  if( Directory.empty() ) usage();
+  mkdir( Directory.c_str(),0755 );
+  InitializeGDAL();
+  try {
+    SyntheticScene Scene = WriteSyntheticScene( Spec,Directory,Overwrite );
+    printf("  synthetic scene %s:\n",SyntheticSceneName( Spec ).c_str() );
+    printf("    bin/toa -f %s -i %s -x %s\n",Scene.ImageFilename.c_str(),
+      Scene.IMDFilename.c_str(),Scene.XMLFilename.c_str() );
+  } catch( const std::exception& e ) {
+    printf("%s\n",e.what() );
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,341 @@
+#include <fstream>
+#include <algorithm>
+#include <ctype.h>
+#include <sstream>
+#include <stdexcept>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "cpl_string.h"
+#include "ogr_srs_api.h"
+#include "SyntheticScene.h"
+#include "Misc.h"
+
+/* ***********************************************************************
+ * SyntheticScene:
+ * Write test scenes shaped like Maxar products without licensed data: an
+ * NITF or Geotiff of any size, band count, pixel type, block layout and
+ * compression, with an IMD and XML that bin/toa accepts (WV03 band
+ * calibrations, acquisition time, sun elevation, line rate and corner
+ * coordinates for -g grid). The pixels are a smooth field plus a little
+ * noise, so compressed inputs compress about as well as real imagery.
+ */
+
+// UL corner and pixel size of every synthetic scene (degrees, ~2 m pixels)
+#define SYNTHETIC_UL_LONGITUDE  10.0
+#define SYNTHETIC_UL_LATITUDE   45.0
+#define SYNTHETIC_PIXEL_DEGREES 2.0e-5
+
+// a band of the synthetic product and its IMD/XML calibration
+struct SyntheticBand {
+  const char* Name;
+  double AbsCalFactor;
+  double EffectiveBandwidth;
+};
+
+static std::vector<SyntheticBand> SyntheticBands( int Bands ) {
+  /* *********************************************************************
+   * The bands of a scene with Bands bands: PAN for one, B,G,R,N for
+   * four, else the eight WV03 multispectral bands in turn. There are no
+   * solar irradiances for the SWIR bands, so a 16-band scene repeats the
+   * eight multispectral bands; only its size matters to a benchmark.
+   */
+  static const SyntheticBand Pan = { "BAND_P",5.675788e-02,2.846000e-01 };
+  static const SyntheticBand Four[4] = {
+    { "BAND_B", 9.295654e-03,5.400000e-02 }, { "BAND_G", 1.783568e-02,6.180000e-02 },
+    { "BAND_R", 1.364197e-02,5.850000e-02 }, { "BAND_N", 6.810718e-03,1.004000e-01 } };
+  static const SyntheticBand Eight[8] = {
+    { "BAND_C", 1.260825e-02,4.050000e-02 }, { "BAND_B", 9.713071e-03,5.400000e-02 },
+    { "BAND_G", 7.132553e-03,6.180000e-02 }, { "BAND_Y", 5.615714e-03,3.810000e-02 },
+    { "BAND_R", 1.103976e-02,5.850000e-02 }, { "BAND_RE",4.539394e-03,3.870000e-02 },
+    { "BAND_N", 1.224380e-02,1.004000e-01 }, { "BAND_N2",9.042234e-03,8.890000e-02 } };
+  std::vector<SyntheticBand> List;
+  for( int b=0; b<Bands; b++ ) {
+    if( Bands == 1 )      List.push_back( Pan );
+    else if( Bands == 4 ) List.push_back( Four[b] );
+    else                  List.push_back( Eight[b%8] );
+  }
+  return List;
+}
+
+static int SyntheticBitsPerPixel( GDALDataType DataType ) {
+  /* bit depth written to the IMD: 8 for Byte, else 11 as in WV03 products */
+  return ( DataType == GDT_Byte ) ? 8 : 11;
+}
+
+static String FormatExtension( const String& Format ) {
+  return ( Format == "NITF" ) ? "NTF" : "TIF";
+}
+
+String SyntheticSceneName( const SyntheticSceneSpec& Spec ) {
+  /* ntf_4096x4096_8b_UInt16_blk512_NONE; "dflt" for the default layout */
+  String Extension = FormatExtension( Spec.Format );
+  for( char& c: Extension ) c = (char)tolower( c );
+  return Extension+"_"+std::to_string( Spec.Rows )+"x"+std::to_string( Spec.Cols )+"_"+
+    std::to_string( Spec.Bands )+"b_"+GDALGetDataTypeName( Spec.DataType )+"_"+
+    ( Spec.BlockSize>0 ? "blk"+std::to_string( Spec.BlockSize ) : String( "dflt" ))+"_"+
+    Spec.Compression;
+}
+
+template<typename T>
+static void FillSyntheticRows( T* Buffer, int FirstRow, int Rows, int Cols, int Bands,
+  const std::vector<float>& ColumnField, const std::vector<float>& RowField, double Max ) {
+  /* *********************************************************************
+   * Band-sequential DNs of Rows rows from FirstRow: a smooth field (a
+   * column term per band times a row term) at up to 90% of the bit
+   * depth, plus up to 15 DNs of hashed noise.
+   */
+  for( int b=0; b<Bands; b++ ) {
+    const float* Columns = ColumnField.data()+(size_t)b*Cols;
+    for( int r=0; r<Rows; r++ ) {
+      int y = FirstRow+r;
+      T* Row = Buffer+((size_t)b*Rows+r)*Cols;
+      for( int x=0; x<Cols; x++ ) {
+        uint32_t h = (uint32_t)x*73856093u ^ (uint32_t)y*19349663u ^ (uint32_t)b*83492791u;
+        h ^= h>>13; h *= 0x5bd1e995u; h ^= h>>15;
+        double Value = floor( Columns[x]*RowField[y]*0.9*Max )+(double)( h&15 );
+        Row[x] = (T)std::min( Value,Max );
+      }
+    }
+  }
+}
+
+static void WriteSyntheticImage( const SyntheticSceneSpec& Spec, const String& Filename ) {
+  /* *********************************************************************
+   * Create the image with the spec's layout and write it in strips of
+   * whole blocks, all bands per call.
+   */
+  GDALDriver *Driver = GetGDALDriverManager()->GetDriverByName( Spec.Format.c_str() );
+  if( Driver == nullptr ) {
+    throw std::runtime_error( "  ERROR (fatal): GDAL driver not available: "+Spec.Format );
+  }
+  char **Options = nullptr;
+  String Block = std::to_string( Spec.BlockSize );
+  if( Spec.Format == "GTiff" ) {
+    if( Spec.BlockSize>0 ) {
+      Options = CSLSetNameValue( Options,"TILED","YES" );
+      Options = CSLSetNameValue( Options,"BLOCKXSIZE",Block.c_str() );
+      Options = CSLSetNameValue( Options,"BLOCKYSIZE",Block.c_str() );
+    }
+    if( Spec.Compression != "NONE" ) Options = CSLSetNameValue( Options,"COMPRESS",Spec.Compression.c_str() );
+    Options = CSLSetNameValue( Options,"BIGTIFF","IF_SAFER" );
+  } else {
+    if( Spec.BlockSize>0 ) {
+      Options = CSLSetNameValue( Options,"BLOCKXSIZE",Block.c_str() );
+      Options = CSLSetNameValue( Options,"BLOCKYSIZE",Block.c_str() );
+    }
+    if( Spec.Compression == "JPEG2000" ) {
+      Options = CSLSetNameValue( Options,"IC","C8" );
+    } else if( Spec.Compression != "NONE" ) {
+      CSLDestroy( Options );
+      throw std::runtime_error( "  ERROR (fatal): NITF compression must be NONE or JPEG2000: "+
+        Spec.Compression );
+    }
+  }
+  GDALDataset *Dataset = Driver->Create( Filename.c_str(),Spec.Cols,Spec.Rows,Spec.Bands,
+    Spec.DataType,Options );
+  CSLDestroy( Options );
+  if( Dataset == nullptr ) {
+    throw std::runtime_error( "  ERROR (fatal): unable to create synthetic image: "+Filename );
+  }
+  double GeoTransform[6] = { SYNTHETIC_UL_LONGITUDE,SYNTHETIC_PIXEL_DEGREES,0.0,
+    SYNTHETIC_UL_LATITUDE,0.0,-SYNTHETIC_PIXEL_DEGREES };
+  Dataset->SetGeoTransform( GeoTransform );
+  Dataset->SetProjection( SRS_WKT_WGS84_LAT_LONG );
+
+  // separable field: a column term per band and a row term
+  std::vector<float> ColumnField( (size_t)Spec.Bands*Spec.Cols );
+  std::vector<float> RowField( Spec.Rows );
+  for( int b=0; b<Spec.Bands; b++ ) {
+    for( int x=0; x<Spec.Cols; x++ ) {
+      ColumnField[(size_t)b*Spec.Cols+x] = (float)( 0.75+0.25*sin( 0.01*x+0.7*b ));
+    }
+  }
+  for( int y=0; y<Spec.Rows; y++ ) RowField[y] = (float)( 0.7+0.3*cos( 0.013*y ));
+
+  int BlockRows = 0, BlockCols = 0;
+  Dataset->GetRasterBand( 1 )->GetBlockSize( &BlockCols,&BlockRows );
+  int StripRows = std::max( 1,( 256/std::max( 1,BlockRows ))*BlockRows );
+  int TypeBytes = GDALGetDataTypeSizeBytes( Spec.DataType );
+  std::vector<unsigned char> Buffer( (size_t)StripRows*Spec.Cols*Spec.Bands*TypeBytes );
+  double Max = (double)(( 1<<SyntheticBitsPerPixel( Spec.DataType ))-1 );
+  for( int Row=0; Row<Spec.Rows; Row+=StripRows ) {
+    int Rows = std::min( StripRows,Spec.Rows-Row );
+    switch( Spec.DataType ) {
+      case GDT_Byte:
+        FillSyntheticRows( (unsigned char*)Buffer.data(),Row,Rows,Spec.Cols,Spec.Bands,ColumnField,RowField,Max );
+        break;
+      case GDT_UInt16:
+        FillSyntheticRows( (unsigned short*)Buffer.data(),Row,Rows,Spec.Cols,Spec.Bands,ColumnField,RowField,Max );
+        break;
+      case GDT_Int16:
+        FillSyntheticRows( (short*)Buffer.data(),Row,Rows,Spec.Cols,Spec.Bands,ColumnField,RowField,Max );
+        break;
+      case GDT_UInt32:
+        FillSyntheticRows( (unsigned int*)Buffer.data(),Row,Rows,Spec.Cols,Spec.Bands,ColumnField,RowField,Max );
+        break;
+      case GDT_Float32:
+        FillSyntheticRows( (float*)Buffer.data(),Row,Rows,Spec.Cols,Spec.Bands,ColumnField,RowField,Max );
+        break;
+      default:
+        GDALClose( Dataset );
+        throw std::runtime_error( "  ERROR (fatal): unsupported synthetic data type: "+
+          String( GDALGetDataTypeName( Spec.DataType )));
+    }
+    CPLErr e = Dataset->RasterIO( GF_Write,0,Row,Spec.Cols,Rows,Buffer.data(),Spec.Cols,Rows,
+      Spec.DataType,Spec.Bands,nullptr,0,0,0 );
+    if( e != CE_None ) {
+      GDALClose( Dataset );
+      throw std::runtime_error( "  ERROR (fatal): unable to write synthetic image: "+Filename );
+    }
+  }
+  GDALClose( Dataset );
+}
+
+static void CornerCoordinates( const SyntheticSceneSpec& Spec, double Latitude[4], double Longitude[4] ) {
+  /* UL, UR, LR, LL corners of the image from the synthetic geotransform */
+  double Right  = SYNTHETIC_UL_LONGITUDE+Spec.Cols*SYNTHETIC_PIXEL_DEGREES;
+  double Bottom = SYNTHETIC_UL_LATITUDE-Spec.Rows*SYNTHETIC_PIXEL_DEGREES;
+  double Lat[4] = { SYNTHETIC_UL_LATITUDE,SYNTHETIC_UL_LATITUDE,Bottom,Bottom };
+  double Lon[4] = { SYNTHETIC_UL_LONGITUDE,Right,Right,SYNTHETIC_UL_LONGITUDE };
+  for( int k=0; k<4; k++ ) {
+    Latitude[k]  = Lat[k];
+    Longitude[k] = Lon[k];
+  }
+}
+
+static void WriteSyntheticIMD( const SyntheticSceneSpec& Spec, const String& Filename ) {
+  /* *********************************************************************
+   * An IMD with the entries bin/toa reads: bitsPerPixel, a BAND_ group
+   * per band (corners, absCalFactor, effectiveBandwidth) and IMAGE_1
+   * (satId, firstLineTime, avgLineRate, meanSunEl).
+   */
+  std::ofstream IMD( Filename );
+  if( !IMD ) throw std::runtime_error( "  ERROR (fatal): unable to write synthetic IMD: "+Filename );
+  double Latitude[4], Longitude[4];
+  CornerCoordinates( Spec,Latitude,Longitude );
+  const char* Corners[4] = { "UL","UR","LR","LL" };
+  IMD.precision( 10 );
+  IMD << "version = \"28.4\";\n"
+      << "generationTime = 2021-10-27T12:30:00.000000Z;\n"
+      << "productType = \"Basic\";\n"
+      << "numRows = " << Spec.Rows << ";\n"
+      << "numColumns = " << Spec.Cols << ";\n"
+      << "bitsPerPixel = " << SyntheticBitsPerPixel( Spec.DataType ) << ";\n";
+  for( const SyntheticBand& Band: SyntheticBands( Spec.Bands )) {
+    IMD << "BEGIN_GROUP = " << Band.Name << "\n";
+    for( int k=0; k<4; k++ ) {
+      IMD << "\t" << Corners[k] << "Lon = " << Longitude[k] << ";\n"
+          << "\t" << Corners[k] << "Lat = " << Latitude[k] << ";\n";
+    }
+    IMD << "\tabsCalFactor = " << Band.AbsCalFactor << ";\n"
+        << "\teffectiveBandwidth = " << Band.EffectiveBandwidth << ";\n"
+        << "END_GROUP = " << Band.Name << "\n";
+  }
+  IMD << "BEGIN_GROUP = IMAGE_1\n"
+      << "\tsatId = \"WV03\";\n"
+      << "\tfirstLineTime = 2021-10-27T11:41:57.133850Z;\n"
+      << "\tavgLineRate = 5000.00;\n"
+      << "\tmeanSunEl = 32.5;\n"
+      << "\tmeanSunAz = 165.2;\n"
+      << "END_GROUP = IMAGE_1\n"
+      << "END;\n";
+}
+
+static void WriteSyntheticXML( const SyntheticSceneSpec& Spec, const String& Filename ) {
+  /* the IMD part of a DG XML: SATID and each band's calibration */
+  std::ofstream XML( Filename );
+  if( !XML ) throw std::runtime_error( "  ERROR (fatal): unable to write synthetic XML: "+Filename );
+  XML.precision( 10 );
+  XML << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<isd>\n  <IMD>\n"
+      << "    <VERSION>28.4</VERSION>\n    <IMAGE>\n      <SATID>WV03</SATID>\n    </IMAGE>\n";
+  for( const SyntheticBand& Band: SyntheticBands( Spec.Bands )) {
+    XML << "    <" << Band.Name << ">\n"
+        << "      <ABSCALFACTOR>" << Band.AbsCalFactor << "</ABSCALFACTOR>\n"
+        << "      <EFFECTIVEBANDWIDTH>" << Band.EffectiveBandwidth << "</EFFECTIVEBANDWIDTH>\n"
+        << "    </" << Band.Name << ">\n";
+  }
+  XML << "  </IMD>\n</isd>\n";
+}
+
+SyntheticScene WriteSyntheticScene( const SyntheticSceneSpec& Spec, const String& Directory,
+  bool Overwrite ) {
+  /* *********************************************************************
+   * Write (or keep, if all three exist and Overwrite is false) the image,
+   * IMD and XML of a spec as {Directory}/{name}.NTF|TIF, .IMD and .XML.
+   */
+  if( Spec.Rows<1 || Spec.Cols<1 || Spec.Bands<1 ) {
+    throw std::runtime_error( "  ERROR (fatal): invalid synthetic scene size: "+SyntheticSceneName( Spec ));
+  }
+  String Base = Directory+"/"+SyntheticSceneName( Spec );
+  SyntheticScene Scene;
+  Scene.ImageFilename = Base+"."+FormatExtension( Spec.Format );
+  Scene.IMDFilename   = Base+".IMD";
+  Scene.XMLFilename   = Base+".XML";
+  if( !Overwrite && file_exists( Scene.ImageFilename ) && file_exists( Scene.IMDFilename ) &&
+      file_exists( Scene.XMLFilename )) return Scene;
+
+  // the image last, so an interrupted write is not mistaken for a scene
+  std::remove( Scene.ImageFilename.c_str() );
+  WriteSyntheticIMD( Spec,Scene.IMDFilename );
+  WriteSyntheticXML( Spec,Scene.XMLFilename );
+  try {
+    WriteSyntheticImage( Spec,Scene.ImageFilename );
+  } catch( ... ) {
+    std::remove( Scene.ImageFilename.c_str() );
+    throw;
+  }
+  return Scene;
+}
+
+std::vector<String> SplitList( const String& Text ) {
+  /* "a,b,c" -> { "a","b","c" }, dropping empty items */
+  std::vector<String> Items;
+  std::stringstream Stream( Text );
+  String Item;
+  while( std::getline( Stream,Item,',' )) {
+    Item = trim( Item );
+    if( !Item.empty() ) Items.push_back( Item );
+  }
+  return Items;
+}
+
+bool ParseFormatList( const String& Text, std::vector<String>& Formats ) {
+  /* ntf|nitf and tif|gtiff, as GDAL driver names */
+  Formats.clear();
+  for( String Item: SplitList( Text )) {
+    for( char& c: Item ) c = (char)tolower( c );
+    if( Item == "ntf" || Item == "nitf" )      Formats.push_back( "NITF" );
+    else if( Item == "tif" || Item == "gtiff" ) Formats.push_back( "GTiff" );
+    else return false;
+  }
+  return !Formats.empty();
+}
+
+bool ParseDataTypeList( const String& Text, std::vector<GDALDataType>& Types ) {
+  /* GDAL type names: Byte, UInt16, Int16, UInt32, Float32 */
+  Types.clear();
+  for( const String& Item: SplitList( Text )) {
+    GDALDataType Type = GDALGetDataTypeByName( Item.c_str() );
+    if( Type != GDT_Byte && Type != GDT_UInt16 && Type != GDT_Int16 &&
+        Type != GDT_UInt32 && Type != GDT_Float32 ) return false;
+    Types.push_back( Type );
+  }
+  return !Types.empty();
+}
+
+bool ParseIntList( const String& Text, std::vector<int>& Values ) {
+  /* positive integers; "default" (block layouts) is 0 */
+  Values.clear();
+  for( const String& Item: SplitList( Text )) {
+    if( Item == "default" ) {
+      Values.push_back( 0 );
+      continue;
+    }
+    char *End = nullptr;
+    long Value = strtol( Item.c_str(),&End,10 );
+    if( *End != '\0' || Value<1 || Value>1000000 ) return false;
+    Values.push_back( (int)Value );
+  }
+  return !Values.empty();
+}
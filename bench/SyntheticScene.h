@@ -0,0 +1,41 @@
+#ifndef SYNTHETICSCENE_H_
+#define SYNTHETICSCENE_H_
+#include "gdal_priv.h"
+#include <string>
+#include <vector>
+typedef std::string String;
+
+// one synthetic scene: the image layout and a matching IMD and XML
+struct SyntheticSceneSpec {
+  String Format = "NITF";          // NITF or GTiff
+  int Rows  = 4096;
+  int Cols  = 4096;
+  int Bands = 8;                   // 1 = PAN, 4 = B,G,R,N, else the WV03 MS bands in turn
+  GDALDataType DataType = GDT_UInt16;
+  int BlockSize = 0;               // square blocks, 0 = the driver's default layout
+  String Compression = "NONE";     // GTiff COMPRESS, or NONE/JPEG2000 for NITF
+};
+
+// the files of a synthetic scene, as bin/toa takes them
+struct SyntheticScene {
+  String ImageFilename;
+  String IMDFilename;
+  String XMLFilename;
+};
+
+// a name that identifies a spec, e.g. ntf_4096x4096_8b_UInt16_blk512_NONE
+String SyntheticSceneName( const SyntheticSceneSpec& );
+
+// write the image, IMD and XML of a scene into a directory, named after
+// the spec (throws on error). Existing files of the same spec are kept:
+// the contents only depend on the spec.
+SyntheticScene WriteSyntheticScene( const SyntheticSceneSpec&, const String& Directory,
+  bool Overwrite=false );
+
+// parse the comma-separated lists of the command lines: formats (ntf,
+// tif), GDAL type names, and positive integers ("default" is 0)
+bool ParseFormatList( const String&, std::vector<String>& );
+bool ParseDataTypeList( const String&, std::vector<GDALDataType>& );
+bool ParseIntList( const String&, std::vector<int>& );
+std::vector<String> SplitList( const String& );
+#endif
@@ -0,0 +1,359 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <ctime>
+#include <stdexcept>
+#include <stdio.h>
+#include "BatchUtil.h"
+using namespace std;
+
+bool ParseJSONObject( const String& Line, std::map<String,String>& Fields ) {
+  /* *********************************************************************
+   * Parse one line of a JSON-lines manifest: a flat object whose values
+   * are strings (numbers, true/false/null are kept as their text).
+   * Returns false on anything else, e.g. nested objects or arrays.
+   */
+  size_t i = 0;
+  auto SkipSpace = [&]() { while( i<Line.size() && isspace( (unsigned char)Line[i] )) i++; };
+  auto ParseString = [&]( String& Out ) -> bool {
+    if( i>=Line.size() || Line[i] != '"' ) return false;
+    i++;
+    Out.clear();
+    while( i<Line.size() && Line[i] != '"' ) {
+      char c = Line[i++];
+      if( c == '\\' ) {
+        if( i>=Line.size() ) return false;
+        char e = Line[i++];
+        switch( e ) {
+          case 'n': Out += '\n'; break;
+          case 't': Out += '\t'; break;
+          case 'r': Out += '\r'; break;
+          case 'b': Out += '\b'; break;
+          case 'f': Out += '\f'; break;
+          case 'u': {
+            if( i+4>Line.size() ) return false;
+            unsigned int Code = (unsigned int)strtoul( Line.substr( i,4 ).c_str(),nullptr,16 );
+            i += 4;
+            // paths are expected to be ASCII; others are encoded as UTF-8
+            if( Code<0x80 ) Out += (char)Code;
+            else if( Code<0x800 ) {
+              Out += (char)( 0xC0|( Code>>6 ));
+              Out += (char)( 0x80|( Code&0x3F ));
+            } else {
+              Out += (char)( 0xE0|( Code>>12 ));
+              Out += (char)( 0x80|(( Code>>6 )&0x3F ));
+              Out += (char)( 0x80|( Code&0x3F ));
+            }
+            break;
+          }
+          default: Out += e;   // \" \\ \/
+        }
+      } else {
+        Out += c;
+      }
+    }
+    if( i>=Line.size() ) return false;
+    i++;
+    return true;
+  };
+
+  SkipSpace();
+  if( i>=Line.size() || Line[i] != '{' ) return false;
+  i++;
+  SkipSpace();
+  if( i<Line.size() && Line[i] == '}' ) return true;
+  while( i<Line.size() ) {
+    String Key, Value;
+    SkipSpace();
+    if( !ParseString( Key )) return false;
+    SkipSpace();
+    if( i>=Line.size() || Line[i] != ':' ) return false;
+    i++;
+    SkipSpace();
+    if( i<Line.size() && Line[i] == '"' ) {
+      if( !ParseString( Value )) return false;
+    } else {
+      size_t Start = i;
+      while( i<Line.size() && Line[i] != ',' && Line[i] != '}' ) i++;
+      Value = trim( Line.substr( Start,i-Start ));
+      if( Value.empty() || Value[0] == '{' || Value[0] == '[' ) return false;
+    }
+    Fields[Key] = Value;
+    SkipSpace();
+    if( i<Line.size() && Line[i] == ',' ) { i++; continue; }
+    if( i<Line.size() && Line[i] == '}' ) return true;
+    return false;
+  }
+  return false;
+}
+
+static std::vector<String> ParseCSVLine( const String& Line ) {
+  /* *********************************************************************
+   * Split one CSV line into trimmed fields. Fields may be double-quoted
+   * (for paths containing commas), with "" standing for a quote.
+   */
+  std::vector<String> Fields;
+  String Field;
+  bool Quoted = false;
+  for( size_t i=0; i<Line.size(); i++ ) {
+    char c = Line[i];
+    if( Quoted ) {
+      if( c == '"' && i+1<Line.size() && Line[i+1] == '"' ) { Field += '"'; i++; }
+      else if( c == '"' ) Quoted = false;
+      else Field += c;
+    } else if( c == '"' ) {
+      Quoted = true;
+    } else if( c == ',' ) {
+      Fields.push_back( trim( Field ));
+      Field.clear();
+    } else {
+      Field += c;
+    }
+  }
+  Fields.push_back( trim( Field ));
+  return Fields;
+}
+
+SceneJob MakeSceneJob( const std::map<String,String>& Fields ) {
+  /* the scene of a JSON object with the keys of a manifest line */
+  auto Field = [&]( const char* Key ) {
+    auto Found = Fields.find( Key );
+    return ( Found == Fields.end() ) ? String("") : Found->second;
+  };
+  SceneJob Job;
+  Job.ImageFilename        = Field( "image" );
+  Job.IMDFilename          = Field( "imd" );
+  Job.XMLFilename          = Field( "xml" );
+  Job.RadiancesFilename    = Field( "radiances" );
+  Job.ReflectancesFilename = Field( "reflectances" );
+  return Job;
+}
+
+std::vector<SceneJob> ReadSceneManifest( const String& ManifestFilename ) {
+  /* *********************************************************************
+   * Read the scenes of a batch. Two formats are accepted:
+   *
+   *   CSV (one scene per line, optional header starting with "image"):
+   *     image,imd[,xml[,radiances,reflectances]]
+   *
+   *   JSON lines (.jsonl/.ndjson, or any file whose first line is an
+   *   object), one object per line:
+   *     {"image": "...", "imd": "...", "xml": "...",
+   *      "radiances": "...", "reflectances": "..."}
+   *
+   * The XML and the output paths are optional. Blank lines and lines starting with
+   * '#' are skipped. Throws on unreadable files and malformed lines.
+   */
+  std::ifstream Manifest( ManifestFilename );
+  if( !Manifest ) {
+    throw std::runtime_error( "  ERROR (fatal): unable to read manifest: "+ManifestFilename );
+  }
+  String Extension = GetExtension( ManifestFilename );
+  std::transform( Extension.begin(),Extension.end(),Extension.begin(),::tolower );
+  bool JSONLines = ( Extension == "jsonl" || Extension == "ndjson" || Extension == "json" );
+
+  std::vector<SceneJob> Jobs;
+  String Line;
+  int LineNumber = 0;
+  bool FirstLine = true;
+  while( std::getline( Manifest,Line )) {
+    LineNumber++;
+    String Trimmed = trim( Line );
+    if( Trimmed.empty() || Trimmed[0] == '#' ) continue;
+    if( FirstLine && Trimmed[0] == '{' ) JSONLines = true;
+
+    SceneJob Job;
+    String Location = ManifestFilename+" line "+std::to_string( LineNumber );
+    if( JSONLines ) {
+      std::map<String,String> Fields;
+      if( !ParseJSONObject( Trimmed,Fields )) {
+        throw std::runtime_error( "  ERROR (fatal): malformed JSON object in manifest: "+Location );
+      }
+      Job = MakeSceneJob( Fields );
+    } else {
+      std::vector<String> Fields = ParseCSVLine( Trimmed );
+      String First = Fields[0];
+      std::transform( First.begin(),First.end(),First.begin(),::tolower );
+      if( FirstLine && First == "image" ) {
+        FirstLine = false;
+        continue;
+      }
+      if( Fields.size()<2 ) {
+        throw std::runtime_error( "  ERROR (fatal): expected image,imd[,xml[,radiances,reflectances]] in manifest: "+Location );
+      }
+      Job.ImageFilename = Fields[0];
+      Job.IMDFilename   = Fields[1];
+      if( Fields.size()>2 ) Job.XMLFilename          = Fields[2];
+      if( Fields.size()>3 ) Job.RadiancesFilename    = Fields[3];
+      if( Fields.size()>4 ) Job.ReflectancesFilename = Fields[4];
+    }
+    FirstLine = false;
+
+    if( Job.ImageFilename.empty() || Job.IMDFilename.empty() ) {
+      throw std::runtime_error( "  ERROR (fatal): scene needs image and imd in manifest: "+Location );
+    }
+    Jobs.push_back( Job );
+  }
+  return Jobs;
+}
+
+void ApplySceneOptions( ImageUtil& Image, const SceneOptions& Options ) {
+  /* *********************************************************************
+   * Hand the command-line settings to an ImageUtil.
+   */
+  Image.SetConversionMode( Options.Mode );
+  Image.SetBlockMultiple( Options.BlockMultiple );
+  Image.SetBandReadMode( Options.ReadMode );
+  for( auto const& [Key,Value]: Options.CreationOptions ) {
+    Image.SetCreationOption( Key,Value );
+  }
+  Image.SetCloudOptimized( Options.CloudOptimized );
+  Image.SetProcessingMode( Options.Processing );
+  Image.SetComputeThreads( Options.ComputeThreads );
+  Image.SetQueueDepth( Options.QueueDepth );
+  Image.SetPixelBudget( Options.PixelBudget );
+  Image.SetSolarGeometryMode( Options.SolarMode );
+}
+
+void ConvertScene( SceneJob& Job, const SceneOptions& Options, SceneProfile* Profile,
+  SceneProgress* Progress ) {
+  /* *********************************************************************
+   * Convert one scene: load its metadata (see LoadSceneMetadata()),
+   * open the image once if the metadata cache did not, then write the
+   * radiances and reflectances Geotiffs. Errors are thrown (std::exception), never
+   * exit the process, so one bad scene does not end a batch. On return
+   * the job holds the output filenames that were written, and the
+   * profile (if any) the scene's stage timings, stopped.
+   */
+  SceneMetadata Scene = LoadSceneMetadata( Job.ImageFilename,Job.IMDFilename,Job.XMLFilename,
+    Options.MetadataCache,Profile );
+  OpenSceneDataset( Scene,Profile );
+  ImageUtil Image( Scene );
+  ApplySceneOptions( Image,Options );
+  Image.SetProfile( Profile );
+  std::unique_ptr<PrintedProgress> Printed;
+  if( Progress == nullptr && Options.Progress != PROGRESS_NONE ) {
+    Printed.reset( new PrintedProgress( Options.Progress,Options.ProgressStream,Job.ImageFilename ));
+    Progress = Printed.get();
+  }
+  Image.SetProgress( Progress );
+  Image.SetOutputFilenames( Job.RadiancesFilename,Job.ReflectancesFilename );
+  Image.WriteRadianceAndReflectanceGeotiffs( &Scene.Solar,Scene.Calibration );
+  if( Profile ) Profile->Finish();
+  Job.RadiancesFilename    = Image.GetRadiancesFilename();
+  Job.ReflectancesFilename = Image.GetReflectancesFilename();
+}
+
+SceneOptions ShareBatchBudget( const SceneOptions& Options, const BatchBudget& Budget, int Scenes ) {
+  /* *********************************************************************
+   * The thread and memory budgets are split evenly between the scenes
+   * converted at once:
+   *
+   *   - each scene gets Threads/Scenes compute threads, and the same
+   *     number of GTiff compression threads (NUM_THREADS) unless that
+   *     creation option was set explicitly;
+   *   - a quarter of the memory budget goes to GDAL's block cache (set
+   *     here), the rest to the scenes' window buffers
+   *     (BATCH_BYTES_PER_PIXEL).
+   */
+  int Threads = ( Budget.Threads>0 ) ? Budget.Threads : HardwareThreads();
+  int ThreadsPerScene = std::max( 1,Threads/Scenes );
+
+  SceneOptions PerScene = Options;
+  PerScene.ComputeThreads = ThreadsPerScene;
+  if( PerScene.CreationOptions.find("NUM_THREADS") == PerScene.CreationOptions.end() ) {
+    PerScene.CreationOptions["NUM_THREADS"] = std::to_string( ThreadsPerScene );
+  }
+  if( Budget.MemoryBytes>0 ) {
+    GDALSetCacheMax64( (GIntBig)( Budget.MemoryBytes/4 ));
+    PerScene.PixelBudget = ( Budget.MemoryBytes-Budget.MemoryBytes/4 )/Scenes/BATCH_BYTES_PER_PIXEL;
+  }
+  return PerScene;
+}
+
+String ConvertSceneRecord( SceneJob& Job, const SceneOptions& Options, const String& Fields,
+  double& Seconds, bool& Failed ) {
+  /* *********************************************************************
+   * Convert one scene and describe it as a JSON status record: its status
+   * ("ok" or "failed"), error message, start time, wall time, outputs and
+   * stage timings (see SceneProfile::ToJSON()). Fields, if not empty, are
+   * written first, e.g. "scene": 3. Scene errors are caught here.
+   */
+  String Message = "";
+  time_t Start = time( nullptr );
+  auto Timer   = std::chrono::steady_clock::now();
+  SceneProfile Profile;
+  try {
+    ConvertScene( Job,Options,&Profile );
+  } catch( const std::exception& e ) {
+    Message = trim( String( e.what() ));
+  }
+  Seconds = std::chrono::duration<double>( std::chrono::steady_clock::now()-Timer ).count();
+  Failed  = !Message.empty();
+
+  char StartTime[32];
+  struct tm StartUTC;
+  gmtime_r( &Start,&StartUTC );
+  strftime( StartTime,sizeof(StartTime),"%Y-%m-%dT%H:%M:%SZ",&StartUTC );
+
+  std::ostringstream Record;
+  Record << "{" << Fields << ( Fields.empty() ? "" : ", " )
+         << "\"image\": " << JSONString( Job.ImageFilename )
+         << ", \"status\": " << ( Failed ? "\"failed\"" : "\"ok\"" )
+         << ", \"start\": \"" << StartTime << "\", \"seconds\": " << Seconds
+         << ", \"radiances\": " << JSONString( Job.RadiancesFilename )
+         << ", \"reflectances\": " << JSONString( Job.ReflectancesFilename )
+         << ", \"message\": " << JSONString( Message )
+         << ", \"profile\": " << Profile.ToJSON() << "}";
+  return Record.str();
+}
+
+int RunBatch( const std::vector<SceneJob>& Jobs, const SceneOptions& Options,
+  const BatchBudget& Budget, const String& StatusFilename ) {
+  /* *********************************************************************
+   * Convert the scenes of a manifest in one process. GDAL is registered
+   * once. Up to Budget.Scenes scenes run at once, sharing the thread and
+   * memory budgets (see ShareBatchBudget()).
+   *
+   * After each scene one JSON line is appended to StatusFilename (see
+   * ConvertSceneRecord()). Returns the number of failed scenes.
+   */
+  InitializeGDAL();
+  int Threads = ( Budget.Threads>0 ) ? Budget.Threads : HardwareThreads();
+  int Scenes  = ( Budget.Scenes>0 ) ? Budget.Scenes : std::max( 1,Threads/4 );
+  Scenes = std::max( 1,std::min( Scenes,(int)Jobs.size() ));
+  SceneOptions PerScene = ShareBatchBudget( Options,Budget,Scenes );
+
+  std::ofstream Status( StatusFilename );
+  if( !Status ) {
+    throw std::runtime_error( "  ERROR (fatal): unable to write status file: "+StatusFilename );
+  }
+  printf("  batch: %zu scenes, %d at a time, %d threads each\n",Jobs.size(),Scenes,PerScene.ComputeThreads );
+  printf("  scene status records: %s\n",StatusFilename.c_str() );
+
+  std::mutex StatusLock;
+  std::atomic<size_t> NextJob( 0 );
+  std::atomic<int> Failed( 0 );
+  auto Runner = [&]() {
+    for( size_t i=NextJob++; i<Jobs.size(); i=NextJob++ ) {
+      SceneJob Job = Jobs[i];
+      double Seconds = 0.0;
+      bool SceneFailed = false;
+      String Record = ConvertSceneRecord( Job,PerScene,"\"scene\": "+std::to_string( i ),
+        Seconds,SceneFailed );
+      if( SceneFailed ) Failed++;
+      std::lock_guard<std::mutex> Guard( StatusLock );
+      Status << Record << std::endl;
+      printf("  scene %zu of %zu %s (%.1f s): %s\n",i+1,Jobs.size(),
+        SceneFailed ? "FAILED" : "done",Seconds,Job.ImageFilename.c_str() );
+    }
+  };
+
+  std::vector<std::thread> Runners;
+  for( int s=0; s<Scenes; s++ ) Runners.emplace_back( Runner );
+  for( std::thread& Thread: Runners ) Thread.join();
+
+  printf("  batch finished: %zu scenes, %d failed\n",Jobs.size(),(int)Failed );
+  return Failed;
+}
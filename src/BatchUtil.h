@@ -0,0 +1,75 @@
+#ifndef BATCHUTIL_H_
+#define BATCHUTIL_H_
+#include <string>
+#include <vector>
+#include <map>
+#include "ImageUtil.h"
+typedef std::string String;
+
+// bytes held per pixel in flight: a DN of up to 4 bytes and two floats.
+// Batch mode turns its memory budget into pixel budgets with this.
+#define BATCH_BYTES_PER_PIXEL 12
+
+// one scene of a batch manifest: the image and IMD, optionally the XML
+// (empty = calibrations from the IMD), and optionally the two output
+// Geotiffs (empty = <image>_TOA_RADIANCES.TIF etc.)
+struct SceneJob {
+  String ImageFilename;
+  String IMDFilename;
+  String XMLFilename;
+  String RadiancesFilename;
+  String ReflectancesFilename;
+};
+
+// command-line settings applied to the ImageUtil of every scene
+struct SceneOptions {
+  ConversionMode Mode = CONVERT_ARITHMETIC;
+  int BlockMultiple = 0;
+  BandReadMode ReadMode = READ_AUTO;
+  std::map<String,String> CreationOptions;
+  bool CloudOptimized = false;
+  ProcessingMode Processing = PROCESS_PIPELINE;
+  int ComputeThreads = 0;
+  int QueueDepth = 0;
+  size_t PixelBudget = WINDOW_PIXEL_BUDGET;
+  String MetadataCache;     // directory of cached scene metadata, "" = none
+  SolarGeometryMode SolarMode = SOLAR_SCENE_MEAN;
+  ProgressOutput Progress = PROGRESS_NONE;
+  FILE *ProgressStream = nullptr;   // nullptr = stdout (console) or stderr (JSON lines)
+};
+
+// limits shared by all scenes of a batch (0 = choose automatically)
+struct BatchBudget {
+  int Scenes = 0;           // scenes converted at once
+  int Threads = 0;          // threads over all scenes, default one per core
+  size_t MemoryBytes = 0;   // window buffers plus GDAL block cache
+};
+
+// read a CSV or JSON-lines manifest of scenes
+std::vector<SceneJob> ReadSceneManifest( const String& );
+
+// parse a flat JSON object (one manifest line) into its fields; false
+// if malformed. The scene of such an object (image, imd, xml,
+// radiances, reflectances).
+bool ParseJSONObject( const String&, std::map<String,String>& );
+SceneJob MakeSceneJob( const std::map<String,String>& );
+
+// apply the settings to an image, and convert one scene (throws on error),
+// timing its stages into a profile if given. Progress goes to the given
+// report, else is printed as the options say.
+void ApplySceneOptions( ImageUtil&, const SceneOptions& );
+void ConvertScene( SceneJob&, const SceneOptions&, SceneProfile* Profile=nullptr,
+  SceneProgress* Progress=nullptr );
+
+// the options of each of the given number of scenes converted at once,
+// with their share of the budget's threads and memory
+SceneOptions ShareBatchBudget( const SceneOptions&, const BatchBudget&, int );
+
+// convert one scene and return its JSON status record, led by the given
+// fields (e.g. "scene": 3); sets its wall time and whether it failed
+String ConvertSceneRecord( SceneJob&, const SceneOptions&, const String&, double&, bool& );
+
+// convert every scene of a manifest, writing one JSON status record per
+// scene; returns the number of scenes that failed
+int RunBatch( const std::vector<SceneJob>&, const SceneOptions&, const BatchBudget&, const String& );
+#endif
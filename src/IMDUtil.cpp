@@ -0,0 +1,187 @@
+#include "IMDUtil.h"
+#include <stdlib.h>
+#include <string.h>
+#include <charconv>
+#include <stdexcept>
+
+static inline bool IsSpace( char c ) {
+  return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\f' || c == '\v';
+}
+
+static std::string_view TrimView( const char* First, const char* Last ) {
+  /* trim whitespace from both ends of [First,Last) */
+  while( First<Last && IsSpace( *First )) First++;
+  while( Last>First && IsSpace( *( Last-1 ))) Last--;
+  return std::string_view( First,(size_t)( Last-First ));
+}
+
+IMDFile::IMDFile( const String& IMDFilename ) : File( new MappedFile( IMDFilename )), 
+  Filename( IMDFilename ) {
+  /* *********************************************************************
+   * Map the IMD read-only and index it. Throws if the file cannot be
+   * read or its groups are not balanced. The mapping lives as long as
+   * this object, and so do the string_views handed out.
+   */
+  Tokenize( File->GetData(),File->GetSize() );
+}
+
+IMDFile::IMDFile( const char* IMDText, size_t Size, const String& Source ) : 
+  Text( IMDText,Size ), Filename( Source ) {
+  /* index a copy of the text of an IMD; Source names it in errors */
+  Tokenize( Text.data(),Text.size() );
+}
+
+void IMDFile::Tokenize( const char* Data, size_t Size ) {
+  /* *********************************************************************
+   * One pass over the mapped text. An IMD is a list of statements
+   *
+   *   key = value;
+   *   key = ( v1,
+   *           v2 );
+   *   BEGIN_GROUP = BAND_C
+   *     ...
+   *   END_GROUP = BAND_C
+   *   END;
+   *
+   * A value runs to the ';' or, for BEGIN_GROUP/END_GROUP lines, to the
+   * end of the line; inside quotes or parentheses neither ends it, so
+   * lists may span lines. Lines without '=' are skipped.
+   */
+  const char* Cursor = Data;
+  const char* End    = Data+Size;
+  Entries.reserve( Size/32 );
+  int Current = IMD_ROOT;
+
+  while( Cursor<End ) {
+    while( Cursor<End && IsSpace( *Cursor )) Cursor++;
+    if( Cursor>=End ) break;
+
+    // the key runs to '=', or the statement has no value
+    const char* KeyStart = Cursor;
+    while( Cursor<End && *Cursor != '=' && *Cursor != ';' && *Cursor != '\n' ) Cursor++;
+    std::string_view Key = TrimView( KeyStart,Cursor );
+    if( Cursor>=End || *Cursor != '=' ) {
+      if( Key == "END" ) break;
+      if( Cursor<End ) Cursor++;
+      continue;
+    }
+    Cursor++;
+
+    // the value runs to ';' or end of line, outside quotes and parentheses
+    const char* ValueStart = Cursor;
+    int Depth   = 0;
+    bool Quoted = false;
+    while( Cursor<End ) {
+      char c = *Cursor;
+      if( c == '"' ) Quoted = !Quoted;
+      else if( !Quoted && c == '(' ) Depth++;
+      else if( !Quoted && c == ')' && Depth>0 ) Depth--;
+      else if( !Quoted && Depth == 0 && ( c == ';' || c == '\n' )) break;
+      Cursor++;
+    }
+    std::string_view Value = TrimView( ValueStart,Cursor );
+    if( Cursor<End ) Cursor++;
+
+    if( Key == "BEGIN_GROUP" ) {
+      Groups.push_back( IMDGroup{ Value,Current,Entries.size(),Entries.size() } );
+      Current = (int)Groups.size()-1;
+    } else if( Key == "END_GROUP" ) {
+      if( Current == IMD_ROOT || Groups[Current].Name != Value ) {
+        throw std::runtime_error( "  ERROR (fatal): unbalanced END_GROUP = "+String( Value )+
+          " in IMD file: "+Filename );
+      }
+      Groups[Current].EndEntry = Entries.size();
+      Current = Groups[Current].Parent;
+    } else {
+      Entries.push_back( IMDEntry{ Key,Value,Current } );
+    }
+  }
+  if( Current != IMD_ROOT ) {
+    throw std::runtime_error( "  ERROR (fatal): no END_GROUP for "+String( Groups[Current].Name )+
+      " in IMD file: "+Filename );
+  }
+}
+
+int IMDFile::FindGroup( std::string_view Name, int Parent ) const {
+  for( size_t g=0; g<Groups.size(); g++ ) {
+    if( Groups[g].Parent == Parent && Groups[g].Name == Name ) return (int)g;
+  }
+  return IMD_NO_GROUP;
+}
+
+bool IMDFile::Find( std::string_view Key, std::string_view& Value, int Group ) const {
+  /* *********************************************************************
+   * Look for a key among the entries of one group (not its nested
+   * groups). The root's entries are scanned in full; a group's only
+   * over its own span of the index.
+   */
+  if( Group == IMD_NO_GROUP ) return false;
+  size_t First = ( Group == IMD_ROOT ) ? 0 : Groups[Group].FirstEntry;
+  size_t Last  = ( Group == IMD_ROOT ) ? Entries.size() : Groups[Group].EndEntry;
+  for( size_t e=First; e<Last; e++ ) {
+    if( Entries[e].Group == Group && Entries[e].Key == Key ) {
+      Value = Entries[e].Value;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool IMDFile::FindAnywhere( std::string_view Key, std::string_view& Value ) const {
+  for( const IMDEntry& Entry: Entries ) {
+    if( Entry.Key == Key ) {
+      Value = Entry.Value;
+      return true;
+    }
+  }
+  return false;
+}
+
+double IMDFile::GetDouble( std::string_view Key, int Group ) const {
+  std::string_view Value;
+  double Number = 0.0;
+  if( !Find( Key,Value,Group ) || !ParseDouble( Value,Number )) {
+    throw std::runtime_error( "  ERROR (fatal): no numeric "+String( Key )+" in IMD file: "+Filename );
+  }
+  return Number;
+}
+
+int IMDFile::GetInt( std::string_view Key, int Group ) const {
+  std::string_view Value;
+  int Number = 0;
+  if( !Find( Key,Value,Group ) || !ParseInt( Value,Number )) {
+    throw std::runtime_error( "  ERROR (fatal): no integer "+String( Key )+" in IMD file: "+Filename );
+  }
+  return Number;
+}
+
+std::string_view IMDFile::Unquote( std::string_view Value ) {
+  if( Value.size()>=2 && Value.front() == '"' && Value.back() == '"' ) {
+    return Value.substr( 1,Value.size()-2 );
+  }
+  return Value;
+}
+
+bool IMDFile::ParseDouble( std::string_view Value, double& Number ) {
+  /* *********************************************************************
+   * strtod needs a terminated string and the mapping has none, so the
+   * number is copied to the stack first. Leading digits are enough
+   * (e.g. "57.133850Z" gives 57.13385), as with stod.
+   */
+  char Buffer[64];
+  Value = Unquote( Value );
+  if( Value.empty() || Value.size()>=sizeof(Buffer) ) return false;
+  memcpy( Buffer,Value.data(),Value.size() );
+  Buffer[Value.size()] = '\0';
+  char* Stop = nullptr;
+  Number = strtod( Buffer,&Stop );
+  return Stop != Buffer;
+}
+
+bool IMDFile::ParseInt( std::string_view Value, int& Number ) {
+  /* leading digits of the value, as with stoi */
+  Value = Unquote( Value );
+  if( !Value.empty() && Value.front() == '+' ) Value.remove_prefix( 1 );
+  std::from_chars_result Result = std::from_chars( Value.data(),Value.data()+Value.size(),Number );
+  return Result.ec == std::errc() && Result.ptr != Value.data();
+}
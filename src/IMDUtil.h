@@ -0,0 +1,75 @@
+#ifndef IMDUTIL_H_
+#define IMDUTIL_H_
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include "Misc.h"
+typedef std::string String;
+
+// group index of the entries outside any BEGIN_GROUP/END_GROUP, and the
+// index returned when a group is not found
+#define IMD_ROOT      -1
+#define IMD_NO_GROUP  -2
+
+// one "key = value;" statement of an IMD file. Key and value point into
+// the mapped file; the value is trimmed but keeps any quotes or
+// parentheses (see IMDFile::Unquote).
+struct IMDEntry {
+  std::string_view Key;
+  std::string_view Value;
+  int Group;                 // index into the groups, or IMD_ROOT
+};
+
+// one BEGIN_GROUP = NAME ... END_GROUP = NAME block. Its entries lie
+// between FirstEntry and EndEntry, mixed with those of nested groups.
+struct IMDGroup {
+  std::string_view Name;
+  int Parent;                // enclosing group, or IMD_ROOT
+  size_t FirstEntry;
+  size_t EndEntry;
+};
+
+// an IMD file mapped into memory and indexed in one pass. Tokens are
+// string_views into the mapping, so no string is allocated per line;
+// the index is two flat vectors in document order. An IMD already in
+// memory is indexed the same way, in a copy of its text.
+class IMDFile {
+  private:
+    std::unique_ptr<MappedFile> File;
+    String Text;
+    String Filename;
+    std::vector<IMDGroup> Groups;
+    std::vector<IMDEntry> Entries;
+    void Tokenize( const char*, size_t );
+
+  public:
+    explicit IMDFile( const String& );
+    IMDFile( const char*, size_t, const String& Source );
+    IMDFile( const IMDFile& ) = delete;
+    IMDFile& operator=( const IMDFile& ) = delete;
+
+    const String& GetFilename() const { return Filename; }
+    const std::vector<IMDGroup>& GetGroups() const { return Groups; }
+    const std::vector<IMDEntry>& GetEntries() const { return Entries; }
+
+    // a direct child group of Parent by name, or IMD_NO_GROUP
+    int FindGroup( std::string_view, int Parent=IMD_ROOT ) const;
+
+    // the value of a key directly inside Group; false if not there
+    bool Find( std::string_view, std::string_view&, int Group=IMD_ROOT ) const;
+
+    // the first value of a key anywhere in the file
+    bool FindAnywhere( std::string_view, std::string_view& ) const;
+
+    // typed values; throw if the key is missing or not a number
+    double GetDouble( std::string_view, int Group=IMD_ROOT ) const;
+    int GetInt( std::string_view, int Group=IMD_ROOT ) const;
+
+    // helpers for values: strip "quotes", parse numbers without allocating
+    static std::string_view Unquote( std::string_view );
+    static bool ParseDouble( std::string_view, double& );
+    static bool ParseInt( std::string_view, int& );
+};
+#endif
@@ -39,11 +39,16 @@ ImageUtil::ImageUtil( const char* ImageFileName ) {
   // copy filename's contents into new char* array
   strcpy((char*)filename,ImageFileName);
   
-  // call GDAL file registers
-  GDALAllRegister();
+  // call GDAL file registers (once per process)
+  InitializeGDAL();
 
   // Open the image file as a GDAL dataset.
   ImageDataset = (GDALDataset*) GDALOpen(filename,GA_ReadOnly );
+  if( ImageDataset == nullptr ) {
+    String ErrorMessage = (String)"ERROR (fatal): GDAL could not open: "+(String)filename+". Exiting ...\n";
+    delete [] filename;
+    throw std::runtime_error(ErrorMessage);
+  }
 
   // set private variables N_rows,N_cols,N_bands
   N_rows  = GDALGetRasterYSize( ImageDataset ); 
@@ -51,19 +56,48 @@ ImageUtil::ImageUtil( const char* ImageFileName ) {
   N_bands = GDALGetRasterCount( ImageDataset );
 }
 
+ImageUtil::ImageUtil( SceneMetadata& Scene ) {
+  /* *******************************************************************
+   * Construct from the metadata of a scene (see LoadSceneMetadata()),
+   * taking over the dataset it opened rather than opening the image
+   * again; a scene read from the metadata cache has none yet and is
+   * opened here. The scene no longer owns the dataset afterwards.
+   */
+  OpenSceneDataset( Scene );
+  filename = new char[Scene.ImageFilename.length()+1];
+  strcpy( (char*)filename,Scene.ImageFilename.c_str() );
+
+  ImageDataset = Scene.Dataset.release();
+  N_rows  = Scene.Rows;
+  N_cols  = Scene.Cols;
+  N_bands = Scene.Bands;
+}
+
 ImageUtil::~ImageUtil() {
   /* *************************************************
    * This is a destructor method for this class.
    * It closes the image dataset stored in the GDAL
    * dataset, releases the memory for the filename
-   * character array created in the constructor,
-   * and releases the GDAL drivers. 
+   * character array created in the constructor.
+   * GDAL's drivers stay registered for the next
+   * scene; see InitializeGDAL().
    */
   GDALClose(ImageDataset);
-  GDALDestroyDriverManager();
   delete [] filename;
 }
 
+void InitializeGDAL() {
+  /* *************************************************
+   * Register GDAL's drivers the first time this is
+   * called, from whichever thread gets there first.
+   * They stay registered until the process ends (or
+   * GDALDestroyDriverManager() is called by main),
+   * so scenes of a batch share them.
+   */
+  static std::once_flag Registered;
+  std::call_once( Registered,[]() { GDALAllRegister(); } );
+}
+
 const char* ImageUtil::GetProjection() {
   /* **********************************************************
    * function const char* GetProjection():
@@ -114,57 +148,506 @@ int *ImageUtil::GetDimensions() {
   return dimensions;  
 }
 
-double *ImageUtil::GetCalibrationAndBandwidthForBand( 
-  int BandNumber,SolarMetadata* Metadata,
-  std::map<String,String> CalibrationAndBandWidths,String& BandName 
-                                                   // got lazy with reference parameter.
-){
-  /* This function returns a 2-element array (a POINTER to the first
-   * element in a float array, that is) that contains the calibration and
-   * bandwidth for some band in the image file.
-   */
-  double *CalibrationAndBandWidth = new double[2];
-  for( auto const& [key,val]:CalibrationAndBandWidths ){
-
-    // move onto next iteration if key does not start with digit
-    if(!isdigit(key[0])){ 
-      continue;}
-
-    // get the band number from the key, move on if not a match
-    int BandNumberFromKey = stoi(key.substr(0,key.find("_")));
-    if(!( BandNumberFromKey == BandNumber )){
-      continue;}
-
-    // get the band name
-    String keystr = key;
-    String Delimiter = "__";
-    size_t Position  = 0;
-    String Token;
-    int Counter      = 0;
-
-    while((Position = keystr.find(Delimiter))!=String::npos){
-      Token = keystr.substr(0,Position);
-      keystr.erase(0,Position+Delimiter.length());
-      if( Counter == 1 ) BandName = Token;
-      Counter++;
+void ImageUtil::SetConversionMode( ConversionMode NewMode ) {
+  /* ****************************************************************
+   * Set how DNs are converted: CONVERT_ARITHMETIC (the default) applies
+   * the fused per-band gains with the vector kernel, CONVERT_LOOKUP
+   * builds a table per band sized to the IMD bit depth and gathers
+   * from it. Both give identical output.
+   */
+  Mode = NewMode;
+}
+
+void ImageUtil::SetBandReadMode( BandReadMode NewReadMode ) {
+  /* ****************************************************************
+   * Set whether bands are read one at a time (READ_PER_BAND), all
+   * together per window (READ_ALL_BANDS), or chosen from the layout
+   * of the input (READ_AUTO, the default; see UseAllBandsRead()).
+   */
+  ReadMode = NewReadMode;
+}
+
+bool ImageUtil::UseAllBandsRead() {
+  /* ****************************************************************
+   * Decide whether to read all bands per window. This requires every
+   * band to have the same data type. In READ_AUTO mode it is used when
+   * the input is pixel-interleaved or JPEG2000-compressed, where each
+   * per-band pass would decode the same compressed data again. Bands
+   * and tiles converted in parallel (PROCESS_BANDS, PROCESS_TILES) are
+   * always read per band.
+   */
+  if( ReadMode == READ_PER_BAND || N_bands<2 ) return false;
+  if( Processing == PROCESS_BANDS || Processing == PROCESS_TILES ) return false;
+  GDALDataType FirstType = GDALGetRasterDataType( ImageDataset->GetRasterBand(1) );
+  for( int BandIndex=2; BandIndex<N_bands+1; BandIndex++ ) {
+    if( GDALGetRasterDataType( ImageDataset->GetRasterBand(BandIndex) ) != FirstType ) {
+      return false;
+    }
+  }
+  if( ReadMode == READ_ALL_BANDS ) return true;
+
+  const char* Interleave  = ImageDataset->GetMetadataItem( "INTERLEAVE","IMAGE_STRUCTURE" );
+  const char* Compression = ImageDataset->GetMetadataItem( "COMPRESSION","IMAGE_STRUCTURE" );
+  if( Interleave && String(Interleave) == "PIXEL" ) return true;
+  if( Compression && String(Compression).find("JPEG2000") != String::npos ) return true;
+  return false;
+}
+
+void ImageUtil::SetCreationOption( const String& Key, const String& Value ) {
+  /* ****************************************************************
+   * Set a GTiff creation option for both output Geotiffs (e.g. 
+   * COMPRESS=DEFLATE). Options set here override the defaults
+   * described in GetCreationOptions(). An empty value removes the
+   * option altogether.
+   */
+  CreationOptions[Key] = Value;
+}
+
+char **ImageUtil::GetCreationOptions() {
+  /* ****************************************************************
+   * Build the list of GTiff creation options for the outputs. Defaults
+   * suit float reflectances: 512x512 tiles, ZSTD compression (DEFLATE
+   * if this GDAL was built without ZSTD) with the floating-point
+   * predictor, BIGTIFF when needed, compression on all cores, and
+   * band-interleaved tiles in every processing mode. User options from
+   * SetCreationOption() are applied on top. The
+   * caller owns the returned list and frees it with CSLDestroy().
+   */
+  const char* OptionList = GetGDALDriverManager()->GetDriverByName("GTiff")->GetMetadataItem( 
+    GDAL_DMD_CREATIONOPTIONLIST );
+  bool HasZSTD = OptionList && String(OptionList).find("ZSTD") != String::npos;
+
+  std::map<String,String> Options;
+  Options["TILED"]       = "YES";
+  Options["BLOCKXSIZE"]  = "512";
+  Options["BLOCKYSIZE"]  = "512";
+  Options["COMPRESS"]    = HasZSTD ? "ZSTD" : "DEFLATE";
+  Options["PREDICTOR"]   = "3";
+  Options["BIGTIFF"]     = "IF_SAFER";
+  Options["NUM_THREADS"] = "ALL_CPUS";
+
+  // every mode writes a window one band at a time: pixel-interleaved
+  // tiles would be decompressed and recompressed once per band, and
+  // bands written by different threads would share tiles
+  Options["INTERLEAVE"]  = "BAND";
+  for( auto const& [Key,Value]: CreationOptions ) {
+    Options[Key] = Value;
+  }
+
+  // the floating-point predictor only applies to the lossless codecs
+  // that take one; LERC and uncompressed output reject it.
+  String Compress = Options["COMPRESS"];
+  if( Compress == "NONE" || Compress.find("LERC") == 0 ) {
+    if( CreationOptions.find("PREDICTOR") == CreationOptions.end() ) Options["PREDICTOR"] = "";
+  }
+
+  char **TiffOptions = nullptr;
+  for( auto const& [Key,Value]: Options ) {
+    if( Value.length()>0 ) {
+      TiffOptions = CSLSetNameValue( TiffOptions,Key.c_str(),Value.c_str() );
+    }
+  }
+  return TiffOptions;
+}
+
+void ImageUtil::SetCloudOptimized( bool Enable ) {
+  /* ****************************************************************
+   * Write the outputs as Cloud-Optimized Geotiffs (COGs), with overview
+   * levels built from the windows as they are converted.
+   */
+  CloudOptimized = Enable;
+}
+
+int ImageUtil::GetOverviewLevelCount() {
+  /* ****************************************************************
+   * Number of overview levels (factors 2,4,8,...) for COG output:
+   * halve the image until it fits in one output tile, the way
+   * gdaladdo and the GDAL COG driver choose their levels.
+   */
+  char **TiffOptions = this->GetCreationOptions();
+  const char* TileSize = CSLFetchNameValue( TiffOptions,"BLOCKXSIZE" );
+  int Tile = TileSize ? std::max( 16,atoi(TileSize) ) : 512;
+  CSLDestroy( TiffOptions );
+
+  int Levels = 0;
+  long Size  = std::max( N_cols,N_rows );
+  while( Size>Tile && Levels<16 ) {
+    Size = ( Size+1 )/2;
+    Levels++;
+  }
+  return Levels;
+}
+
+char **ImageUtil::GetWorkingOptions() {
+  /* ****************************************************************
+   * GTiff creation options of the working Geotiffs of COG output (see
+   * FinishCloudOptimized()): the tiling and band layout of the outputs
+   * but no compression, since the final copy compresses every tile
+   * anyway and would otherwise have to decompress them all first.
+   * The caller frees the list with CSLDestroy().
+   */
+  char **TiffOptions = this->GetCreationOptions();
+  char **WorkOptions = nullptr;
+  for( const char* Key: { "BLOCKXSIZE","BLOCKYSIZE","INTERLEAVE" } ) {
+    const char* Value = CSLFetchNameValue( TiffOptions,Key );
+    if( Value ) WorkOptions = CSLSetNameValue( WorkOptions,Key,Value );
+  }
+  CSLDestroy( TiffOptions );
+  WorkOptions = CSLSetNameValue( WorkOptions,"TILED","YES" );
+  WorkOptions = CSLSetNameValue( WorkOptions,"COMPRESS","NONE" );
+  WorkOptions = CSLSetNameValue( WorkOptions,"BIGTIFF","IF_SAFER" );
+  return WorkOptions;
+}
+
+void ImageUtil::CreateOverviewLevels( GDALDataset* Dataset ) {
+  /* ****************************************************************
+   * Create empty internal overview levels in an output dataset. The
+   * "NONE" resampling only allocates the levels; their pixels are
+   * written by WriteWindowOverviews().
+   */
+  int Levels = this->GetOverviewLevelCount();
+  if( Levels<1 ) return;
+  std::vector<int> Factors;
+  for( int i=1; i<=Levels; i++ ) Factors.push_back( 1<<i );
+  if( Dataset->BuildOverviews( "NONE",Levels,Factors.data(),0,nullptr,
+        GDALDummyProgress,nullptr ) != CE_None ) {
+    String ErrorMsg = "  ERROR (fatal): unable to create overviews for outputs of: "+(String)filename;
+    throw std::runtime_error( ErrorMsg );
+  }
+}
+
+CPLErr ImageUtil::WriteWindowOverviews( GDALDataset* Dataset, int BandIndex,
+  const ImageWindow& Window, const float* Buffer ) {
+  /* ****************************************************************
+   * Fill the overview levels of one band from a converted window. Each
+   * level is the 2x2 average of the level below it, ignoring NoData
+   * pixels (a block that is all NoData stays NoData), so the full
+   * resolution window is the only input and nothing is read back from
+   * the file. The window must start on a multiple of the coarsest
+   * overview factor; GetProcessingWindows() ensures that.
+   */
+  StageTimer Timer( Profile,STAGE_WRITE );
+  GDALRasterBand *Band = Dataset->GetRasterBand(BandIndex);
+  std::vector<float> Previous( Buffer,Buffer+(size_t)Window.width*Window.height );
+  int Width  = Window.width;
+  int Height = Window.height;
+
+  for( int Level=0; Level<Band->GetOverviewCount(); Level++ ) {
+    int Factor     = 2<<Level;
+    int HalfWidth  = ( Width+1 )/2;
+    int HalfHeight = ( Height+1 )/2;
+    std::vector<float> Current( (size_t)HalfWidth*HalfHeight );
+
+    for( int y=0; y<HalfHeight; y++ ) {
+      for( int x=0; x<HalfWidth; x++ ) {
+        double Sum = 0.0;
+        int Count  = 0;
+        for( int dy=0; dy<2 && 2*y+dy<Height; dy++ ) {
+          for( int dx=0; dx<2 && 2*x+dx<Width; dx++ ) {
+            float Value = Previous[(size_t)(2*y+dy)*Width+2*x+dx];
+            if( Value != (float)NODATA ) {
+              Sum += Value;
+              Count++;
+            }
+          }
+        }
+        Current[(size_t)y*HalfWidth+x] = Count ? (float)(Sum/Count) : (float)NODATA;
+      }
     }
-    BandName = trim(BandName);
-    // get absolute calibration factor and effective bandwidth 
-    // 1_BAND_C_ABSCALFACTOR -> 1.397474000000000e-02
-    // 1_BAND_C_EFFECTIVEBANDWIDTH -> 4.050000000000000e-02
-    if( key.find("ABSCALFACTOR")!=String::npos ){
-      CalibrationAndBandWidth[0] = stod(val);
+
+    // clip to the overview band (its size is rounded up the same way)
+    GDALRasterBand *Overview = Band->GetOverview(Level);
+    int OverviewX = Window.x/Factor;
+    int OverviewY = Window.y/Factor;
+    int WriteWidth  = std::min( HalfWidth,Overview->GetXSize()-OverviewX );
+    int WriteHeight = std::min( HalfHeight,Overview->GetYSize()-OverviewY );
+    if( WriteWidth>0 && WriteHeight>0 ) {
+      CPLErr e = Overview->RasterIO( GF_Write,OverviewX,OverviewY,WriteWidth,WriteHeight,
+        Current.data(),WriteWidth,WriteHeight,GDT_Float32,sizeof(float),
+        (GSpacing)sizeof(float)*HalfWidth );
+      if( e != CE_None ) return e;
+      Timer.AddBytes( sizeof(float)*(uint64_t)WriteWidth*WriteHeight );
+    }
+    Previous.swap( Current );
+    Width  = HalfWidth;
+    Height = HalfHeight;
+  }
+  return CE_None;
+}
+
+// the scene's progress and which of the two copies of the outputs runs
+struct CopyProgress {
+  SceneProgress *Progress;
+  int Copy;
+};
+
+static int CPL_STDCALL ReportCopyProgress( double Fraction, const char*, void* Data ) {
+  /* a GDALProgressFunc for CreateCopy(); FALSE once cancelled */
+  CopyProgress *Copy = (CopyProgress*)Data;
+  return Copy->Progress->AdvancePhase( 0.5*( Copy->Copy+Fraction )) ? TRUE : FALSE;
+}
+
+void ImageUtil::FinishCloudOptimized( GDALDataset* WorkDataset, const String& WorkFilename,
+  const String& FinalFilename, int Copy ) {
+  /* ****************************************************************
+   * Turn an uncompressed working Geotiff, whose overviews are already
+   * filled, into the final COG. A COG needs its overview IFDs and
+   * tiles ordered ahead of the full-resolution data, which GDAL can
+   * only lay out with CreateCopy(), so the copy is the one compression
+   * pass of the outputs. It reuses the existing overviews
+   * (OVERVIEWS=FORCE_USE_EXISTING) rather than resampling, so it is a
+   * sequential copy of already computed pixels. GDAL builds without
+   * the COG driver (before 3.1) fall back to a tiled GTiff copy with
+   * COPY_SRC_OVERVIEWS=YES, which gives the same layout. The copy is
+   * reported as the final phase of the scene's progress, Copy (0 or 1)
+   * being which of the two outputs it is.
+   */
+  char **TiffOptions = this->GetCreationOptions();
+  char **CopyOptions = nullptr;
+  GDALDriver *Driver = GetGDALDriverManager()->GetDriverByName("COG");
+  const char* Compress   = CSLFetchNameValue( TiffOptions,"COMPRESS" );
+  const char* Predictor  = CSLFetchNameValue( TiffOptions,"PREDICTOR" );
+  const char* BigTiff    = CSLFetchNameValue( TiffOptions,"BIGTIFF" );
+  const char* Threads    = CSLFetchNameValue( TiffOptions,"NUM_THREADS" );
+  const char* BlockSize  = CSLFetchNameValue( TiffOptions,"BLOCKXSIZE" );
+  const char* Level      = CSLFetchNameValue( TiffOptions,"ZLEVEL" );
+  if( Level == nullptr ) Level = CSLFetchNameValue( TiffOptions,"ZSTD_LEVEL" );
+
+  if( Driver != nullptr ) {
+    if( Compress )  CopyOptions = CSLSetNameValue( CopyOptions,"COMPRESS",Compress );
+    if( Predictor ) CopyOptions = CSLSetNameValue( CopyOptions,"PREDICTOR",
+      String(Predictor) == "3" ? "FLOATING_POINT" : ( String(Predictor) == "2" ? "STANDARD" : Predictor ));
+    if( BigTiff )   CopyOptions = CSLSetNameValue( CopyOptions,"BIGTIFF",BigTiff );
+    if( Threads )   CopyOptions = CSLSetNameValue( CopyOptions,"NUM_THREADS",Threads );
+    if( BlockSize ) CopyOptions = CSLSetNameValue( CopyOptions,"BLOCKSIZE",BlockSize );
+    if( Level )     CopyOptions = CSLSetNameValue( CopyOptions,"LEVEL",Level );
+    CopyOptions = CSLSetNameValue( CopyOptions,"OVERVIEWS","FORCE_USE_EXISTING" );
+  } else {
+    Driver = GetGDALDriverManager()->GetDriverByName("GTiff");
+    CopyOptions = CSLDuplicate( TiffOptions );
+    CopyOptions = CSLSetNameValue( CopyOptions,"TILED","YES" );
+    CopyOptions = CSLSetNameValue( CopyOptions,"COPY_SRC_OVERVIEWS","YES" );
+  }
+  CSLDestroy( TiffOptions );
+
+  // the working file is closed and removed however the copy ends
+  GDALDataset *Final = nullptr;
+  CopyProgress Reporter{ Progress,Copy };
+  try {
+    WorkDataset->FlushCache();
+    Final = Driver->CreateCopy( FinalFilename.c_str(),WorkDataset,FALSE,CopyOptions,
+      Progress ? ReportCopyProgress : GDALDummyProgress,Progress ? &Reporter : nullptr );
+  } catch( ... ) {
+    CSLDestroy( CopyOptions );
+    GDALClose( WorkDataset );
+    GetGDALDriverManager()->GetDriverByName("GTiff")->Delete( WorkFilename.c_str() );
+    throw;
+  }
+  CSLDestroy( CopyOptions );
+  GDALClose( WorkDataset );
+  GetGDALDriverManager()->GetDriverByName("GTiff")->Delete( WorkFilename.c_str() );
+
+  if( Final == nullptr ) {
+    String ErrorMsg = ( Progress && Progress->IsCancelled() ) ?
+      "  ERROR (fatal): conversion cancelled: "+(String)filename :
+      "  ERROR (fatal): unable to write Cloud-Optimized Geotiff: "+FinalFilename;
+    throw std::runtime_error( ErrorMsg );
+  }
+  GDALClose( Final );
+}
+
+void ImageUtil::SetProcessingMode( ProcessingMode NewProcessing ) {
+  /* ****************************************************************
+   * Run the reader/compute/writer pipeline (PROCESS_PIPELINE, the
+   * default), convert bands in parallel (PROCESS_BANDS), schedule the
+   * tiles of all bands on a work-stealing pool (PROCESS_TILES), or
+   * read, convert and write each window in turn on the calling thread
+   * (PROCESS_SEQUENTIAL).
+   */
+  Processing = NewProcessing;
+}
+
+void ImageUtil::SetSolarGeometryMode( SolarGeometryMode NewSolarMode ) {
+  /* ****************************************************************
+   * Use the IMD's mean sun elevation for every pixel (SOLAR_SCENE_MEAN,
+   * the default), or per-pixel solar zenith angles interpolated from a
+   * coarse grid built from the line times and corner coordinates
+   * (SOLAR_GRID, see BuildSolarZenithGrid()).
+   */
+  SolarMode = NewSolarMode;
+}
+
+void ImageUtil::SetProfile( SceneProfile* NewProfile ) {
+  /* ****************************************************************
+   * Time the coefficient build and every read, conversion, write and
+   * close of the scene into a profile shared with the caller, which
+   * also holds the metadata stages (see LoadSceneMetadata()).
+   */
+  Profile = NewProfile;
+}
+
+void ImageUtil::SetProgress( SceneProgress* NewProgress ) {
+  /* ****************************************************************
+   * Advance a progress report by every window once it is converted
+   * and written, from whichever thread wrote it. The report starts
+   * when the outputs have been created and finishes once they are
+   * closed; a cancelled report stops the conversion with an error.
+   */
+  Progress = NewProgress;
+}
+
+void ImageUtil::SetComputeThreads( int Threads ) {
+  /* ****************************************************************
+   * Number of pipeline compute workers. 0 picks min(4,cores): the
+   * conversion kernel is much faster than reading and compressing, so
+   * a few workers keep up with the I/O threads. In PROCESS_BANDS mode
+   * it is the number of bands converted at once, and 0 picks
+   * min(bands,cores); in PROCESS_TILES mode it is the number of pool
+   * workers, and 0 picks one per core.
+   */
+  ComputeThreads = Threads;
+}
+
+void ImageUtil::SetQueueDepth( int Depth ) {
+  /* ****************************************************************
+   * Number of window buffers the pipeline keeps in flight, which is
+   * also the capacity of each of its queues. 0 picks the number of
+   * compute workers plus 3 (one being read, one per writer stage,
+   * one spare).
+   */
+  QueueDepth = Depth;
+}
+
+void ImageUtil::SetPixelBudget( size_t Pixels ) {
+  /* ****************************************************************
+   * Number of pixels (of all bands and buffers) held in memory at once
+   * when windows are sized automatically. Defaults to
+   * WINDOW_PIXEL_BUDGET; batch mode splits its memory budget between
+   * the scenes running at once.
+   */
+  PixelBudget = std::max( (size_t)1,Pixels );
+}
+
+void ImageUtil::SetOutputFilenames( const String& Radiances, const String& Reflectances ) {
+  /* ****************************************************************
+   * Write the outputs to the given Geotiffs instead of next to the
+   * input (<image>_TOA_RADIANCES.TIF, <image>_TOA_REFLECTANCES.TIF).
+   * An empty name keeps the default for that output.
+   */
+  radiances_filename    = Radiances;
+  reflectances_filename = Reflectances;
+}
+
+void ImageUtil::SetMosaicOutputs( GDALDataset* Radiances, GDALDataset* Reflectances,
+  int XOffset, int YOffset, std::mutex* Lock ) {
+  /* ****************************************************************
+   * Write into existing outputs shared by the tiles of a mosaic, with
+   * this image's pixel (0,0) at (XOffset,YOffset). The caller creates
+   * and closes the outputs, and Lock (held for every write) serializes
+   * the tiles converted at once. Set SetOutputFilenames() to the
+   * mosaic's names for error messages.
+   */
+  MosaicRadiances    = Radiances;
+  MosaicReflectances = Reflectances;
+  OutputXOffset      = XOffset;
+  OutputYOffset      = YOffset;
+  MosaicLock         = Lock;
+}
+
+CPLErr ImageUtil::WriteOutputWindow( GDALDataset* Dataset, const ImageWindow& Window,
+  float* Data, int BandCount, int* BandMap ) {
+  /* ****************************************************************
+   * Write a band-sequential window of BandCount bands (BandMap, or
+   * bands 1..BandCount if null) into an output, shifted by the mosaic
+   * offset and under the mosaic lock when writing into a mosaic.
+   */
+  uint64_t Pixels = (uint64_t)Window.width*Window.height*BandCount;
+  StageTimer Timer( Profile,STAGE_WRITE,sizeof(float)*Pixels,Pixels );
+  std::unique_lock<std::mutex> Guard;
+  if( MosaicLock ) Guard = std::unique_lock<std::mutex>( *MosaicLock );
+  return Dataset->RasterIO( GF_Write,Window.x+OutputXOffset,Window.y+OutputYOffset,
+    Window.width,Window.height,Data,Window.width,Window.height,GDT_Float32,
+    BandCount,BandMap,0,0,0 );
+}
+
+void ImageUtil::SetBlockMultiple( int Multiple ) {
+  /* ****************************************************************
+   * Set the size of the processing windows, as a multiple of the input
+   * dataset's natural block size in each direction. 0 (the default)
+   * picks the multiple automatically; see GetProcessingWindows().
+   */
+  BlockMultiple = Multiple;
+}
+
+std::vector<ImageWindow> ImageUtil::GetProcessingWindows( int BandIndex, int BandsPerWindow ) {
+  /* ****************************************************************
+   * Split the image into windows aligned to the natural block size of
+   * a band (GetBlockSize()), so every read covers whole blocks and a
+   * block is decoded once rather than once per scanline. A window is
+   * BlockMultiple blocks wide and tall, clipped to the image edges.
+   *
+   * With no multiple set, windows are at least WINDOW_MIN_ROWS rows
+   * tall (striped and scanline-interleaved files have tiny blocks), and
+   * no shorter than the output tiles (BLOCKYSIZE), and
+   * as many blocks wide as fit in the pixel budget, shared
+   * between the BandsPerWindow bands held in memory at once. Windows
+   * of blocks as wide as the image (strips) that would exceed that
+   * share get fewer rows instead.
+   */
+  int BlockX = 0, BlockY = 0;
+  ImageDataset->GetRasterBand(BandIndex)->GetBlockSize( &BlockX,&BlockY );
+  if( BlockX<1 ) BlockX = N_cols;
+  if( BlockY<1 ) BlockY = 1;
+
+  int MultipleX = BlockMultiple, MultipleY = BlockMultiple;
+  if( BlockMultiple<1 ) {
+    // tall enough to complete a row of output tiles in one window
+    int MinRows = WINDOW_MIN_ROWS;
+    char **TiffOptions = this->GetCreationOptions();
+    const char* TileRows = CSLFetchNameValue( TiffOptions,"BLOCKYSIZE" );
+    if( TileRows && atoi(TileRows)>MinRows ) MinRows = atoi(TileRows);
+    CSLDestroy( TiffOptions );
+    MultipleY = ( MinRows+BlockY-1 )/BlockY;
+    long WindowRows = std::min( (long)BlockY*MultipleY,(long)N_rows );
+    MultipleX = std::max( 1L,(long)PixelBudget/( WindowRows*BlockX*std::max(1,BandsPerWindow) ));
+
+    // strips (and other blocks as wide as the image) cannot be narrowed,
+    // so when those rows do not fit in the budget the window is made
+    // shorter instead, down to one block row
+    long Share = std::max( 1L,(long)PixelBudget/std::max(1,BandsPerWindow) );
+    if( WindowRows*BlockX>Share ) {
+      MultipleY = (int)std::max( 1L,Share/( (long)BlockX*BlockY ));
     }
+  }
+  long WindowWidth  = (long)BlockX*MultipleX;
+  long WindowHeight = (long)BlockY*MultipleY;
 
-    if( key.find("EFFECTIVEBANDWIDTH")!=String::npos ){
-      CalibrationAndBandWidth[1] = stod(val);
+  // overviews are filled per window, so for Cloud-Optimized output the
+  // windows must start on multiples of the coarsest overview factor
+  if( CloudOptimized ) {
+    long Factor  = 1L << this->GetOverviewLevelCount();
+    WindowWidth  = (( WindowWidth+Factor-1 )/Factor )*Factor;
+    WindowHeight = (( WindowHeight+Factor-1 )/Factor )*Factor;
+  }
+  WindowWidth  = std::min( WindowWidth,(long)N_cols );
+  WindowHeight = std::min( WindowHeight,(long)N_rows );
+
+  std::vector<ImageWindow> Windows;
+  for( int y=0; y<N_rows; y+=(int)WindowHeight ) {
+    for( int x=0; x<N_cols; x+=(int)WindowWidth ) {
+      ImageWindow Window;
+      Window.x      = x;
+      Window.y      = y;
+      Window.width  = (int)std::min( WindowWidth,(long)( N_cols-x ));
+      Window.height = (int)std::min( WindowHeight,(long)( N_rows-y ));
+      Windows.push_back( Window );
     }
   }
-  return CalibrationAndBandWidth;
+  return Windows;
 }
 
 void ImageUtil::WriteRadianceAndReflectanceGeotiffs( 
-  SolarMetadata* Metadata, std::map<String,String> CalibrationAndBandWidths ){
+  SolarMetadata* Metadata, const SceneCalibration& Calibration ){
   /* *************************************************************************
    * This function writes out Geotiffs containing:
    * (1) the top of atmosphere radiances
@@ -174,66 +657,62 @@ void ImageUtil::WriteRadianceAndReflectanceGeotiffs(
   // first calculate+set the radiances and reflectances
   // note the keyword "this" is redundant and not needed. we put it here for emphasis
   // that is meant to be called using an object.
-  this->CalculateSpectralRadiancesAndReflectances<float>( Metadata,CalibrationAndBandWidths );
+  this->CalculateSpectralRadiancesAndReflectances<float>( Metadata,Calibration );
 }
 
-void ImageUtil::SetSolarIrradiances( SolarIrradiances& Irradiances, String SatelliteID ){
+std::vector<BandCoefficients> ImageUtil::BuildBandCoefficients( 
+  SolarMetadata* Metadata, const SceneCalibration& Calibration ){
   /* ***********************************************************************
-   * Set the radiances in the solar irradiances structure. See ImageUtil.h
-   * for this definition. This function will take a pointer to this
-   * structure as well as a String for the satellite ID (e.g. "WV02").
-   *
-   * This function uses the pointer to the structure containing
-   * the solar irradiances and sets those values on the satellite.
-   */
-  if( SatelliteID == "WV03" ) {
-    // https://dg-cms-uploads-production.s3.amazonaws.com/uploads/document/file/207/Radiometric_Use_of_WorldView-3_v2.pdf
-    Irradiances.BAND_P = 1583.58;        // PAN 
-    Irradiances.BAND_C = 1743.81;        // COASTAL
-    Irradiances.BAND_B = 1971.48;        // BLUE
-    Irradiances.BAND_G = 1856.26;        // GREEN
-    Irradiances.BAND_Y = 1749.4 ;        // YELLOW
-    Irradiances.BAND_R = 1555.11;        // RED
-    Irradiances.BAND_N = 1071.98;        // NIR
-    Irradiances.BAND_N2 = 863.296;       // NIR2
-    Irradiances.BAND_RE = 1343.95;       // REDEDGE
-  } else if ( SatelliteID == "WV02" ) {
-    // https://www.yumpu.com/en/document/read/43552535/radiometric-use-of-worldview-2-imagery-technical-note-pancroma
-    Irradiances.BAND_P = 1580.8140;      // PAN 
-    Irradiances.BAND_C = 1758.2229;      // COASTAL
-    Irradiances.BAND_B = 1974.2416;      // BLUE
-    Irradiances.BAND_G = 1856.4104;      // GREEN
-    Irradiances.BAND_Y = 1738.4791;      // YELLOW
-    Irradiances.BAND_R = 1559.4555;      // RED
-    Irradiances.BAND_N = 1069.7302;      // NIR
-    Irradiances.BAND_N2 = 861.2866;      // NIR2
-    Irradiances.BAND_RE = 1342.0695;     // REDEDGE
-  } else if( SatelliteID == "QB02"  ) {
-    // https://grasswiki.osgeo.org/wiki/QuickBird
-    Irradiances.BAND_P = 1381.79;        // PAN 
-    Irradiances.BAND_C = -9999.0;        // COASTAL
-    Irradiances.BAND_B = 1924.59;        // BLUE
-    Irradiances.BAND_G = 1843.08;        // GREEN
-    Irradiances.BAND_Y = -9999.0;        // YELLOW
-    Irradiances.BAND_R = 1574.77;        // RED
-    Irradiances.BAND_N = 1113.71;        // NIR
-    Irradiances.BAND_N2 = -9999.0;       // NIR2
-    Irradiances.BAND_RE = -9999.0;       // REDEDGE
-  } else if( SatelliteID == "OV05" ) {
-    // https://apollomapping.com/wp-content/user_uploads/2011/09/GeoEye1_Radiance_at_Aperture.pdf 
-    Irradiances.BAND_P = 161.7 * (1.0/1000.0) * (1.0/0.0001);         // PAN 
-    Irradiances.BAND_C = -9999.0;                                     // COASTAL
-    Irradiances.BAND_B = 196.0 * (1.0/1000.0) * (1.0/0.0001);         // BLUE
-    Irradiances.BAND_G = 185.3 * (1.0/1000.0) * (1.0/0.0001);         // GREEN
-    Irradiances.BAND_Y = -9999.0;                                     // YELLOW
-    Irradiances.BAND_R = 150.5 * (1.0/1000.0) * (1.0/0.0001);         // RED
-    Irradiances.BAND_N = 103.9 * (1.0/1000.0) * (1.0/0.0001);         // NIR
-    Irradiances.BAND_N2 = -9999.0;                                    // NIR2
-    Irradiances.BAND_RE = -9999.0;                                    // REDEDGE
-  } else {
-    String ErrorMessage = (String)"ERROR (fatal): satellite key from XML not recognized: "+SatelliteID+". Exiting ...\n";
-    throw std::runtime_error(ErrorMessage); 
+   * Build the table of fused per-band coefficients (see KernelUtil.h) for
+   * every band in the image. This runs once per scene, before any pixels
+   * are read: it takes the calibration, bandwidth and solar irradiance of
+   * each band and folds them together with the Earth-sun distance and
+   * the solar zenith angle.
+   */
+  if( Calibration.GetBandCount()<N_bands ) {
+    throw std::runtime_error( "  ERROR (fatal): XML file has calibrations for "+
+      std::to_string( Calibration.GetBandCount() )+" bands, the image has "+
+      std::to_string( N_bands ));
   }
+
+  double earthSunDistance = Metadata->earthSunDistance;
+  double solarZenithAngle = Metadata->solarZenithAngle * ( M_PI / 180.0 );
+
+  std::vector<BandCoefficients> BandCoefficientTable;
+  for( int BandIndex=1; BandIndex<N_bands+1; BandIndex++ ) {
+    const BandCalibration& Band = Calibration.GetBand( BandIndex );
+    BandCoefficientTable.push_back( MakeBandCoefficients( Band.Name,
+      Band.AbsCalFactor,Band.EffectiveBandwidth,Band.SolarIrradiance,
+      earthSunDistance,solarZenithAngle ));
+  }
+  return BandCoefficientTable;
+}
+
+bool ImageUtil::ValidateBandCoefficients( 
+  SolarMetadata* Metadata, const SceneCalibration& Calibration, int ToleranceULP ){
+  /* ***********************************************************************
+   * Validation mode: check, for every band and every possible 16-bit DN,
+   * that the fused coefficients give the same radiances and reflectances
+   * as the original per-pixel formula to within ToleranceULP units in the
+   * last place. Prints a line per band and returns true if all pass.
+   */
+  std::vector<BandCoefficients> BandCoefficientTable = this->BuildBandCoefficients( 
+    Metadata,Calibration );
+
+  bool Passed = true;
+  printf("%s\n","");
+  printf("  validating fused band coefficients (kernel: %s, tolerance: %d ULP)\n",
+    KernelISAName( GetKernelISA() ),ToleranceULP );
+  for( size_t i=0; i<BandCoefficientTable.size(); i++ ) {
+    CoefficientValidation Result = ::ValidateBandCoefficients( 
+      BandCoefficientTable[i],65535,ToleranceULP );
+    bool BandPassed = ( Result.MismatchedPixels == 0 );
+    printf("    band %2d %-8s radiance max %d ULP, reflectance max %d ULP ... %s\n",
+      (int)i+1,BandCoefficientTable[i].BandName.c_str(),Result.MaxRadianceULP,
+      Result.MaxReflectanceULP,BandPassed ? "ok" : "FAILED" );
+    Passed = Passed && BandPassed;
+  }
+  return Passed;
 }
 
 template<typename T>
@@ -243,34 +722,56 @@ void ImageUtil::CalculateSpectralRadiancesAndReflectances(
    *  reflectances. Both are written out as GDAL "float" datasets.
    */
 		
-  SolarMetadata* Metadata,std::map<String,String> CalibrationAndBandWidths ){
-  // register GDAL drivers for C/C++	
-  GDALAllRegister();
+  SolarMetadata* Metadata,const SceneCalibration& Calibration ){
   String ErrorMsg = "";
- 
-  GDALDataType BandType; 
-  int BandIndex=1; // GDAL starts at 1, not 0.
-  long NoDataValue = this->GetNoDataValue();
-  String SatelliteID = CalibrationAndBandWidths[ "SatelliteID" ];
 
-  // based on the satellite ID, get array of solar irradiances
+  // build the per-band coefficient table once for the whole scene
   /* ****************************************************** */
-  SolarIrradiances Irradiances;
-  this->SetSolarIrradiances( Irradiances,SatelliteID ); 
+  StageTimer CoefficientTimer( Profile,STAGE_COEFFICIENTS );
+  std::vector<BandCoefficients> BandCoefficientTable = this->BuildBandCoefficients( 
+    Metadata,Calibration );
+  if( Profile ) Profile->SetScenePixels( (uint64_t)N_rows*N_cols*N_bands );
 
-  // initial variales (float) for TOA radiance, TOA reflectance
-  float radiance_TOA;
-  float reflectance_TOA;
-  double earthSunDistance = Metadata->earthSunDistance;
-  double solarZenithAngle = Metadata->solarZenithAngle * ( M_PI / 180.0 );
+  // and, for per-pixel solar geometry, the scene's grid of zenith angles
+  if( SolarMode == SOLAR_GRID ) {
+    SolarGrid = BuildSolarZenithGrid( *Metadata,N_rows,N_cols );
+    float MinScale = *std::min_element( SolarGrid.Scale.begin(),SolarGrid.Scale.end() );
+    float MaxScale = *std::max_element( SolarGrid.Scale.begin(),SolarGrid.Scale.end() );
+    printf("  per-pixel solar zenith: %d x %d grid, reflectance scale %.5f to %.5f\n",
+      SolarGrid.NodeCols,SolarGrid.NodeRows,MinScale,MaxScale );
+  }
+  CoefficientTimer.Stop();
+
+  // the output buffers are handed to the conversion kernel and written
+  // as GDT_Float32, so only float output is supported.
+  static_assert( std::is_same<T,float>::value,"TOA outputs are written as GDT_Float32" );
+
+  // a tile of a mosaic writes into the shared outputs, which the caller
+  // created and will close (see SetMosaicOutputs()); the caller also
+  // starts and finishes the mosaic's progress, which the tile advances
+  if( MosaicRadiances != nullptr ) {
+    if( CloudOptimized ) {
+      throw std::runtime_error( "  ERROR (fatal): Cloud-Optimized output is not supported for mosaics" );
+    }
+    if( MosaicRadiances->GetRasterCount() != N_bands ||
+        OutputXOffset+N_cols>MosaicRadiances->GetRasterXSize() ||
+        OutputYOffset+N_rows>MosaicRadiances->GetRasterYSize() ) {
+      ErrorMsg = "  ERROR (fatal): tile does not fit the mosaic: "+(String)filename;
+      throw std::runtime_error( ErrorMsg );
+    }
+    printf("  converting %s into the mosaic at column %d, row %d\n",filename,OutputXOffset,OutputYOffset );
+    this->ConvertImage( Metadata,BandCoefficientTable,MosaicRadiances,MosaicReflectances );
+    return;
+  }
 
   // create output filenames for the two geotiffs, one Geotiff
   // holding the top-of-atmosphere radiances, the other top-of-atmosphere reflectances
+  // next to the input, unless set with SetOutputFilenames()
   String image_filename;
   image_filename = (String)this->filename;
   image_filename = image_filename.substr( 0,image_filename.length()-4 );
-  String radiances_filename    = image_filename+"_TOA_RADIANCES.TIF";
-  String reflectances_filename = image_filename+"_TOA_REFLECTANCES.TIF";
+  if( radiances_filename.empty() )    radiances_filename    = image_filename+"_TOA_RADIANCES.TIF";
+  if( reflectances_filename.empty() ) reflectances_filename = image_filename+"_TOA_REFLECTANCES.TIF";
  
   // delete either output file if it already exists (radiances geotiff file)
   // ***********************************************************************
@@ -299,6 +800,8 @@ void ImageUtil::CalculateSpectralRadiancesAndReflectances(
     radiances_filename.c_str() );
   printf("  creating the following top-of-atmosphere reflectances geotiff:\n   %s\n", 
     reflectances_filename.c_str() );
+  printf("  DN-to-TOA conversion: %s (kernel: %s)\n",ConversionModeName( Mode ),
+    KernelISAName( GetKernelISA() ));
 
   // open up GDAL Geotiff dataset objects for writing geotiffs for
   //   (1) geotiff holding top-of-atmosphere radiances
@@ -307,10 +810,40 @@ void ImageUtil::CalculateSpectralRadiancesAndReflectances(
   DriverTiff_Radiances    = GetGDALDriverManager()->GetDriverByName("GTiff");
   DriverTiff_Reflectances = GetGDALDriverManager()->GetDriverByName("GTiff");
 
+  // GTiff creation options (tiling, compression, ...), see GetCreationOptions()
+  char **TiffOptions = this->GetCreationOptions();
+  printf("  Geotiff creation options:%s\n","");
+  for( int i=0; TiffOptions && TiffOptions[i]; i++ ) {
+    printf("    %s\n",TiffOptions[i] );
+  }
+
+  // for Cloud-Optimized output the pixels and overviews are first written
+  // into uncompressed working Geotiffs next to the final ones (see
+  // FinishCloudOptimized()), so only the final copy compresses
+  String radiances_work    = CloudOptimized ? radiances_filename+".tmp.tif" : radiances_filename;
+  String reflectances_work = CloudOptimized ? reflectances_filename+".tmp.tif" : reflectances_filename;
+  if( CloudOptimized ) {
+    CSLDestroy( TiffOptions );
+    TiffOptions = this->GetWorkingOptions();
+  }
+
   GDALDataset *ReflectancesDataset = DriverTiff_Reflectances->Create( 
-    reflectances_filename.c_str(),N_cols,N_rows,N_bands,GDT_Float32,NULL);
+    reflectances_work.c_str(),N_cols,N_rows,N_bands,GDT_Float32,TiffOptions);
   GDALDataset *RadiancesDataset    = DriverTiff_Radiances->Create( 
-    radiances_filename.c_str(),N_cols,N_rows,N_bands,GDT_Float32,NULL);
+    radiances_work.c_str(),N_cols,N_rows,N_bands,GDT_Float32,TiffOptions);
+  CSLDestroy( TiffOptions );
+
+  if( ReflectancesDataset == nullptr || RadiancesDataset == nullptr ) {
+    ErrorMsg = "  ERROR (fatal): unable to create output Geotiffs for: "+(String)filename;
+    throw std::runtime_error( ErrorMsg );
+  }
+
+  // create the (empty) overview levels up front, so that they can be
+  // filled from each window as it is converted.
+  if( CloudOptimized ) {
+    this->CreateOverviewLevels( RadiancesDataset );
+    this->CreateOverviewLevels( ReflectancesDataset );
+  }
 
   // set geotransforms and map projections
   // *************************************
@@ -326,118 +859,752 @@ void ImageUtil::CalculateSpectralRadiancesAndReflectances(
   std::cout << this->GetGeoTransform() << std::endl;
   std::cout << this->GetProjection() << std::endl;
 
-  // iterate through bands in image file
-  while( BandIndex<N_bands+1 ) {
-
-    // create GetRasterBand() object.
-    BandType = GDALGetRasterDataType(
-      ImageDataset->GetRasterBand(BandIndex));
-    unsigned short *rowBuffer = (unsigned short*) CPLMalloc(sizeof(unsigned short)*N_cols);
-
-    // create memory buffers for output radiances/reflectances
-    // *******************************************************
-    T *radiancesRowBuff    = (T*) CPLMalloc(sizeof(T)*N_cols);
-    T *reflectancesRowBuff = (T*) CPLMalloc(sizeof(T)*N_cols);
-
-    // for specific or current band, get calibration and bandwidth
-    String BandName = "";
-    double *CalibrationAndBandWidth = this->GetCalibrationAndBandwidthForBand( 
-      BandIndex,Metadata,CalibrationAndBandWidths,BandName );
-    float BandEffectiveCalibration = (float)CalibrationAndBandWidth[0];
-    float BandWidth = (float)CalibrationAndBandWidth[1];
-    double SolarIrradianceForBand;
-
-    // based on the name of the band ,get the solar irradiance for this band
-    // possible bands:
-    //   BAND_P, BAND_C, BAND_B, BAND_G, BAND_Y, 
-    //   BAND_R, BAND_N, BAND_N2, BAND_RE 
-    if( BandName == "BAND_P" ) {
-      SolarIrradianceForBand = Irradiances.BAND_P; 
-    } else if( BandName == "BAND_C" ) {
-      SolarIrradianceForBand = Irradiances.BAND_C; 
-    } else if( BandName == "BAND_B" ) {
-      SolarIrradianceForBand = Irradiances.BAND_B; 
-    } else if( BandName == "BAND_G" ) {
-      SolarIrradianceForBand = Irradiances.BAND_G; 
-    } else if( BandName == "BAND_Y" ) {
-      SolarIrradianceForBand = Irradiances.BAND_Y; 
-    } else if( BandName == "BAND_R" ) {
-      SolarIrradianceForBand = Irradiances.BAND_R; 
-    } else if( BandName == "BAND_N" ) {
-      SolarIrradianceForBand = Irradiances.BAND_N; 
-    } else if( BandName == "BAND_N2" ) {
-      SolarIrradianceForBand = Irradiances.BAND_N2; 
-    } else if( BandName == "BAND_RE" ) {
-      SolarIrradianceForBand = Irradiances.BAND_RE; 
-    } else {
-      String ErrorMessage = (String)"ERROR (fatal): unable to get solar irradiance for band: "+BandName+"\n";
-      throw std::runtime_error(ErrorMessage); 
+  // on any error close (and drop) the partial outputs before passing it on,
+  // so a failed scene of a batch leaves no open datasets behind
+  try {
+    if( Progress ) Progress->Start( (uint64_t)N_rows*N_cols*N_bands,N_bands,
+      CloudOptimized ? COG_PROGRESS_SHARE : 0.0 );
+    this->ConvertImage( Metadata,BandCoefficientTable,RadiancesDataset,ReflectancesDataset );
+  } catch( ... ) {
+    GDALClose( RadiancesDataset    );
+    GDALClose( ReflectancesDataset );
+    std::remove( radiances_work.c_str() );
+    std::remove( reflectances_work.c_str() );
+    throw;
+  }
+  StageTimer CloseTimer( Profile,STAGE_CLOSE );
+  if( CloudOptimized ) {
+    // if the radiances copy fails, the reflectances working file is
+    // closed and removed too before the error is passed on
+    if( Progress ) Progress->StartPhase( "writing COG" );
+    try {
+      this->FinishCloudOptimized( RadiancesDataset,radiances_work,radiances_filename,0 );
+    } catch( ... ) {
+      GDALClose( ReflectancesDataset );
+      std::remove( reflectances_work.c_str() );
+      throw;
+    }
+    this->FinishCloudOptimized( ReflectancesDataset,reflectances_work,reflectances_filename,1 );
+  } else {
+    GDALClose( RadiancesDataset    );
+    GDALClose( ReflectancesDataset );
+  }
+  CloseTimer.Stop();
+  if( Progress ) Progress->Finish();
+  printf("finished%s\n","");
+}
+
+void ImageUtil::ConvertImage( SolarMetadata* Metadata, 
+  const std::vector<BandCoefficients>& BandCoefficientTable, GDALDataset* RadiancesDataset, 
+  GDALDataset* ReflectancesDataset ){
+  /* *************************************************************************
+   * Convert every band of the image into the two outputs, by the read
+   * and processing modes chosen (see UseAllBandsRead(), ProcessingMode).
+   */
+  String ErrorMsg = "";
+  GDALDataType BandType; 
+  int BandIndex=1; // GDAL starts at 1, not 0.
+
+  // in all-bands mode every band is read and written together per window
+  if( this->UseAllBandsRead() ) {
+    printf("  reading all %d bands per window%s\n",N_bands,"");
+    switch( GDALGetRasterDataType( ImageDataset->GetRasterBand(1) )) {
+      case GDT_Byte:
+        this->ConvertAllBands<unsigned char>( Metadata,BandCoefficientTable,
+          RadiancesDataset,ReflectancesDataset );
+        break;
+      case GDT_UInt16:
+        this->ConvertAllBands<unsigned short>( Metadata,BandCoefficientTable,
+          RadiancesDataset,ReflectancesDataset );
+        break;
+      case GDT_Int16:
+        this->ConvertAllBands<short>( Metadata,BandCoefficientTable,
+          RadiancesDataset,ReflectancesDataset );
+        break;
+      case GDT_UInt32:
+        this->ConvertAllBands<unsigned int>( Metadata,BandCoefficientTable,
+          RadiancesDataset,ReflectancesDataset );
+        break;
+      case GDT_Float32:
+        this->ConvertAllBands<float>( Metadata,BandCoefficientTable,
+          RadiancesDataset,ReflectancesDataset );
+        break;
+      default:
+        ErrorMsg = "  ERROR (fatal): unsupported data type "+(String)GDALGetDataTypeName( 
+          GDALGetRasterDataType( ImageDataset->GetRasterBand(1) ))+" of image file: "+(String)filename;
+        throw std::runtime_error( ErrorMsg );
+    }
+  } else if( Processing == PROCESS_BANDS ) {
+    this->ConvertBandsParallel( Metadata,BandCoefficientTable,RadiancesDataset,ReflectancesDataset );
+  } else if( Processing == PROCESS_TILES ) {
+    this->ConvertTilesParallel( Metadata,BandCoefficientTable,RadiancesDataset,ReflectancesDataset );
+  } else {
+    // iterate through bands in image file. Each band is converted by the
+    // instantiation of ConvertBand() for its pixel type, picked once here.
+    while( BandIndex<N_bands+1 ) {
+      BandType = GDALGetRasterDataType(
+        ImageDataset->GetRasterBand(BandIndex));
+      const BandCoefficients& Coefficients = BandCoefficientTable[BandIndex-1];
+
+      switch( BandType ) {
+        case GDT_Byte:
+          this->ConvertBand<unsigned char>( BandIndex,Metadata,Coefficients,
+            RadiancesDataset,ReflectancesDataset );
+          break;
+        case GDT_UInt16:
+          this->ConvertBand<unsigned short>( BandIndex,Metadata,Coefficients,
+            RadiancesDataset,ReflectancesDataset );
+          break;
+        case GDT_Int16:
+          this->ConvertBand<short>( BandIndex,Metadata,Coefficients,
+            RadiancesDataset,ReflectancesDataset );
+          break;
+        case GDT_UInt32:
+          this->ConvertBand<unsigned int>( BandIndex,Metadata,Coefficients,
+            RadiancesDataset,ReflectancesDataset );
+          break;
+        case GDT_Float32:
+          this->ConvertBand<float>( BandIndex,Metadata,Coefficients,
+            RadiancesDataset,ReflectancesDataset );
+          break;
+        default:
+          ErrorMsg = "  ERROR (fatal): unsupported data type "+(String)GDALGetDataTypeName( BandType )+
+            " for band "+std::to_string(BandIndex)+" of image file: "+(String)filename;
+          throw std::runtime_error( ErrorMsg );
+      }
+      BandIndex++;
+    }
+  }
+}
+
+template<typename TIn>
+BandConverter<TIn> ImageUtil::GetBandConverter( int BandIndex, SolarMetadata* Metadata, 
+  const BandCoefficients& Coefficients ){
+  /* *************************************************************************
+   * Set up the conversion of one band (see KernelUtil.h) from its fused
+   * coefficients, its NoData value and the conversion mode. If the band
+   * has no NoData value, or it cannot be represented in the band's pixel
+   * type, no pixel is treated as NoData.
+   */
+  int NoDataIsSet = 0;
+  double BandNoData = ImageDataset->GetRasterBand(BandIndex)->GetNoDataValue( &NoDataIsSet );
+  BandConverter<TIn> Converter = MakeBandConverter<TIn>( Coefficients,NoDataIsSet != 0,
+    BandNoData,Mode,Metadata->bitsPerPixel );
+  if( SolarMode == SOLAR_GRID ) Converter.Grid = &SolarGrid;
+  return Converter;
+}
+
+template<typename TIn>
+void ImageUtil::ConvertBand( int BandIndex, SolarMetadata* Metadata, 
+  const BandCoefficients& Coefficients, GDALDataset* RadiancesDataset, 
+  GDALDataset* ReflectancesDataset ){
+  /* *************************************************************************
+   * Convert one band of the image, window by window, and write it into
+   * the radiances and reflectances datasets. TIn is the C++ type matching
+   * the band's GDALDataType, so the window buffer is read in the band's
+   * native type: unsigned char (Byte), unsigned short (UInt16), short
+   * (Int16), unsigned int (UInt32) or float (Float32).
+   */
+  BandConverter<TIn> Converter = this->GetBandConverter<TIn>( BandIndex,Metadata,Coefficients );
+  if( Processing == PROCESS_PIPELINE ) {
+    this->ConvertPipelined<TIn>( BandIndex,{ Converter },RadiancesDataset,ReflectancesDataset );
+    return;
+  }
+  this->ConvertBandWindows<TIn>( ImageDataset,BandIndex,Converter,
+    this->GetProcessingWindows( BandIndex,1 ),RadiancesDataset,ReflectancesDataset,nullptr );
+}
+
+template<typename TIn>
+void ImageUtil::ConvertBandWindows( GDALDataset* Input, int BandIndex, 
+  const BandConverter<TIn>& Converter, const std::vector<ImageWindow>& Windows, 
+  GDALDataset* RadiancesDataset, GDALDataset* ReflectancesDataset, OutputLocks* Locks ){
+  /* *************************************************************************
+   * Read, convert and write the given windows of one band in turn. Input
+   * is the dataset handle to read from: ImageDataset, or the calling
+   * thread's own handle in band-parallel mode, where Locks serialize
+   * the writes of all threads into each output.
+   */
+  // buffers for the largest window
+  size_t WindowPixels = 0;
+  for( const ImageWindow& Window: Windows ) {
+    WindowPixels = std::max( WindowPixels,(size_t)Window.width*Window.height );
+  }
+  TIn *dnBuffer = (TIn*) CPLMalloc(sizeof(TIn)*WindowPixels);
+
+  // create memory buffers for output radiances/reflectances
+  // *******************************************************
+  float *radiancesBuffer    = (float*) CPLMalloc(sizeof(float)*WindowPixels);
+  float *reflectancesBuffer = (float*) CPLMalloc(sizeof(float)*WindowPixels);
+
+  // iterate through the windows of the image
+  for( const ImageWindow& Window: Windows ) {
+    this->ConvertTile<TIn>( Input,BandIndex,Converter,Window,dnBuffer,radiancesBuffer,
+      reflectancesBuffer,RadiancesDataset,ReflectancesDataset,Locks );
+  }
+
+  // free up memory for window buffers
+  CPLFree( dnBuffer );
+  CPLFree( radiancesBuffer );
+  CPLFree( reflectancesBuffer );
+}
+
+template<typename TIn>
+double ImageUtil::ConvertTile( GDALDataset* Input, int BandIndex, const BandConverter<TIn>& Converter,
+  const ImageWindow& Window, TIn* dnBuffer, float* radiancesBuffer, float* reflectancesBuffer,
+  GDALDataset* RadiancesDataset, GDALDataset* ReflectancesDataset, OutputLocks* Locks ){
+  /* *************************************************************************
+   * Read one window of one band into dnBuffer, convert it and write it
+   * (and its overviews) into the two outputs. The buffers must hold the
+   * window's pixels. Locks, if given, are held during the writes of each
+   * output; returns the seconds spent waiting for them.
+   */
+  String ErrorMsg = "";
+  GDALRasterBand *Band = Input->GetRasterBand(BandIndex);
+  GDALDataType BandType = GDALGetRasterDataType( Band );
+  uint64_t Pixels = (uint64_t)Window.width*Window.height;
+  StageTimer ReadTimer( Profile,STAGE_READ,sizeof(TIn)*Pixels,Pixels );
+  CPLErr e = Band->RasterIO( GF_Read,Window.x,Window.y,Window.width,Window.height,
+    dnBuffer,Window.width,Window.height,BandType,0,0 );
+  ReadTimer.Stop();
+  
+  // make sure window was read correctly.
+  if(!(e == 0)){
+    ErrorMsg = "  ERROR (fatal): unable to read image file: "+(String)filename;
+    throw std::runtime_error( ErrorMsg );
+  }
+
+  // convert the window (contiguous in memory) to radiances and reflectances
+  StageTimer ComputeTimer( Profile,STAGE_COMPUTE,0,Pixels );
+  Converter.ConvertWindow( dnBuffer,Window.x,Window.y,Window.width,Window.height,
+    radiancesBuffer,reflectancesBuffer );
+  ComputeTimer.Stop();
+
+  // write the window (and its overviews) into each output, under that
+  // output's lock if given, timing the waits for the locks
+  double WaitSeconds = 0.0;
+  auto WriteOutput = [&]( GDALDataset* Dataset, float* Data, std::mutex* Lock ) {
+    std::unique_lock<std::mutex> Guard;
+    if( Lock ) {
+      auto WaitStart = std::chrono::steady_clock::now();
+      Guard = std::unique_lock<std::mutex>( *Lock );
+      WaitSeconds += std::chrono::duration<double>( std::chrono::steady_clock::now()-WaitStart ).count();
     }
+    CPLErr e = this->WriteOutputWindow( Dataset,Window,Data,1,&BandIndex );
+    if( CloudOptimized && e == CE_None ) e = this->WriteWindowOverviews( Dataset,BandIndex,Window,Data );
+    return e;
+  };
+  CPLErr RadianceWriteStatus    = WriteOutput( RadiancesDataset,radiancesBuffer,
+    Locks ? &Locks->Radiances : nullptr );
+  CPLErr ReflectanceWriteStatus = WriteOutput( ReflectancesDataset,reflectancesBuffer,
+    Locks ? &Locks->Reflectances : nullptr );
+
+  // check write status of radiances window
+  if(!(RadianceWriteStatus == 0) ) {
+    ErrorMsg = "  ERROR (fatal): unable to write window into image file: "+radiances_filename+". Exiting ...\n";
+    throw std::runtime_error( ErrorMsg );
+  } 
 
-    // iterate through rows in image
-    for( int row=0; row<N_rows; row++ ) {
-      CPLErr e = ImageDataset->GetRasterBand(BandIndex)->RasterIO(
-        GF_Read,0,row,N_cols,1,rowBuffer,N_cols,1,BandType,0,0);
-      
-      // make sure scanline was read correctly.
+  // check write status of reflectances window
+  if(!(ReflectanceWriteStatus == 0) ) {
+    ErrorMsg = "  ERROR (fatal): unable to write window into image file: "+reflectances_filename+". Exiting ...\n";
+    throw std::runtime_error( ErrorMsg );
+  }
+  if( Progress && !Progress->Advance( Pixels,BandIndex )) {
+    throw std::runtime_error( "  ERROR (fatal): conversion cancelled: "+(String)filename );
+  }
+  return WaitSeconds;
+}
+
+template<typename TIn>
+void ImageUtil::ConvertAllBands( SolarMetadata* Metadata, 
+  const std::vector<BandCoefficients>& BandCoefficientTable, GDALDataset* RadiancesDataset, 
+  GDALDataset* ReflectancesDataset ){
+  /* *************************************************************************
+   * Convert every band of the image in a single pass. For each window all
+   * bands are read with one GDALDataset::RasterIO call into a band-
+   * sequential buffer, each band is converted, and all bands are written
+   * with one call per output. Pixel-interleaved NITFs and JPEG2000 inputs
+   * are then decoded once instead of once per band. All bands must share
+   * the data type TIn.
+   */
+  String ErrorMsg = "";
+  GDALDataType BandType = GDALGetRasterDataType( ImageDataset->GetRasterBand(1) );
+
+  std::vector<BandConverter<TIn>> Converters;
+  for( int BandIndex=1; BandIndex<N_bands+1; BandIndex++ ) {
+    Converters.push_back( this->GetBandConverter<TIn>( BandIndex,Metadata,
+      BandCoefficientTable[BandIndex-1] ));
+  }
+  if( Processing == PROCESS_PIPELINE ) {
+    this->ConvertPipelined<TIn>( 1,Converters,RadiancesDataset,ReflectancesDataset );
+    return;
+  }
+
+  // windows are sized so that all bands together stay within the budget
+  std::vector<ImageWindow> Windows = this->GetProcessingWindows( 1,N_bands );
+  size_t WindowPixels = 0;
+  for( const ImageWindow& Window: Windows ) {
+    WindowPixels = std::max( WindowPixels,(size_t)Window.width*Window.height );
+  }
+  TIn *dnBuffer = (TIn*) CPLMalloc(sizeof(TIn)*WindowPixels*N_bands);
+  float *radiancesBuffer    = (float*) CPLMalloc(sizeof(float)*WindowPixels*N_bands);
+  float *reflectancesBuffer = (float*) CPLMalloc(sizeof(float)*WindowPixels*N_bands);
+
+  for( const ImageWindow& Window: Windows ) {
+    size_t Pixels = (size_t)Window.width*Window.height;
+
+    // one read for all bands; default spacings give a band-sequential buffer
+    StageTimer ReadTimer( Profile,STAGE_READ,sizeof(TIn)*Pixels*N_bands,Pixels*N_bands );
+    CPLErr e = ImageDataset->RasterIO( GF_Read,Window.x,Window.y,Window.width,Window.height,
+      dnBuffer,Window.width,Window.height,BandType,N_bands,nullptr,0,0,0 );
+    ReadTimer.Stop();
+    if(!(e == 0)){
+      ErrorMsg = "  ERROR (fatal): unable to read image file: "+(String)filename;
+      throw std::runtime_error( ErrorMsg );
+    }
+
+    StageTimer ComputeTimer( Profile,STAGE_COMPUTE,0,Pixels*N_bands );
+    for( int b=0; b<N_bands; b++ ) {
+      Converters[b].ConvertWindow( dnBuffer+b*Pixels,Window.x,Window.y,Window.width,
+        Window.height,radiancesBuffer+b*Pixels,reflectancesBuffer+b*Pixels );
+    }
+    ComputeTimer.Stop();
+
+    // one write per output for all bands
+    CPLErr RadianceWriteStatus = this->WriteOutputWindow( RadiancesDataset,Window,
+      radiancesBuffer,N_bands,nullptr );
+    CPLErr ReflectanceWriteStatus = this->WriteOutputWindow( ReflectancesDataset,Window,
+      reflectancesBuffer,N_bands,nullptr );
+
+    // downsample each band of the window into the overview levels
+    for( int b=0; CloudOptimized && b<N_bands; b++ ) {
+      if( RadianceWriteStatus == 0 ) {
+        RadianceWriteStatus = this->WriteWindowOverviews( RadiancesDataset,b+1,
+          Window,radiancesBuffer+b*Pixels );
+      }
+      if( ReflectanceWriteStatus == 0 ) {
+        ReflectanceWriteStatus = this->WriteWindowOverviews( ReflectancesDataset,b+1,
+          Window,reflectancesBuffer+b*Pixels );
+      }
+    }
+
+    if(!(RadianceWriteStatus == 0) ) {
+      ErrorMsg = "  ERROR (fatal): unable to write window into image file: "+radiances_filename+". Exiting ...\n";
+      throw std::runtime_error( ErrorMsg );
+    } 
+    if(!(ReflectanceWriteStatus == 0) ) {
+      ErrorMsg = "  ERROR (fatal): unable to write window into image file: "+reflectances_filename+". Exiting ...\n";
+      throw std::runtime_error( ErrorMsg );
+    } 
+    if( Progress && !Progress->Advance( (uint64_t)Pixels*N_bands,N_bands>1 ? 0 : 1 )) {
+      ErrorMsg = "  ERROR (fatal): conversion cancelled: "+(String)filename;
+      throw std::runtime_error( ErrorMsg );
+    }
+  }
+
+  CPLFree( dnBuffer );
+  CPLFree( radiancesBuffer );
+  CPLFree( reflectancesBuffer );
+}
+
+// a window of DNs and its converted outputs, handed from stage to stage
+// of ConvertPipelined(). PendingWrites counts the writers that still
+// need the window before the buffer can be reused.
+template<typename TIn>
+struct PipelineBuffer {
+  size_t Sequence;
+  ImageWindow Window;
+  std::vector<TIn> DN;
+  std::vector<float> Radiances;
+  std::vector<float> Reflectances;
+  std::atomic<int> PendingWrites;
+};
+
+template<typename TIn>
+void ImageUtil::ConvertPipelined( int FirstBand, const std::vector<BandConverter<TIn>>& Converters,
+  GDALDataset* RadiancesDataset, GDALDataset* ReflectancesDataset ){
+  /* *************************************************************************
+   * Convert the bands FirstBand .. FirstBand+Converters.size()-1 with
+   * reading, conversion and writing overlapped:
+   *
+   *   reader thread -> compute workers -> radiances writer thread
+   *                                    -> reflectances writer thread
+   *
+   * The stages are joined by BoundedQueues of pointers into a fixed set
+   * of window buffers, which go back to the reader through a free list
+   * once both writers are done with them, so memory stays bounded and
+   * nothing is allocated per window. Workers may finish windows out of
+   * order; each writer holds them back until the next window in order
+   * arrives, so the outputs are written exactly as the sequential path
+   * writes them. Only the reader touches the input dataset and each
+   * output dataset has a single writer, as GDAL handles are not thread
+   * safe. Queue depths and stalls are printed at the end.
+   */
+  typedef PipelineBuffer<TIn> Buffer;
+  int BandCount = (int)Converters.size();
+  GDALDataType BandType = GDALGetRasterDataType( ImageDataset->GetRasterBand(FirstBand) );
+  std::vector<int> BandMap;
+  for( int b=0; b<BandCount; b++ ) BandMap.push_back( FirstBand+b );
+
+  int Workers = ( ComputeThreads>0 ) ? ComputeThreads : std::min( 4,HardwareThreads() );
+  int Buffers = ( QueueDepth>0 ) ? QueueDepth : Workers+3;
+
+  // windows are sized so that all buffers in flight stay within the budget
+  std::vector<ImageWindow> Windows = this->GetProcessingWindows( FirstBand,BandCount*Buffers );
+  size_t WindowPixels = 0;
+  for( const ImageWindow& Window: Windows ) {
+    WindowPixels = std::max( WindowPixels,(size_t)Window.width*Window.height );
+  }
+
+  std::vector<std::unique_ptr<Buffer>> Pool;
+  BoundedQueue<Buffer*> FreeBuffers( Buffers );
+  BoundedQueue<Buffer*> ReadQueue( Buffers );
+  BoundedQueue<Buffer*> RadianceQueue( Buffers );
+  BoundedQueue<Buffer*> ReflectanceQueue( Buffers );
+  for( int i=0; i<Buffers; i++ ) {
+    Pool.emplace_back( new Buffer );
+    Pool.back()->DN.resize( WindowPixels*BandCount );
+    Pool.back()->Radiances.resize( WindowPixels*BandCount );
+    Pool.back()->Reflectances.resize( WindowPixels*BandCount );
+    FreeBuffers.Push( Pool.back().get() );
+  }
+
+  // the first error stops every stage; it is reported once all have joined
+  std::atomic<bool> Failed( false );
+  std::mutex ErrorLock;
+  String ErrorMsg = "";
+  auto Fail = [&]( const String& Message ) {
+    {
+      std::lock_guard<std::mutex> Guard( ErrorLock );
+      if( ErrorMsg.empty() ) ErrorMsg = Message;
+    }
+    Failed = true;
+    FreeBuffers.Close();
+    ReadQueue.Close();
+    RadianceQueue.Close();
+    ReflectanceQueue.Close();
+  };
+
+  std::thread Reader( [&]() {
+    for( size_t i=0; i<Windows.size() && !Failed; i++ ) {
+      Buffer *Next = nullptr;
+      if( !FreeBuffers.Pop( Next )) break;
+      const ImageWindow& Window = Windows[i];
+      Next->Sequence      = i;
+      Next->Window        = Window;
+      Next->PendingWrites = 2;
+      uint64_t Pixels = (uint64_t)Window.width*Window.height*BandCount;
+      StageTimer ReadTimer( Profile,STAGE_READ,sizeof(TIn)*Pixels,Pixels );
+      CPLErr e = ImageDataset->RasterIO( GF_Read,Window.x,Window.y,Window.width,Window.height,
+        Next->DN.data(),Window.width,Window.height,BandType,BandCount,BandMap.data(),0,0,0 );
+      ReadTimer.Stop();
       if(!(e == 0)){
-        ErrorMsg = "  ERROR (fatal): unable to read image file: "+(String)filename;
-        print_error_msg_and_exit( ErrorMsg.c_str() );
+        Fail( "  ERROR (fatal): unable to read image file: "+(String)filename );
+        break;
       }
+      if( !ReadQueue.Push( Next )) break;
+    }
+    ReadQueue.Close();
+  });
 
-      // iterate through columns
-      for( int col=0; col<N_cols; col++ ) {
+  std::atomic<int> RunningWorkers( Workers );
+  std::vector<std::thread> Computers;
+  for( int w=0; w<Workers; w++ ) {
+    Computers.emplace_back( [&]() {
+      Buffer *Next = nullptr;
+      while( ReadQueue.Pop( Next )) {
+        size_t Pixels = (size_t)Next->Window.width*Next->Window.height;
+        StageTimer ComputeTimer( Profile,STAGE_COMPUTE,0,(uint64_t)Pixels*BandCount );
+        for( int b=0; b<BandCount; b++ ) {
+          const ImageWindow& Window = Next->Window;
+          Converters[b].ConvertWindow( Next->DN.data()+b*Pixels,Window.x,Window.y,Window.width,
+            Window.height,Next->Radiances.data()+b*Pixels,Next->Reflectances.data()+b*Pixels );
+        }
+        RadianceQueue.Push( Next );
+        ReflectanceQueue.Push( Next );
+      }
+      // the last worker out tells the writers no more windows are coming
+      if( --RunningWorkers == 0 ) {
+        RadianceQueue.Close();
+        ReflectanceQueue.Close();
+      }
+    });
+  }
 
-	// set the spectral top-of-atmosphere radiance pixel value using DN
-	radiance_TOA = (float)((float)rowBuffer[col]*BandEffectiveCalibration )/BandWidth;
- 
-	// calculate the solar reflectance
-	if( SolarIrradianceForBand<1.0 ) {
-	  reflectance_TOA = (float)-9999.0;
-	} else {
-	  reflectance_TOA = (float)(( radiance_TOA * (
-	    earthSunDistance*earthSunDistance) * M_PI ) / ( SolarIrradianceForBand * cos(solarZenithAngle)));
-	}
-      
-        // if in the original image, the digital number (DN) value was NoData, then set
-	// the radiance and reflectance to -9999.0
-	if( rowBuffer[col] == NoDataValue ) {
-          radiance_TOA = float(-9999.0);
-	  reflectance_TOA = float(-9999.0);
-	}
-
-	// fill in the memory buffers with pixel values
-	radiancesRowBuff[col]    = radiance_TOA;
-	reflectancesRowBuff[col] = (float)reflectance_TOA;
+  auto Writer = [&]( GDALDataset* Dataset, BoundedQueue<Buffer*>& Queue,
+    std::vector<float> Buffer::* Output, const String& OutputFilename ) {
+    std::map<size_t,Buffer*> Pending;
+    size_t NextSequence = 0;
+    Buffer *Next = nullptr;
+    while( Queue.Pop( Next )) {
+      Pending[Next->Sequence] = Next;
+      while( !Pending.empty() && Pending.begin()->first == NextSequence ) {
+        Buffer *Ready = Pending.begin()->second;
+        Pending.erase( Pending.begin() );
+        NextSequence++;
+        if( Failed ) continue;
+
+        const ImageWindow& Window = Ready->Window;
+        size_t Pixels = (size_t)Window.width*Window.height;
+        float *Data   = ( Ready->*Output ).data();
+        CPLErr e = this->WriteOutputWindow( Dataset,Window,Data,BandCount,BandMap.data() );
+        for( int b=0; CloudOptimized && e == CE_None && b<BandCount; b++ ) {
+          e = this->WriteWindowOverviews( Dataset,FirstBand+b,Window,Data+b*Pixels );
+        }
+        if(!(e == 0)) {
+          Fail( "  ERROR (fatal): unable to write window into image file: "+OutputFilename+". Exiting ...\n" );
+          continue;
+        }
+        if( --Ready->PendingWrites == 0 ) {
+          // both outputs hold the window now
+          if( Progress && !Progress->Advance( (uint64_t)Pixels*BandCount,BandCount>1 ? 0 : FirstBand )) {
+            Fail( "  ERROR (fatal): conversion cancelled: "+(String)filename );
+            continue;
+          }
+          FreeBuffers.Push( Ready );
+        }
       }
+    }
+  };
+  std::thread RadianceWriter( Writer,RadiancesDataset,std::ref( RadianceQueue ),
+    &Buffer::Radiances,std::cref( radiances_filename ));
+  std::thread ReflectanceWriter( Writer,ReflectancesDataset,std::ref( ReflectanceQueue ),
+    &Buffer::Reflectances,std::cref( reflectances_filename ));
+
+  Reader.join();
+  for( std::thread& Computer: Computers ) Computer.join();
+  RadianceWriter.join();
+  ReflectanceWriter.join();
+
+  if( BandCount == 1 ) {
+    printf("  pipeline, band %d: %zu windows, %d compute threads, %d buffers\n",FirstBand,
+      Windows.size(),Workers,Buffers );
+  } else {
+    printf("  pipeline, bands %d-%d: %zu windows, %d compute threads, %d buffers\n",FirstBand,
+      FirstBand+BandCount-1,Windows.size(),Workers,Buffers );
+  }
+  PrintQueueStats( "free buffers",FreeBuffers.Stats() );
+  PrintQueueStats( "read -> compute",ReadQueue.Stats() );
+  PrintQueueStats( "compute -> radiances",RadianceQueue.Stats() );
+  PrintQueueStats( "compute -> reflect.",ReflectanceQueue.Stats() );
 
-      // write the scanline or row of values to the output geotiff datasets
-      CPLErr RadianceWriteStatus = RadiancesDataset->GetRasterBand(BandIndex)->RasterIO(
-        GF_Write,0,row,N_cols,1,radiancesRowBuff,N_cols,1,GDT_Float32,0,0);
-      CPLErr ReflectanceWriteStatus = ReflectancesDataset->GetRasterBand(BandIndex)->RasterIO(
-        GF_Write,0,row,N_cols,1,reflectancesRowBuff,N_cols,1,GDT_Float32,0,0);
-
-      // check write status of radiances scanline
-      if(!(RadianceWriteStatus == 0) ) {
-        ErrorMsg = "  ERROR (fatal): unable to write scanline into image file: "+radiances_filename+". Exiting ...\n";
-        print_error_msg_and_exit( ErrorMsg.c_str() );
-      } 
-
-      // check write status of reflectances scanline
-      if(!(ReflectanceWriteStatus == 0) ) {
-        ErrorMsg = "  ERROR (fatal): unable to write scanline into image file: "+reflectances_filename+". Exiting ...\n";
-        print_error_msg_and_exit( ErrorMsg.c_str() );
-      } 
+  if( Failed ) {
+    throw std::runtime_error( ErrorMsg );
+  }
+}
+
+void ImageUtil::ConvertBandsParallel( SolarMetadata* Metadata, 
+  const std::vector<BandCoefficients>& BandCoefficientTable, GDALDataset* RadiancesDataset, 
+  GDALDataset* ReflectancesDataset ){
+  /* *************************************************************************
+   * Convert several bands at once. GDAL dataset handles are not thread
+   * safe, so each thread opens its own read handle to the input and
+   * takes the next unconverted band until none are left; the writes
+   * into each output go through that output's lock. Everything read from the
+   * shared ImageDataset (types, NoData values, windows) is gathered
+   * here, before the threads start. The default thread count is
+   * min(bands,cores), and windows are sized so that all threads
+   * together stay within the pixel budget.
+   */
+  String ErrorMsg = "";
+  int Threads = ( ComputeThreads>0 ) ? ComputeThreads : HardwareThreads();
+  Threads = std::max( 1,std::min( Threads,N_bands ));
+
+  std::vector<GDALDataType> BandTypes( N_bands+1 );
+  std::vector<int> NoDataIsSet( N_bands+1,0 );
+  std::vector<double> NoDataValues( N_bands+1,0.0 );
+  std::vector<std::vector<ImageWindow>> BandWindows( N_bands+1 );
+  for( int BandIndex=1; BandIndex<N_bands+1; BandIndex++ ) {
+    GDALRasterBand *Band = ImageDataset->GetRasterBand(BandIndex);
+    BandTypes[BandIndex]    = GDALGetRasterDataType( Band );
+    NoDataValues[BandIndex] = Band->GetNoDataValue( &NoDataIsSet[BandIndex] );
+    BandWindows[BandIndex]  = this->GetProcessingWindows( BandIndex,Threads );
+  }
+  printf("  converting %d bands on %d threads%s\n",N_bands,Threads,"");
+
+  // the first error stops the other threads and is rethrown once all have joined
+  OutputLocks Locks;
+  std::mutex ErrorLock;
+  std::atomic<int> NextBand( 1 );
+  std::atomic<bool> Failed( false );
+  std::exception_ptr FirstError;
+  auto Worker = [&]() {
+    GDALDataset *Input = (GDALDataset*) GDALOpen( filename,GA_ReadOnly );
+    try {
+      if( Input == nullptr ) {
+        String OpenError = "  ERROR (fatal): unable to open image file: "+(String)filename;
+        throw std::runtime_error( OpenError );
+      }
+      for( int BandIndex=NextBand++; BandIndex<N_bands+1 && !Failed; BandIndex=NextBand++ ) {
+        const BandCoefficients& Coefficients = BandCoefficientTable[BandIndex-1];
+        bool HasNoData = NoDataIsSet[BandIndex] != 0;
+        double NoData  = NoDataValues[BandIndex];
+        int Bits = Metadata->bitsPerPixel;
+        switch( BandTypes[BandIndex] ) {
+          case GDT_Byte:
+            this->ConvertBandWindows<unsigned char>( Input,BandIndex,
+              MakeBandConverter<unsigned char>( Coefficients,HasNoData,NoData,Mode,Bits ),
+              BandWindows[BandIndex],RadiancesDataset,ReflectancesDataset,&Locks );
+            break;
+          case GDT_UInt16:
+            this->ConvertBandWindows<unsigned short>( Input,BandIndex,
+              MakeBandConverter<unsigned short>( Coefficients,HasNoData,NoData,Mode,Bits ),
+              BandWindows[BandIndex],RadiancesDataset,ReflectancesDataset,&Locks );
+            break;
+          case GDT_Int16:
+            this->ConvertBandWindows<short>( Input,BandIndex,
+              MakeBandConverter<short>( Coefficients,HasNoData,NoData,Mode,Bits ),
+              BandWindows[BandIndex],RadiancesDataset,ReflectancesDataset,&Locks );
+            break;
+          case GDT_UInt32:
+            this->ConvertBandWindows<unsigned int>( Input,BandIndex,
+              MakeBandConverter<unsigned int>( Coefficients,HasNoData,NoData,Mode,Bits ),
+              BandWindows[BandIndex],RadiancesDataset,ReflectancesDataset,&Locks );
+            break;
+          case GDT_Float32:
+            this->ConvertBandWindows<float>( Input,BandIndex,
+              MakeBandConverter<float>( Coefficients,HasNoData,NoData,Mode,Bits ),
+              BandWindows[BandIndex],RadiancesDataset,ReflectancesDataset,&Locks );
+            break;
+          default:
+            String TypeError = "  ERROR (fatal): unsupported data type "+(String)GDALGetDataTypeName( 
+              BandTypes[BandIndex] )+" for band "+std::to_string(BandIndex)+" of image file: "+(String)filename;
+            throw std::runtime_error( TypeError );
+        }
+      }
+    } catch( ... ) {
+      std::lock_guard<std::mutex> Guard( ErrorLock );
+      if( !Failed ) FirstError = std::current_exception();
+      Failed = true;
     }
+    if( Input != nullptr ) GDALClose( Input );
+  };
+
+  std::vector<std::thread> Workers;
+  for( int t=0; t<Threads; t++ ) Workers.emplace_back( Worker );
+  for( std::thread& Thread: Workers ) Thread.join();
+  if( Failed ) std::rethrow_exception( FirstError );
+}
 
-    // free up memory for scanline, array that holds calibration/bandwidth
-    CPLFree( rowBuffer );
-    CPLFree( radiancesRowBuff );
-    CPLFree( reflectancesRowBuff );
-    delete [] CalibrationAndBandWidth; 
-    BandIndex++;
+void ImageUtil::ConvertTilesParallel( SolarMetadata* Metadata, 
+  const std::vector<BandCoefficients>& BandCoefficientTable, GDALDataset* RadiancesDataset, 
+  GDALDataset* ReflectancesDataset ){
+  /* *************************************************************************
+   * Split every band into block-aligned windows (GetProcessingWindows)
+   * and run the (band,window) tiles on a WorkStealingPool, so a scene
+   * with one large band (e.g. PAN) keeps every core busy. Each worker
+   * reads through its own input handle into its own buffers, sized
+   * once for the largest tile. The writes into each output go through
+   * that output's lock and mostly hand finished blocks to GDAL, which
+   * compresses them on its own threads (NUM_THREADS, a default creation
+   * option). Per-worker utilization, net of the waits for the output
+   * locks, is printed at the end.
+   */
+  String ErrorMsg = "";
+  int Workers = ( ComputeThreads>0 ) ? ComputeThreads : HardwareThreads();
+  OutputLocks Locks;
+
+  // per-worker input handle and tile buffers (DNs of any input type)
+  struct TileBuffers {
+    GDALDataset *Input = nullptr;
+    std::vector<unsigned char> DN;
+    std::vector<float> Radiances;
+    std::vector<float> Reflectances;
+  };
+  typedef std::function<double( const ImageWindow&,TileBuffers& )> TileFunction;
+
+  // one conversion function per band, for its pixel type and converter;
+  // each returns the seconds its tile waited for the output locks
+  auto MakeTileFunction = [&]( auto Converter, int BandIndex ) -> TileFunction {
+    typedef decltype( Converter.NoDataValue ) TIn;
+    return [this,Converter,BandIndex,RadiancesDataset,ReflectancesDataset,&Locks](
+      const ImageWindow& Window, TileBuffers& Buffers ) {
+      return this->ConvertTile<TIn>( Buffers.Input,BandIndex,Converter,Window,
+        (TIn*)Buffers.DN.data(),Buffers.Radiances.data(),Buffers.Reflectances.data(),
+        RadiancesDataset,ReflectancesDataset,&Locks );
+    };
+  };
+
+  std::vector<TileFunction> BandFunctions( N_bands+1 );
+  std::vector<std::pair<int,ImageWindow>> Tiles;
+  size_t TilePixels = 0;
+  for( int BandIndex=1; BandIndex<N_bands+1; BandIndex++ ) {
+    GDALRasterBand *Band = ImageDataset->GetRasterBand(BandIndex);
+    const BandCoefficients& Coefficients = BandCoefficientTable[BandIndex-1];
+    int NoDataIsSet = 0;
+    double NoData = Band->GetNoDataValue( &NoDataIsSet );
+    int Bits = Metadata->bitsPerPixel;
+    switch( GDALGetRasterDataType( Band )) {
+      case GDT_Byte:
+        BandFunctions[BandIndex] = MakeTileFunction( MakeBandConverter<unsigned char>( 
+          Coefficients,NoDataIsSet != 0,NoData,Mode,Bits ),BandIndex );
+        break;
+      case GDT_UInt16:
+        BandFunctions[BandIndex] = MakeTileFunction( MakeBandConverter<unsigned short>( 
+          Coefficients,NoDataIsSet != 0,NoData,Mode,Bits ),BandIndex );
+        break;
+      case GDT_Int16:
+        BandFunctions[BandIndex] = MakeTileFunction( MakeBandConverter<short>( 
+          Coefficients,NoDataIsSet != 0,NoData,Mode,Bits ),BandIndex );
+        break;
+      case GDT_UInt32:
+        BandFunctions[BandIndex] = MakeTileFunction( MakeBandConverter<unsigned int>( 
+          Coefficients,NoDataIsSet != 0,NoData,Mode,Bits ),BandIndex );
+        break;
+      case GDT_Float32:
+        BandFunctions[BandIndex] = MakeTileFunction( MakeBandConverter<float>( 
+          Coefficients,NoDataIsSet != 0,NoData,Mode,Bits ),BandIndex );
+        break;
+      default:
+        ErrorMsg = "  ERROR (fatal): unsupported data type "+(String)GDALGetDataTypeName( 
+          GDALGetRasterDataType( Band ))+" for band "+std::to_string(BandIndex)+" of image file: "+(String)filename;
+        throw std::runtime_error( ErrorMsg );
+    }
+
+    // windows are sized so that the tiles of all workers stay within the budget
+    for( const ImageWindow& Window: this->GetProcessingWindows( BandIndex,Workers )) {
+      Tiles.push_back( std::make_pair( BandIndex,Window ));
+      TilePixels = std::max( TilePixels,(size_t)Window.width*Window.height );
+    }
   }
-  GDALClose( RadiancesDataset    );
-  GDALClose( ReflectancesDataset );
-  printf("finished%s\n","");
+
+  std::vector<TileBuffers> Buffers( Workers );
+  for( TileBuffers& WorkerBuffers: Buffers ) {
+    WorkerBuffers.Input = (GDALDataset*) GDALOpen( filename,GA_ReadOnly );
+    if( WorkerBuffers.Input == nullptr ) {
+      for( TileBuffers& Opened: Buffers ) {
+        if( Opened.Input != nullptr ) GDALClose( Opened.Input );
+      }
+      ErrorMsg = "  ERROR (fatal): unable to open image file: "+(String)filename;
+      throw std::runtime_error( ErrorMsg );
+    }
+    WorkerBuffers.DN.resize( TilePixels*sizeof(float) );   // widest input type
+    WorkerBuffers.Radiances.resize( TilePixels );
+    WorkerBuffers.Reflectances.resize( TilePixels );
+  }
+  printf("  converting %zu tiles of %d bands on %d workers%s\n",Tiles.size(),N_bands,Workers,"");
+
+  // after the first error the remaining tiles are skipped, and the error
+  // is rethrown once the pool has finished
+  std::atomic<bool> Failed( false );
+  std::exception_ptr FirstError;
+  std::mutex ErrorLock;
+  WorkStealingPool Pool( Workers );
+  Pool.Run( Tiles.size(),[&]( int Worker, size_t Task ) {
+    if( Failed ) return;
+    try {
+      Pool.AddWaitSeconds( Worker,BandFunctions[Tiles[Task].first]( Tiles[Task].second,
+        Buffers[Worker] ));
+    } catch( ... ) {
+      std::lock_guard<std::mutex> Guard( ErrorLock );
+      if( !Failed ) FirstError = std::current_exception();
+      Failed = true;
+    }
+  });
+  PrintWorkerStats( Pool );
+
+  for( TileBuffers& WorkerBuffers: Buffers ) {
+    GDALClose( WorkerBuffers.Input );
+  }
+  if( Failed ) std::rethrow_exception( FirstError );
 }
@@ -2,15 +2,77 @@
 #define IMAGEUTIL_H_
 #include "gdal_priv.h"
 #include "cpl_conv.h"
+#include "cpl_string.h"
 #include <iostream>
 #include <fstream>
 #include <math.h>
+#include <type_traits>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
 #include "TOAUtil.h"
+#include "SceneUtil.h"
 #include "Misc.h"
-#define NODATA -9999
+#include "KernelUtil.h"
+#include "PipelineUtil.h"
+#include "ProfileUtil.h"
+#include "ProgressUtil.h"
 typedef std::string String;
 using namespace std;
 
+// default window sizing when no block multiple is given (see ImageUtil.cpp)
+#define WINDOW_MIN_ROWS      256
+#define WINDOW_PIXEL_BUDGET  (8*1024*1024)
+
+// share of a Cloud-Optimized scene's progress given to the compressing
+// copies after the last window (see FinishCloudOptimized())
+#define COG_PROGRESS_SHARE 0.25
+
+// a rectangle of the image, aligned to the dataset's block layout, that
+// is read, converted and written in one pass.
+struct ImageWindow {
+  int x;
+  int y;
+  int width;
+  int height;
+};
+
+// one lock per output, serializing the writes of several threads into
+// it. The two outputs are separate datasets and are written in parallel.
+struct OutputLocks {
+  std::mutex Radiances;
+  std::mutex Reflectances;
+};
+
+// register GDAL's drivers once per process (thread safe)
+void InitializeGDAL();
+
+// how bands are read from the input image
+enum BandReadMode {
+  READ_AUTO      = 0,   // all bands per window if pixel-interleaved or JPEG2000
+  READ_PER_BAND  = 1,   // one pass over the image per band
+  READ_ALL_BANDS = 2    // one multi-band read per window
+};
+
+// how the conversion of an image is spread over threads
+enum ProcessingMode {
+  PROCESS_SEQUENTIAL = 0,   // read, convert and write each window in turn
+  PROCESS_PIPELINE   = 1,   // reader, compute and writer threads (default)
+  PROCESS_BANDS      = 2,   // bands in parallel, one input handle per thread
+  PROCESS_TILES      = 3    // tiles of all bands on a work-stealing pool
+};
+
+// solar zenith angle used for the reflectances
+enum SolarGeometryMode {
+  SOLAR_SCENE_MEAN = 0,   // meanSunEl of the IMD for every pixel (default)
+  SOLAR_GRID       = 1    // per pixel, interpolated from a SolarZenithGrid
+};
+
 class ImageUtil {
   private:
     const char* filename      = nullptr;
@@ -18,24 +80,60 @@ class ImageUtil {
     double geotransform[6];
     int dimensions[3];
     int N_rows,N_cols,N_bands;
+    ConversionMode Mode = CONVERT_ARITHMETIC;
+    String radiances_filename;
+    String reflectances_filename;
+    int BlockMultiple = 0;   // 0 = choose automatically
+    BandReadMode ReadMode = READ_AUTO;
+    std::map<String,String> CreationOptions;
+    bool CloudOptimized = false;
+    ProcessingMode Processing = PROCESS_PIPELINE;
+    int ComputeThreads = 0;  // 0 = choose automatically
+    int QueueDepth = 0;      // buffers in flight, 0 = choose automatically
+    size_t PixelBudget = WINDOW_PIXEL_BUDGET;
+    GDALDataset *MosaicRadiances    = nullptr;   // shared outputs of a mosaic
+    GDALDataset *MosaicReflectances = nullptr;
+    int OutputXOffset = 0;
+    int OutputYOffset = 0;
+    std::mutex *MosaicLock = nullptr;
+    SolarGeometryMode SolarMode = SOLAR_SCENE_MEAN;
+    SolarZenithGrid SolarGrid;   // built per scene in SOLAR_GRID mode
+    SceneProfile *Profile = nullptr;
+    SceneProgress *Progress = nullptr;
 
-    // solar irradiances structure
-    struct SolarIrradiances {
-      double BAND_P;
-      double BAND_C;
-      double BAND_B;
-      double BAND_G;
-      double BAND_Y;
-      double BAND_R;
-      double BAND_N;
-      double BAND_N2;
-      double BAND_RE;
-    };
+    // convert one band, or all bands at once, instantiated per input pixel type
+    template<typename TIn>
+    BandConverter<TIn> GetBandConverter( int,SolarMetadata*,const BandCoefficients& );
+    template<typename TIn>
+    void ConvertBand( int,SolarMetadata*,const BandCoefficients&,GDALDataset*,GDALDataset* );
+    template<typename TIn>
+    void ConvertBandWindows( GDALDataset*,int,const BandConverter<TIn>&,const std::vector<ImageWindow>&,
+      GDALDataset*,GDALDataset*,OutputLocks* );
+    template<typename TIn>
+    double ConvertTile( GDALDataset*,int,const BandConverter<TIn>&,const ImageWindow&,TIn*,float*,float*,
+      GDALDataset*,GDALDataset*,OutputLocks* );
+    void ConvertBandsParallel( SolarMetadata*,const std::vector<BandCoefficients>&,GDALDataset*,GDALDataset* );
+    void ConvertTilesParallel( SolarMetadata*,const std::vector<BandCoefficients>&,GDALDataset*,GDALDataset* );
+    template<typename TIn>
+    void ConvertAllBands( SolarMetadata*,const std::vector<BandCoefficients>&,GDALDataset*,GDALDataset* );
+    template<typename TIn>
+    void ConvertPipelined( int,const std::vector<BandConverter<TIn>>&,GDALDataset*,GDALDataset* );
+    void ConvertImage( SolarMetadata*,const std::vector<BandCoefficients>&,GDALDataset*,GDALDataset* );
+    bool UseAllBandsRead();
+    CPLErr WriteOutputWindow( GDALDataset*,const ImageWindow&,float*,int,int* );
+
+    // overviews and final layout of Cloud-Optimized Geotiff outputs
+    int GetOverviewLevelCount();
+    char **GetWorkingOptions();
+    void CreateOverviewLevels( GDALDataset* );
+    CPLErr WriteWindowOverviews( GDALDataset*,int,const ImageWindow&,const float* );
+    void FinishCloudOptimized( GDALDataset*,const String&,const String&,int );
 
   public:
     // constructors and destructors
     ImageUtil();
     ImageUtil( const char* );
+    ImageUtil( SceneMetadata& );
     ~ImageUtil();
 
     // methods to obtain file metadata and 
@@ -45,11 +143,51 @@ class ImageUtil {
     long GetNoDataValue();
     int *GetDimensions();
 
+    // choose between the arithmetic kernel and per-band lookup tables
+    void SetConversionMode( ConversionMode );
+
+    // size the processing windows as a multiple of the dataset's blocks
+    void SetBlockMultiple( int );
+    void SetPixelBudget( size_t );
+    std::vector<ImageWindow> GetProcessingWindows( int,int );
+
+    // read bands one at a time or all together per window
+    void SetBandReadMode( BandReadMode );
+
+    // GTiff creation options for the output Geotiffs
+    void SetCreationOption( const String&, const String& );
+    char **GetCreationOptions();
+
+    // output Geotiffs (default: next to the input image)
+    void SetOutputFilenames( const String&, const String& );
+    String GetRadiancesFilename() { return radiances_filename; }
+    String GetReflectancesFilename() { return reflectances_filename; }
+
+    // write into outputs shared with other tiles of a mosaic
+    void SetMosaicOutputs( GDALDataset*,GDALDataset*,int,int,std::mutex* );
+
+    // per-pixel solar zenith angles from the IMD's geometry, or the scene mean
+    void SetSolarGeometryMode( SolarGeometryMode );
+
+    // time the stages of the conversion into a profile (nullptr = none)
+    void SetProfile( SceneProfile* );
+
+    // report progress as windows are converted (nullptr = none)
+    void SetProgress( SceneProgress* );
+
+    // write Cloud-Optimized Geotiffs with overviews
+    void SetCloudOptimized( bool );
+
+    // spread the conversion over threads (see ProcessingMode)
+    void SetProcessingMode( ProcessingMode );
+    void SetComputeThreads( int );
+    void SetQueueDepth( int );
+
     // function to set TOA radiances and reflectances
-    void SetSolarIrradiances( SolarIrradiances&, String );
-    double *GetCalibrationAndBandwidthForBand( int,SolarMetadata*,std::map<String,String>,String& );
-    void WriteRadianceAndReflectanceGeotiffs( SolarMetadata*, std::map<String,String> );
+    std::vector<BandCoefficients> BuildBandCoefficients( SolarMetadata*,const SceneCalibration& );
+    bool ValidateBandCoefficients( SolarMetadata*,const SceneCalibration&,int );
+    void WriteRadianceAndReflectanceGeotiffs( SolarMetadata*,const SceneCalibration& );
     template<typename T>
-    void CalculateSpectralRadiancesAndReflectances( SolarMetadata*,std::map<String,String> );
+    void CalculateSpectralRadiancesAndReflectances( SolarMetadata*,const SceneCalibration& );
 };
 #endif
@@ -0,0 +1,547 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdint>
+#include <cstdlib>
+#include <limits>
+#include <algorithm>
+#include <type_traits>
+#include <math.h>
+#include "KernelUtil.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TOA_KERNEL_X86 1
+#endif
+using namespace std;
+
+/* ***********************************************************************
+ * function IsNoData(...):
+ * true if a DN equals the band's NoData value. A NaN NoData value on a
+ * floating-point band matches NaN pixels.
+ */
+template<typename TIn>
+static inline bool IsNoData( TIn DN, TIn NoDataValue ) {
+  if constexpr ( std::is_floating_point<TIn>::value ) {
+    if( std::isnan(NoDataValue) ) return std::isnan(DN);
+  }
+  return DN == NoDataValue;
+}
+
+/* ***********************************************************************
+ * function ConvertRowScalar(...):
+ * Portable implementation of the DN-to-TOA conversion for any input
+ * type. The vector implementations below use it for the tail of a row
+ * that does not fill a whole vector register. It is also the fallback
+ * on CPUs without SSE4.1 (or on non-x86 hosts), and it is the only path
+ * for 32-bit integer and floating-point input.
+ *
+ * With Ramp set the reflectance gain of pixel i is ReflectanceGain +
+ * i*ReflectanceStep, for the per-pixel solar zenith angles of a
+ * SolarZenithGrid (see ConvertRowToTOAGrid()). All kernels take the
+ * same two parameters; without Ramp the step is ignored.
+ */
+template<bool Ramp=false, typename TIn>
+static void ConvertRowScalar( const TIn* DN, size_t N,
+  float RadianceGain, float ReflectanceGain, bool ReflectanceValid,
+  bool HasNoData, TIn NoDataValue, float* Radiances, float* Reflectances,
+  float ReflectanceStep=0.0f )
+{
+  for( size_t i=0; i<N; i++ ) {
+    float dn              = (float)DN[i];
+    float gain            = Ramp ? ReflectanceGain+ReflectanceStep*(float)i : ReflectanceGain;
+    float radiance_TOA    = dn*RadianceGain;
+    float reflectance_TOA = ReflectanceValid ? dn*gain : (float)NODATA;
+    if( HasNoData && IsNoData( DN[i],NoDataValue ) ) {
+      radiance_TOA    = (float)NODATA;
+      reflectance_TOA = (float)NODATA;
+    }
+    Radiances[i]    = radiance_TOA;
+    Reflectances[i] = reflectance_TOA;
+  }
+}
+
+#ifdef TOA_KERNEL_X86
+/* ***********************************************************************
+ * The vector kernels widen 8- or 16-bit DNs to 32-bit integers (zero- or
+ * sign-extending as the type requires), convert them to float and apply
+ * the gains. NoData is handled with a compare mask and a blend instead of
+ * a branch: when the band has no NoData value the compare is done against
+ * INT32_MAX, which no widened 8- or 16-bit DN can equal, so every lane
+ * keeps its computed value.
+ *
+ * The WidenN() overloads load N DNs and widen them to 32-bit lanes.
+ */
+__attribute__((target("sse4.1")))
+static inline __m128i Widen4( const unsigned char* DN ) {
+  int Packed;
+  memcpy( &Packed,DN,sizeof(int) );
+  return _mm_cvtepu8_epi32( _mm_cvtsi32_si128(Packed) );
+}
+__attribute__((target("sse4.1")))
+static inline __m128i Widen4( const unsigned short* DN ) {
+  return _mm_cvtepu16_epi32( _mm_loadl_epi64((const __m128i*)DN) );
+}
+__attribute__((target("sse4.1")))
+static inline __m128i Widen4( const short* DN ) {
+  return _mm_cvtepi16_epi32( _mm_loadl_epi64((const __m128i*)DN) );
+}
+
+__attribute__((target("avx2")))
+static inline __m256i Widen8( const unsigned char* DN ) {
+  return _mm256_cvtepu8_epi32( _mm_loadl_epi64((const __m128i*)DN) );
+}
+__attribute__((target("avx2")))
+static inline __m256i Widen8( const unsigned short* DN ) {
+  return _mm256_cvtepu16_epi32( _mm_loadu_si128((const __m128i*)DN) );
+}
+__attribute__((target("avx2")))
+static inline __m256i Widen8( const short* DN ) {
+  return _mm256_cvtepi16_epi32( _mm_loadu_si128((const __m128i*)DN) );
+}
+
+__attribute__((target("avx512f")))
+static inline __m512i Widen16( const unsigned char* DN ) {
+  return _mm512_cvtepu8_epi32( _mm_loadu_si128((const __m128i*)DN) );
+}
+__attribute__((target("avx512f")))
+static inline __m512i Widen16( const unsigned short* DN ) {
+  return _mm512_cvtepu16_epi32( _mm256_loadu_si256((const __m256i*)DN) );
+}
+__attribute__((target("avx512f")))
+static inline __m512i Widen16( const short* DN ) {
+  return _mm512_cvtepi16_epi32( _mm256_loadu_si256((const __m256i*)DN) );
+}
+
+template<bool Ramp=false, typename TIn>
+__attribute__((target("sse4.1")))
+static void ConvertRowSSE41( const TIn* DN, size_t N,
+  float RadianceGain, float ReflectanceGain, bool ReflectanceValid,
+  bool HasNoData, TIn NoDataValue, float* Radiances, float* Reflectances,
+  float ReflectanceStep=0.0f )
+{
+  const __m128  gain   = _mm_set1_ps( RadianceGain );
+  __m128        rgain  = _mm_set1_ps( ReflectanceGain );
+  const __m128  rstep  = _mm_set1_ps( 4*ReflectanceStep );
+  const __m128  fill   = _mm_set1_ps( (float)NODATA );
+  const __m128i nodata = _mm_set1_epi32( HasNoData ? (int)NoDataValue : INT32_MAX );
+  if constexpr ( Ramp ) {
+    rgain = _mm_add_ps( rgain,_mm_mul_ps( _mm_set1_ps( ReflectanceStep ),
+      _mm_setr_ps( 0.0f,1.0f,2.0f,3.0f ) ));
+  }
+  size_t i = 0;
+  for( ; i+4<=N; i+=4 ) {
+    __m128i dn   = Widen4( DN+i );
+    __m128  dnf  = _mm_cvtepi32_ps( dn );
+    __m128  rad  = _mm_mul_ps( dnf,gain );
+    __m128  refl = ReflectanceValid ? _mm_mul_ps( dnf,rgain ) : fill;
+    __m128  mask = _mm_castsi128_ps( _mm_cmpeq_epi32(dn,nodata) );
+    _mm_storeu_ps( Radiances+i,    _mm_blendv_ps(rad,fill,mask) );
+    _mm_storeu_ps( Reflectances+i, _mm_blendv_ps(refl,fill,mask) );
+    if constexpr ( Ramp ) rgain = _mm_add_ps( rgain,rstep );
+  }
+  ConvertRowScalar<Ramp>( DN+i,N-i,RadianceGain,ReflectanceGain+ReflectanceStep*(float)i,
+    ReflectanceValid,HasNoData,NoDataValue,Radiances+i,Reflectances+i,ReflectanceStep );
+}
+
+template<bool Ramp=false, typename TIn>
+__attribute__((target("avx2")))
+static void ConvertRowAVX2( const TIn* DN, size_t N,
+  float RadianceGain, float ReflectanceGain, bool ReflectanceValid,
+  bool HasNoData, TIn NoDataValue, float* Radiances, float* Reflectances,
+  float ReflectanceStep=0.0f )
+{
+  const __m256  gain   = _mm256_set1_ps( RadianceGain );
+  __m256        rgain  = _mm256_set1_ps( ReflectanceGain );
+  const __m256  rstep  = _mm256_set1_ps( 8*ReflectanceStep );
+  const __m256  fill   = _mm256_set1_ps( (float)NODATA );
+  const __m256i nodata = _mm256_set1_epi32( HasNoData ? (int)NoDataValue : INT32_MAX );
+  if constexpr ( Ramp ) {
+    rgain = _mm256_add_ps( rgain,_mm256_mul_ps( _mm256_set1_ps( ReflectanceStep ),
+      _mm256_setr_ps( 0.0f,1.0f,2.0f,3.0f,4.0f,5.0f,6.0f,7.0f ) ));
+  }
+  size_t i = 0;
+  for( ; i+8<=N; i+=8 ) {
+    __m256i dn   = Widen8( DN+i );
+    __m256  dnf  = _mm256_cvtepi32_ps( dn );
+    __m256  rad  = _mm256_mul_ps( dnf,gain );
+    __m256  refl = ReflectanceValid ? _mm256_mul_ps( dnf,rgain ) : fill;
+    __m256  mask = _mm256_castsi256_ps( _mm256_cmpeq_epi32(dn,nodata) );
+    _mm256_storeu_ps( Radiances+i,    _mm256_blendv_ps(rad,fill,mask) );
+    _mm256_storeu_ps( Reflectances+i, _mm256_blendv_ps(refl,fill,mask) );
+    if constexpr ( Ramp ) rgain = _mm256_add_ps( rgain,rstep );
+  }
+  ConvertRowScalar<Ramp>( DN+i,N-i,RadianceGain,ReflectanceGain+ReflectanceStep*(float)i,
+    ReflectanceValid,HasNoData,NoDataValue,Radiances+i,Reflectances+i,ReflectanceStep );
+}
+
+// GCC 12 warns about the deliberately undefined pass-through operand in
+// its own AVX-512 intrinsic headers (GCC bug 105593).
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+template<bool Ramp=false, typename TIn>
+__attribute__((target("avx512f")))
+static void ConvertRowAVX512( const TIn* DN, size_t N,
+  float RadianceGain, float ReflectanceGain, bool ReflectanceValid,
+  bool HasNoData, TIn NoDataValue, float* Radiances, float* Reflectances,
+  float ReflectanceStep=0.0f )
+{
+  const __m512  gain   = _mm512_set1_ps( RadianceGain );
+  __m512        rgain  = _mm512_set1_ps( ReflectanceGain );
+  const __m512  rstep  = _mm512_set1_ps( 16*ReflectanceStep );
+  const __m512  fill   = _mm512_set1_ps( (float)NODATA );
+  const __m512i nodata = _mm512_set1_epi32( HasNoData ? (int)NoDataValue : INT32_MAX );
+  if constexpr ( Ramp ) {
+    rgain = _mm512_add_ps( rgain,_mm512_mul_ps( _mm512_set1_ps( ReflectanceStep ),
+      _mm512_setr_ps( 0.0f,1.0f,2.0f,3.0f,4.0f,5.0f,6.0f,7.0f,
+                      8.0f,9.0f,10.0f,11.0f,12.0f,13.0f,14.0f,15.0f ) ));
+  }
+  size_t i = 0;
+  for( ; i+16<=N; i+=16 ) {
+    __m512i   dn   = Widen16( DN+i );
+    __m512    dnf  = _mm512_cvtepi32_ps( dn );
+    __m512    rad  = _mm512_mul_ps( dnf,gain );
+    __m512    refl = ReflectanceValid ? _mm512_mul_ps( dnf,rgain ) : fill;
+    __mmask16 mask = _mm512_cmpeq_epi32_mask( dn,nodata );
+    _mm512_storeu_ps( Radiances+i,    _mm512_mask_blend_ps(mask,rad,fill) );
+    _mm512_storeu_ps( Reflectances+i, _mm512_mask_blend_ps(mask,refl,fill) );
+    if constexpr ( Ramp ) rgain = _mm512_add_ps( rgain,rstep );
+  }
+  ConvertRowScalar<Ramp>( DN+i,N-i,RadianceGain,ReflectanceGain+ReflectanceStep*(float)i,
+    ReflectanceValid,HasNoData,NoDataValue,Radiances+i,Reflectances+i,ReflectanceStep );
+}
+#pragma GCC diagnostic pop
+#endif
+
+KernelISA DetectKernelISA() {
+  /* *******************************************************************
+   * function KernelISA DetectKernelISA():
+   * Query the CPU for the widest instruction set the kernel can use.
+   * __builtin_cpu_supports() also accounts for whether the operating
+   * system saves the wider registers on a context switch.
+   */
+#ifdef TOA_KERNEL_X86
+  __builtin_cpu_init();
+  if( __builtin_cpu_supports("avx512f") ) return KERNEL_AVX512;
+  if( __builtin_cpu_supports("avx2") )    return KERNEL_AVX2;
+  if( __builtin_cpu_supports("sse4.1") )  return KERNEL_SSE41;
+#endif
+  return KERNEL_SCALAR;
+}
+
+// the instruction set in use, resolved once at startup.
+static KernelISA ActiveISA = DetectKernelISA();
+
+KernelISA GetKernelISA() {
+  return ActiveISA;
+}
+
+void SetKernelISA( KernelISA ISA ) {
+  /* *******************************************************************
+   * Restrict the kernel to some instruction set (e.g. to compare output
+   * against the scalar path). Requests for an instruction set the CPU
+   * does not support are clamped to the best one that it does.
+   */
+  KernelISA Supported = DetectKernelISA();
+  ActiveISA = ( ISA>Supported ) ? Supported : ISA;
+}
+
+const char* KernelISAName( KernelISA ISA ) {
+  switch( ISA ) {
+    case KERNEL_AVX512: return "avx512";
+    case KERNEL_AVX2:   return "avx2";
+    case KERNEL_SSE41:  return "sse4.1";
+    default:            return "scalar";
+  }
+}
+
+bool ParseKernelISA( const String& Name, KernelISA& ISA ) {
+  /* parse the name of an instruction set as given on the command-line */
+  if( Name == "avx512" )      ISA = KERNEL_AVX512;
+  else if( Name == "avx2" )   ISA = KERNEL_AVX2;
+  else if( Name == "sse4.1" || Name == "sse41" ) ISA = KERNEL_SSE41;
+  else if( Name == "scalar" ) ISA = KERNEL_SCALAR;
+  else return false;
+  return true;
+}
+
+template<bool Ramp, typename TIn>
+static void ConvertRow( const TIn* DN, size_t N, float RadianceGain, float ReflectanceGain,
+  bool ReflectanceValid, bool HasNoData, TIn NoDataValue, float* Radiances, float* Reflectances,
+  float ReflectanceStep )
+{
+  /* ***********************************************************************
+   * function ConvertRow(...):
+   * Dispatch one row to the kernel for the active instruction set; 8-
+   * and 16-bit integers go to the vector kernels, other types to the
+   * scalar one.
+   */
+#ifdef TOA_KERNEL_X86
+  if constexpr ( std::is_same<TIn,unsigned char>::value || 
+                 std::is_same<TIn,unsigned short>::value || std::is_same<TIn,short>::value ) {
+    switch( ActiveISA ) {
+      case KERNEL_AVX512:
+        ConvertRowAVX512<Ramp>( DN,N,RadianceGain,ReflectanceGain,ReflectanceValid,
+          HasNoData,NoDataValue,Radiances,Reflectances,ReflectanceStep );
+        return;
+      case KERNEL_AVX2:
+        ConvertRowAVX2<Ramp>( DN,N,RadianceGain,ReflectanceGain,ReflectanceValid,
+          HasNoData,NoDataValue,Radiances,Reflectances,ReflectanceStep );
+        return;
+      case KERNEL_SSE41:
+        ConvertRowSSE41<Ramp>( DN,N,RadianceGain,ReflectanceGain,ReflectanceValid,
+          HasNoData,NoDataValue,Radiances,Reflectances,ReflectanceStep );
+        return;
+      default:
+        break;
+    }
+  }
+#endif
+  ConvertRowScalar<Ramp>( DN,N,RadianceGain,ReflectanceGain,ReflectanceValid,
+    HasNoData,NoDataValue,Radiances,Reflectances,ReflectanceStep );
+}
+
+template<typename TIn>
+void ConvertRowToTOA( const TIn* DN, size_t N, const BandCoefficients& Coefficients,
+  bool HasNoData, TIn NoDataValue, float* Radiances, float* Reflectances )
+{
+  /* ***********************************************************************
+   * function ConvertRowToTOA(...):
+   * Convert N digital numbers into TOA radiances and reflectances:
+   *
+   *   radiance    = DN * RadianceGain
+   *   reflectance = DN * ReflectanceGain
+   *
+   * using the gains folded together by MakeBandCoefficients(). If the band
+   * has no solar irradiance every reflectance is set to NoData, and pixels
+   * whose DN equals NoDataValue (when HasNoData is set) get NoData in both
+   * outputs. There is one instantiation per supported GDAL input type;
+   * 8- and 16-bit integers are dispatched to the vector kernels.
+   */
+  ConvertRow<false>( DN,N,Coefficients.RadianceGain,Coefficients.ReflectanceGain,
+    Coefficients.ReflectanceValid,HasNoData,NoDataValue,Radiances,Reflectances,0.0f );
+}
+
+template<typename TIn>
+void ConvertRowToTOAGrid( const TIn* DN, size_t N, int X, int Y,
+  const BandCoefficients& Coefficients, const SolarZenithGrid& Grid,
+  bool HasNoData, TIn NoDataValue, float* Radiances, float* Reflectances )
+{
+  /* ***********************************************************************
+   * function ConvertRowToTOAGrid(...):
+   * As ConvertRowToTOA(), for the row of N pixels starting at image
+   * column X of row Y, with the reflectance gain of each pixel scaled
+   * by the grid. The grid's two node rows around Y are interpolated
+   * once for the row; between two node columns the scale is then
+   * linear in x, so each span is converted by the vector kernels with
+   * a gain that ramps by a constant step per pixel. There are no
+   * per-pixel cosines or divisions.
+   */
+  if( !Coefficients.ReflectanceValid || Grid.Scale.empty() ) {
+    ConvertRowToTOA( DN,N,Coefficients,HasNoData,NoDataValue,Radiances,Reflectances );
+    return;
+  }
+  int Spacing  = Grid.Spacing;
+  int NodeRow  = std::min( Y/Spacing,Grid.NodeRows-2 );
+  float Weight = (float)( Y-NodeRow*Spacing )/(float)Spacing;
+  const float* Above = Grid.Scale.data()+(size_t)NodeRow*Grid.NodeCols;
+  const float* Below = Above+Grid.NodeCols;
+
+  size_t i = 0;
+  while( i<N ) {
+    int x       = X+(int)i;
+    int NodeCol = std::min( x/Spacing,Grid.NodeCols-2 );
+    size_t End  = ( NodeCol == Grid.NodeCols-2 ) ? N :
+      std::min( N,(size_t)( (NodeCol+1)*Spacing-X ));
+    float Left  = Above[NodeCol]+( Below[NodeCol]-Above[NodeCol] )*Weight;
+    float Right = Above[NodeCol+1]+( Below[NodeCol+1]-Above[NodeCol+1] )*Weight;
+    float Step  = ( Right-Left )/(float)Spacing;
+    float Start = Left+Step*(float)( x-NodeCol*Spacing );
+    ConvertRow<true>( DN+i,End-i,Coefficients.RadianceGain,Coefficients.ReflectanceGain*Start,
+      true,HasNoData,NoDataValue,Radiances+i,Reflectances+i,Coefficients.ReflectanceGain*Step );
+    i = End;
+  }
+}
+
+// the input types supported by CalculateSpectralRadiancesAndReflectances
+template void ConvertRowToTOA<unsigned char>( const unsigned char*, size_t,
+  const BandCoefficients&, bool, unsigned char, float*, float* );
+template void ConvertRowToTOA<unsigned short>( const unsigned short*, size_t,
+  const BandCoefficients&, bool, unsigned short, float*, float* );
+template void ConvertRowToTOA<short>( const short*, size_t,
+  const BandCoefficients&, bool, short, float*, float* );
+template void ConvertRowToTOA<unsigned int>( const unsigned int*, size_t,
+  const BandCoefficients&, bool, unsigned int, float*, float* );
+template void ConvertRowToTOA<float>( const float*, size_t,
+  const BandCoefficients&, bool, float, float*, float* );
+template void ConvertRowToTOAGrid<unsigned char>( const unsigned char*, size_t, int, int,
+  const BandCoefficients&, const SolarZenithGrid&, bool, unsigned char, float*, float* );
+template void ConvertRowToTOAGrid<unsigned short>( const unsigned short*, size_t, int, int,
+  const BandCoefficients&, const SolarZenithGrid&, bool, unsigned short, float*, float* );
+template void ConvertRowToTOAGrid<short>( const short*, size_t, int, int,
+  const BandCoefficients&, const SolarZenithGrid&, bool, short, float*, float* );
+template void ConvertRowToTOAGrid<unsigned int>( const unsigned int*, size_t, int, int,
+  const BandCoefficients&, const SolarZenithGrid&, bool, unsigned int, float*, float* );
+template void ConvertRowToTOAGrid<float>( const float*, size_t, int, int,
+  const BandCoefficients&, const SolarZenithGrid&, bool, float, float*, float* );
+
+BandCoefficients MakeBandCoefficients( const String& BandName, double AbsCalFactor,
+  double EffectiveBandwidth, double SolarIrradiance, double EarthSunDistance,
+  double SolarZenithAngle )
+{
+  /* ***********************************************************************
+   * function MakeBandCoefficients(...):
+   * Fold the per-band constants of the TOA formula
+   *
+   *   radiance    = DN * abscal / bandwidth
+   *   reflectance = radiance * d^2 * pi / ( irradiance * cos(zenith) )
+   *
+   * into a radiance gain and a reflectance gain. The products are formed
+   * in double precision and rounded to float once. SolarZenithAngle is
+   * in radians. A solar irradiance below 1.0 is the placeholder used for
+   * bands a satellite does not have (see SolarIrradiance() in TOAUtil.cpp).
+   */
+  BandCoefficients Coefficients;
+  Coefficients.BandName           = BandName;
+  Coefficients.AbsCalFactor       = AbsCalFactor;
+  Coefficients.EffectiveBandwidth = EffectiveBandwidth;
+  Coefficients.SolarIrradiance    = SolarIrradiance;
+  Coefficients.EarthSunDistance   = EarthSunDistance;
+  Coefficients.SolarZenithAngle   = SolarZenithAngle;
+  Coefficients.ReflectanceValid   = !( SolarIrradiance<1.0 );
+
+  double RadianceGain = AbsCalFactor/EffectiveBandwidth;
+  Coefficients.RadianceGain    = (float)RadianceGain;
+  Coefficients.ReflectanceGain = Coefficients.ReflectanceValid ?
+    (float)(( RadianceGain*EarthSunDistance*EarthSunDistance*M_PI ) /
+      ( SolarIrradiance*cos(SolarZenithAngle) )) : (float)NODATA;
+  return Coefficients;
+}
+
+static int ULPDistance( float a, float b ) {
+  /* number of representable floats between a and b (same sign assumed) */
+  int32_t ia, ib;
+  memcpy( &ia,&a,sizeof(float) );
+  memcpy( &ib,&b,sizeof(float) );
+  if( (ia<0) != (ib<0) ) return ( a==b ) ? 0 : std::numeric_limits<int>::max();
+  return abs( ia-ib );
+}
+
+CoefficientValidation ValidateBandCoefficients( const BandCoefficients& Coefficients,
+  int MaxDN, int ToleranceULP )
+{
+  /* ***********************************************************************
+   * function ValidateBandCoefficients(...):
+   * Run every DN in [0,MaxDN] through the active conversion kernel and
+   * compare against the original per-pixel formula, evaluated exactly as
+   * CalculateSpectralRadiancesAndReflectances used to (float radiance,
+   * double reflectance). Returns the worst ULP difference seen for each
+   * output and the number of pixels over ToleranceULP.
+   */
+  CoefficientValidation Result = { 0,0,0 };
+  size_t N = (size_t)MaxDN+1;
+  std::vector<unsigned short> DN( N );
+  std::vector<float> Radiances( N ), Reflectances( N );
+  for( size_t i=0; i<N; i++ ) DN[i] = (unsigned short)i;
+
+  ConvertRowToTOA( DN.data(),N,Coefficients,false,(unsigned short)0,
+    Radiances.data(),Reflectances.data() );
+
+  float BandEffectiveCalibration = (float)Coefficients.AbsCalFactor;
+  float BandWidth                = (float)Coefficients.EffectiveBandwidth;
+  double earthSunDistance        = Coefficients.EarthSunDistance;
+  for( size_t i=0; i<N; i++ ) {
+    float radiance_TOA = (float)((float)DN[i]*BandEffectiveCalibration )/BandWidth;
+    float reflectance_TOA;
+    if( Coefficients.SolarIrradiance<1.0 ) {
+      reflectance_TOA = (float)-9999.0;
+    } else {
+      reflectance_TOA = (float)(( radiance_TOA * (
+        earthSunDistance*earthSunDistance) * M_PI ) / ( Coefficients.SolarIrradiance *
+        cos(Coefficients.SolarZenithAngle)));
+    }
+    int RadianceULP    = ULPDistance( radiance_TOA,Radiances[i] );
+    int ReflectanceULP = ULPDistance( reflectance_TOA,Reflectances[i] );
+    Result.MaxRadianceULP    = std::max( Result.MaxRadianceULP,RadianceULP );
+    Result.MaxReflectanceULP = std::max( Result.MaxReflectanceULP,ReflectanceULP );
+    if( RadianceULP>ToleranceULP || ReflectanceULP>ToleranceULP ) Result.MismatchedPixels++;
+  }
+  return Result;
+}
+
+BandLookupTable BuildBandLookupTable( const BandCoefficients& Coefficients,
+  int BitsPerPixel, bool HasNoData, unsigned short NoDataValue )
+{
+  /* ***********************************************************************
+   * function BuildBandLookupTable(...):
+   * Tabulate the radiance and reflectance of every DN representable in
+   * BitsPerPixel bits (clamped to 1..16, the range of unsigned short).
+   * The table is filled by the arithmetic kernel itself, so a lookup
+   * gives bit-identical output to the arithmetic path, NoData included.
+   * If the NoData value does not fit in BitsPerPixel bits the full 16-bit
+   * table is built so that NoData is still baked in.
+   * Radiance and reflectance are interleaved so one DN touches one
+   * cache line.
+   */
+  if( BitsPerPixel<1 || BitsPerPixel>16 ) BitsPerPixel = 16;
+  if( HasNoData && ( (size_t)NoDataValue>>BitsPerPixel ) != 0 ) BitsPerPixel = 16;
+  BandLookupTable Table;
+  Table.Coefficients = Coefficients;
+  Table.Size         = (size_t)1 << BitsPerPixel;
+  Table.Values.resize( 2*Table.Size );
+
+  std::vector<unsigned short> DN( Table.Size );
+  std::vector<float> Radiances( Table.Size ), Reflectances( Table.Size );
+  for( size_t i=0; i<Table.Size; i++ ) DN[i] = (unsigned short)i;
+  ConvertRowToTOA( DN.data(),Table.Size,Coefficients,HasNoData,NoDataValue,
+    Radiances.data(),Reflectances.data() );
+  for( size_t i=0; i<Table.Size; i++ ) {
+    Table.Values[2*i]   = Radiances[i];
+    Table.Values[2*i+1] = Reflectances[i];
+  }
+  return Table;
+}
+
+template<typename TIn>
+void ConvertRowLookup( const TIn* DN, size_t N, const BandLookupTable& Table,
+  float* Radiances, float* Reflectances )
+{
+  /* ***********************************************************************
+   * function ConvertRowLookup(...):
+   * Convert N digital numbers with a table from BuildBandLookupTable().
+   * A DN beyond the table (a pixel using more bits than the IMD declares)
+   * is converted with the fused gains instead of being read out of bounds;
+   * such a DN is never NoData, which always lies inside the table.
+   * Only 8- and 16-bit unsigned input can be tabulated.
+   */
+  const float* Values = Table.Values.data();
+  const BandCoefficients& Coefficients = Table.Coefficients;
+  for( size_t i=0; i<N; i++ ) {
+    size_t dn = DN[i];
+    if( dn<Table.Size ) {
+      Radiances[i]    = Values[2*dn];
+      Reflectances[i] = Values[2*dn+1];
+    } else {
+      Radiances[i]    = (float)dn*Coefficients.RadianceGain;
+      Reflectances[i] = Coefficients.ReflectanceValid ?
+        (float)dn*Coefficients.ReflectanceGain : (float)NODATA;
+    }
+  }
+}
+
+template void ConvertRowLookup<unsigned char>( const unsigned char*, size_t,
+  const BandLookupTable&, float*, float* );
+template void ConvertRowLookup<unsigned short>( const unsigned short*, size_t,
+  const BandLookupTable&, float*, float* );
+
+const char* ConversionModeName( ConversionMode Mode ) {
+  return ( Mode == CONVERT_LOOKUP ) ? "lut" : "arith";
+}
+
+bool ParseConversionMode( const String& Name, ConversionMode& Mode ) {
+  /* parse the name of a conversion mode as given on the command-line */
+  if( Name == "arith" )    Mode = CONVERT_ARITHMETIC;
+  else if( Name == "lut" ) Mode = CONVERT_LOOKUP;
+  else return false;
+  return true;
+}
@@ -0,0 +1,186 @@
+#ifndef KERNELUTIL_H_
+#define KERNELUTIL_H_
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <limits>
+#include <type_traits>
+
+// radiance and reflectance written for NoData DNs, everywhere
+#define NODATA -9999
+typedef std::string String;
+
+// instruction sets the DN-to-TOA kernel can be dispatched to, in
+// increasing order of vector width. The best one supported by the
+// CPU is picked at startup.
+enum KernelISA {
+  KERNEL_SCALAR = 0,
+  KERNEL_SSE41  = 1,
+  KERNEL_AVX2   = 2,
+  KERNEL_AVX512 = 3
+};
+
+// per-band coefficients, built once per scene. The calibration, effective
+// bandwidth, Earth-sun distance, solar irradiance and cosine of the solar
+// zenith angle are folded into one gain per output, so converting a pixel
+// takes two multiplies. The inputs are kept for ValidateBandCoefficients().
+struct BandCoefficients {
+  String BandName;
+  double AbsCalFactor;
+  double EffectiveBandwidth;
+  double SolarIrradiance;
+  double EarthSunDistance;
+  double SolarZenithAngle;   // radians
+  float RadianceGain;
+  float ReflectanceGain;
+  bool ReflectanceValid;     // false if no solar irradiance for the band
+};
+
+// reflectance scale factors of a scene on a coarse grid of image
+// positions, for per-pixel solar zenith angles (built by
+// BuildSolarZenithGrid() in TOAUtil.h). Node (r,c) lies at row
+// r*Spacing, column c*Spacing, and holds cos(mean zenith)/cos(zenith),
+// so a pixel's reflectance gain is ReflectanceGain times the scale
+// interpolated bilinearly from the four nodes around it.
+struct SolarZenithGrid {
+  int NodeRows = 0;
+  int NodeCols = 0;
+  int Spacing  = 0;                // pixels between nodes
+  std::vector<float> Scale;        // NodeRows x NodeCols, by rows
+};
+
+// result of comparing the fused coefficients against the reference formula
+struct CoefficientValidation {
+  int MaxRadianceULP;
+  int MaxReflectanceULP;
+  long MismatchedPixels;
+};
+
+// per-band lookup tables for integer imagery: one (radiance,reflectance)
+// pair per possible DN, sized from the bit depth in the IMD. NoData is
+// baked into the table, so conversion is a gather.
+struct BandLookupTable {
+  BandCoefficients Coefficients;   // for DNs above the declared bit depth
+  size_t Size;                     // 1 << bitsPerPixel
+  std::vector<float> Values;       // interleaved radiance,reflectance
+};
+
+// how digital numbers are turned into radiances and reflectances
+enum ConversionMode {
+  CONVERT_ARITHMETIC = 0,          // fused gains, vector kernel
+  CONVERT_LOOKUP     = 1           // per-band lookup table
+};
+
+// tolerance used by the -V validation mode, in units in the last place
+#define COEFFICIENT_TOLERANCE_ULP 4
+
+BandCoefficients MakeBandCoefficients( const String&, double, double, double, double, double );
+CoefficientValidation ValidateBandCoefficients( const BandCoefficients&, int, int );
+
+BandLookupTable BuildBandLookupTable( const BandCoefficients&, int, bool, unsigned short );
+template<typename TIn>
+void ConvertRowLookup( const TIn*, size_t, const BandLookupTable&, float*, float* );
+const char* ConversionModeName( ConversionMode );
+bool ParseConversionMode( const String&, ConversionMode& );
+
+// convert one row (or block) of DNs into TOA radiances and reflectances.
+// Instantiated for unsigned char, unsigned short, short, unsigned int and
+// float input (GDT_Byte, GDT_UInt16, GDT_Int16, GDT_UInt32, GDT_Float32).
+template<typename TIn>
+void ConvertRowToTOA( const TIn*, size_t, const BandCoefficients&,
+  bool, TIn, float*, float* );
+
+// as ConvertRowToTOA(), for the row starting at image column X of row Y,
+// with reflectance gains scaled by a SolarZenithGrid
+template<typename TIn>
+void ConvertRowToTOAGrid( const TIn*, size_t, int, int, const BandCoefficients&,
+  const SolarZenithGrid&, bool, TIn, float*, float* );
+
+template<typename TIn>
+inline bool NoDataForType( double NoDataValue, TIn& Converted ) {
+  /* *******************************************************************
+   * Convert a band's NoData value to its pixel type. Returns false if
+   * an integer type cannot represent it exactly (e.g. -9999 on an
+   * unsigned band), in which case no pixel can be NoData.
+   */
+  if constexpr ( std::is_integral<TIn>::value ) {
+    if(!( NoDataValue>=(double)std::numeric_limits<TIn>::min() &&
+          NoDataValue<=(double)std::numeric_limits<TIn>::max() )) return false;
+    if( (double)(TIn)NoDataValue != NoDataValue ) return false;
+  }
+  Converted = (TIn)NoDataValue;
+  return true;
+}
+
+// everything needed to convert the pixels of one band: the fused gains,
+// the band's NoData value in its pixel type, and the lookup table when
+// the band is converted in lookup mode.
+template<typename TIn>
+struct BandConverter {
+  BandCoefficients Coefficients;
+  bool HasNoData;
+  TIn NoDataValue;
+  bool UseLookup;
+  BandLookupTable LookupTable;
+  const SolarZenithGrid* Grid = nullptr;   // per-pixel solar zenith, or the scene mean
+
+  void Convert( const TIn* DN, size_t N, float* Radiances, float* Reflectances ) const {
+    if constexpr ( std::is_same<TIn,unsigned char>::value || std::is_same<TIn,unsigned short>::value ) {
+      if( UseLookup ) {
+        ConvertRowLookup( DN,N,LookupTable,Radiances,Reflectances );
+        return;
+      }
+    }
+    ConvertRowToTOA( DN,N,Coefficients,HasNoData,NoDataValue,Radiances,Reflectances );
+  }
+
+  // convert a window of Width x Height pixels at image position (X,Y),
+  // row by row through the grid when there is one (lookup tables hold
+  // scene-mean reflectances, so the grid always uses the arithmetic kernel)
+  void ConvertWindow( const TIn* DN, int X, int Y, int Width, int Height,
+    float* Radiances, float* Reflectances ) const {
+    if( Grid == nullptr ) {
+      Convert( DN,(size_t)Width*Height,Radiances,Reflectances );
+      return;
+    }
+    for( int Row=0; Row<Height; Row++ ) {
+      size_t Offset = (size_t)Row*Width;
+      ConvertRowToTOAGrid( DN+Offset,(size_t)Width,X,Y+Row,Coefficients,*Grid,HasNoData,
+        NoDataValue,Radiances+Offset,Reflectances+Offset );
+    }
+  }
+};
+
+template<typename TIn>
+BandConverter<TIn> MakeBandConverter( const BandCoefficients& Coefficients,
+  bool NoDataIsSet, double NoDataValue, ConversionMode Mode, int BitsPerPixel ) {
+  /* *******************************************************************
+   * Set up the conversion of one band. NoData is converted to the pixel
+   * type (see NoDataForType). Lookup mode applies only to 8- and 16-bit
+   * unsigned bands; the table is sized to BitsPerPixel, capped at the
+   * width of the type. Other bands use the arithmetic kernel.
+   */
+  BandConverter<TIn> Converter;
+  Converter.Coefficients = Coefficients;
+  Converter.NoDataValue  = 0;
+  Converter.HasNoData    = NoDataIsSet && NoDataForType( NoDataValue,Converter.NoDataValue );
+  Converter.UseLookup    = false;
+  if constexpr ( std::is_same<TIn,unsigned char>::value || std::is_same<TIn,unsigned short>::value ) {
+    if( Mode == CONVERT_LOOKUP ) {
+      int Bits = ( BitsPerPixel<(int)(8*sizeof(TIn)) ) ? BitsPerPixel : (int)(8*sizeof(TIn));
+      Converter.UseLookup   = true;
+      Converter.LookupTable = BuildBandLookupTable( Coefficients,Bits,
+        Converter.HasNoData,(unsigned short)Converter.NoDataValue );
+    }
+  }
+  return Converter;
+}
+
+// functions to query (and optionally restrict) the kernel instruction set
+KernelISA DetectKernelISA();
+KernelISA GetKernelISA();
+void SetKernelISA( KernelISA );
+const char* KernelISAName( KernelISA );
+bool ParseKernelISA( const String&, KernelISA& );
+
+#endif
@@ -0,0 +1,385 @@
+#include <math.h>
+#include <string.h>
+#include <new>
+#include <memory>
+#include "LibTOA.h"
+#include "TOAUtil.h"
+#include "KernelUtil.h"
+#include "IMDUtil.h"
+
+static_assert( TOA_NODATA == NODATA,"TOA_NODATA is the NODATA of the kernels" );
+
+// the parts of a scene and a converter the public header leaves opaque
+struct TOASceneData {
+  SolarMetadata Solar;
+  SceneCalibration Calibration;
+};
+
+struct TOAConverterData {
+  TOAScene Scene;
+  std::vector<BandCoefficients> Coefficients;
+  SolarZenithGrid Grid;
+  bool UseGrid = false;
+  int ImageRows = 0;
+  int ImageCols = 0;
+
+  const BandCoefficients& GetBandCoefficients( int Band ) const {
+    if( Band<1 || Band>(int)Coefficients.size() ) {
+      throw std::invalid_argument( "  ERROR (fatal): no band "+std::to_string( Band )+
+        ", the scene has "+std::to_string( Coefficients.size() ));
+    }
+    return Coefficients[Band-1];
+  }
+};
+
+TOAScene::TOAScene() : Data( new TOASceneData ) {}
+TOAScene::TOAScene( const TOAScene& Other ) : Data( new TOASceneData( *Other.Data )) {}
+TOAScene::TOAScene( TOAScene&& Other ) noexcept : Data( std::move( Other.Data )) {}
+TOAScene::~TOAScene() {}
+
+TOAScene& TOAScene::operator=( const TOAScene& Other ) {
+  if( this != &Other ) Data.reset( new TOASceneData( *Other.Data ));
+  return *this;
+}
+
+TOAScene& TOAScene::operator=( TOAScene&& Other ) noexcept {
+  Data = std::move( Other.Data );
+  return *this;
+}
+
+String TOAScene::GetSatelliteID() const {
+  return Data->Calibration.SatelliteID;
+}
+
+int TOAScene::GetBandCount() const {
+  return Data->Calibration.GetBandCount();
+}
+
+String TOAScene::GetBandName( int Band ) const {
+  if( Band<1 || Band>this->GetBandCount() ) {
+    throw std::invalid_argument( "  ERROR (fatal): no band "+std::to_string( Band )+
+      ", the scene has "+std::to_string( this->GetBandCount() ));
+  }
+  return Data->Calibration.Bands[Band-1].Name;
+}
+
+TOAScene ParseTOAScene( const String& IMDText, const String& XMLText ) {
+  /* *********************************************************************
+   * The same metadata LoadSharedSceneMetadata() takes from the files:
+   * the Earth-sun distance, solar zenith angle, bit depth and geometry
+   * from the IMD, and the band calibrations from the IMD if it has them,
+   * else from the XML.
+   */
+  TOAScene Scene;
+  TOASceneData& Data = *Scene.Data;
+  IMDFile IMD( IMDText.data(),IMDText.size(),"(IMD text)" );
+  EarthSunDistance( IMD,&Data.Solar );
+  if( HasBandCalibration( IMD )) {
+    Data.Calibration = ReadSceneCalibration( IMD );
+  } else if( !XMLText.empty() ) {
+    Data.Calibration = ReadSceneCalibrationText( XMLText,"(XML text)" );
+  } else {
+    throw std::runtime_error( "  ERROR (fatal): no band calibrations in IMD text and no XML text" );
+  }
+  return Scene;
+}
+
+TOAScene MakeTOAScene( const String& SatelliteID, double EarthSunDistance,
+  double MeanSunElevation, int BitsPerPixel ) {
+  TOAScene Scene;
+  TOASceneData& Data = *Scene.Data;
+  Data.Solar.earthSunDistance  = EarthSunDistance;
+  Data.Solar.solarZenithAngle  = SolarZenithAngle( MeanSunElevation );
+  Data.Solar.bitsPerPixel      = BitsPerPixel;
+  Data.Calibration.SatelliteID = SatelliteID;
+  return Scene;
+}
+
+void AddTOABand( TOAScene& Scene, const String& BandName, double AbsCalFactor,
+  double EffectiveBandwidth ) {
+  SpectralBand ID;
+  if( !ParseSpectralBand( BandName,ID )) {
+    throw std::invalid_argument( "  ERROR (fatal): unknown band name: "+BandName );
+  }
+  SceneCalibration& Calibration = Scene.Data->Calibration;
+  Calibration.Bands.push_back( MakeBandCalibration( Calibration.SatelliteID,
+    BandName,AbsCalFactor,EffectiveBandwidth ));
+}
+
+TOAConverter::TOAConverter( const TOAScene& ConverterScene, int Rows, int Cols ) :
+  Data( new TOAConverterData ) {
+  /* *********************************************************************
+   * Fold each band's calibration, bandwidth and solar irradiance with
+   * the Earth-sun distance and zenith angle into its gains, as
+   * ImageUtil::BuildBandCoefficients() does for a file.
+   */
+  Data->Scene = ConverterScene;
+  const TOASceneData& Scene = *Data->Scene.Data;
+  if( Scene.Calibration.GetBandCount() == 0 ) {
+    throw std::runtime_error( "  ERROR (fatal): scene has no band calibrations" );
+  }
+  double SolarZenith = Scene.Solar.solarZenithAngle*( M_PI/180.0 );
+  for( const BandCalibration& Band : Scene.Calibration.Bands ) {
+    Data->Coefficients.push_back( MakeBandCoefficients( Band.Name,Band.AbsCalFactor,
+      Band.EffectiveBandwidth,Band.SolarIrradiance,Scene.Solar.earthSunDistance,SolarZenith ));
+  }
+  if( Rows>0 && Cols>0 ) {
+    Data->Grid      = BuildSolarZenithGrid( Scene.Solar,Rows,Cols );
+    Data->UseGrid   = true;
+    Data->ImageRows = Rows;
+    Data->ImageCols = Cols;
+  }
+}
+
+TOAConverter::TOAConverter( TOAConverter&& Other ) noexcept : Data( std::move( Other.Data )) {}
+TOAConverter::~TOAConverter() {}
+
+TOAConverter& TOAConverter::operator=( TOAConverter&& Other ) noexcept {
+  Data = std::move( Other.Data );
+  return *this;
+}
+
+int TOAConverter::GetBandCount() const {
+  return (int)Data->Coefficients.size();
+}
+
+TOABandGains TOAConverter::GetBandGains( int Band ) const {
+  const BandCoefficients& Coefficients = Data->GetBandCoefficients( Band );
+  return TOABandGains{ Coefficients.BandName,Coefficients.RadianceGain,
+    Coefficients.ReflectanceGain,Coefficients.ReflectanceValid };
+}
+
+const TOAScene& TOAConverter::GetScene() const {
+  return Data->Scene;
+}
+
+template<typename T>
+static void CheckBuffer( const TOABuffer<T>& Buffer, int Width, int Height, const char* Name ) {
+  /* a buffer's size must match the DNs', its strides must hold a pixel
+   * and a row, and its pixels must be aligned for their type */
+  String Prefix = "  ERROR (fatal): "+(String)Name+" buffer ";
+  if( Buffer.Width != Width || Buffer.Height != Height ) {
+    throw std::invalid_argument( Prefix+"is "+std::to_string( Buffer.Width )+" x "+
+      std::to_string( Buffer.Height )+", not "+std::to_string( Width )+" x "+std::to_string( Height ));
+  }
+  if( Buffer.GetPixelStride()<sizeof(T) ||
+      Buffer.GetRowStride()<( Width-1 )*Buffer.GetPixelStride()+sizeof(T) ) {
+    throw std::invalid_argument( Prefix+"strides are too small for its pixels" );
+  }
+  if( (size_t)Buffer.Data%alignof(T) != 0 || Buffer.GetPixelStride()%alignof(T) != 0 ||
+      Buffer.GetRowStride()%alignof(T) != 0 ) {
+    throw std::invalid_argument( Prefix+"is not aligned for its pixel type" );
+  }
+}
+
+template<typename TIn>
+void TOAConverter::Convert( int Band, const TOABuffer<const TIn>& DN,
+  const TOABuffer<float>& Radiances, const TOABuffer<float>& Reflectances,
+  bool HasNoData, double NoDataValue, int X, int Y ) const {
+  /* *********************************************************************
+   * Convert a caller's buffer with the kernels bin/toa uses. Packed rows
+   * are converted in place, and a buffer that is packed from end to end
+   * in one call; strided rows are gathered into (and scattered from) a
+   * row of scratch, as is an output that was not asked for.
+   */
+  const BandCoefficients& BandGains = Data->GetBandCoefficients( Band );
+  if( DN.Data == nullptr || DN.Width<=0 || DN.Height<=0 ) {
+    throw std::invalid_argument( "  ERROR (fatal): empty DN buffer" );
+  }
+  if( Radiances.Data == nullptr && Reflectances.Data == nullptr ) {
+    throw std::invalid_argument( "  ERROR (fatal): no radiance or reflectance buffer" );
+  }
+  int Width  = DN.Width;
+  int Height = DN.Height;
+  CheckBuffer( DN,Width,Height,"DN" );
+  if( Radiances.Data )    CheckBuffer( Radiances,Width,Height,"radiance" );
+  if( Reflectances.Data ) CheckBuffer( Reflectances,Width,Height,"reflectance" );
+  if( Data->UseGrid && ( X<0 || Y<0 || X+Width>Data->ImageCols || Y+Height>Data->ImageRows )) {
+    throw std::invalid_argument( "  ERROR (fatal): buffer at ("+std::to_string( X )+","+
+      std::to_string( Y )+") lies outside the "+std::to_string( Data->ImageCols )+" x "+
+      std::to_string( Data->ImageRows )+" image" );
+  }
+
+  BandConverter<TIn> Converter = MakeBandConverter<TIn>( BandGains,HasNoData,NoDataValue,
+    CONVERT_ARITHMETIC,Data->Scene.Data->Solar.bitsPerPixel );
+  if( Data->UseGrid ) Converter.Grid = &Data->Grid;
+
+  bool DirectDN          = DN.IsPacked();
+  bool DirectRadiance    = Radiances.Data && Radiances.IsPacked();
+  bool DirectReflectance = Reflectances.Data && Reflectances.IsPacked();
+  size_t PackedRow = (size_t)Width*sizeof(float);
+  if( DirectDN && DirectRadiance && DirectReflectance &&
+      DN.GetRowStride() == (size_t)Width*sizeof(TIn) &&
+      Radiances.GetRowStride() == PackedRow && Reflectances.GetRowStride() == PackedRow ) {
+    Converter.ConvertWindow( DN.Data,X,Y,Width,Height,Radiances.Data,Reflectances.Data );
+    return;
+  }
+
+  std::vector<TIn> DNRow( DirectDN ? 0 : Width );
+  std::vector<float> RadianceRow( DirectRadiance ? 0 : Width );
+  std::vector<float> ReflectanceRow( DirectReflectance ? 0 : Width );
+  for( int Row=0; Row<Height; Row++ ) {
+    const TIn* In = DN.GetRow( Row );
+    if( !DirectDN ) {
+      const char* Pixel = (const char*)In;
+      for( int i=0; i<Width; i++, Pixel+=DN.GetPixelStride() ) memcpy( &DNRow[i],Pixel,sizeof(TIn) );
+      In = DNRow.data();
+    }
+    float* RadianceOut    = DirectRadiance ? Radiances.GetRow( Row ) : RadianceRow.data();
+    float* ReflectanceOut = DirectReflectance ? Reflectances.GetRow( Row ) : ReflectanceRow.data();
+    Converter.ConvertWindow( In,X,Y+Row,Width,1,RadianceOut,ReflectanceOut );
+
+    if( Radiances.Data && !DirectRadiance ) {
+      char* Pixel = (char*)Radiances.GetRow( Row );
+      for( int i=0; i<Width; i++, Pixel+=Radiances.GetPixelStride() ) *(float*)Pixel = RadianceRow[i];
+    }
+    if( Reflectances.Data && !DirectReflectance ) {
+      char* Pixel = (char*)Reflectances.GetRow( Row );
+      for( int i=0; i<Width; i++, Pixel+=Reflectances.GetPixelStride() ) *(float*)Pixel = ReflectanceRow[i];
+    }
+  }
+}
+
+template void TOAConverter::Convert<unsigned char>( int, const TOABuffer<const unsigned char>&,
+  const TOABuffer<float>&, const TOABuffer<float>&, bool, double, int, int ) const;
+template void TOAConverter::Convert<unsigned short>( int, const TOABuffer<const unsigned short>&,
+  const TOABuffer<float>&, const TOABuffer<float>&, bool, double, int, int ) const;
+template void TOAConverter::Convert<short>( int, const TOABuffer<const short>&,
+  const TOABuffer<float>&, const TOABuffer<float>&, bool, double, int, int ) const;
+template void TOAConverter::Convert<unsigned int>( int, const TOABuffer<const unsigned int>&,
+  const TOABuffer<float>&, const TOABuffer<float>&, bool, double, int, int ) const;
+template void TOAConverter::Convert<float>( int, const TOABuffer<const float>&,
+  const TOABuffer<float>&, const TOABuffer<float>&, bool, double, int, int ) const;
+
+/* ***********************************************************************
+ * The C API (toa.h): opaque handles around the C++ objects, and every
+ * exception caught at the boundary and kept, per thread, for
+ * toa_last_error().
+ */
+struct toa_scene {
+  TOAScene Scene;
+};
+
+struct toa_converter {
+  TOAConverter Converter;
+  explicit toa_converter( const TOAScene& Scene, int Rows, int Cols ) : Converter( Scene,Rows,Cols ) {}
+};
+
+static thread_local String LastError;
+
+template<typename Function>
+static int CallTOA( Function Call ) {
+  /* run Call, turning an exception into a status and a message */
+  LastError.clear();
+  try {
+    Call();
+    return TOA_OK;
+  } catch( const std::invalid_argument& e ) {
+    LastError = e.what();
+    return TOA_ERROR_ARGUMENT;
+  } catch( const std::bad_alloc& ) {
+    LastError = "  ERROR (fatal): out of memory";
+    return TOA_ERROR_MEMORY;
+  } catch( const std::exception& e ) {
+    LastError = e.what();
+    return TOA_ERROR_METADATA;
+  } catch( ... ) {
+    LastError = "  ERROR (fatal): unknown error";
+    return TOA_ERROR_METADATA;
+  }
+}
+
+template<typename TIn>
+static void ConvertC( const toa_converter* Handle, int Band, int Width, int Height,
+  const toa_buffer* DN, const toa_buffer* Radiances, const toa_buffer* Reflectances,
+  const double* NoData, int X, int Y ) {
+  TOABuffer<const TIn> In( (const TIn*)DN->data,Width,Height,DN->row_stride,DN->pixel_stride );
+  TOABuffer<float> Radiance, Reflectance;
+  if( Radiances ) {
+    Radiance = TOABuffer<float>( (float*)Radiances->data,Width,Height,Radiances->row_stride,
+      Radiances->pixel_stride );
+  }
+  if( Reflectances ) {
+    Reflectance = TOABuffer<float>( (float*)Reflectances->data,Width,Height,Reflectances->row_stride,
+      Reflectances->pixel_stride );
+  }
+  Handle->Converter.Convert<TIn>( Band,In,Radiance,Reflectance,NoData != nullptr,
+    NoData ? *NoData : 0.0,X,Y );
+}
+
+extern "C" {
+
+toa_scene* toa_scene_parse( const char* IMDText, const char* XMLText ) {
+  std::unique_ptr<toa_scene> Scene;
+  if( CallTOA( [&]{
+        if( IMDText == nullptr ) throw std::invalid_argument( "  ERROR (fatal): no IMD text" );
+        Scene.reset( new toa_scene{ ParseTOAScene( IMDText,XMLText ? XMLText : "" ) } );
+      }) != TOA_OK ) return nullptr;
+  return Scene.release();
+}
+
+toa_scene* toa_scene_new( const char* SatelliteID, double EarthSunDistance,
+  double SunElevation, int BitsPerPixel ) {
+  std::unique_ptr<toa_scene> Scene;
+  if( CallTOA( [&]{
+        if( SatelliteID == nullptr ) throw std::invalid_argument( "  ERROR (fatal): no satellite ID" );
+        Scene.reset( new toa_scene{ MakeTOAScene( SatelliteID,EarthSunDistance,SunElevation,BitsPerPixel ) } );
+      }) != TOA_OK ) return nullptr;
+  return Scene.release();
+}
+
+int toa_scene_add_band( toa_scene* Scene, const char* BandName, double AbsCalFactor,
+  double EffectiveBandwidth ) {
+  return CallTOA( [&]{
+    if( Scene == nullptr || BandName == nullptr ) {
+      throw std::invalid_argument( "  ERROR (fatal): no scene or band name" );
+    }
+    AddTOABand( Scene->Scene,BandName,AbsCalFactor,EffectiveBandwidth );
+  });
+}
+
+int toa_scene_band_count( const toa_scene* Scene ) {
+  return Scene ? Scene->Scene.GetBandCount() : 0;
+}
+
+void toa_scene_free( toa_scene* Scene ) {
+  delete Scene;
+}
+
+toa_converter* toa_converter_new( const toa_scene* Scene, int ImageRows, int ImageCols ) {
+  std::unique_ptr<toa_converter> Converter;
+  if( CallTOA( [&]{
+        if( Scene == nullptr ) throw std::invalid_argument( "  ERROR (fatal): no scene" );
+        Converter.reset( new toa_converter( Scene->Scene,ImageRows,ImageCols ));
+      }) != TOA_OK ) return nullptr;
+  return Converter.release();
+}
+
+void toa_converter_free( toa_converter* Converter ) {
+  delete Converter;
+}
+
+int toa_convert( const toa_converter* Converter, int Band, toa_data_type Type,
+  int Width, int Height, const toa_buffer* DN, const toa_buffer* Radiances,
+  const toa_buffer* Reflectances, const double* NoData, int X, int Y ) {
+  return CallTOA( [&]{
+    if( Converter == nullptr || DN == nullptr ) {
+      throw std::invalid_argument( "  ERROR (fatal): no converter or DN buffer" );
+    }
+    switch( Type ) {
+      case TOA_BYTE:    ConvertC<unsigned char>( Converter,Band,Width,Height,DN,Radiances,Reflectances,NoData,X,Y ); break;
+      case TOA_UINT16:  ConvertC<unsigned short>( Converter,Band,Width,Height,DN,Radiances,Reflectances,NoData,X,Y ); break;
+      case TOA_INT16:   ConvertC<short>( Converter,Band,Width,Height,DN,Radiances,Reflectances,NoData,X,Y ); break;
+      case TOA_UINT32:  ConvertC<unsigned int>( Converter,Band,Width,Height,DN,Radiances,Reflectances,NoData,X,Y ); break;
+      case TOA_FLOAT32: ConvertC<float>( Converter,Band,Width,Height,DN,Radiances,Reflectances,NoData,X,Y ); break;
+      default:
+        throw std::invalid_argument( "  ERROR (fatal): unsupported pixel type "+std::to_string( (int)Type ));
+    }
+  });
+}
+
+const char* toa_last_error( void ) {
+  return LastError.c_str();
+}
+
+}
@@ -0,0 +1,127 @@
+#ifndef LIBTOA_H_
+#define LIBTOA_H_
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <stdexcept>
+#include "toa.h"
+
+/* ***********************************************************************
+ * The in-memory API of libtoa, for services that hold the pixels
+ * themselves: scene metadata in, a caller-owned buffer of DNs in, and
+ * caller-owned buffers of radiances and reflectances filled. Nothing is
+ * read from or written to disk and nothing exits; errors are thrown as
+ * std::invalid_argument (bad buffers or band numbers) or
+ * std::runtime_error (bad metadata). The plain C API is in toa.h; the
+ * two headers are all a program using libtoa needs.
+ *
+ *   TOAScene Scene = ParseTOAScene( IMDText,XMLText );
+ *   TOAConverter Converter( Scene );
+ *   Converter.Convert<unsigned short>( 1,DN,Radiances,Reflectances );
+ */
+
+struct TOASceneData;
+struct TOAConverterData;
+class TOAScene;
+
+// a scene from the text of its IMD and, if the IMD has no band
+// calibrations, of its XML ("" for none)
+TOAScene ParseTOAScene( const std::string&, const std::string& XMLText="" );
+
+// a scene filled in by the caller: satellite ID (e.g. WV03), Earth-sun
+// distance (AU), mean sun elevation (degrees) and DN bit depth, then
+// one band at a time by name (BAND_C, ...), absolute calibration
+// factor and effective bandwidth
+TOAScene MakeTOAScene( const std::string&, double, double, int BitsPerPixel=16 );
+void AddTOABand( TOAScene&, const std::string&, double, double );
+
+// what the conversion needs to know about a scene: the Earth-sun
+// distance, mean solar zenith angle, bit depth and (optionally) the
+// acquisition geometry, and the calibration of each band in the
+// order of the buffers' bands. A value; copies are independent.
+class TOAScene {
+  private:
+    std::unique_ptr<TOASceneData> Data;
+    friend TOAScene ParseTOAScene( const std::string&, const std::string& );
+    friend TOAScene MakeTOAScene( const std::string&, double, double, int );
+    friend void AddTOABand( TOAScene&, const std::string&, double, double );
+    friend class TOAConverter;
+
+  public:
+    TOAScene();
+    TOAScene( const TOAScene& );
+    TOAScene( TOAScene&& ) noexcept;
+    TOAScene& operator=( const TOAScene& );
+    TOAScene& operator=( TOAScene&& ) noexcept;
+    ~TOAScene();
+
+    std::string GetSatelliteID() const;
+    int GetBandCount() const;
+    std::string GetBandName( int ) const;      // band from 1
+};
+
+// a caller-owned image of Width x Height pixels of type T. Strides are
+// in bytes, so a band of a pixel-interleaved buffer or a window of a
+// larger image can be passed as is; 0 means packed.
+template<typename T>
+struct TOABuffer {
+  T* Data = nullptr;
+  int Width = 0;
+  int Height = 0;
+  size_t RowStride = 0;        // bytes from one row to the next, 0 = Width pixels
+  size_t PixelStride = 0;      // bytes from one pixel to the next, 0 = sizeof(T)
+
+  TOABuffer() {}
+  TOABuffer( T* BufferData, int BufferWidth, int BufferHeight, size_t BufferRowStride=0,
+    size_t BufferPixelStride=0 ) : Data( BufferData ), Width( BufferWidth ),
+    Height( BufferHeight ), RowStride( BufferRowStride ), PixelStride( BufferPixelStride ) {}
+
+  size_t GetPixelStride() const { return PixelStride ? PixelStride : sizeof(T); }
+  size_t GetRowStride() const { return RowStride ? RowStride : (size_t)Width*GetPixelStride(); }
+  T* GetRow( int Row ) const { return (T*)( (char*)Data+(size_t)Row*GetRowStride() ); }
+  bool IsPacked() const { return GetPixelStride() == sizeof(T); }
+};
+
+// the fused gains of one band: radiance = DN x RadianceGain and
+// reflectance = DN x ReflectanceGain (at the scene's mean zenith angle)
+struct TOABandGains {
+  std::string Name;
+  float RadianceGain;
+  float ReflectanceGain;
+  bool ReflectanceValid;       // false if no solar irradiance for the band
+};
+
+// converts the bands of one scene. The fused coefficients of every band
+// are built once, and, given the size of the full image, the grid of
+// per-pixel solar zenith angles. Convert() is const and may be called
+// from any number of threads at once, e.g. on separate rows of the same
+// band.
+class TOAConverter {
+  private:
+    std::unique_ptr<TOAConverterData> Data;
+
+  public:
+    // ImageRows x ImageCols > 0 converts with per-pixel solar zenith
+    // angles over an image of that size (throws if the scene has no
+    // geometry); 0 uses the scene's mean angle everywhere
+    explicit TOAConverter( const TOAScene&, int ImageRows=0, int ImageCols=0 );
+    TOAConverter( TOAConverter&& ) noexcept;
+    TOAConverter& operator=( TOAConverter&& ) noexcept;
+    ~TOAConverter();
+
+    int GetBandCount() const;
+    TOABandGains GetBandGains( int ) const;    // band from 1
+    const TOAScene& GetScene() const;
+
+    // convert a buffer of DNs of band Band (from 1) into radiances and
+    // reflectances of the same size, either of which may have no Data.
+    // DNs equal to NoDataValue, if HasNoData, become TOA_NODATA. X and
+    // Y place the buffer in the image, for per-pixel solar zenith
+    // angles. Instantiated for unsigned char, unsigned short, short,
+    // unsigned int and float.
+    template<typename TIn>
+    void Convert( int Band, const TOABuffer<const TIn>& DN, const TOABuffer<float>& Radiances,
+      const TOABuffer<float>& Reflectances, bool HasNoData=false, double NoDataValue=0.0,
+      int X=0, int Y=0 ) const;
+};
+#endif
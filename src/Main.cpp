@@ -10,6 +10,10 @@
 #include "Misc.h"
 #include "TOAUtil.h"
 #include "ImageUtil.h"
+#include "KernelUtil.h"
+#include "BatchUtil.h"
+#include "TileUtil.h"
+#include "ServeUtil.h"
 using namespace std; 
 
 /* ***********************************************
@@ -56,7 +60,101 @@ void usage() {
   cout << "       $ make                                                                          \n";
   cout << "       $ bin/toa -f {filename ntf|tif}                                                 \n";
   cout << "         -i {filename IMD}                                                             \n";
-  cout << "         -x {filename xml}                                                             \n";
+  cout << "         [-x {filename xml}]                                                           \n";
+  cout << "         [-k {scalar|sse4.1|avx2|avx512}] [-m {arith|lut}] [-b N]                      \n";
+  cout << "         [-r {auto|band|all}] [-z {ZSTD|DEFLATE|LZW|LERC|NONE}] [-c KEY=VALUE ...]      \n";
+  cout << "         [-C] [-p {pipeline|bands|tiles|sequential}] [-j N] [-q N] [-D {dir}]          \n";
+  cout << "         [-g {mean|grid}] [-P {profile json}] [-l {console|jsonl}[:{file}]] [-V]       \n";
+  cout << "       $ bin/toa -B {manifest csv|jsonl} [-o {status jsonl}] [-S N] [-M MB] [-j N]     \n";
+  cout << "         [other options as above]                                                      \n";
+  cout << "       $ bin/toa -t {filename TIL} -i {filename IMD} [-x {filename xml}]               \n";
+  cout << "         [-T {tiles|mosaic}] [-S N] [-M MB] [-j N] [other options as above]            \n";
+  cout << "       $ bin/toa --serve [-u {socket}] [-w {spool dir}] [-A N] [-S N] [-M MB] [-j N]   \n";
+  cout << "         [other options as above]                                                      \n";
+  cout << "                                                                                       \n";
+  cout << "     -x is optional: band calibrations are read from the IMD, and the XML only if      \n";
+  cout << "        the IMD has no BAND_* groups.                                                  \n";
+  cout << "     -k restricts the DN-to-TOA conversion kernel to an instruction set. By default    \n";
+  cout << "        the widest one supported by the CPU is used.                                   \n";
+  cout << "     -m selects how DNs are converted: arith (default) applies per-band gains,       \n";
+  cout << "        lut gathers from per-band tables sized to the IMD bitsPerPixel (Byte and       \n";
+  cout << "        UInt16 bands; other bands always use arith).                                   \n";
+  cout << "     -b reads and writes windows of N x N blocks of the input's natural block size.    \n";
+  cout << "        By default windows are sized automatically (at least 256 rows, ~8 Mpixels).    \n";
+  cout << "     -r band reads the image once per band, all reads every band of a window in one    \n";
+  cout << "        call. auto (default) uses all for pixel-interleaved or JPEG2000 inputs.        \n";
+  cout << "     -z sets the output compression. Default: ZSTD (DEFLATE if unavailable).           \n";
+  cout << "     -c sets any GTiff creation option of the outputs and may be repeated, e.g.        \n";
+  cout << "        -c ZLEVEL=9 -c BLOCKXSIZE=256 -c BLOCKYSIZE=256 -c BIGTIFF=YES. Defaults:      \n";
+  cout << "        TILED=YES BLOCKXSIZE=512 BLOCKYSIZE=512 PREDICTOR=3 BIGTIFF=IF_SAFER           \n";
+  cout << "        NUM_THREADS=ALL_CPUS INTERLEAVE=BAND. -c KEY= removes a default.               \n";
+  cout << "     -C writes Cloud-Optimized Geotiffs. Overviews are averaged from each window as    \n";
+  cout << "        it is converted, so no separate gdaladdo/COG conversion pass is needed.        \n";
+  cout << "     -p selects how work is spread over threads. pipeline (default) overlaps a reader  \n";
+  cout << "        thread, compute threads and one writer thread per output. bands converts      \n";
+  cout << "        several bands at once, each thread with its own handle to the input (always    \n";
+  cout << "        reads per band). tiles splits every band into block-aligned tiles run on a     \n";
+  cout << "        work-stealing pool, for single-band (PAN) scenes on many cores. sequential     \n";
+  cout << "        reads, converts and writes windows in turn. -s (deprecated) is -p sequential.  \n";
+  cout << "     -j number of compute threads: default min(4, cores) for the pipeline,             \n";
+  cout << "        min(bands, cores) for -p bands and one per core for -p tiles.                  \n";
+  cout << "     -q number of window buffers in flight in the pipeline (also the capacity of       \n";
+  cout << "        each queue). Default: compute threads + 3. Queue depths are reported.          \n";
+  cout << "     -D directory of cached scene metadata (calibration, solar geometry, image         \n";
+  cout << "        size), one record per scene.                                                   \n";
+  cout << "        Records are checked against the size, modification time, inode and a hash of   \n";
+  cout << "        the first and last 4 KB of each input used, and rewritten when stale; on a hit \n";
+  cout << "        the IMD and XML are not parsed.                                                \n";
+  cout << "     -g solar zenith angle of the reflectances: mean (default) uses the IMD meanSunEl  \n";
+  cout << "        for every pixel; grid computes it per pixel from the IMD line times and corner \n";
+  cout << "        coordinates, on a grid every 512 pixels anchored on meanSunEl, interpolated    \n";
+  cout << "        bilinearly in the conversion kernel (always the arith kernel).                 \n";
+  cout << "     -P file to write the stage timings of the scene to as JSON: wall and CPU seconds, \n";
+  cout << "        bytes, pixels and MPix/s of the GDAL setup, IMD and XML parsing, image open,   \n";
+  cout << "        coefficients, reads, conversion, writes and closing the outputs. The timings   \n";
+  cout << "        are always printed; batch status records (-o) always include them.             \n";
+  cout << "     -l reports progress while the bands are converted, at most once a second: percent \n";
+  cout << "        done, current band, MPix/s and ETA. console prints a line on stdout, jsonl one \n";
+  cout << "        JSON object per line on stderr (keys image, percent, phase, band, bands,       \n";
+  cout << "        pixels_done, pixels_total, mpix_per_s, elapsed_s, eta_s). :{file} writes the   \n";
+  cout << "        lines to a file instead. Also applies to batches and tiled scenes. With -C the \n";
+  cout << "        last quarter is the compressing copy to the COGs (phase writing COG).          \n";
+  cout << "     -V validation mode: checks that the fused per-band coefficients reproduce the     \n";
+  cout << "        original per-pixel formula for every 16-bit DN, then exits without writing     \n";
+  cout << "        any Geotiffs. Exit status is non-zero if any band fails.                       \n";
+  cout << "                                                                                       \n";
+  cout << "   INPUT DATA TYPES:                                                                   \n";
+  cout << "     Byte, UInt16, Int16, UInt32 and Float32 bands are read in their native type.      \n";
+  cout << "                                                                                       \n";
+  cout << "   BATCH MODE:                                                                         \n";
+  cout << "     -B converts every scene of a manifest in one process. CSV lines are               \n";
+  cout << "        image,imd[,xml[,radiances,reflectances]]; JSON lines are objects with the keys \n";
+  cout << "        image, imd and optionally xml, radiances, reflectances (output Geotiffs).      \n";
+  cout << "     -o file to write one JSON status/timing record per scene to. Default:             \n";
+  cout << "        {manifest}.status.jsonl. Exit status is non-zero if any scene failed.          \n";
+  cout << "     -S number of scenes converted at once. Default: threads / 4.                      \n";
+  cout << "     -M memory budget in MB shared by all scenes (window buffers and GDAL cache).      \n";
+  cout << "     -j in batch mode: total number of threads, split evenly between the scenes.       \n";
+  cout << "                                                                                       \n";
+  cout << "   TILED SCENES:                                                                       \n";
+  cout << "     -t converts every tile (R1C1, R1C2, ...) of a multi-tile delivery listed in its   \n";
+  cout << "        .TIL file. The IMD and XML are parsed once for all tiles; tiles run at once    \n";
+  cout << "        and share -S, -M and -j as the scenes of a batch do.                           \n";
+  cout << "     -T tiles (default) writes a pair of Geotiffs next to each tile; mosaic writes     \n";
+  cout << "        one pair for the whole scene, {TIL}_TOA_RADIANCES.TIF etc. (not with -C).      \n";
+  cout << "                                                                                       \n";
+  cout << "   SERVER MODE:                                                                        \n";
+  cout << "     --serve keeps GDAL registered and one worker per scene slot running, and takes    \n";
+  cout << "        jobs until a shutdown command, SIGINT or SIGTERM; admitted jobs are finished.  \n";
+  cout << "     -u Unix domain socket to take jobs on: one JSON object per line with the keys of  \n";
+  cout << "        a batch manifest and an optional id, answered by one status record per job     \n";
+  cout << "        (as -o, plus id and queue_seconds). status and shutdown commands are lines     \n";
+  cout << "        such as {command: status}, with command and status quoted. See bin/toa_client. \n";
+  cout << "     -w spool directory: each {name}.jsonl file of jobs is claimed, its records are    \n";
+  cout << "        written to {name}.jsonl.status and it is renamed {name}.jsonl.done.            \n";
+  cout << "     -A jobs that may wait for a slot (admission control). Socket jobs beyond it are   \n";
+  cout << "        rejected at once; spool jobs wait for room. Default: 4 per scene slot.         \n";
+  cout << "     -S, -M and -j share scene slots, memory and threads as in batch mode.             \n";
   cout << "                                                                                       \n";
   cout << "   EXAMPLE USAGE:                                                                      \n";
   cout << "                                                                                       \n";
@@ -81,6 +179,20 @@ void usage() {
   exit(1);
 }
 
+static void print_error_msg_and_exit( const char* Msg ) {
+/* **************************************************
+ * function print_error_msg_and_exit( const char * ):
+ *   Simple function to print an error message and
+ *   exit this program. 
+ */
+  cout << "\n";
+  cout << "   top-of-atmosphere conversion program encountered error:\n";
+  cout << Msg << "\n";
+  cout << "   exiting ... \n";
+  cout << endl;
+  exit(1);
+}
+
 int main( int argc , char* argv[] ) {
 
   /* initialize counter for getopt for obtaining
@@ -92,16 +204,38 @@ int main( int argc , char* argv[] ) {
   const char* img_filename = nullptr;
   const char* xml_filename = nullptr;
   const char* imd_filename = nullptr;
+  const char* manifest_filename = nullptr;
+  const char* til_filename = nullptr;
+  TileOutput TileOutputMode = TILE_OUTPUT_TILES;
+  String status_filename = "";
+  String profile_filename = "";
+  KernelISA ISA;
+  bool validate_only = false;
+  SceneOptions Options;
+  BatchBudget Budget;
+  bool serve = false;
+  ServeOptions Serve;
+
+  /* long options: --serve, and long names of the server's options */
+  enum { OPTION_SERVE = 256 };
+  static struct option long_options[] = {
+    { "serve",  no_argument,       nullptr,OPTION_SERVE },
+    { "socket", required_argument, nullptr,'u' },
+    { "spool",  required_argument, nullptr,'w' },
+    { "queue",  required_argument, nullptr,'A' },
+    { nullptr,  0,                 nullptr,0 }
+  };
 
   /* check to make sure script has correct number of
    * input arguments */
-  if( argc<4 )
+  if( argc<3 )
   {
     usage();
   }
 
   /* iterate through command-line args. */
-  while((opt=getopt(argc,argv,":f:i:x:h"))!=-1) {
+  while((opt=getopt_long(argc,argv,":f:i:x:k:m:b:r:z:c:Csp:j:q:B:o:S:M:D:t:T:g:P:l:u:w:A:Vh",
+    long_options,nullptr))!=-1) {
     switch(opt){
       case 'f':
         img_filename = optarg;
@@ -111,24 +245,235 @@ int main( int argc , char* argv[] ) {
 	break;
       case 'i':
 	imd_filename = optarg;
+	break;
+      case 'k':
+	if(!ParseKernelISA( (String)optarg,ISA )) {
+	  cout << "    Unrecognized kernel instruction set passed with -k flag: " << optarg << "\n";
+	  usage();
+	}
+	SetKernelISA( ISA );
+	break;
+      case 'm':
+	if(!ParseConversionMode( (String)optarg,Options.Mode )) {
+	  cout << "    Unrecognized conversion mode passed with -m flag: " << optarg << "\n";
+	  usage();
+	}
+	break;
+      case 'b':
+	Options.BlockMultiple = atoi( optarg );
+	if( Options.BlockMultiple<1 ) {
+	  cout << "    Block multiple passed with -b flag must be a positive integer.\n";
+	  usage();
+	}
+	break;
+      case 'r':
+	if( String(optarg) == "auto" )      Options.ReadMode = READ_AUTO;
+	else if( String(optarg) == "band" ) Options.ReadMode = READ_PER_BAND;
+	else if( String(optarg) == "all" )  Options.ReadMode = READ_ALL_BANDS;
+	else {
+	  cout << "    Unrecognized band read mode passed with -r flag: " << optarg << "\n";
+	  usage();
+	}
+	break;
+      case 'z':
+	Options.CreationOptions["COMPRESS"] = String(optarg);
+	break;
+      case 'c': {
+	String Option = String(optarg);
+	size_t Equals = Option.find("=");
+	if( Equals == String::npos || Equals == 0 ) {
+	  cout << "    Creation option passed with -c flag must be KEY=VALUE: " << optarg << "\n";
+	  usage();
+	}
+	Options.CreationOptions[Option.substr(0,Equals)] = Option.substr(Equals+1);
+	break;
+      }
+      case 'C':
+	Options.CloudOptimized = true;
+	break;
+      case 'p':
+	if( String(optarg) == "pipeline" )        Options.Processing = PROCESS_PIPELINE;
+	else if( String(optarg) == "bands" )      Options.Processing = PROCESS_BANDS;
+	else if( String(optarg) == "tiles" )      Options.Processing = PROCESS_TILES;
+	else if( String(optarg) == "sequential" ) Options.Processing = PROCESS_SEQUENTIAL;
+	else {
+	  cout << "    Unrecognized processing mode passed with -p flag: " << optarg << "\n";
+	  usage();
+	}
+	break;
+      case 's':
+	// deprecated: -s predates -p and is kept for existing scripts
+	cout << "    The -s flag is deprecated; use -p sequential.\n";
+	Options.Processing = PROCESS_SEQUENTIAL;
+	break;
+      case 'j':
+	Options.ComputeThreads = atoi( optarg );
+	Budget.Threads = Options.ComputeThreads;
+	if( Options.ComputeThreads<1 ) {
+	  cout << "    Number of compute threads passed with -j flag must be a positive integer.\n";
+	  usage();
+	}
+	break;
+      case 'q':
+	Options.QueueDepth = atoi( optarg );
+	if( Options.QueueDepth<1 ) {
+	  cout << "    Number of buffers passed with -q flag must be a positive integer.\n";
+	  usage();
+	}
+	break;
+      case 'B':
+	manifest_filename = optarg;
+	break;
+      case 'o':
+	status_filename = String(optarg);
+	break;
+      case 'S':
+	Budget.Scenes = atoi( optarg );
+	if( Budget.Scenes<1 ) {
+	  cout << "    Number of scenes passed with -S flag must be a positive integer.\n";
+	  usage();
+	}
+	break;
+      case 'M':
+	Budget.MemoryBytes = (size_t)atol( optarg )*1024*1024;
+	if( Budget.MemoryBytes<1 ) {
+	  cout << "    Memory budget passed with -M flag must be a positive number of megabytes.\n";
+	  usage();
+	}
+	break;
+      case 'D':
+	Options.MetadataCache = String(optarg);
+	break;
+      case 'P':
+	profile_filename = String(optarg);
+	break;
+      case 'l': {
+	String Mode = String(optarg);
+	size_t Colon = Mode.find( ':' );
+	if( Colon != String::npos ) {
+	  Options.ProgressStream = fopen( Mode.substr( Colon+1 ).c_str(),"w" );
+	  if( Options.ProgressStream == nullptr ) {
+	    cout << "    Unable to write progress file passed with -l flag: " << Mode.substr( Colon+1 ) << "\n";
+	    usage();
+	  }
+	  Mode = Mode.substr( 0,Colon );
+	}
+	if( Mode == "console" )    Options.Progress = PROGRESS_CONSOLE;
+	else if( Mode == "jsonl" ) Options.Progress = PROGRESS_JSONL;
+	else {
+	  cout << "    Unrecognized progress output passed with -l flag: " << optarg << "\n";
+	  usage();
+	}
+	break;
+      }
+      case 't':
+	til_filename = optarg;
+	break;
+      case 'T':
+	if( String(optarg) == "tiles" )       TileOutputMode = TILE_OUTPUT_TILES;
+	else if( String(optarg) == "mosaic" ) TileOutputMode = TILE_OUTPUT_MOSAIC;
+	else {
+	  cout << "    Unrecognized tile output passed with -T flag: " << optarg << "\n";
+	  usage();
+	}
+	break;
+      case 'g':
+	if( String(optarg) == "mean" )      Options.SolarMode = SOLAR_SCENE_MEAN;
+	else if( String(optarg) == "grid" ) Options.SolarMode = SOLAR_GRID;
+	else {
+	  cout << "    Unrecognized solar geometry passed with -g flag: " << optarg << "\n";
+	  usage();
+	}
+	break;
+      case 'V':
+	validate_only = true;
+	break;
+      case OPTION_SERVE:
+	serve = true;
+	break;
+      case 'u':
+	Serve.SocketPath = String(optarg);
+	break;
+      case 'w':
+	Serve.SpoolDirectory = String(optarg);
+	break;
+      case 'A':
+	Serve.QueueLimit = atoi( optarg );
+	if( Serve.QueueLimit<1 ) {
+	  cout << "    Number of queued jobs passed with -A flag must be a positive integer.\n";
+	  usage();
+	}
+	break;
       default:
         ; 
     }
   }
 
+ /* server mode: keep GDAL registered and the workers running, and
+  * take jobs from a socket or spool directory until told to stop.
+  */
+  if( serve ) {
+    if( Serve.SocketPath.empty() && Serve.SpoolDirectory.empty() ) {
+      cout << "    Please pass in a socket with -u or a spool directory with -w.      \n";
+      usage();
+    }
+    try {
+      RunServer( Options,Budget,Serve );
+    } catch( const std::exception& e ) {
+      print_error_msg_and_exit( e.what() );
+    }
+    GDALDestroyDriverManager();
+    print_datetime();
+    return 0;
+  }
+
+ /* batch mode: convert every scene of a manifest in this process,
+  * then exit non-zero if any scene failed.
+  */
+  if( manifest_filename ) {
+    if( status_filename.empty() ) status_filename = (String)manifest_filename+".status.jsonl";
+    int FailedScenes = 0;
+    try {
+      std::vector<SceneJob> Jobs = ReadSceneManifest( manifest_filename );
+      FailedScenes = RunBatch( Jobs,Options,Budget,status_filename );
+    } catch( const std::exception& e ) {
+      print_error_msg_and_exit( e.what() );
+    }
+    GDALDestroyDriverManager();
+    print_datetime();
+    return FailedScenes>0 ? 1 : 0;
+  }
+
+ /* tiled scene: convert every tile of a .TIL with the IMD and XML
+  * parsed once, then exit non-zero if any tile failed.
+  */
+  if( til_filename ) {
+    if( imd_filename == nullptr || !strlen(imd_filename) ) {
+      cout << "    Please pass in name of IMD file with -i flag (.IMD).          \n";
+      usage();
+    }
+    int FailedTiles = 0;
+    try {
+      FailedTiles = ConvertTiledScene( til_filename,imd_filename,xml_filename ? xml_filename : "",
+        Options,Budget,TileOutputMode );
+    } catch( const std::exception& e ) {
+      print_error_msg_and_exit( e.what() );
+    }
+    GDALDestroyDriverManager();
+    print_datetime();
+    return FailedTiles>0 ? 1 : 0;
+  }
+
  /* make sure user passed in 3 args:
   *   (1) NITF/NTF filename
   *   (2) XML filename
   *   (3) IMD filename
   * *********************************
   */
-  if(!strlen(img_filename))        {
+  if( img_filename == nullptr || !strlen(img_filename) ) {
     cout << "    Please pass in name of image file with -f flag (TIF/NITF/NTF).\n";
     usage();  
-  } else if(!strlen(xml_filename)) {
-    cout << "    Please pass in name of XML with -x flag (.XML or .xml).       \n";
-    usage();  
-  } else if(!strlen(imd_filename)) {
+  } else if( imd_filename == nullptr || !strlen(imd_filename) ) {
     cout << "    Please pass in name of IMD file with -i flag (.IMD).          \n";
     usage();  
   } 
@@ -139,8 +484,10 @@ int main( int argc , char* argv[] ) {
     cout << "    " << img_filename << "\n";
     cout << "  name of input IMD file (.IMD): " << endl;
     cout << "    " << imd_filename << "\n";
-    cout << "  name of input XML file (.XML): " << endl;
-    cout << "    " << xml_filename << "\n";
+    if( xml_filename ) {
+      cout << "  name of input XML file (.XML): " << endl;
+      cout << "    " << xml_filename << "\n";
+    }
   };
 
   /* make sure the input image file does indeed exist
@@ -167,7 +514,7 @@ int main( int argc , char* argv[] ) {
 
   /* make sure the XML file exists
    */
-  if(!file_exists(xml_filename)){
+  if( xml_filename && !file_exists(xml_filename)){
     cout << "  ERROR (fatal): file does not exist:\n";
     cout << "    " << xml_filename << "\n";
     cout << "  exiting at ...\n";
@@ -175,26 +522,49 @@ int main( int argc , char* argv[] ) {
     exit(1); 
   }
 
-  /* initialize C++ structure to hold all the
-   * metadata from the XML and IMD files for
-   * the NGA scene. 
-   */
-  SolarMetadata Metadata;
-  Metadata.earthSunDistance = (double)0.0;
-  Metadata.solarZenithAngle = (double)0.0;
-	  
-  /* now pass a POINTER to the structure so the 
-   * Earth-sun distance (in AU) is parsed and calculated, along with
-   * the solar zenith angle.
+  /* validation mode: check the fused coefficients of this scene's
+   * bands, without writing any Geotiffs.
    */
-  EarthSunDistance( imd_filename,&Metadata );
-  
-  /* read and set effective and absolute calibration factors */
-  std::map<String,String> CalibrationAndBandWidths = SetCalibrationAndBandWidth( 
-    imd_filename, xml_filename, img_filename );
-  
-  /* create ImageUtil object for purpose of calculating/writing TOA radiances/reflectances*/
-  ImageUtil Image(img_filename);
-  Image.WriteRadianceAndReflectanceGeotiffs( &Metadata,CalibrationAndBandWidths );  
+  SceneJob Job;
+  Job.ImageFilename = img_filename;
+  Job.IMDFilename   = imd_filename;
+  Job.XMLFilename   = xml_filename ? xml_filename : "";
+  try {
+    if( validate_only ) {
+      SceneMetadata Scene = LoadSceneMetadata( Job.ImageFilename,Job.IMDFilename,Job.XMLFilename,
+        Options.MetadataCache );
+      bool Passed = false;
+      {
+        ImageUtil Image( Scene );
+        ApplySceneOptions( Image,Options );
+        Passed = Image.ValidateBandCoefficients( &Scene.Solar,Scene.Calibration,
+          COEFFICIENT_TOLERANCE_ULP );
+      }
+      cout << ( Passed ? "  validation passed\n" : "  validation FAILED\n" );
+      Scene.Dataset.reset();
+      GDALDestroyDriverManager();
+      return Passed ? 0 : 1;
+    }
+
+    /* parse the IMD and XML metadata (Earth-sun distance, solar zenith
+     * angle, calibration factors and bandwidths) and write the
+     * radiances and reflectances Geotiffs, timing every stage.
+     */
+    SceneProfile Profile;
+    ConvertScene( Job,Options,&Profile );
+    Profile.Print();
+    if( !profile_filename.empty() ) {
+      std::ofstream ProfileFile( profile_filename );
+      if( !ProfileFile ) {
+        throw std::runtime_error( "  ERROR (fatal): unable to write profile file: "+profile_filename );
+      }
+      ProfileFile << "{\"image\": " << JSONString( Job.ImageFilename )
+                  << ", \"profile\": " << Profile.ToJSON() << "}" << std::endl;
+      cout << "  stage timings written to: " << profile_filename << "\n";
+    }
+  } catch( const std::exception& e ) {
+    print_error_msg_and_exit( e.what() );
+  }
+  GDALDestroyDriverManager();
   return 0;
 }
@@ -2,7 +2,11 @@
 #include <sys/stat.h>
 #include <fstream>
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
 #include <string>
+#include <stdexcept>
+#include <stdio.h>
 #include "Misc.h"
 using namespace std;
 const String WHITESPACE = " \n\r\t\f\v";
@@ -51,20 +55,6 @@ void print_datetime() {
   cout << "  " << start_dt << endl;
 }
 
-void print_error_msg_and_exit( const char* Msg ) {
-/* **************************************************
- * function print_error_msg_and_exit( const char * ):
- *   Simple function to print an error message and
- *   exit this program. 
- */
-  cout << "\n";
-  cout << "   top-of-atmosphere conversion program encountered error:\n";
-  cout << Msg << "\n";
-  cout << "   exiting ... \n";
-  cout << endl;
-  exit(1);
-}
-
 /* ****************************************
  * C++ inline function to check to see if a
  * file exists.
@@ -85,3 +75,65 @@ bool file_exists( const std::string& filename ) { // note: C++ reference paramet
     return false;
   }
 }
+
+String JSONString( const String& Text ) {
+  /* ****************************************
+   * Quote and escape a string for a JSON
+   * document.
+   * ****************************************
+   */
+  String Quoted = "\"";
+  for( unsigned char c: Text ) {
+    switch( c ) {
+      case '"':  Quoted += "\\\""; break;
+      case '\\': Quoted += "\\\\"; break;
+      case '\n': Quoted += "\\n";  break;
+      case '\r': Quoted += "\\r";  break;
+      case '\t': Quoted += "\\t";  break;
+      default:
+        if( c<0x20 ) {
+          char Escaped[8];
+          snprintf( Escaped,sizeof(Escaped),"\\u%04x",c );
+          Quoted += Escaped;
+        } else {
+          Quoted += (char)c;
+        }
+    }
+  }
+  return Quoted+"\"";
+}
+
+MappedFile::MappedFile( const String& Filename, bool Writable ) {
+  /* ****************************************
+   * Map the file. A writable mapping is private:
+   * pages are copied only when written, so a
+   * parser that works in place costs no copy of
+   * the parts it never touches. An empty file
+   * maps to no data.
+   * ****************************************
+   */
+  int File = open( Filename.c_str(),O_RDONLY );
+  if( File<0 ) {
+    throw std::runtime_error( "  ERROR (fatal): unable to open file: "+Filename );
+  }
+  struct stat Status;
+  if( fstat( File,&Status ) != 0 ) {
+    close( File );
+    throw std::runtime_error( "  ERROR (fatal): unable to stat file: "+Filename );
+  }
+  Size = (size_t)Status.st_size;
+  if( Size>0 ) {
+    int Protection = Writable ? ( PROT_READ|PROT_WRITE ) : PROT_READ;
+    void* Mapping = mmap( nullptr,Size,Protection,MAP_PRIVATE,File,0 );
+    if( Mapping == MAP_FAILED ) {
+      close( File );
+      throw std::runtime_error( "  ERROR (fatal): unable to map file: "+Filename );
+    }
+    Data = (char*)Mapping;
+  }
+  close( File );
+}
+
+MappedFile::~MappedFile() {
+  if( Data ) munmap( Data,Size );
+}
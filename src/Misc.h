@@ -1,12 +1,32 @@
 #ifndef MISC_H_
 #define MISC_H_
 #include <iostream>
+#include <cstddef>
 typedef std::string String;
 String GetExtension( String );
 String ltrim(const String &s);
 String rtrim(const String &s);
 String trim(const String &s);
 void print_datetime();
-void print_error_msg_and_exit( const char* );
 bool file_exists( const std::string& );
+
+// quote a string for a JSON document
+String JSONString( const String& );
+
+// a whole file mapped into memory, read-only or copy-on-write (changes
+// stay private to the process and never reach the file). Throws if the
+// file cannot be opened or mapped.
+class MappedFile {
+  private:
+    char* Data  = nullptr;
+    size_t Size = 0;
+
+  public:
+    explicit MappedFile( const String&, bool Writable=false );
+    ~MappedFile();
+    MappedFile( const MappedFile& ) = delete;
+    MappedFile& operator=( const MappedFile& ) = delete;
+    char* GetData() { return Data; }
+    size_t GetSize() const { return Size; }
+};
 #endif
@@ -0,0 +1,117 @@
+#include "PipelineUtil.h"
+#include <stdio.h>
+#include <thread>
+#include <algorithm>
+
+void PrintQueueStats( const String& Name, const QueueStats& Stats ) {
+  /* *******************************************************************
+   * Report how full a queue ran. A queue that is usually at capacity
+   * with a blocked producer means the next stage is the bottleneck; one
+   * that is usually empty with blocked consumers means the previous
+   * stage is.
+   */
+  printf("    %-20s depth mean %5.2f max %2zu of %2zu  producer blocked %7.3f s  consumer idle %7.3f s\n",
+    Name.c_str(),Stats.MeanDepth,Stats.MaxDepth,Stats.Capacity,Stats.PushWaitSeconds,
+    Stats.PopWaitSeconds );
+}
+
+int HardwareThreads() {
+  /* *******************************************************************
+   * std::thread::hardware_concurrency() may return 0 when it cannot
+   * tell; treat that as a single core.
+   */
+  unsigned int Threads = std::thread::hardware_concurrency();
+  return Threads>0 ? (int)Threads : 1;
+}
+
+WorkStealingPool::WorkStealingPool( int WorkerCount ) {
+  Workers = WorkerCount>0 ? WorkerCount : 1;
+  for( int w=0; w<Workers; w++ ) {
+    Queues.emplace_back( new WorkerQueue );
+  }
+  Counters.assign( Workers,WorkerStats{ 0,0,0.0,0.0 } );
+}
+
+bool WorkStealingPool::Take( int Worker, size_t& Task, bool& Stolen ) {
+  /* *******************************************************************
+   * Next task for a worker: the front of its own queue, or else the
+   * back of the first non-empty queue after it. Tasks are never added
+   * during a run, so when every queue is empty the worker is done.
+   */
+  {
+    WorkerQueue& Own = *Queues[Worker];
+    std::lock_guard<std::mutex> Guard( Own.Lock );
+    if( !Own.Tasks.empty() ) {
+      Task = Own.Tasks.front();
+      Own.Tasks.pop_front();
+      Stolen = false;
+      return true;
+    }
+  }
+  for( int i=1; i<Workers; i++ ) {
+    WorkerQueue& Victim = *Queues[( Worker+i )%Workers];
+    std::lock_guard<std::mutex> Guard( Victim.Lock );
+    if( !Victim.Tasks.empty() ) {
+      Task = Victim.Tasks.back();
+      Victim.Tasks.pop_back();
+      Stolen = true;
+      return true;
+    }
+  }
+  return false;
+}
+
+void WorkStealingPool::Run( size_t Count, const std::function<void(int,size_t)>& Task ) {
+  /* *******************************************************************
+   * Run Task(worker,index) for every index in 0..Count-1 and return
+   * when all are done. Neighbouring indices start on the same worker,
+   * so a worker that is not stolen from walks its share in order.
+   */
+  for( int w=0; w<Workers; w++ ) {
+    size_t First = Count*w/Workers;
+    size_t Last  = Count*( w+1 )/Workers;
+    Queues[w]->Tasks.clear();
+    for( size_t i=First; i<Last; i++ ) Queues[w]->Tasks.push_back( i );
+  }
+  Counters.assign( Workers,WorkerStats{ 0,0,0.0,0.0 } );
+
+  auto Start = std::chrono::steady_clock::now();
+  std::vector<std::thread> Threads;
+  for( int w=0; w<Workers; w++ ) {
+    Threads.emplace_back( [this,w,&Task]() {
+      size_t Next = 0;
+      bool Stolen = false;
+      while( this->Take( w,Next,Stolen )) {
+        auto TaskStart = std::chrono::steady_clock::now();
+        Task( w,Next );
+        Counters[w].BusySeconds += std::chrono::duration<double>( 
+          std::chrono::steady_clock::now()-TaskStart ).count();
+        Counters[w].Tasks++;
+        if( Stolen ) Counters[w].Stolen++;
+      }
+    });
+  }
+  for( std::thread& Thread: Threads ) Thread.join();
+  WallSeconds = std::chrono::duration<double>( std::chrono::steady_clock::now()-Start ).count();
+}
+
+void PrintWorkerStats( const WorkStealingPool& Pool ) {
+  /* *******************************************************************
+   * Utilization is the share of the run's wall time a worker spent in
+   * tasks, less the time its tasks reported waiting on locks (see
+   * WorkStealingPool::AddWaitSeconds()), which is printed separately.
+   */
+  const std::vector<WorkerStats>& Stats = Pool.GetStats();
+  double Wall = std::max( Pool.GetWallSeconds(),1e-9 );
+  double Busy = 0.0, Wait = 0.0;
+  printf("  worker utilization over %.3f s:\n",Pool.GetWallSeconds() );
+  for( size_t w=0; w<Stats.size(); w++ ) {
+    double Working = Stats[w].BusySeconds-Stats[w].WaitSeconds;
+    printf("    worker %3zu  %6ld tasks (%5ld stolen)  busy %8.3f s  %5.1f%%  lock wait %8.3f s\n",w,
+      Stats[w].Tasks,Stats[w].Stolen,Working,100.0*Working/Wall,Stats[w].WaitSeconds );
+    Busy += Working;
+    Wait += Stats[w].WaitSeconds;
+  }
+  printf("    mean utilization %5.1f%%, mean lock wait %5.1f%%\n",100.0*Busy/( Wall*(double)Stats.size() ),
+    100.0*Wait/( Wall*(double)Stats.size() ));
+}
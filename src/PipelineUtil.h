@@ -0,0 +1,141 @@
+#ifndef PIPELINEUTIL_H_
+#define PIPELINEUTIL_H_
+#include <cstddef>
+#include <string>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <vector>
+#include <memory>
+#include <functional>
+typedef std::string String;
+
+// occupancy of a BoundedQueue over its lifetime, used to tune the number
+// of buffers in flight. Depths are sampled each time an item is popped;
+// the wait times are how long producers were blocked on a full queue and
+// consumers on an empty one.
+struct QueueStats {
+  size_t Capacity;
+  size_t MaxDepth;
+  double MeanDepth;
+  long Items;
+  double PushWaitSeconds;
+  double PopWaitSeconds;
+};
+
+// a fixed-capacity FIFO between pipeline stages. Push() blocks while the
+// queue is full, Pop() while it is empty. Close() wakes everyone: pushes
+// then fail, and pops drain what is left and then fail.
+template<typename T>
+class BoundedQueue {
+  private:
+    std::mutex Lock;
+    std::condition_variable NotEmpty;
+    std::condition_variable NotFull;
+    std::deque<T> Items;
+    size_t Capacity;
+    bool Closed = false;
+    size_t MaxDepth = 0;
+    double DepthSum = 0.0;
+    long Pops = 0;
+    double PushWait = 0.0;
+    double PopWait = 0.0;
+
+  public:
+    explicit BoundedQueue( size_t QueueCapacity ) : Capacity( QueueCapacity>0 ? QueueCapacity : 1 ) {}
+
+    bool Push( T Item ) {
+      std::unique_lock<std::mutex> Guard( Lock );
+      if( Items.size()>=Capacity && !Closed ) {
+        auto Start = std::chrono::steady_clock::now();
+        NotFull.wait( Guard,[this]{ return Items.size()<Capacity || Closed; } );
+        PushWait += std::chrono::duration<double>( std::chrono::steady_clock::now()-Start ).count();
+      }
+      if( Closed ) return false;
+      Items.push_back( Item );
+      if( Items.size()>MaxDepth ) MaxDepth = Items.size();
+      NotEmpty.notify_one();
+      return true;
+    }
+
+    bool Pop( T& Item ) {
+      std::unique_lock<std::mutex> Guard( Lock );
+      if( Items.empty() && !Closed ) {
+        auto Start = std::chrono::steady_clock::now();
+        NotEmpty.wait( Guard,[this]{ return !Items.empty() || Closed; } );
+        PopWait += std::chrono::duration<double>( std::chrono::steady_clock::now()-Start ).count();
+      }
+      if( Items.empty() ) return false;
+      DepthSum += (double)Items.size();
+      Pops++;
+      Item = Items.front();
+      Items.pop_front();
+      NotFull.notify_one();
+      return true;
+    }
+
+    void Close() {
+      std::lock_guard<std::mutex> Guard( Lock );
+      Closed = true;
+      NotEmpty.notify_all();
+      NotFull.notify_all();
+    }
+
+    QueueStats Stats() {
+      std::lock_guard<std::mutex> Guard( Lock );
+      QueueStats S;
+      S.Capacity        = Capacity;
+      S.MaxDepth        = MaxDepth;
+      S.MeanDepth       = Pops>0 ? DepthSum/(double)Pops : 0.0;
+      S.Items           = Pops;
+      S.PushWaitSeconds = PushWait;
+      S.PopWaitSeconds  = PopWait;
+      return S;
+    }
+};
+
+// per-worker counters of a WorkStealingPool run
+struct WorkerStats {
+  long Tasks;            // tasks run, including stolen ones
+  long Stolen;           // tasks taken from another worker's queue
+  double BusySeconds;    // time spent inside tasks
+  double WaitSeconds;    // part of it spent waiting on locks, as reported by the tasks
+};
+
+// a fixed set of worker threads running a known number of independent
+// tasks. Each worker starts with a contiguous share of the tasks in its
+// own queue and takes them front to back; a worker whose queue is empty
+// steals from the back of another's, so uneven tasks still keep every
+// worker busy until the last one finishes.
+class WorkStealingPool {
+  private:
+    struct WorkerQueue {
+      std::mutex Lock;
+      std::deque<size_t> Tasks;
+    };
+    int Workers;
+    std::vector<std::unique_ptr<WorkerQueue>> Queues;
+    std::vector<WorkerStats> Counters;
+    double WallSeconds = 0.0;
+    bool Take( int,size_t&,bool& );
+
+  public:
+    explicit WorkStealingPool( int );
+    void Run( size_t,const std::function<void(int,size_t)>& );
+    void AddWaitSeconds( int Worker, double Seconds ) { Counters[Worker].WaitSeconds += Seconds; }
+    int GetWorkers() const { return Workers; }
+    const std::vector<WorkerStats>& GetStats() const { return Counters; }
+    double GetWallSeconds() const { return WallSeconds; }
+};
+
+// print the tasks, steals and utilization of every worker of a pool
+void PrintWorkerStats( const WorkStealingPool& );
+
+// print one line of queue statistics, prefixed by the queue's name
+void PrintQueueStats( const String&, const QueueStats& );
+
+// number of hardware threads, at least 1
+int HardwareThreads();
+
+#endif
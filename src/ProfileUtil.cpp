@@ -0,0 +1,116 @@
+#include <sstream>
+#include <stdio.h>
+#include <time.h>
+#include "ProfileUtil.h"
+
+static int64_t ClockNanoseconds( clockid_t Clock ) {
+  struct timespec Now;
+  clock_gettime( Clock,&Now );
+  return (int64_t)Now.tv_sec*1000000000LL+Now.tv_nsec;
+}
+
+const char* ProfileStageName( ProfileStage Stage ) {
+  switch( Stage ) {
+    case STAGE_GDAL_INIT:    return "gdal_init";
+    case STAGE_IMD_PARSE:    return "imd_parse";
+    case STAGE_XML_PARSE:    return "xml_parse";
+    case STAGE_DATASET_OPEN: return "dataset_open";
+    case STAGE_COEFFICIENTS: return "coefficients";
+    case STAGE_READ:         return "read";
+    case STAGE_COMPUTE:      return "compute";
+    case STAGE_WRITE:        return "write";
+    case STAGE_CLOSE:        return "close";
+    default:                 return "unknown";
+  }
+}
+
+SceneProfile::SceneProfile() : Start( std::chrono::steady_clock::now() ) {}
+
+void SceneProfile::Add( ProfileStage Stage, int64_t WallNanoseconds, int64_t CPUNanoseconds,
+  uint64_t Bytes, uint64_t Pixels ) {
+  StageCounters& Counters = Stages[Stage];
+  Counters.WallNanoseconds += WallNanoseconds;
+  Counters.CPUNanoseconds  += CPUNanoseconds;
+  Counters.Bytes  += Bytes;
+  Counters.Pixels += Pixels;
+  Counters.Calls++;
+}
+
+StageTotals SceneProfile::GetStage( ProfileStage Stage ) const {
+  const StageCounters& Counters = Stages[Stage];
+  StageTotals Totals;
+  Totals.WallSeconds = 1e-9*(double)Counters.WallNanoseconds.load();
+  Totals.CPUSeconds  = 1e-9*(double)Counters.CPUNanoseconds.load();
+  Totals.Bytes  = Counters.Bytes.load();
+  Totals.Pixels = Counters.Pixels.load();
+  Totals.Calls  = Counters.Calls.load();
+  return Totals;
+}
+
+void SceneProfile::Finish() {
+  ElapsedSeconds = std::chrono::duration<double>( std::chrono::steady_clock::now()-Start ).count();
+}
+
+double SceneProfile::GetElapsedSeconds() const {
+  if( ElapsedSeconds>=0.0 ) return ElapsedSeconds;
+  return std::chrono::duration<double>( std::chrono::steady_clock::now()-Start ).count();
+}
+
+String SceneProfile::ToJSON() const {
+  /* *********************************************************************
+   * {"seconds": 12.3, "pixels": N, "mpix_per_s": x, "bytes_read": N,
+   *  "bytes_written": N, "stages": {"gdal_init": {"wall_seconds": ...,
+   *  "cpu_seconds": ..., "bytes": ..., "pixels": ..., "calls": ...,
+   *  "mpix_per_s": ...}, ...}}
+   * MPix/s of a stage is its pixels over its summed wall seconds.
+   */
+  double Seconds = this->GetElapsedSeconds();
+  std::ostringstream JSON;
+  JSON.precision( 6 );
+  JSON << "{\"seconds\": " << Seconds << ", \"pixels\": " << ScenePixels
+       << ", \"mpix_per_s\": " << ( Seconds>0.0 ? (double)ScenePixels/Seconds/1e6 : 0.0 )
+       << ", \"bytes_read\": " << GetStage( STAGE_READ ).Bytes
+       << ", \"bytes_written\": " << GetStage( STAGE_WRITE ).Bytes << ", \"stages\": {";
+  for( int s=0; s<STAGE_COUNT; s++ ) {
+    StageTotals Totals = GetStage( (ProfileStage)s );
+    JSON << ( s ? ", " : "" ) << "\"" << ProfileStageName( (ProfileStage)s ) << "\": {"
+         << "\"wall_seconds\": " << Totals.WallSeconds << ", \"cpu_seconds\": " << Totals.CPUSeconds
+         << ", \"bytes\": " << Totals.Bytes << ", \"pixels\": " << Totals.Pixels
+         << ", \"calls\": " << Totals.Calls << ", \"mpix_per_s\": "
+         << ( Totals.WallSeconds>0.0 ? (double)Totals.Pixels/Totals.WallSeconds/1e6 : 0.0 ) << "}";
+  }
+  JSON << "}}";
+  return JSON.str();
+}
+
+void SceneProfile::Print() const {
+  /* the stage totals as a table on the console */
+  double Seconds = this->GetElapsedSeconds();
+  printf("  stage timings (%.3f s, %.1f MPix/s; seconds summed over threads):\n",Seconds,
+    Seconds>0.0 ? (double)ScenePixels/Seconds/1e6 : 0.0 );
+  printf("    %-14s %10s %10s %10s %10s\n","stage","wall s","cpu s","MB","MPix/s");
+  for( int s=0; s<STAGE_COUNT; s++ ) {
+    StageTotals Totals = GetStage( (ProfileStage)s );
+    if( Totals.Calls == 0 ) continue;
+    printf("    %-14s %10.3f %10.3f %10.1f %10.1f\n",ProfileStageName( (ProfileStage)s ),
+      Totals.WallSeconds,Totals.CPUSeconds,(double)Totals.Bytes/1e6,
+      Totals.WallSeconds>0.0 ? (double)Totals.Pixels/Totals.WallSeconds/1e6 : 0.0 );
+  }
+}
+
+StageTimer::StageTimer( SceneProfile* TimedProfile, ProfileStage TimedStage,
+  uint64_t StageBytes, uint64_t StagePixels ) : Profile( TimedProfile ), Stage( TimedStage ),
+  Bytes( StageBytes ), Pixels( StagePixels ), WallStart( 0 ), CPUStart( 0 ) {
+  if( Profile == nullptr ) return;
+  WallStart = ClockNanoseconds( CLOCK_MONOTONIC );
+  CPUStart  = ClockNanoseconds( CLOCK_THREAD_CPUTIME_ID );
+}
+
+void StageTimer::Stop() {
+  /* add the time since construction to the profile, once */
+  if( Profile == nullptr ) return;
+  int64_t Wall = ClockNanoseconds( CLOCK_MONOTONIC )-WallStart;
+  int64_t CPU  = ClockNanoseconds( CLOCK_THREAD_CPUTIME_ID )-CPUStart;
+  Profile->Add( Stage,Wall,CPU,Bytes,Pixels );
+  Profile = nullptr;
+}
@@ -0,0 +1,95 @@
+#ifndef PROFILEUTIL_H_
+#define PROFILEUTIL_H_
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <chrono>
+#include <string>
+typedef std::string String;
+
+// the stages of converting a scene timed by a SceneProfile
+enum ProfileStage {
+  STAGE_GDAL_INIT = 0,      // registering the GDAL drivers
+  STAGE_IMD_PARSE,          // solar geometry, bit depth (and calibrations) from the IMD
+  STAGE_XML_PARSE,          // band calibrations from the XML
+  STAGE_DATASET_OPEN,       // opening the image and reading its header
+  STAGE_COEFFICIENTS,       // fused per-band coefficients (and the solar grid)
+  STAGE_READ,               // reading DN windows
+  STAGE_COMPUTE,            // converting DNs to radiances and reflectances
+  STAGE_WRITE,              // writing windows and overviews
+  STAGE_CLOSE,              // flushing and closing the outputs
+  STAGE_COUNT
+};
+
+// what one stage took. Times are summed over calls and threads, so a
+// stage that runs on several threads at once can add up to more
+// seconds than the scene took; CPU seconds well below wall seconds mark
+// a stage that waited (on I/O, or on a lock).
+struct StageTotals {
+  double WallSeconds;
+  double CPUSeconds;
+  uint64_t Bytes;
+  uint64_t Pixels;
+  uint64_t Calls;
+};
+
+// per-stage wall time, CPU time, bytes and pixels of one scene. The
+// counters are atomic, so the threads of a scene can add to the same
+// profile without locking.
+class SceneProfile {
+  private:
+    struct StageCounters {
+      std::atomic<int64_t> WallNanoseconds{ 0 };
+      std::atomic<int64_t> CPUNanoseconds{ 0 };
+      std::atomic<uint64_t> Bytes{ 0 };
+      std::atomic<uint64_t> Pixels{ 0 };
+      std::atomic<uint64_t> Calls{ 0 };
+    };
+    StageCounters Stages[STAGE_COUNT];
+    std::chrono::steady_clock::time_point Start;
+    double ElapsedSeconds = -1.0;   // set by Finish()
+    uint64_t ScenePixels = 0;
+
+  public:
+    SceneProfile();
+    SceneProfile( const SceneProfile& ) = delete;
+    SceneProfile& operator=( const SceneProfile& ) = delete;
+
+    void Add( ProfileStage, int64_t, int64_t, uint64_t, uint64_t );
+    StageTotals GetStage( ProfileStage ) const;
+
+    // pixels of the scene (rows x columns x bands), for its MPix/s
+    void SetScenePixels( uint64_t Pixels ) { ScenePixels = Pixels; }
+
+    // stop the scene's clock (started at construction)
+    void Finish();
+    double GetElapsedSeconds() const;
+
+    // a JSON object of the scene and stage totals, and a console table
+    String ToJSON() const;
+    void Print() const;
+};
+
+// times one stage on the calling thread from construction until Stop()
+// or destruction, and adds it to a profile. Does nothing without one.
+class StageTimer {
+  private:
+    SceneProfile* Profile;
+    ProfileStage Stage;
+    uint64_t Bytes;
+    uint64_t Pixels;
+    int64_t WallStart;
+    int64_t CPUStart;
+
+  public:
+    StageTimer( SceneProfile*, ProfileStage, uint64_t Bytes=0, uint64_t Pixels=0 );
+    ~StageTimer() { Stop(); }
+    StageTimer( const StageTimer& ) = delete;
+    StageTimer& operator=( const StageTimer& ) = delete;
+    void AddBytes( uint64_t MoreBytes, uint64_t MorePixels=0 ) { Bytes += MoreBytes; Pixels += MorePixels; }
+    void Stop();
+};
+
+// name of a stage in reports, e.g. "imd_parse"
+const char* ProfileStageName( ProfileStage );
+#endif
@@ -0,0 +1,181 @@
+#include <algorithm>
+#include <stdio.h>
+#include "ProgressUtil.h"
+#include "Misc.h"
+
+SceneProgress::SceneProgress( GDALProgressFunc ProgressCallback, void* ProgressData,
+  double IntervalSeconds ) : Callback( ProgressCallback ), CallbackData( ProgressData ),
+  IntervalNanoseconds( (int64_t)( 1e9*IntervalSeconds )), StartTime( std::chrono::steady_clock::now() ) {}
+
+void SceneProgress::Start( uint64_t Pixels, int SceneBands, double FinalPhaseShare ) {
+  /* *********************************************************************
+   * Reset the counters and the clock for a scene, and report 0%. Called
+   * by ImageUtil once the outputs are created, before the first window.
+   */
+  PixelsTotal = Pixels;
+  Bands       = SceneBands;
+  PixelsDone  = 0;
+  Band        = 0;
+  Cancelled   = false;
+  PhaseShare  = std::min( std::max( FinalPhaseShare,0.0 ),1.0 );
+  PhaseName   = nullptr;
+  InPhase     = false;
+  PhaseDone   = 0.0;
+  StartTime   = std::chrono::steady_clock::now();
+  LastReport  = 0;
+  std::lock_guard<std::mutex> Guard( ReportLock );
+  this->Report();
+}
+
+bool SceneProgress::Advance( uint64_t Pixels, int ForBand ) {
+  /* count a converted and written window, and report if due */
+  PixelsDone += Pixels;
+  Band = ForBand;
+  this->ReportIfDue();
+  return !Cancelled;
+}
+
+void SceneProgress::StartPhase( const char* Name ) {
+  /* *********************************************************************
+   * Begin the final phase: every pixel is done, and from here on the
+   * reports follow AdvancePhase() within the share given to Start().
+   */
+  std::lock_guard<std::mutex> Guard( ReportLock );
+  PixelsDone     = std::max( PixelsDone.load(),PixelsTotal );
+  PhaseName      = Name;
+  PhaseDone      = 0.0;
+  PhaseStartTime = std::chrono::steady_clock::now();
+  InPhase        = true;
+  this->Report();
+}
+
+bool SceneProgress::AdvancePhase( double Fraction ) {
+  PhaseDone = std::min( std::max( Fraction,0.0 ),1.0 );
+  this->ReportIfDue();
+  return !Cancelled;
+}
+
+void SceneProgress::Finish() {
+  std::lock_guard<std::mutex> Guard( ReportLock );
+  PixelsDone = std::max( PixelsDone.load(),PixelsTotal );
+  if( InPhase ) PhaseDone = 1.0;
+  else          PhaseShare = 0.0;
+  this->Report();
+}
+
+void SceneProgress::ReportIfDue() {
+  /* *********************************************************************
+   * Report if the interval has passed. The clock is checked without
+   * locking; the thread that finds the interval passed reports, and any
+   * other thread that arrives meanwhile carries on without waiting.
+   */
+  int64_t Now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now()-StartTime ).count();
+  if( Now-LastReport.load()>=IntervalNanoseconds ) {
+    std::unique_lock<std::mutex> Guard( ReportLock,std::try_to_lock );
+    if( Guard.owns_lock() && Now-LastReport.load()>=IntervalNanoseconds ) {
+      LastReport = Now;
+      this->Report();
+    }
+  }
+}
+
+void SceneProgress::Report() {
+  /* call the callback (ReportLock held); FALSE from it cancels */
+  if( Callback == nullptr ) return;
+  ProgressStatus Status = this->GetStatus();
+  if( !Callback( Status.Fraction,FormatProgress( Status ).c_str(),CallbackData )) {
+    Cancelled = true;
+  }
+}
+
+ProgressStatus SceneProgress::GetStatus() const {
+  /* *********************************************************************
+   * The pixels make up 1-PhaseShare of the fraction and the final phase
+   * the rest; in the final phase the ETA is that of the phase, from its
+   * own rate so far.
+   */
+  ProgressStatus Status;
+  auto Now = std::chrono::steady_clock::now();
+  Status.PixelsDone     = std::min( PixelsDone.load(),PixelsTotal );
+  Status.PixelsTotal    = PixelsTotal;
+  Status.Band           = Band;
+  Status.Bands          = Bands;
+  Status.Phase          = InPhase ? PhaseName : nullptr;
+  Status.PhaseFraction  = PhaseDone;
+  double PixelFraction  = ( PixelsTotal>0 ) ? (double)Status.PixelsDone/(double)PixelsTotal : 0.0;
+  Status.Fraction       = ( 1.0-PhaseShare )*PixelFraction+PhaseShare*Status.PhaseFraction;
+  Status.ElapsedSeconds = std::chrono::duration<double>( Now-StartTime ).count();
+  Status.MPixPerSecond  = ( Status.ElapsedSeconds>0.0 ) ? (double)Status.PixelsDone/Status.ElapsedSeconds/1e6 : 0.0;
+  if( Status.Phase ) {
+    double PhaseSeconds = std::chrono::duration<double>( Now-PhaseStartTime ).count();
+    Status.ETASeconds   = ( Status.PhaseFraction>0.0 ) ?
+      PhaseSeconds*( 1.0-Status.PhaseFraction )/Status.PhaseFraction : -1.0;
+  } else {
+    Status.ETASeconds   = ( Status.PixelsDone>0 ) ?
+      Status.ElapsedSeconds*(double)( PixelsTotal-Status.PixelsDone )/(double)Status.PixelsDone : -1.0;
+  }
+  return Status;
+}
+
+String FormatProgress( const ProgressStatus& Status ) {
+  /* "band 3 of 8, 142.5 MPix/s, ETA 0:42" ("all 8 bands" when read
+     together), or "writing COG 35%, ETA 0:12" in the final phase */
+  char Message[128];
+  char Bands[32];
+  if( Status.Phase ) {
+    int Percent = (int)( 100.0*Status.PhaseFraction );
+    if( Status.ETASeconds<0.0 ) {
+      snprintf( Message,sizeof(Message),"%s %d%%, ETA -",Status.Phase,Percent );
+    } else {
+      long ETA = (long)( Status.ETASeconds+0.5 );
+      snprintf( Message,sizeof(Message),"%s %d%%, ETA %ld:%02ld",Status.Phase,Percent,ETA/60,ETA%60 );
+    }
+    return Message;
+  }
+  if( Status.PixelsDone == 0 ) {
+    snprintf( Message,sizeof(Message),"starting, %d band%s",Status.Bands,Status.Bands == 1 ? "" : "s" );
+    return Message;
+  }
+  if( Status.Band>0 ) snprintf( Bands,sizeof(Bands),"band %d of %d",Status.Band,Status.Bands );
+  else                snprintf( Bands,sizeof(Bands),"all %d bands",Status.Bands );
+  if( Status.ETASeconds<0.0 ) {
+    snprintf( Message,sizeof(Message),"%s, %.1f MPix/s, ETA -",Bands,Status.MPixPerSecond );
+  } else {
+    long ETA = (long)( Status.ETASeconds+0.5 );
+    snprintf( Message,sizeof(Message),"%s, %.1f MPix/s, ETA %ld:%02ld",Bands,Status.MPixPerSecond,
+      ETA/60,ETA%60 );
+  }
+  return Message;
+}
+
+PrintedProgress::PrintedProgress( ProgressOutput PrintOutput, FILE* PrintStream,
+  const String& ImageFilename ) : SceneProgress( PrintedProgress::Print,this ),
+  Output( PrintOutput ), Stream( PrintStream ), Image( ImageFilename ) {
+  if( Stream == nullptr ) Stream = ( Output == PROGRESS_JSONL ) ? stderr : stdout;
+}
+
+int CPL_STDCALL PrintedProgress::Print( double Fraction, const char* Message, void* Data ) {
+  /* *********************************************************************
+   * One line per report, written with a single fprintf so that the lines
+   * of scenes converted at once do not interleave:
+   *
+   *   progress  42.0%  band 3 of 8, 142.5 MPix/s, ETA 0:42  (image)
+   *   {"image": ..., "percent": 42.0, "band": 3, "bands": 8, ...}
+   */
+  PrintedProgress *Progress = (PrintedProgress*)Data;
+  if( Progress->Output == PROGRESS_CONSOLE ) {
+    fprintf( Progress->Stream,"  progress %5.1f%%  %s  (%s)\n",100.0*Fraction,Message,
+      Progress->Image.c_str() );
+  } else {
+    ProgressStatus Status = Progress->GetStatus();
+    fprintf( Progress->Stream,"{\"image\": %s, \"percent\": %.2f, \"phase\": %s, \"band\": %d, "
+      "\"bands\": %d, \"pixels_done\": %llu, \"pixels_total\": %llu, \"mpix_per_s\": %.2f, "
+      "\"elapsed_s\": %.2f, \"eta_s\": %.1f}\n",JSONString( Progress->Image ).c_str(),100.0*Fraction,
+      JSONString( Status.Phase ? Status.Phase : "converting" ).c_str(),Status.Band,Status.Bands,
+      (unsigned long long)Status.PixelsDone,(unsigned long long)Status.PixelsTotal,
+      Status.MPixPerSecond,Status.ElapsedSeconds,Status.ETASeconds );
+  }
+  fflush( Progress->Stream );
+  return TRUE;
+}
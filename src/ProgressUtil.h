@@ -0,0 +1,108 @@
+#ifndef PROGRESSUTIL_H_
+#define PROGRESSUTIL_H_
+#include "gdal.h"
+#include <cstdint>
+#include <stdio.h>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+typedef std::string String;
+
+// seconds between progress reports by default
+#define PROGRESS_INTERVAL_SECONDS 1.0
+
+// how the command line reports progress: not at all, a line on the
+// console, or one JSON object per line
+enum ProgressOutput {
+  PROGRESS_NONE    = 0,
+  PROGRESS_CONSOLE = 1,
+  PROGRESS_JSONL   = 2
+};
+
+// where a conversion stands
+struct ProgressStatus {
+  double Fraction;           // 0 to 1
+  int Band;                  // band of the last converted window, 0 = all bands at once
+  int Bands;
+  uint64_t PixelsDone;       // over all bands
+  uint64_t PixelsTotal;
+  double ElapsedSeconds;
+  double MPixPerSecond;      // average since Start()
+  double ETASeconds;         // -1 until anything is done (of the final phase, once in it)
+  const char *Phase;         // the final phase once started (see StartPhase()), else nullptr
+  double PhaseFraction;      // 0 to 1 of the final phase
+};
+
+// progress of one scene, advanced from the processing loops (any
+// thread) as windows are converted and written. At most once per
+// interval, and at the start and end, it calls a GDALProgressFunc with
+// the fraction done and a message such as "band 3 of 8, 142.5 MPix/s,
+// ETA 0:42". A callback that returns FALSE cancels the conversion.
+// Work left after the last window (e.g. the compressing copies of a
+// Cloud-Optimized Geotiff) can be given a share of the fraction as a
+// final phase, so that 100% is only reported once it is done.
+class SceneProgress {
+  private:
+    GDALProgressFunc Callback;
+    void *CallbackData;
+    int64_t IntervalNanoseconds;
+    std::chrono::steady_clock::time_point StartTime;
+    std::atomic<int64_t> LastReport{ 0 };      // ns since StartTime
+    std::atomic<uint64_t> PixelsDone{ 0 };
+    std::atomic<int> Band{ 0 };
+    std::atomic<bool> Cancelled{ false };
+    uint64_t PixelsTotal = 0;
+    int Bands = 0;
+    double PhaseShare = 0.0;
+    const char *PhaseName = nullptr;
+    std::chrono::steady_clock::time_point PhaseStartTime;
+    std::atomic<bool> InPhase{ false };
+    std::atomic<double> PhaseDone{ 0.0 };
+    std::mutex ReportLock;
+    void Report();
+    void ReportIfDue();
+
+  public:
+    SceneProgress( GDALProgressFunc, void*, double IntervalSeconds=PROGRESS_INTERVAL_SECONDS );
+    virtual ~SceneProgress() {}
+    SceneProgress( const SceneProgress& ) = delete;
+    SceneProgress& operator=( const SceneProgress& ) = delete;
+
+    // start the clock for a scene of Pixels pixels over all bands, with
+    // FinalPhaseShare (0 to 1) of the fraction kept for a final phase
+    void Start( uint64_t Pixels, int SceneBands, double FinalPhaseShare=0.0 );
+
+    // Pixels more pixels of a band (0 = all bands) are done; false once
+    // the callback has cancelled the conversion
+    bool Advance( uint64_t Pixels, int ForBand );
+
+    // the pixels are done and the final phase, named e.g. "writing COG",
+    // begins; then Fraction (0 to 1) of it is done, false once cancelled
+    void StartPhase( const char* );
+    bool AdvancePhase( double Fraction );
+
+    // report completion
+    void Finish();
+
+    ProgressStatus GetStatus() const;
+    bool IsCancelled() const { return Cancelled; }
+};
+
+// "band 3 of 8, 142.5 MPix/s, ETA 0:42"
+String FormatProgress( const ProgressStatus& );
+
+// a SceneProgress that prints its reports for the command line: a
+// console line on stdout or a JSON line on stderr, or into a stream
+// given (e.g. a file); lines name the image. Throttled as above.
+class PrintedProgress : public SceneProgress {
+  private:
+    ProgressOutput Output;
+    FILE *Stream;
+    String Image;
+    static int CPL_STDCALL Print( double, const char*, void* );
+
+  public:
+    PrintedProgress( ProgressOutput, FILE*, const String& );
+};
+#endif
@@ -0,0 +1,398 @@
+#include "SceneUtil.h"
+#include <stdexcept>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <atomic>
+#include "ImageUtil.h"
+#include "Misc.h"
+#include "IMDUtil.h"
+
+static uint64_t HashBytes( const char* Data, size_t Size, uint64_t Hash=14695981039346656037ULL ) {
+  /* FNV-1a, 64 bits */
+  for( size_t i=0; i<Size; i++ ) {
+    Hash ^= (unsigned char)Data[i];
+    Hash *= 1099511628211ULL;
+  }
+  return Hash;
+}
+
+static String CanonicalPath( const String& Filename ) {
+  char Resolved[PATH_MAX];
+  return realpath( Filename.c_str(),Resolved ) ? String( Resolved ) : Filename;
+}
+
+static FileFingerprint FingerprintFile( const String& Filename ) {
+  /* *********************************************************************
+   * Path, size, modification time, device and inode, and a hash of the
+   * first and last FINGERPRINT_SAMPLE_BYTES. The stat fields change on
+   * any rewrite or replacement of the file; the sample catches the odd
+   * one that keeps them (a copy with preserved times onto a reused
+   * inode) while reading at most two pages, whatever the file's size.
+   * An empty filename (no XML) has an empty fingerprint.
+   */
+  FileFingerprint Fingerprint{ "",0,0,0,0,0 };
+  if( Filename.empty() ) return Fingerprint;
+  int File = open( Filename.c_str(),O_RDONLY );
+  struct stat Status;
+  if( File<0 || fstat( File,&Status ) != 0 ) {
+    if( File>=0 ) close( File );
+    throw std::runtime_error( "  ERROR (fatal): unable to stat file: "+Filename );
+  }
+  Fingerprint.Path   = CanonicalPath( Filename );
+  Fingerprint.Size   = (uint64_t)Status.st_size;
+  Fingerprint.Device = (uint64_t)Status.st_dev;
+  Fingerprint.Inode  = (uint64_t)Status.st_ino;
+  Fingerprint.ModifiedNanoseconds = (int64_t)Status.st_mtim.tv_sec*1000000000LL+Status.st_mtim.tv_nsec;
+
+  char Sample[2*FINGERPRINT_SAMPLE_BYTES];
+  size_t Head = std::min( Fingerprint.Size,(uint64_t)FINGERPRINT_SAMPLE_BYTES );
+  size_t Tail = std::min( Fingerprint.Size-Head,(uint64_t)FINGERPRINT_SAMPLE_BYTES );
+  bool Read = pread( File,Sample,Head,0 ) == (ssize_t)Head &&
+    pread( File,Sample+Head,Tail,(off_t)( Fingerprint.Size-Tail )) == (ssize_t)Tail;
+  close( File );
+  if( !Read ) {
+    throw std::runtime_error( "  ERROR (fatal): unable to read file: "+Filename );
+  }
+  Fingerprint.SampleHash = HashBytes( Sample,Head+Tail );
+  return Fingerprint;
+}
+
+SceneFingerprints::SceneFingerprints( const String& ImageFilename, const String& IMDFilename,
+  const String& XMLFilename ) {
+  Filenames[SCENE_IMAGE] = ImageFilename;
+  Filenames[SCENE_IMD]   = IMDFilename;
+  Filenames[SCENE_XML]   = XMLFilename;
+}
+
+const FileFingerprint& SceneFingerprints::Get( SceneInput Input ) {
+  /* the fingerprint of an input, taken the first time it is asked for */
+  if( !Taken[Input] ) {
+    Fingerprints[Input] = FingerprintFile( Filenames[Input] );
+    Taken[Input] = true;
+  }
+  return Fingerprints[Input];
+}
+
+static String CacheRecordFilename( const String& CacheDirectory, const String& ImageFilename,
+  const String& IMDFilename, const String& XMLFilename ) {
+  /* one record per set of input paths, named by a hash of the paths */
+  String Paths = CanonicalPath( ImageFilename )+"\n"+CanonicalPath( IMDFilename )+"\n"+
+    ( XMLFilename.empty() ? String("") : CanonicalPath( XMLFilename ));
+  char Name[32];
+  snprintf( Name,sizeof(Name),"%016llx",(unsigned long long)HashBytes( Paths.data(),Paths.size() ));
+  return CacheDirectory+"/"+String( Name )+".toameta";
+}
+
+// appends values to a cache record in the byte order of this host
+class RecordWriter {
+  public:
+    String Bytes;
+    template<typename T> void Put( const T& Value ) {
+      Bytes.append( (const char*)&Value,sizeof(T) );
+    }
+    void PutString( const String& Value ) {
+      Put( (uint32_t)Value.size() );
+      Bytes.append( Value );
+    }
+    void PutFingerprint( const FileFingerprint& Fingerprint ) {
+      PutString( Fingerprint.Path );
+      Put( Fingerprint.Size );
+      Put( Fingerprint.ModifiedNanoseconds );
+      Put( Fingerprint.Device );
+      Put( Fingerprint.Inode );
+      Put( Fingerprint.SampleHash );
+    }
+};
+
+// reads values back; every Get fails (and stays failed) past the end
+class RecordReader {
+  private:
+    const char* Data;
+    size_t Size;
+    size_t Position = 0;
+  public:
+    bool Good = true;
+    RecordReader( const char* RecordData, size_t RecordSize ) : Data( RecordData ), Size( RecordSize ) {}
+    template<typename T> T Get() {
+      T Value{};
+      if( !Good || Size-Position<sizeof(T) ) { Good = false; return Value; }
+      memcpy( &Value,Data+Position,sizeof(T) );
+      Position += sizeof(T);
+      return Value;
+    }
+    String GetString() {
+      uint32_t Length = Get<uint32_t>();
+      if( !Good || Size-Position<Length ) { Good = false; return ""; }
+      String Value( Data+Position,Length );
+      Position += Length;
+      return Value;
+    }
+    bool MatchesFingerprint( const FileFingerprint& Fingerprint ) {
+      bool Matches = ( GetString() == Fingerprint.Path );
+      Matches = ( Get<uint64_t>() == Fingerprint.Size ) && Matches;
+      Matches = ( Get<int64_t>() == Fingerprint.ModifiedNanoseconds ) && Matches;
+      Matches = ( Get<uint64_t>() == Fingerprint.Device ) && Matches;
+      Matches = ( Get<uint64_t>() == Fingerprint.Inode ) && Matches;
+      Matches = ( Get<uint64_t>() == Fingerprint.SampleHash ) && Matches;
+      return Good && Matches;
+    }
+    bool AtEnd() const { return Good && Position == Size; }
+};
+
+static const char METADATA_CACHE_MAGIC[8] = { 'T','O','A','M','E','T','A','\0' };
+
+bool ReadCachedSceneMetadata( const String& CacheDirectory, SceneFingerprints& Inputs,
+  SceneMetadata& Scene ) {
+  /* *********************************************************************
+   * Fill the scene from its cache record, if there is one and it is
+   * still valid: same record version, and the same fingerprint (see
+   * FingerprintFile()) for each input the record was made from, i.e.
+   * the image, the IMD and the XML only if the calibrations came from
+   * it. Inputs are fingerprinted in turn and the first mismatch stops
+   * the check. Anything else (no record, a stale or truncated one)
+   * returns false and the scene is parsed as usual. The dataset is not
+   * opened.
+   */
+  String RecordFilename = CacheRecordFilename( CacheDirectory,Inputs.GetFilename( SCENE_IMAGE ),
+    Inputs.GetFilename( SCENE_IMD ),Inputs.GetFilename( SCENE_XML ));
+  if( !file_exists( RecordFilename )) return false;
+  try {
+    MappedFile Record( RecordFilename );
+    RecordReader Reader( Record.GetData(),Record.GetSize() );
+    char Magic[8];
+    for( char& c: Magic ) c = Reader.Get<char>();
+    if( !Reader.Good || memcmp( Magic,METADATA_CACHE_MAGIC,sizeof(Magic) ) != 0 ) return false;
+    if( Reader.Get<uint32_t>() != METADATA_CACHE_VERSION ) return false;
+    for( SceneInput Input: { SCENE_IMAGE,SCENE_IMD,SCENE_XML } ) {
+      if( Reader.Get<uint8_t>() == 0 ) continue;
+      if( !Reader.MatchesFingerprint( Inputs.Get( Input ))) return false;
+    }
+
+    SceneMetadata Cached;
+    Cached.ImageFilename = Inputs.GetFilename( SCENE_IMAGE );
+    Cached.Solar.earthSunDistance = Reader.Get<double>();
+    Cached.Solar.solarZenithAngle = Reader.Get<double>();
+    Cached.Solar.bitsPerPixel     = Reader.Get<int32_t>();
+    SolarGeometry& Geometry       = Cached.Solar.Geometry;
+    Geometry.Valid                = ( Reader.Get<uint8_t>() != 0 );
+    Geometry.FirstLineJulianDate  = Reader.Get<double>();
+    Geometry.LineRate             = Reader.Get<double>();
+    for( double& Latitude: Geometry.CornerLatitude )   Latitude  = Reader.Get<double>();
+    for( double& Longitude: Geometry.CornerLongitude ) Longitude = Reader.Get<double>();
+    Cached.Calibration.SatelliteID = Reader.GetString();
+    uint32_t CalibratedBands = Reader.Get<uint32_t>();
+    for( uint32_t b=0; b<CalibratedBands && Reader.Good; b++ ) {
+      BandCalibration Band;
+      Band.Name               = Reader.GetString();
+      Band.ID                 = (SpectralBand)Reader.Get<int32_t>();
+      Band.AbsCalFactor       = Reader.Get<double>();
+      Band.EffectiveBandwidth = Reader.Get<double>();
+      Band.SolarIrradiance    = Reader.Get<double>();
+      Cached.Calibration.Bands.push_back( Band );
+    }
+    Cached.Rows  = Reader.Get<int32_t>();
+    Cached.Cols  = Reader.Get<int32_t>();
+    Cached.Bands = Reader.Get<int32_t>();
+    if( !Reader.AtEnd() ) return false;
+    Scene = std::move( Cached );
+    return true;
+  } catch( const std::exception& ) {
+    return false;
+  }
+}
+
+void WriteCachedSceneMetadata( const String& CacheDirectory, SceneFingerprints& Inputs,
+  bool UsedXML, const SceneMetadata& Scene ) {
+  /* *********************************************************************
+   * Write the scene's cache record, creating the directory if needed.
+   * The XML is part of the record only if the calibrations came from
+   * it (UsedXML). The record is written to a temporary file and renamed
+   * into place, so concurrent scenes and readers never see a partial
+   * record. The cache is only an optimization: failures are reported
+   * and ignored.
+   */
+  static std::atomic<long> Counter( 0 );
+  String RecordFilename = CacheRecordFilename( CacheDirectory,Inputs.GetFilename( SCENE_IMAGE ),
+    Inputs.GetFilename( SCENE_IMD ),Inputs.GetFilename( SCENE_XML ));
+  String TemporaryFilename = RecordFilename+".tmp."+std::to_string( getpid() )+"."+
+    std::to_string( Counter++ );
+  try {
+    RecordWriter Writer;
+    Writer.Bytes.append( METADATA_CACHE_MAGIC,sizeof(METADATA_CACHE_MAGIC) );
+    Writer.Put( (uint32_t)METADATA_CACHE_VERSION );
+    for( SceneInput Input: { SCENE_IMAGE,SCENE_IMD,SCENE_XML } ) {
+      bool Recorded = ( Input != SCENE_XML || UsedXML );
+      Writer.Put( (uint8_t)( Recorded ? 1 : 0 ));
+      if( Recorded ) Writer.PutFingerprint( Inputs.Get( Input ));
+    }
+    Writer.Put( Scene.Solar.earthSunDistance );
+    Writer.Put( Scene.Solar.solarZenithAngle );
+    Writer.Put( (int32_t)Scene.Solar.bitsPerPixel );
+    const SolarGeometry& Geometry = Scene.Solar.Geometry;
+    Writer.Put( (uint8_t)( Geometry.Valid ? 1 : 0 ));
+    Writer.Put( Geometry.FirstLineJulianDate );
+    Writer.Put( Geometry.LineRate );
+    for( double Latitude: Geometry.CornerLatitude )   Writer.Put( Latitude );
+    for( double Longitude: Geometry.CornerLongitude ) Writer.Put( Longitude );
+    Writer.PutString( Scene.Calibration.SatelliteID );
+    Writer.Put( (uint32_t)Scene.Calibration.Bands.size() );
+    for( const BandCalibration& Band: Scene.Calibration.Bands ) {
+      Writer.PutString( Band.Name );
+      Writer.Put( (int32_t)Band.ID );
+      Writer.Put( Band.AbsCalFactor );
+      Writer.Put( Band.EffectiveBandwidth );
+      Writer.Put( Band.SolarIrradiance );
+    }
+    Writer.Put( (int32_t)Scene.Rows );
+    Writer.Put( (int32_t)Scene.Cols );
+    Writer.Put( (int32_t)Scene.Bands );
+
+    mkdir( CacheDirectory.c_str(),0755 );
+    FILE* Record = fopen( TemporaryFilename.c_str(),"wb" );
+    bool Written = Record && fwrite( Writer.Bytes.data(),1,Writer.Bytes.size(),Record ) == Writer.Bytes.size();
+    if( Record && fclose( Record ) != 0 ) Written = false;
+    if( !Written || rename( TemporaryFilename.c_str(),RecordFilename.c_str() ) != 0 ) {
+      throw std::runtime_error( "unable to write "+RecordFilename );
+    }
+  } catch( const std::exception& e ) {
+    std::remove( TemporaryFilename.c_str() );
+    printf("  WARNING: metadata cache not updated: %s\n",e.what() );
+  }
+}
+
+static void ReadDatasetInfo( SceneMetadata& Scene ) {
+  /* size and band count of the open image */
+  GDALDataset* Dataset = Scene.Dataset.get();
+  Scene.Rows  = Dataset->GetRasterYSize();
+  Scene.Cols  = Dataset->GetRasterXSize();
+  Scene.Bands = Dataset->GetRasterCount();
+}
+
+static uint64_t FileBytes( const String& Filename ) {
+  struct stat Status;
+  return ( stat( Filename.c_str(),&Status ) == 0 ) ? (uint64_t)Status.st_size : 0;
+}
+
+static bool ParseSceneMetadata( const String& IMDFilename, const String& XMLFilename,
+  SceneMetadata& Scene, SceneProfile* Profile ) {
+  /* solar geometry, bit depth and calibrations from the IMD (or XML);
+   * true if the XML was read */
+  Scene.Solar.earthSunDistance = (double)0.0;
+  Scene.Solar.solarZenithAngle = (double)0.0;
+  Scene.Solar.bitsPerPixel     = 16;
+  StageTimer IMDTimer( Profile,STAGE_IMD_PARSE,FileBytes( IMDFilename ));
+  IMDFile IMD( IMDFilename );
+  EarthSunDistance( IMD,&Scene.Solar );
+  if( HasBandCalibration( IMD )) {
+    Scene.Calibration = ReadSceneCalibration( IMD );
+    return false;
+  } else if( !XMLFilename.empty() ) {
+    IMDTimer.Stop();
+    StageTimer XMLTimer( Profile,STAGE_XML_PARSE,FileBytes( XMLFilename ));
+    Scene.Calibration = ReadSceneCalibration( XMLFilename.c_str() );
+    return true;
+  } else {
+    throw std::runtime_error( "  ERROR (fatal): no band calibrations in IMD file and no XML file: "+IMDFilename );
+  }
+}
+
+void OpenSceneDataset( SceneMetadata& Scene, SceneProfile* Profile ) {
+  /* *********************************************************************
+   * Open the scene's image for the conversion, unless LoadSceneMetadata()
+   * already did (it does not on a cache hit).
+   */
+  if( Scene.Dataset ) return;
+  {
+    StageTimer Timer( Profile,STAGE_GDAL_INIT );
+    InitializeGDAL();
+  }
+  StageTimer Timer( Profile,STAGE_DATASET_OPEN );
+  Scene.Dataset.reset( (GDALDataset*) GDALOpen( Scene.ImageFilename.c_str(),GA_ReadOnly ));
+  if( !Scene.Dataset ) {
+    throw std::runtime_error( "  ERROR (fatal): GDAL could not open: "+Scene.ImageFilename );
+  }
+}
+
+SceneMetadata LoadSceneMetadata( const String& ImageFilename,
+  const String& IMDFilename, const String& XMLFilename, const String& CacheDirectory,
+  SceneProfile* Profile ) {
+  /* *********************************************************************
+   * Gather a scene's metadata: the Earth-sun distance, solar zenith
+   * angle, bit depth and band calibrations from the IMD (the XML is
+   * optional, and read only if the IMD has no BAND_* groups), and the
+   * size and band count of the image. The image is opened exactly
+   * once, and the handle is returned in the metadata for ImageUtil to
+   * take over (see ImageUtil( SceneMetadata& )). Headers of NITFs with
+   * large TREs are slow to parse on network filesystems, so nothing
+   * here reopens it.
+   *
+   * With a cache directory, a valid record (see ReadCachedSceneMetadata)
+   * replaces the IMD and XML parsing. The image still has to be opened
+   * to read its pixels, once, by OpenSceneDataset(), so a hit saves
+   * only the parsing; now that the IMD is indexed in place and only the
+   * IMD subtree of the XML is parsed, that is about what fingerprinting
+   * the inputs costs (tens of microseconds), and the cache pays off
+   * only where metadata reads are slow. Each input is fingerprinted at
+   * most once, whether the lookup hits or misses. Parsing and opening
+   * are timed into Profile, if given.
+   */
+  for( const String& Input: { ImageFilename,IMDFilename,XMLFilename } ) {
+    if( !Input.empty() && !file_exists( Input )) {
+      throw std::runtime_error( "  ERROR (fatal): file does not exist: "+Input );
+    }
+  }
+
+  SceneMetadata Scene;
+  SceneFingerprints Inputs( ImageFilename,IMDFilename,XMLFilename );
+  bool UseCache = !CacheDirectory.empty();
+  if( UseCache && ReadCachedSceneMetadata( CacheDirectory,Inputs,Scene )) return Scene;
+
+  Scene.ImageFilename = ImageFilename;
+  bool UsedXML = ParseSceneMetadata( IMDFilename,XMLFilename,Scene,Profile );
+  OpenSceneDataset( Scene,Profile );
+  StageTimer Timer( Profile,STAGE_DATASET_OPEN );
+  ReadDatasetInfo( Scene );
+  Timer.Stop();
+  if( UseCache ) WriteCachedSceneMetadata( CacheDirectory,Inputs,UsedXML,Scene );
+  return Scene;
+}
+
+SceneMetadata LoadSharedSceneMetadata( const String& IMDFilename, const String& XMLFilename ) {
+  /* *********************************************************************
+   * The part of a scene's metadata shared by all of its tiles (see
+   * TileUtil.h): solar geometry, bit depth and band calibrations. No
+   * image is opened; see LoadTileMetadata().
+   */
+  for( const String& Input: { IMDFilename,XMLFilename } ) {
+    if( !Input.empty() && !file_exists( Input )) {
+      throw std::runtime_error( "  ERROR (fatal): file does not exist: "+Input );
+    }
+  }
+  SceneMetadata Scene;
+  ParseSceneMetadata( IMDFilename,XMLFilename,Scene,nullptr );
+  return Scene;
+}
+
+SceneMetadata LoadTileMetadata( const String& TileFilename, const SceneMetadata& Shared ) {
+  /* *********************************************************************
+   * Metadata of one tile of a scene: the shared solar geometry and
+   * calibrations, and the tile's own dataset, opened once.
+   */
+  if( !file_exists( TileFilename )) {
+    throw std::runtime_error( "  ERROR (fatal): file does not exist: "+TileFilename );
+  }
+  SceneMetadata Tile;
+  Tile.ImageFilename = TileFilename;
+  Tile.Solar         = Shared.Solar;
+  Tile.Calibration   = Shared.Calibration;
+  OpenSceneDataset( Tile,nullptr );
+  ReadDatasetInfo( Tile );
+  return Tile;
+}
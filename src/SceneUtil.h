@@ -0,0 +1,92 @@
+#ifndef SCENEUTIL_H_
+#define SCENEUTIL_H_
+#include "gdal_priv.h"
+#include <string>
+#include <vector>
+#include <memory>
+#include <stdint.h>
+#include "TOAUtil.h"
+#include "ProfileUtil.h"
+typedef std::string String;
+
+// closes a dataset owned by a std::unique_ptr
+struct GDALDatasetCloser {
+  void operator()( GDALDataset* Dataset ) const { if( Dataset ) GDALClose( Dataset ); }
+};
+typedef std::unique_ptr<GDALDataset,GDALDatasetCloser> GDALDatasetPtr;
+
+// everything the conversion needs to know about a scene, gathered from
+// one pass over the IMD, one over the XML and a single open of the
+// image. The open dataset is kept so that ImageUtil can take it over
+// instead of opening the image again (none for a cached scene). Band
+// types, NoData, geotransform and projection are read by ImageUtil
+// from the dataset itself.
+struct SceneMetadata {
+  String ImageFilename;
+  SolarMetadata Solar;
+  SceneCalibration Calibration;
+  int Rows = 0;
+  int Cols = 0;
+  int Bands = 0;
+  GDALDatasetPtr Dataset;              // empty once handed to ImageUtil
+};
+
+// bump when the layout of a cache record changes
+#define METADATA_CACHE_VERSION 4
+
+// bytes hashed from each end of an input for its cache fingerprint
+#define FINGERPRINT_SAMPLE_BYTES 4096
+
+// identity of one input file in a cache record
+struct FileFingerprint {
+  String Path;
+  uint64_t Size;
+  int64_t ModifiedNanoseconds;
+  uint64_t Device;
+  uint64_t Inode;
+  uint64_t SampleHash;      // first and last FINGERPRINT_SAMPLE_BYTES
+};
+
+// the inputs of a scene, in the order of a cache record
+enum SceneInput {
+  SCENE_IMAGE  = 0,
+  SCENE_IMD    = 1,
+  SCENE_XML    = 2,
+  SCENE_INPUTS = 3
+};
+
+// the input filenames of one scene and their fingerprints, each taken
+// at most once (on first use) however often the cache looks at it
+class SceneFingerprints {
+  private:
+    String Filenames[SCENE_INPUTS];
+    FileFingerprint Fingerprints[SCENE_INPUTS];
+    bool Taken[SCENE_INPUTS] = { false,false,false };
+
+  public:
+    SceneFingerprints( const String&, const String&, const String& );
+    const String& GetFilename( SceneInput Input ) const { return Filenames[Input]; }
+    const FileFingerprint& Get( SceneInput );
+};
+
+// parse the IMD (and the XML, which may be "") and open the image once
+// (throws on error). With a cache directory, a valid cached record is
+// used instead of parsing and the image is opened later, for the
+// conversion (see OpenSceneDataset()); a new record is written after
+// parsing. The stages are timed into a profile, if given.
+SceneMetadata LoadSceneMetadata( const String&, const String&, const String&,
+  const String& CacheDirectory="", SceneProfile* Profile=nullptr );
+
+// open the image of a scene unless it is open already (throws on error)
+void OpenSceneDataset( SceneMetadata&, SceneProfile* Profile=nullptr );
+
+// the metadata shared by the tiles of a scene (from the IMD and XML, no
+// image opened), and that of one tile, opened once
+SceneMetadata LoadSharedSceneMetadata( const String&, const String& );
+SceneMetadata LoadTileMetadata( const String&, const SceneMetadata& );
+
+// the cache record of a scene: read (false if missing or stale) and
+// write, with whether its calibrations came from the XML
+bool ReadCachedSceneMetadata( const String&, SceneFingerprints&, SceneMetadata& );
+void WriteCachedSceneMetadata( const String&, SceneFingerprints&, bool, const SceneMetadata& );
+#endif
@@ -0,0 +1,275 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <chrono>
+#include <algorithm>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+using namespace std;
+typedef std::string String;
+typedef std::chrono::steady_clock Clock;
+
+// jobs of a manifest in flight at once, by default
+#define CLIENT_WINDOW 4
+
+// a job rejected because the server's queue is full is sent again after
+// CLIENT_RETRY_SECONDS, doubling up to CLIENT_RETRY_MAX_SECONDS, at most
+// CLIENT_RETRY_LIMIT times
+#define CLIENT_RETRY_SECONDS 0.1
+#define CLIENT_RETRY_MAX_SECONDS 5.0
+#define CLIENT_RETRY_LIMIT 8
+
+/* ***********************************************************************
+ * ServeClient:
+ * A small client of the conversion server (bin/toa --serve -u, see
+ * ServeUtil.cpp). It sends one job, the jobs of a JSON-lines manifest,
+ * or a command, prints each reply line as it arrives and exits non-zero
+ * if any job was not converted. Needs no GDAL.
+ *
+ * A manifest's jobs are sent a window at a time (-W), the next going out
+ * as each reply comes back, so the server's queue is not flooded. Jobs
+ * without an "id" get one ({manifest}:{line}), so replies, which come in
+ * the order jobs finish, can be matched to them. A job rejected because
+ * the queue is full is sent again after an exponential backoff.
+ *
+ *   $ bin/toa --serve -u /tmp/toa.sock &
+ *   $ bin/toa_client -u /tmp/toa.sock -f chip.tif -i chip.IMD -x chip.XML
+ *   $ bin/toa_client -u /tmp/toa.sock -B jobs.jsonl -W 8
+ *   $ bin/toa_client -u /tmp/toa.sock -s
+ *   $ bin/toa_client -u /tmp/toa.sock -q
+ */
+
+static void usage() {
+  cout << "\n";
+  cout << "  USAGE: bin/toa_client -u {socket} -f {image} -i {IMD} [-x {XML}] [-o {radiances}]\n";
+  cout << "         [-O {reflectances}] [-n {id}]\n";
+  cout << "       bin/toa_client -u {socket} -B {manifest jsonl} [-W {window}]\n";
+  cout << "       bin/toa_client -u {socket} {-s | -q}\n";
+  cout << "\n";
+  cout << "    -B sends every line of a JSON-lines manifest as a job, at most -W at a time\n";
+  cout << "    (default 4); jobs without an id are given {manifest}:{line}. Jobs rejected with\n";
+  cout << "    a full queue are retried with an exponential backoff. -s prints the server's\n";
+  cout << "    status, -q shuts it down once its admitted jobs are finished. Replies are printed\n";
+  cout << "    one per line; the exit status is non-zero if any job failed or was rejected.\n";
+  cout << "\n";
+  exit(1);
+}
+
+static String Quote( const String& Text ) {
+  /* quote a path for a JSON line */
+  String Quoted = "\"";
+  for( char c: Text ) {
+    if( c == '"' || c == '\\' ) Quoted += '\\';
+    Quoted += c;
+  }
+  return Quoted+"\"";
+}
+
+static bool JSONField( const String& Text, const String& Key, String& Value ) {
+  /* the string value of Key in a flat JSON line, unescaped; false if none */
+  size_t i = Text.find( "\""+Key+"\"" );
+  while( i != String::npos ) {
+    size_t j = Text.find_first_not_of( " \t",i+Key.size()+2 );
+    if( j != String::npos && Text[j] == ':' ) {
+      j = Text.find_first_not_of( " \t",j+1 );
+      if( j == String::npos || Text[j] != '"' ) return false;
+      Value.clear();
+      for( j++; j<Text.size() && Text[j] != '"'; j++ ) {
+        if( Text[j] == '\\' && j+1<Text.size() ) j++;
+        Value += Text[j];
+      }
+      return j<Text.size();
+    }
+    i = Text.find( "\""+Key+"\"",i+1 );
+  }
+  return false;
+}
+
+static bool SendAll( int Socket, const String& Text ) {
+  size_t Sent = 0;
+  while( Sent<Text.size() ) {
+    ssize_t n = send( Socket,Text.data()+Sent,Text.size()-Sent,MSG_NOSIGNAL );
+    if( n<0 && errno == EINTR ) continue;
+    if( n<=0 ) return false;
+    Sent += (size_t)n;
+  }
+  return true;
+}
+
+// one line sent to the server, and how often it was turned away
+struct ClientJob {
+  String Line;
+  String ID;
+  int Attempts = 0;
+};
+
+int main( int argc, char* argv[] ) {
+  String SocketPath, Image, IMD, XML, Radiances, Reflectances, ID, Manifest, Command;
+  int Window = CLIENT_WINDOW;
+  int opt = 0;
+  while(( opt = getopt( argc,argv,":u:f:i:x:o:O:n:B:W:sqh" )) != -1 ) {
+    switch( opt ) {
+      case 'u': SocketPath   = optarg; break;
+      case 'f': Image        = optarg; break;
+      case 'i': IMD          = optarg; break;
+      case 'x': XML          = optarg; break;
+      case 'o': Radiances    = optarg; break;
+      case 'O': Reflectances = optarg; break;
+      case 'n': ID           = optarg; break;
+      case 'B': Manifest     = optarg; break;
+      case 'W': Window       = atoi( optarg ); break;
+      case 's': Command      = "status"; break;
+      case 'q': Command      = "shutdown"; break;
+      default: usage();
+    }
+  }
+  if( SocketPath.empty() || Window<1 ) usage();
+
+  std::vector<ClientJob> Jobs;
+  if( !Command.empty() ) {
+    Jobs.push_back( ClientJob{ "{\"command\": "+Quote( Command )+"}","" } );
+  } else if( !Manifest.empty() ) {
+    std::ifstream Lines( Manifest );
+    if( !Lines ) {
+      fprintf( stderr,"  ERROR (fatal): unable to read manifest: %s\n",Manifest.c_str() );
+      return 1;
+    }
+    String Base = Manifest.substr( Manifest.find_last_of( '/' )+1 );
+    String Line;
+    int LineNumber = 0;
+    while( std::getline( Lines,Line )) {
+      LineNumber++;
+      size_t First = Line.find_first_not_of( " \t\r" );
+      if( First == String::npos || Line[First] == '#' ) continue;
+      Line = Line.substr( First,Line.find_last_not_of( " \t\r" )-First+1 );
+      ClientJob Job;
+      if( !JSONField( Line,"id",Job.ID ) && Line[0] == '{' ) {
+        Job.ID = Base+":"+std::to_string( LineNumber );
+        size_t Next = Line.find_first_not_of( " \t",1 );
+        bool Empty = Next != String::npos && Line[Next] == '}';
+        Line = "{\"id\": "+Quote( Job.ID )+( Empty ? "" : ", " )+Line.substr( 1 );
+      }
+      Job.Line = Line;
+      Jobs.push_back( Job );
+    }
+  } else {
+    if( Image.empty() || IMD.empty() ) usage();
+    if( ID.empty() ) ID = Image.substr( Image.find_last_of( '/' )+1 );
+    String Job = "{\"id\": "+Quote( ID )+", \"image\": "+Quote( Image )+", \"imd\": "+Quote( IMD );
+    if( !XML.empty() )          Job += ", \"xml\": "+Quote( XML );
+    if( !Radiances.empty() )    Job += ", \"radiances\": "+Quote( Radiances );
+    if( !Reflectances.empty() ) Job += ", \"reflectances\": "+Quote( Reflectances );
+    Jobs.push_back( ClientJob{ Job+"}",ID } );
+  }
+
+  struct sockaddr_un Address;
+  memset( &Address,0,sizeof(Address) );
+  Address.sun_family = AF_UNIX;
+  strncpy( Address.sun_path,SocketPath.c_str(),sizeof(Address.sun_path)-1 );
+  int Socket = socket( AF_UNIX,SOCK_STREAM,0 );
+  if( Socket<0 || connect( Socket,(struct sockaddr*)&Address,sizeof(Address) ) != 0 ) {
+    fprintf( stderr,"  ERROR (fatal): unable to connect to %s: %s\n",SocketPath.c_str(),strerror( errno ));
+    return 1;
+  }
+
+  /* *********************************************************************
+   * Keep up to Window jobs in flight: send from the retries that are due,
+   * then from the manifest, and wait for replies (or the next retry).
+   * A reply is matched to its job by id; one without, e.g. to a line the
+   * server could not parse, by the line it quotes, else to the oldest
+   * job in flight. A job counts as failed unless its status is ok.
+   */
+  std::deque<size_t> Unsent, Due;
+  for( size_t j=0; j<Jobs.size(); j++ ) Unsent.push_back( j );
+  std::multimap<Clock::time_point,size_t> Retries;
+  std::vector<size_t> InFlight;
+  size_t Finished = 0;
+  int Failed = 0;
+  String Pending;
+  char Buffer[4096];
+  bool Closed = false;
+  while( Finished<Jobs.size() && !Closed ) {
+    Clock::time_point Now = Clock::now();
+    while( !Retries.empty() && Retries.begin()->first<=Now ) {
+      Due.push_back( Retries.begin()->second );
+      Retries.erase( Retries.begin() );
+    }
+    while( (int)InFlight.size()<Window && ( !Due.empty() || !Unsent.empty() )) {
+      std::deque<size_t>& From = Due.empty() ? Unsent : Due;
+      size_t j = From.front();
+      From.pop_front();
+      if( !SendAll( Socket,Jobs[j].Line+"\n" )) {
+        fprintf( stderr,"  ERROR (fatal): unable to send to %s: %s\n",SocketPath.c_str(),strerror( errno ));
+        return 1;
+      }
+      InFlight.push_back( j );
+    }
+
+    int Timeout = 200;
+    if( !Retries.empty() ) {
+      long long Wait = std::chrono::duration_cast<std::chrono::milliseconds>(
+        Retries.begin()->first-Now ).count();
+      Timeout = (int)std::max( 0LL,std::min( (long long)Timeout,Wait ));
+    }
+    struct pollfd Poll = { Socket,POLLIN,0 };
+    int Ready = poll( &Poll,1,Timeout );
+    if( Ready<0 && errno != EINTR ) break;
+    if( Ready<=0 ) continue;
+    ssize_t n = read( Socket,Buffer,sizeof(Buffer) );
+    if( n<0 && errno == EINTR ) continue;
+    if( n<=0 ) {
+      Closed = true;
+      break;
+    }
+    Pending.append( Buffer,(size_t)n );
+    size_t End;
+    while(( End = Pending.find( '\n' )) != String::npos ) {
+      String Reply = Pending.substr( 0,End );
+      Pending.erase( 0,End+1 );
+      String ReplyID;
+      bool HasID = JSONField( Reply,"id",ReplyID ) && !ReplyID.empty();
+      auto Match = std::find_if( InFlight.begin(),InFlight.end(),[&]( size_t j ) {
+        String Quoted = Quote( Jobs[j].Line );
+        return HasID ? Jobs[j].ID == ReplyID : Reply.find( Quoted.substr( 1,Quoted.size()-2 )) != String::npos;
+      });
+      if( Match == InFlight.end() && !InFlight.empty() ) Match = InFlight.begin();
+      if( Match == InFlight.end() ) continue;
+      size_t j = *Match;
+      InFlight.erase( Match );
+
+      String Status, Message;
+      JSONField( Reply,"status",Status );
+      JSONField( Reply,"message",Message );
+      if( Status == "rejected" && Message.compare( 0,10,"queue full" ) == 0 &&
+          Jobs[j].Attempts<CLIENT_RETRY_LIMIT ) {
+        double Delay = std::min( CLIENT_RETRY_SECONDS*( 1 << Jobs[j].Attempts ),CLIENT_RETRY_MAX_SECONDS );
+        Jobs[j].Attempts++;
+        Retries.insert( std::make_pair( Clock::now()+std::chrono::duration_cast<Clock::duration>(
+          std::chrono::duration<double>( Delay )),j ));
+        fprintf( stderr,"  job %s: queue full, retrying in %.1f s\n",Jobs[j].ID.c_str(),Delay );
+        continue;
+      }
+      printf( "%s\n",Reply.c_str() );
+      fflush( stdout );
+      if( Status != "ok" ) Failed++;
+      Finished++;
+    }
+  }
+  close( Socket );
+  if( Finished<Jobs.size() ) {
+    fprintf( stderr,"  ERROR (fatal): server closed the connection after %zu of %zu replies\n",
+      Finished,Jobs.size() );
+    return 1;
+  }
+  return Failed>0 ? 1 : 0;
+}
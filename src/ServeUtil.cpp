@@ -0,0 +1,535 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <stdexcept>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "ServeUtil.h"
+#include "Misc.h"
+
+/* ***********************************************************************
+ * The conversion server (bin/toa --serve). GDAL is registered once and
+ * one worker thread per scene slot waits for jobs, so a small chip costs
+ * its conversion and nothing else. Jobs come from either or both of:
+ *
+ *   - a Unix domain socket. A client writes one JSON object per line
+ *     and gets one JSON line back per object, in the order the jobs
+ *     finish:
+ *
+ *       {"id": "a1", "image": "...", "imd": "...", "xml": "...",
+ *        "radiances": "...", "reflectances": "..."}
+ *         -> the scene's status record, as in a batch (status "ok" or
+ *            "failed", message, start, seconds, outputs, profile), led
+ *            by "id" and "queue_seconds"; or status "rejected" at once
+ *            when the queue is full or the server is shutting down
+ *       {"command": "status"}     -> slots, queue and job counters
+ *       {"command": "shutdown"}   -> stop taking jobs, finish the ones
+ *                                    admitted, then exit
+ *
+ *     The keys of a job are those of a JSON-lines manifest; "id" is
+ *     optional (job-N by default). See bin/toa_client.
+ *
+ *   - a spool directory, scanned twice a second. Each file *.jsonl
+ *     holds jobs, one per line as above; write it under another name
+ *     and rename it into place. A file is claimed (renamed *.running)
+ *     once the jobs of the files before it have all been admitted, its
+ *     status records are written to *.jsonl.status as the jobs finish,
+ *     and it is renamed *.jsonl.done after the last one.
+ *
+ * Admission control: at most QueueLimit jobs wait for a slot. Socket
+ * jobs beyond that are rejected, so a client can back off. Spool jobs
+ * simply wait: those of the claimed file are held in a backlog and
+ * admitted as the queue has room (each time a worker takes a job, and
+ * on each scan), and the files after it wait in the directory. On
+ * shutdown, jobs still in the backlog are rejected.
+ */
+
+static volatile sig_atomic_t StopSignal = 0;
+
+static void OnStopSignal( int ) {
+  StopSignal = 1;
+}
+
+// one job waiting for a scene slot, and where its status record goes
+struct ServeJob {
+  SceneJob Job;
+  String ID;
+  std::chrono::steady_clock::time_point Queued;
+  std::function<void( const String& )> Reply;
+};
+
+// a client of the socket. Workers reply from any thread, a line at a
+// time under a lock; the socket is closed with the last reference,
+// once the reader is done and every job of the client has replied.
+class ServeConnection {
+  private:
+    int Socket;
+    std::mutex WriteLock;
+
+  public:
+    explicit ServeConnection( int ClientSocket ) : Socket( ClientSocket ) {}
+    ~ServeConnection() { close( Socket ); }
+    ServeConnection( const ServeConnection& ) = delete;
+    ServeConnection& operator=( const ServeConnection& ) = delete;
+    int GetSocket() const { return Socket; }
+
+    void Send( const String& Line ) {
+      /* a client that has gone away is not an error of the server */
+      std::lock_guard<std::mutex> Guard( WriteLock );
+      String Text = Line+"\n";
+      size_t Sent = 0;
+      while( Sent<Text.size() ) {
+        ssize_t n = send( Socket,Text.data()+Sent,Text.size()-Sent,MSG_NOSIGNAL );
+        if( n<0 && errno == EINTR ) continue;
+        if( n<=0 ) return;
+        Sent += (size_t)n;
+      }
+    }
+};
+
+// a claimed spool file: status records are appended as its jobs finish,
+// and it is renamed *.done when the last job lets go of it
+struct SpoolFile {
+  String JobFilename;
+  String RunningFilename;
+  std::ofstream Status;
+  std::mutex Lock;
+
+  SpoolFile( const String& Job, const String& Running ) : JobFilename( Job ),
+    RunningFilename( Running ), Status( Job+".status",std::ios::app ) {}
+  ~SpoolFile() { rename( RunningFilename.c_str(),( JobFilename+".done" ).c_str() ); }
+
+  void Write( const String& Record ) {
+    std::lock_guard<std::mutex> Guard( Lock );
+    Status << Record << std::endl;
+  }
+};
+
+static String RejectedRecord( const String& ID, const String& Image, const String& Message ) {
+  return "{\"id\": "+JSONString( ID )+", \"image\": "+JSONString( Image )+
+    ", \"status\": \"rejected\", \"message\": "+JSONString( Message )+"}";
+}
+
+class ConversionServer {
+  private:
+    ServeOptions Serve;
+    SceneOptions PerScene;
+    int Scenes;
+    size_t QueueLimit;
+    std::deque<ServeJob> Queue;
+    std::deque<ServeJob> SpoolBacklog;
+    std::mutex QueueLock;
+    std::condition_variable QueueReady;
+    std::atomic<bool> Stopping{ false };
+    std::atomic<int> Running{ 0 };
+    std::atomic<int> Completed{ 0 };
+    std::atomic<int> Failed{ 0 };
+    std::atomic<int> Rejected{ 0 };
+    std::atomic<uint64_t> NextID{ 1 };
+    std::atomic<int> Readers{ 0 };
+    std::mutex ReadersLock;
+    std::condition_variable ReadersDone;
+    std::chrono::steady_clock::time_point StartTime;
+    int ListenSocket = -1;
+
+    bool Submit( ServeJob&&, String& );
+    void AdmitSpoolJobs();
+    void Worker();
+    String StatusRecord();
+    void HandleLine( const String&, const std::shared_ptr<ServeConnection>& );
+    void ReadConnection( std::shared_ptr<ServeConnection> );
+    void Listen();
+    void AcceptConnections();
+    void ScanSpool();
+    void ClaimSpoolFile( const String& );
+
+  public:
+    ConversionServer( const SceneOptions&, const BatchBudget&, const ServeOptions& );
+    int Run();
+};
+
+ConversionServer::ConversionServer( const SceneOptions& Options, const BatchBudget& Budget,
+  const ServeOptions& ServerOptions ) : Serve( ServerOptions ) {
+  /* scene slots, threads and memory are shared out as for a batch */
+  InitializeGDAL();
+  int Threads = ( Budget.Threads>0 ) ? Budget.Threads : HardwareThreads();
+  Scenes      = ( Budget.Scenes>0 ) ? Budget.Scenes : std::max( 1,Threads/4 );
+  PerScene    = ShareBatchBudget( Options,Budget,Scenes );
+  QueueLimit  = ( Serve.QueueLimit>0 ) ? (size_t)Serve.QueueLimit : (size_t)( SERVE_QUEUE_PER_SCENE*Scenes );
+  StartTime   = std::chrono::steady_clock::now();
+}
+
+bool ConversionServer::Submit( ServeJob&& Job, String& Why ) {
+  /* *********************************************************************
+   * Admit a socket job into the queue. Refused while shutting down, and
+   * when QueueLimit jobs wait.
+   */
+  std::lock_guard<std::mutex> Guard( QueueLock );
+  if( Stopping ) {
+    Why = "server is shutting down";
+    return false;
+  }
+  if( Queue.size()>=QueueLimit ) {
+    Why = "queue full: "+std::to_string( Queue.size() )+" jobs waiting for "+
+      std::to_string( Scenes )+" scene slots";
+    return false;
+  }
+  Job.Queued = std::chrono::steady_clock::now();
+  Queue.push_back( std::move( Job ));
+  QueueReady.notify_one();
+  return true;
+}
+
+void ConversionServer::AdmitSpoolJobs() {
+  /* move spool jobs from the backlog into the queue while it has room;
+     called with QueueLock held */
+  while( !Stopping && !SpoolBacklog.empty() && Queue.size()<QueueLimit ) {
+    SpoolBacklog.front().Queued = std::chrono::steady_clock::now();
+    Queue.push_back( std::move( SpoolBacklog.front() ));
+    SpoolBacklog.pop_front();
+    QueueReady.notify_one();
+  }
+}
+
+void ConversionServer::Worker() {
+  /* *********************************************************************
+   * One scene slot: take the oldest job, let the next spool job into
+   * the place it frees, convert it (ConvertSceneRecord() catches the
+   * scene's errors) and reply with its record. Exits once the server is
+   * stopping and the queue has drained.
+   */
+  for(;;) {
+    ServeJob Job;
+    {
+      std::unique_lock<std::mutex> Guard( QueueLock );
+      QueueReady.wait( Guard,[&]{ return Stopping || !Queue.empty(); } );
+      if( Queue.empty() ) return;
+      Job = std::move( Queue.front() );
+      Queue.pop_front();
+      this->AdmitSpoolJobs();
+      Running++;
+    }
+    double QueueSeconds = std::chrono::duration<double>(
+      std::chrono::steady_clock::now()-Job.Queued ).count();
+    char Fields[64];
+    snprintf( Fields,sizeof(Fields),", \"queue_seconds\": %.4f",QueueSeconds );
+    double Seconds = 0.0;
+    bool JobFailed = false;
+    String Record = ConvertSceneRecord( Job.Job,PerScene,"\"id\": "+JSONString( Job.ID )+Fields,
+      Seconds,JobFailed );
+    Running--;
+    Completed++;
+    if( JobFailed ) Failed++;
+    Job.Reply( Record );
+    printf("  job %s %s (%.2f s, queued %.2f s): %s\n",Job.ID.c_str(),
+      JobFailed ? "FAILED" : "done",Seconds,QueueSeconds,Job.Job.ImageFilename.c_str() );
+    fflush( stdout );
+  }
+}
+
+String ConversionServer::StatusRecord() {
+  size_t Queued, Spooled;
+  {
+    std::lock_guard<std::mutex> Guard( QueueLock );
+    Queued  = Queue.size();
+    Spooled = SpoolBacklog.size();
+  }
+  double Uptime = std::chrono::duration<double>( std::chrono::steady_clock::now()-StartTime ).count();
+  std::ostringstream Record;
+  Record << "{\"command\": \"status\", \"status\": \"ok\", \"scenes\": " << Scenes
+         << ", \"threads_per_scene\": " << PerScene.ComputeThreads
+         << ", \"queue_limit\": " << QueueLimit << ", \"queued\": " << Queued
+         << ", \"spooled\": " << Spooled
+         << ", \"running\": " << Running << ", \"completed\": " << Completed
+         << ", \"failed\": " << Failed << ", \"rejected\": " << Rejected
+         << ", \"stopping\": " << ( Stopping ? "true" : "false" )
+         << ", \"uptime_seconds\": " << Uptime << "}";
+  return Record.str();
+}
+
+void ConversionServer::HandleLine( const String& Line,
+  const std::shared_ptr<ServeConnection>& Connection ) {
+  /* one line from a client: a command, or a job to admit or reject */
+  std::map<String,String> Fields;
+  if( !ParseJSONObject( Line,Fields )) {
+    Rejected++;
+    Connection->Send( RejectedRecord( "","","malformed JSON object: "+Line ));
+    return;
+  }
+  if( Fields.count( "command" )) {
+    if( Fields["command"] == "status" ) {
+      Connection->Send( this->StatusRecord() );
+    } else if( Fields["command"] == "shutdown" ) {
+      {
+        std::lock_guard<std::mutex> Guard( QueueLock );
+        Stopping = true;
+      }
+      QueueReady.notify_all();
+      Connection->Send( "{\"command\": \"shutdown\", \"status\": \"ok\"}" );
+    } else {
+      Connection->Send( "{\"command\": "+JSONString( Fields["command"] )+
+        ", \"status\": \"failed\", \"message\": \"unknown command\"}" );
+    }
+    return;
+  }
+
+  ServeJob Job;
+  Job.Job = MakeSceneJob( Fields );
+  Job.ID  = Fields.count( "id" ) ? Fields["id"] : "job-"+std::to_string( NextID++ );
+  String ID    = Job.ID;
+  String Image = Job.Job.ImageFilename;
+  if( Job.Job.ImageFilename.empty() || Job.Job.IMDFilename.empty() ) {
+    Rejected++;
+    Connection->Send( RejectedRecord( ID,Image,"job needs image and imd" ));
+    return;
+  }
+  std::shared_ptr<ServeConnection> Client = Connection;
+  Job.Reply = [Client]( const String& Record ) { Client->Send( Record ); };
+  String Why;
+  if( !this->Submit( std::move( Job ),Why )) {
+    Rejected++;
+    Connection->Send( RejectedRecord( ID,Image,Why ));
+  }
+}
+
+void ConversionServer::ReadConnection( std::shared_ptr<ServeConnection> Connection ) {
+  /* *********************************************************************
+   * Read a client's lines until it closes its end or the server stops.
+   * The socket is polled so that a quiet client does not hold up a
+   * shutdown; replies to jobs already admitted still go out afterwards.
+   */
+  String Pending;
+  char Buffer[4096];
+  while( !Stopping ) {
+    struct pollfd Poll = { Connection->GetSocket(),POLLIN,0 };
+    int Ready = poll( &Poll,1,200 );
+    if( Ready<0 && errno != EINTR ) break;
+    if( Ready<=0 ) continue;
+    ssize_t n = read( Connection->GetSocket(),Buffer,sizeof(Buffer) );
+    if( n<0 && errno == EINTR ) continue;
+    if( n<=0 ) break;
+    Pending.append( Buffer,(size_t)n );
+    size_t End;
+    while(( End = Pending.find( '\n' )) != String::npos ) {
+      String Line = trim( Pending.substr( 0,End ));
+      Pending.erase( 0,End+1 );
+      if( !Line.empty() ) this->HandleLine( Line,Connection );
+    }
+  }
+  std::lock_guard<std::mutex> Guard( ReadersLock );
+  Readers--;
+  ReadersDone.notify_all();
+}
+
+void ConversionServer::Listen() {
+  /* *********************************************************************
+   * Bind the socket. A socket file left by a server that died is
+   * replaced; one that a server still answers on is an error.
+   */
+  struct sockaddr_un Address;
+  memset( &Address,0,sizeof(Address) );
+  Address.sun_family = AF_UNIX;
+  if( Serve.SocketPath.size()>=sizeof(Address.sun_path) ) {
+    throw std::runtime_error( "  ERROR (fatal): socket path too long: "+Serve.SocketPath );
+  }
+  strncpy( Address.sun_path,Serve.SocketPath.c_str(),sizeof(Address.sun_path)-1 );
+
+  int Probe = socket( AF_UNIX,SOCK_STREAM,0 );
+  if( Probe>=0 ) {
+    bool Answered = connect( Probe,(struct sockaddr*)&Address,sizeof(Address) ) == 0;
+    close( Probe );
+    if( Answered ) {
+      throw std::runtime_error( "  ERROR (fatal): a server is already listening on: "+Serve.SocketPath );
+    }
+  }
+  unlink( Serve.SocketPath.c_str() );
+
+  ListenSocket = socket( AF_UNIX,SOCK_STREAM,0 );
+  if( ListenSocket<0 || bind( ListenSocket,(struct sockaddr*)&Address,sizeof(Address) ) != 0 ||
+      listen( ListenSocket,64 ) != 0 ) {
+    String Reason = strerror( errno );
+    if( ListenSocket>=0 ) close( ListenSocket );
+    ListenSocket = -1;
+    throw std::runtime_error( "  ERROR (fatal): unable to listen on socket "+Serve.SocketPath+": "+Reason );
+  }
+}
+
+void ConversionServer::AcceptConnections() {
+  /* wait up to 200 ms for a client, and give each its reader thread */
+  if( ListenSocket<0 ) {
+    std::this_thread::sleep_for( std::chrono::milliseconds( 200 ));
+    return;
+  }
+  struct pollfd Poll = { ListenSocket,POLLIN,0 };
+  if( poll( &Poll,1,200 )<=0 ) return;
+  int Client = accept( ListenSocket,nullptr,nullptr );
+  if( Client<0 ) return;
+  {
+    std::lock_guard<std::mutex> Guard( ReadersLock );
+    Readers++;
+  }
+  std::thread( &ConversionServer::ReadConnection,this,std::make_shared<ServeConnection>( Client )).detach();
+}
+
+void ConversionServer::ClaimSpoolFile( const String& JobFilename ) {
+  /* *********************************************************************
+   * Take one spool file: rename it *.running (another server watching
+   * the same directory may win the race, and then it is skipped) and
+   * put its jobs in the backlog, admitting what the queue has room for.
+   * Bad lines get a rejected record straight away.
+   */
+  String RunningFilename = JobFilename+".running";
+  if( rename( JobFilename.c_str(),RunningFilename.c_str() ) != 0 ) return;
+  std::shared_ptr<SpoolFile> Spool = std::make_shared<SpoolFile>( JobFilename,RunningFilename );
+  std::ifstream Jobs( RunningFilename );
+  String Base = JobFilename.substr( JobFilename.find_last_of( '/' )+1 );
+  std::deque<ServeJob> Backlog;
+  String Line;
+  int LineNumber = 0;
+  while( std::getline( Jobs,Line )) {
+    LineNumber++;
+    String Trimmed = trim( Line );
+    if( Trimmed.empty() || Trimmed[0] == '#' ) continue;
+    std::map<String,String> Fields;
+    String DefaultID = Base+":"+std::to_string( LineNumber );
+    if( !ParseJSONObject( Trimmed,Fields )) {
+      Rejected++;
+      Spool->Write( RejectedRecord( DefaultID,"","malformed JSON object" ));
+      continue;
+    }
+    ServeJob Job;
+    Job.Job   = MakeSceneJob( Fields );
+    Job.ID    = Fields.count( "id" ) ? Fields["id"] : DefaultID;
+    Job.Reply = [Spool]( const String& Record ) { Spool->Write( Record ); };
+    if( Job.Job.ImageFilename.empty() || Job.Job.IMDFilename.empty() ) {
+      Rejected++;
+      Spool->Write( RejectedRecord( Job.ID,Job.Job.ImageFilename,"job needs image and imd" ));
+      continue;
+    }
+    Backlog.push_back( std::move( Job ));
+  }
+  size_t Count = Backlog.size();
+  {
+    std::lock_guard<std::mutex> Guard( QueueLock );
+    for( ServeJob& Job: Backlog ) SpoolBacklog.push_back( std::move( Job ));
+    this->AdmitSpoolJobs();
+  }
+  printf("  spool file claimed: %s (%zu jobs)\n",JobFilename.c_str(),Count );
+  fflush( stdout );
+}
+
+void ConversionServer::ScanSpool() {
+  /* admit backlogged spool jobs, then claim *.jsonl files, oldest name
+     first, while the backlog is empty and the queue has room */
+  DIR* Directory = opendir( Serve.SpoolDirectory.c_str() );
+  if( Directory == nullptr ) return;
+  std::vector<String> Names;
+  while( struct dirent* Entry = readdir( Directory )) {
+    String Name = Entry->d_name;
+    if( Name.size()>6 && Name.compare( Name.size()-6,6,".jsonl" ) == 0 ) Names.push_back( Name );
+  }
+  closedir( Directory );
+  std::sort( Names.begin(),Names.end() );
+  for( const String& Name: Names ) {
+    {
+      std::lock_guard<std::mutex> Guard( QueueLock );
+      this->AdmitSpoolJobs();
+      if( Stopping || !SpoolBacklog.empty() || Queue.size()>=QueueLimit ) return;
+    }
+    this->ClaimSpoolFile( Serve.SpoolDirectory+"/"+Name );
+  }
+}
+
+int ConversionServer::Run() {
+  /* *********************************************************************
+   * Start the workers, then take jobs until a shutdown command or signal.
+   * On the way out no new jobs are admitted, the queue drains, and the
+   * socket file is removed.
+   */
+  if( !Serve.SocketPath.empty() ) this->Listen();
+  struct sigaction Action, OldInterrupt, OldTerminate;
+  memset( &Action,0,sizeof(Action) );
+  Action.sa_handler = OnStopSignal;
+  sigemptyset( &Action.sa_mask );
+  sigaction( SIGINT,&Action,&OldInterrupt );
+  sigaction( SIGTERM,&Action,&OldTerminate );
+
+  std::vector<std::thread> Workers;
+  for( int s=0; s<Scenes; s++ ) Workers.emplace_back( &ConversionServer::Worker,this );
+
+  printf("  serving: %d scene slots, %d threads each, up to %zu jobs queued\n",Scenes,
+    PerScene.ComputeThreads,QueueLimit );
+  if( !Serve.SocketPath.empty() )     printf("  socket: %s\n",Serve.SocketPath.c_str() );
+  if( !Serve.SpoolDirectory.empty() ) printf("  spool directory: %s\n",Serve.SpoolDirectory.c_str() );
+  fflush( stdout );
+
+  auto LastScan = std::chrono::steady_clock::now()-std::chrono::seconds( 1 );
+  while( !Stopping ) {
+    if( StopSignal ) {
+      std::lock_guard<std::mutex> Guard( QueueLock );
+      Stopping = true;
+      break;
+    }
+    this->AcceptConnections();
+    if( !Serve.SpoolDirectory.empty() && std::chrono::duration<double>(
+          std::chrono::steady_clock::now()-LastScan ).count()>=SERVE_SPOOL_INTERVAL_SECONDS ) {
+      this->ScanSpool();
+      LastScan = std::chrono::steady_clock::now();
+    }
+  }
+
+  size_t Queued;
+  std::deque<ServeJob> Unadmitted;
+  {
+    std::lock_guard<std::mutex> Guard( QueueLock );
+    Queued = Queue.size();
+    Unadmitted.swap( SpoolBacklog );
+  }
+  printf("  shutting down: finishing %d running and %zu queued jobs\n",(int)Running,Queued );
+  fflush( stdout );
+  for( ServeJob& Job: Unadmitted ) {
+    Rejected++;
+    Job.Reply( RejectedRecord( Job.ID,Job.Job.ImageFilename,"server is shutting down" ));
+  }
+  Unadmitted.clear();
+  if( ListenSocket>=0 ) {
+    close( ListenSocket );
+    unlink( Serve.SocketPath.c_str() );
+  }
+  QueueReady.notify_all();
+  for( std::thread& Thread: Workers ) Thread.join();
+  {
+    std::unique_lock<std::mutex> Guard( ReadersLock );
+    ReadersDone.wait( Guard,[&]{ return Readers == 0; } );
+  }
+  sigaction( SIGINT,&OldInterrupt,nullptr );
+  sigaction( SIGTERM,&OldTerminate,nullptr );
+  StopSignal = 0;
+
+  printf("  server finished: %d jobs, %d failed, %d rejected\n",(int)Completed,(int)Failed,(int)Rejected );
+  return Failed;
+}
+
+int RunServer( const SceneOptions& Options, const BatchBudget& Budget, const ServeOptions& Serve ) {
+  if( Serve.SocketPath.empty() && Serve.SpoolDirectory.empty() ) {
+    throw std::runtime_error( "  ERROR (fatal): the server needs a socket or a spool directory" );
+  }
+  ConversionServer Server( Options,Budget,Serve );
+  return Server.Run();
+}
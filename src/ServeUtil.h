@@ -0,0 +1,26 @@
+#ifndef SERVEUTIL_H_
+#define SERVEUTIL_H_
+#include <string>
+#include "BatchUtil.h"
+typedef std::string String;
+
+// seconds between scans of the spool directory
+#define SERVE_SPOOL_INTERVAL_SECONDS 0.5
+
+// jobs that may wait for a free scene slot, per scene slot, by default
+#define SERVE_QUEUE_PER_SCENE 4
+
+// where a server takes jobs from, and how many it admits
+struct ServeOptions {
+  String SocketPath;        // Unix domain socket, "" = none
+  String SpoolDirectory;    // directory of job files, "" = none
+  int QueueLimit = 0;       // jobs waiting for a slot, 0 = SERVE_QUEUE_PER_SCENE per scene
+};
+
+// run a conversion server until it is told to shut down (a shutdown
+// command, SIGINT or SIGTERM), with GDAL registered once and one warm
+// worker per scene slot (see ServeUtil.cpp for the protocol). Jobs run
+// with the options given, sharing the budget as a batch's scenes do.
+// Returns the number of jobs that failed.
+int RunServer( const SceneOptions&, const BatchBudget&, const ServeOptions& );
+#endif
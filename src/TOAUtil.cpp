@@ -5,101 +5,246 @@
 #include <cassert>
 #include <unistd.h>
 #include <string>
+#include <stdexcept>
 #include <math.h>
-#include "gdal_priv.h"
-#include "cpl_conv.h"
+#include <string.h>
 #include "pugixml.hpp"
 #include "Misc.h"
 #include "TOAUtil.h"
+#include "IMDUtil.h"
 #include <algorithm>
 using namespace std;
 using namespace pugi;
 typedef std::string String;
 
+bool ParseSpectralBand( const String& BandName, SpectralBand& ID ) {
+  /* *****************************
+   * function ParseSpectralBand( BandName,ID ):
+   * map the name of a band in the XML (e.g. BAND_C) to its
+   * SpectralBand. Returns false for other bands.
+   */
+  static const char* Names[SPECTRAL_BAND_COUNT] = { 
+    "BAND_P","BAND_C","BAND_B","BAND_G","BAND_Y","BAND_R","BAND_N","BAND_N2","BAND_RE" };
+  for( int i=0; i<SPECTRAL_BAND_COUNT; i++ ) {
+    if( BandName == Names[i] ) {
+      ID = (SpectralBand)i;
+      return true;
+    }
+  }
+  return false;
+}
+
+double SolarIrradiance( const String& SatelliteID, SpectralBand ID ) {
+  /* ***********************************************************************
+   * Exo-atmospheric solar irradiance for a band of a satellite (e.g.
+   * "WV02"), in the order of SpectralBand: PAN, COASTAL, BLUE, GREEN,
+   * YELLOW, RED, NIR, NIR2, REDEDGE. Bands a satellite does not have
+   * are -9999.
+   */
+  if( SatelliteID == "WV03" ) {
+    // https://dg-cms-uploads-production.s3.amazonaws.com/uploads/document/file/207/Radiometric_Use_of_WorldView-3_v2.pdf
+    static const double Irradiances[SPECTRAL_BAND_COUNT] = {
+      1583.58, 1743.81, 1971.48, 1856.26, 1749.4, 1555.11, 1071.98, 863.296, 1343.95 };
+    return Irradiances[ID];
+  } else if ( SatelliteID == "WV02" ) {
+    // https://www.yumpu.com/en/document/read/43552535/radiometric-use-of-worldview-2-imagery-technical-note-pancroma
+    static const double Irradiances[SPECTRAL_BAND_COUNT] = {
+      1580.8140, 1758.2229, 1974.2416, 1856.4104, 1738.4791, 1559.4555, 1069.7302, 861.2866, 1342.0695 };
+    return Irradiances[ID];
+  } else if( SatelliteID == "QB02"  ) {
+    // https://grasswiki.osgeo.org/wiki/QuickBird
+    static const double Irradiances[SPECTRAL_BAND_COUNT] = {
+      1381.79, -9999.0, 1924.59, 1843.08, -9999.0, 1574.77, 1113.71, -9999.0, -9999.0 };
+    return Irradiances[ID];
+  } else if( SatelliteID == "OV05" ) {
+    // https://apollomapping.com/wp-content/user_uploads/2011/09/GeoEye1_Radiance_at_Aperture.pdf 
+    // (mW/cm2/um, converted to W/m2/um)
+    static const double Irradiances[SPECTRAL_BAND_COUNT] = {
+      161.7 * (1.0/1000.0) * (1.0/0.0001), -9999.0, 196.0 * (1.0/1000.0) * (1.0/0.0001),
+      185.3 * (1.0/1000.0) * (1.0/0.0001), -9999.0, 150.5 * (1.0/1000.0) * (1.0/0.0001),
+      103.9 * (1.0/1000.0) * (1.0/0.0001), -9999.0, -9999.0 };
+    return Irradiances[ID];
+  }
+  String ErrorMessage = (String)"ERROR (fatal): satellite key from XML not recognized: "+SatelliteID+". Exiting ...\n";
+  throw std::runtime_error(ErrorMessage); 
+}
+
 /* *****************************
- * function SetCalibration( 
- *   const char* imd_filename,
- *   const char* xml_filename, 
- *   const char* ntf_filename )
+ * function MakeBandCalibration( ... ):
+ * one band's calibration, with its solar irradiance looked up
+ * for the satellite. Throws for band names that are not known.
  */
-std::map<String,String> SetCalibrationAndBandWidth( const char* imd_filename, 
-  const char* xml_filename, 
-  const char* ntf_filename )
+BandCalibration MakeBandCalibration( const String& SatelliteID, const String& BandName,
+  double AbsCalFactor, double EffectiveBandwidth )
 {
-  // first determine the number of bands in the image using GDAL
-  GDALAllRegister();
-  String ErrorMsg = "";
-  GDALDataset *imageDataset;
-  imageDataset    = (GDALDataset*) GDALOpen( ntf_filename,GA_ReadOnly );
-  GDALClose(imageDataset);
-  GDALDestroyDriverManager();
+  BandCalibration Band;
+  Band.Name = BandName;
+  if(!ParseSpectralBand( BandName,Band.ID )) {
+    String ErrorMsg = (String)"ERROR (fatal): unable to get solar irradiance for band: "+BandName+"\n";
+    throw std::runtime_error( ErrorMsg );
+  }
+  Band.AbsCalFactor       = AbsCalFactor;
+  Band.EffectiveBandwidth = EffectiveBandwidth;
+  Band.SolarIrradiance    = SolarIrradiance( SatelliteID,Band.ID );
+  return Band;
+}
 
-  // initialize map to hold band metadata (calibration and bandwidth factors)
-  std::map<String,String> CalibrationAndBandwidths;
+/* *****************************
+ * function FindIMDSubtree( Data,Size,First,Last ):
+ * locate the <IMD> ... </IMD> element of a DG XML in memory, so
+ * that only it is parsed. The rest of the file (RPBs, tile lists,
+ * per-line EPH/ATT arrays) can run to megabytes and is never
+ * needed. Returns false if the element is not there.
+ */
+static bool FindIMDSubtree( const char* Data, size_t Size, size_t& First, size_t& Last )
+{
+  static const char OpenTag[]  = "<IMD>";
+  static const char CloseTag[] = "</IMD>";
+  const char* Open = (const char*)memmem( Data,Size,OpenTag,sizeof(OpenTag)-1 );
+  if( !Open ) return false;
+  size_t Rest = Size-( Open-Data );
+  const char* Close = (const char*)memmem( Open,Rest,CloseTag,sizeof(CloseTag)-1 );
+  if( !Close ) return false;
+  First = Open-Data;
+  Last  = ( Close-Data )+sizeof(CloseTag)-1;
+  return true;
+}
+
+/* *****************************
+ * function ParseSceneCalibration( Data,Size,Source ):
+ * parse the satellite ID and, for every band in the IMD section
+ * of the XML (BAND_P, BAND_C, ...), its absolute calibration
+ * factor and effective bandwidth. The solar irradiance of each
+ * band is looked up here too, so the scene's calibration is
+ * complete after this one pass over the XML.
+ *
+ * Only the IMD element is handed to pugixml, parsed in place
+ * (no copy of the text, which must be writable) with the
+ * minimal flags: no attributes, escapes or end-of-line
+ * normalization, none of which the IMD values use. Source
+ * names the XML in error messages.
+ */
+static SceneCalibration ParseSceneCalibration( char* Data, size_t Size, const String& Source )
+{
+  String ErrorMsg = "";
+  SceneCalibration Calibration;
 
-  // now based on number of bands, open XML and parse metadata
-  // first try to open and create file object. if failure, then
-  // send an exit message to the terminal.
+  // parse just the IMD subtree if it can be found, else the whole text
+  size_t First = 0;
+  size_t Last  = Size;
+  bool Subtree = FindIMDSubtree( Data,Size,First,Last );
   pugi::xml_document xmldoc;
-  pugi::xml_parse_result xml_parse_result = xmldoc.load_file(xml_filename);
+  pugi::xml_parse_result xml_parse_result = xmldoc.load_buffer_inplace( 
+    Data+First,Last-First,pugi::parse_minimal,pugi::encoding_utf8 );
 
   // exit if failure to read the XML file
   if(!xml_parse_result)
   {
-    ErrorMsg = "  ERROR (fatal): unable to read XML file: "+(String)xml_filename;
-    print_error_msg_and_exit( ErrorMsg.c_str() );
+    ErrorMsg = "  ERROR (fatal): unable to read XML file: "+Source;
+    throw std::runtime_error( ErrorMsg );
   }
 
   // get the satellite ID
-  const char* SatelliteID = xmldoc.child("isd").child("IMD").child("IMAGE").child("SATID").child_value();
-  CalibrationAndBandwidths[(String)"SatelliteID"] = (String)SatelliteID;
+  xml_node IMD = Subtree ? xmldoc.child("IMD") : xmldoc.child("isd").child("IMD");
+  Calibration.SatelliteID = trim( (String)IMD.child("IMAGE").child("SATID").child_value() );
 
-  /* Do something like the following:
-   *   xmldoc.child("isd").child("IMD").child("BAND_C").child("ULLON").child_value() << endl;
-   * to parse out values from the bands.
+  /* the bands are the children of the IMD named BAND_*, in the
+   * order of the image's bands, e.g.
+   *   <BAND_C> ... <ABSCALFACTOR>1.397474e-02</ABSCALFACTOR>
+   *            ... <EFFECTIVEBANDWIDTH>4.05e-02</EFFECTIVEBANDWIDTH>
    */
-  xml_node IMD = xmldoc.child("isd").child("IMD");
-  int BandNumber = 0;
-
   for( pugi::xml_node xml_child: IMD.children()) {
-    
-    const char* xml_child_name = xml_child.name();
-    bool isBand = true;
-    isBand = ((String)xml_child_name).find("BAND")!=std::string::npos;
-    if(!isBand){continue;}
-
-    for( pugi::xml_node xml_subchild: xml_child.children() ) {
- 
-      // set variables for keys and values to store into a hash or map
-      const char* xml_subchild_name  = xml_subchild.name();
-      const char* xml_subchild_value = IMD.child( 
-        xml_child_name ).child( xml_subchild_name ).child_value(); 
-      String Key = std::to_string(BandNumber)+"__"+(String)xml_child_name+"__"+(String)xml_subchild_name;
-      String Val = (String)xml_subchild_value;
-      CalibrationAndBandwidths[Key]=Val;
+    String BandName = (String)xml_child.name();
+    if( BandName.compare( 0,5,"BAND_" ) != 0 ){continue;}
+
+    String AbsCalFactor       = trim( (String)xml_child.child("ABSCALFACTOR").child_value() );
+    String EffectiveBandwidth = trim( (String)xml_child.child("EFFECTIVEBANDWIDTH").child_value() );
+    if( AbsCalFactor.empty() || EffectiveBandwidth.empty() ) {
+      ErrorMsg = "  ERROR (fatal): no ABSCALFACTOR/EFFECTIVEBANDWIDTH for "+BandName+" in XML file: "+Source;
+      throw std::runtime_error( ErrorMsg );
     }
-    BandNumber++;
+    Calibration.Bands.push_back( MakeBandCalibration( Calibration.SatelliteID,BandName,
+      stod( AbsCalFactor ),stod( EffectiveBandwidth )));
+  }
+  return Calibration;
+}
+
+/* *****************************
+ * function ReadSceneCalibration( const char* xml_filename ):
+ * the calibration from an XML file, memory-mapped copy-on-write
+ * so that it is parsed in place.
+ */
+SceneCalibration ReadSceneCalibration( const char* xml_filename )
+{
+  // map the XML file; throws if it cannot be opened.
+  MappedFile XMLFile( (String)xml_filename,true );
+  return ParseSceneCalibration( XMLFile.GetData(),XMLFile.GetSize(),(String)xml_filename );
+}
+
+/* *****************************
+ * function ReadSceneCalibrationText( XMLText,Source ):
+ * the same from the text of an XML held in memory (see LibTOA.h),
+ * parsed in a private copy. Source names it in error messages.
+ */
+SceneCalibration ReadSceneCalibrationText( const String& XMLText, const String& Source )
+{
+  String Text = XMLText;
+  return ParseSceneCalibration( &Text[0],Text.size(),Source );
+}
+
+/* *****************************
+ * function ReadSceneCalibration( const IMDFile& IMD ):
+ * the same calibration from the IMD alone, so that the XML is not
+ * needed. The bands are the top-level groups named BAND_*, in
+ * the order of the image's bands, e.g.
+ *   BEGIN_GROUP = BAND_C
+ *     absCalFactor = 1.397474e-02;
+ *     effectiveBandwidth = 4.05e-02;
+ *   END_GROUP = BAND_C
+ * and the satellite is satId in the IMAGE_1 group.
+ */
+SceneCalibration ReadSceneCalibration( const IMDFile& IMD )
+{
+  String ErrorMsg = "";
+  SceneCalibration Calibration;
+
+  std::string_view SatelliteID;
+  if( !IMD.Find( "satId",SatelliteID,IMD.FindGroup( "IMAGE_1" )) && 
+      !IMD.FindAnywhere( "satId",SatelliteID )) {
+    ErrorMsg = "  ERROR (fatal): no satId in IMD file: "+IMD.GetFilename();
+    throw std::runtime_error( ErrorMsg );
+  }
+  Calibration.SatelliteID = String( IMDFile::Unquote( SatelliteID ));
+
+  const std::vector<IMDGroup>& Groups = IMD.GetGroups();
+  for( size_t g=0; g<Groups.size(); g++ ) {
+    if( Groups[g].Parent != IMD_ROOT || Groups[g].Name.compare( 0,5,"BAND_" ) != 0 ){continue;}
+    String BandName = String( Groups[g].Name );
+    Calibration.Bands.push_back( MakeBandCalibration( Calibration.SatelliteID,BandName,
+      IMD.GetDouble( "absCalFactor",(int)g ),IMD.GetDouble( "effectiveBandwidth",(int)g )));
+  }
+  return Calibration;
+}
+
+bool HasBandCalibration( const IMDFile& IMD )
+{
+  /* true if the IMD has any top-level BAND_* group */
+  for( const IMDGroup& Group: IMD.GetGroups() ) {
+    if( Group.Parent == IMD_ROOT && Group.Name.compare( 0,5,"BAND_" ) == 0 ) return true;
   }
-  return CalibrationAndBandwidths;
+  return false;
 }
 
 /* ***************************************************************
- * function SolarZenithAngle( const char* MetadataLine)
- * This function takes in a string (pointer to string that is)
- * corresponding to the line in the .IMD metadata file containing
- * the solar zenith information. This function parses out the 
- * data from the line and calculates the solar zenith angle.
+ * function SolarZenithAngle( double MeanSunElevation )
+ * This function takes in the mean sun elevation of the scene
+ * (meanSunEl in the .IMD metadata file, in degrees) and
+ * calculates the solar zenith angle.
  *
  * Returns the angle in degrees. Not radians.
  */
-double SolarZenithAngle( const char* MetadataLine ){
-  double solarZenithAngle = NODATA;
-  String MeanSunElevStr = String(MetadataLine);
-  MeanSunElevStr = trim(MeanSunElevStr.substr( 
-    MeanSunElevStr.find("=")+1,MeanSunElevStr.length()-1 ));
-  double solarElevationAngle = stod(MeanSunElevStr);
-  solarZenithAngle = 90.0 - solarElevationAngle;  
-  return solarZenithAngle; 
+double SolarZenithAngle( double MeanSunElevation ){
+  return 90.0 - MeanSunElevation;
 }
 
 /* ****************************************************************
@@ -120,62 +265,67 @@ void EarthSunDistance( const char* imd_filename, SolarMetadata* Metadata ) {
   String ErrorMsg = "";
   if(!file_exists(imd_filename)) {
     ErrorMsg = "  ERROR (fatal): file does not exist: "+(String)imd_filename;
-    print_error_msg_and_exit( ErrorMsg.c_str() );
-  }
-
-  // open up the file for parsing.
-  // iterate through the lines in the file
-  std::ifstream imd_stream( imd_filename );
-  String line;
-  String firstTimeLine   = "";
-  String solarZenithLine = "";
-  String searchStr("firstLineTime");
-  String searchStrZenithAngle("meanSunEl");
-
-  while( std::getline(imd_stream,line)) {
-    if( line.find(searchStr) != String::npos ){
-      firstTimeLine   = line;
-    }
-    if( line.find(searchStrZenithAngle) != String::npos ) {
-      solarZenithLine = line; 
-    }
+    throw std::runtime_error( ErrorMsg );
   }
+  IMDFile IMD( imd_filename );
+  EarthSunDistance( IMD,Metadata );
+}
 
-  // close out the file-stream
-  // *************************
-  imd_stream.close();
+/* ****************************************************************
+ * function EarthSunDistance( const IMDFile&, SolarMetadata* ):
+ * as above, from an IMD that has already been indexed. The
+ * acquisition time (firstLineTime) and mean sun elevation
+ * (meanSunEl) are looked up in the IMAGE_1 group, or anywhere in
+ * the file if there is no such group, and the bit depth
+ * (bitsPerPixel) at the top level. Fields are read from the
+ * mapped text in place.
+ * ****************************************************************
+ */
+void EarthSunDistance( const IMDFile& IMD, SolarMetadata* Metadata ) {
+  String ErrorMsg = "";
+  std::string_view firstTimeValue;
+  std::string_view solarElevationValue;
+  int Image = IMD.FindGroup( "IMAGE_1" );
+  if( !IMD.Find( "firstLineTime",firstTimeValue,Image ))     IMD.FindAnywhere( "firstLineTime",firstTimeValue );
+  if( !IMD.Find( "meanSunEl",solarElevationValue,Image ))    IMD.FindAnywhere( "meanSunEl",solarElevationValue );
 
   // check to make sure IMD file had firstLineTime entry,
   // if not, error and exit.
-  if( firstTimeLine.length()<1 )
+  if( firstTimeValue.length()<1 )
   {
-    ErrorMsg = "  ERROR (fatal): IMD file does not have first line time: "+(String)imd_filename;
-    print_error_msg_and_exit( ErrorMsg.c_str() );
+    ErrorMsg = "  ERROR (fatal): IMD file does not have first line time: "+IMD.GetFilename();
+    throw std::runtime_error( ErrorMsg );
   }
 
   // check to make sure solar zenith line was found...
-  if( solarZenithLine.length()<1 )
+  double solarElevationAngle = 0.0;
+  if( !IMDFile::ParseDouble( solarElevationValue,solarElevationAngle ))
   {
-    ErrorMsg = "  ERROR (fatal): IMD file does not have solar zenith line: "+(String)imd_filename;
-    print_error_msg_and_exit( ErrorMsg.c_str() );
-  }
-
-  // create some C++ datetime object to extract the
-  // the year,month,day,hour,minutes, and seconds
-  //   e.g. use this string:
-  //     2021-10-27 11:41:57.133850
-  // to parse out the dates.
-  String DateTimeStr = trim(firstTimeLine.substr( 
-    firstTimeLine.find("=")+1, firstTimeLine.length()-1 ));
-  std::replace( DateTimeStr.begin(),DateTimeStr.end(),'T',' ' ); 
-  std::replace( DateTimeStr.begin(),DateTimeStr.end(),'Z',' ' ); 
-  std::replace( DateTimeStr.begin(),DateTimeStr.end(),';',' ' ); 
-
-  size_t year  = std::stoi(DateTimeStr.substr(0,4));
-  size_t month = std::stoi(DateTimeStr.substr(5,6)); 
-  size_t day   = std::stoi(DateTimeStr.substr(8,9));
-  size_t hour  = std::stoi(DateTimeStr.substr(11,12));
-  double mmss  = stod(DateTimeStr.substr(17,DateTimeStr.length()-1 ));  
+    ErrorMsg = "  ERROR (fatal): IMD file does not have solar zenith line: "+IMD.GetFilename();
+    throw std::runtime_error( ErrorMsg );
+  }
+
+  // parse the year,month,day,hour, and seconds from fixed
+  // positions of the timestamp, e.g.:
+  //     2021-10-27T11:41:57.133850Z
+  int Fields[4];
+  const size_t FieldStart[4] = { 0,5,8,11 };
+  double mmss = 0.0;
+  for( int f=0; f<4; f++ ) {
+    if( firstTimeValue.size()<=FieldStart[f] || 
+        !IMDFile::ParseInt( firstTimeValue.substr( FieldStart[f] ),Fields[f] )) {
+      ErrorMsg = "  ERROR (fatal): unable to parse first line time in IMD file: "+IMD.GetFilename();
+      throw std::runtime_error( ErrorMsg );
+    }
+  }
+  if( firstTimeValue.size()<=17 || !IMDFile::ParseDouble( firstTimeValue.substr( 17 ),mmss )) {
+    ErrorMsg = "  ERROR (fatal): unable to parse first line time in IMD file: "+IMD.GetFilename();
+    throw std::runtime_error( ErrorMsg );
+  }
+  size_t year  = Fields[0];
+  size_t month = Fields[1];
+  size_t day   = Fields[2];
+  size_t hour  = Fields[3];
 
   // ---- if month is Jan/Feb ... make adjustment per documentation
   // from digital globe:
@@ -199,7 +349,172 @@ void EarthSunDistance( const char* imd_filename, SolarMetadata* Metadata ) {
   Metadata->earthSunDistance = earthSunDist;
   Metadata->solarZenithAngle = (double)0.0;
 
-  // now parse out and compute the solar zenith angle
-  double solarZenithAngle = SolarZenithAngle( solarZenithLine.c_str() ); 
-  Metadata->solarZenithAngle = solarZenithAngle;
+  // now compute the solar zenith angle
+  Metadata->solarZenithAngle = SolarZenithAngle( solarElevationAngle );
+
+  // bit depth of the DNs (e.g. bitsPerPixel = 11;), used to size lookup
+  // tables. Products without the entry are treated as full 16-bit.
+  Metadata->bitsPerPixel = 16;
+  std::string_view bitsPerPixelValue;
+  if( IMD.FindAnywhere( "bitsPerPixel",bitsPerPixelValue )) {
+    if( !IMDFile::ParseInt( bitsPerPixelValue,Metadata->bitsPerPixel )) {
+      ErrorMsg = "  ERROR (fatal): unable to parse bitsPerPixel in IMD file: "+IMD.GetFilename();
+      throw std::runtime_error( ErrorMsg );
+    }
+  }
+
+  // line time, line rate and corners, for per-pixel solar zenith angles
+  Metadata->Geometry = ReadSolarGeometry( IMD );
+}
+
+static bool ParseJulianDate( std::string_view Time, double& JulianDate ) {
+  /* *********************************************************************
+   * Julian date of a UTC timestamp such as 2021-10-27T11:41:57.133850Z
+   * (Meeus, Astronomical Algorithms, ch. 7), to the fraction of a second.
+   */
+  int Fields[5];
+  const size_t FieldStart[5] = { 0,5,8,11,14 };
+  double Seconds = 0.0;
+  for( int f=0; f<5; f++ ) {
+    if( Time.size()<=FieldStart[f] || !IMDFile::ParseInt( Time.substr( FieldStart[f] ),Fields[f] )) return false;
+  }
+  if( Time.size()<=17 || !IMDFile::ParseDouble( Time.substr( 17 ),Seconds )) return false;
+  int Year = Fields[0], Month = Fields[1];
+  if( Month<=2 ) {
+    Year  -= 1;
+    Month += 12;
+  }
+  int A = Year/100;
+  int B = 2-A+A/4;
+  double Day = Fields[2]+( Fields[3]+( Fields[4]+Seconds/60.0 )/60.0 )/24.0;
+  JulianDate = floor( 365.25*( Year+4716 ))+floor( 30.6001*( Month+1 ))+Day+B-1524.5;
+  return true;
+}
+
+SolarGeometry ReadSolarGeometry( const IMDFile& IMD ) {
+  /* *********************************************************************
+   * The acquisition geometry of a scene: firstLineTime and avgLineRate
+   * (IMAGE_1, or anywhere in the file) and the product's corner
+   * coordinates (ULLat/ULLon ... LLLat/LLLon of the first BAND_ group).
+   * Anything missing leaves the geometry invalid; only -g grid needs it.
+   */
+  SolarGeometry Geometry;
+  std::string_view Value;
+  int Image = IMD.FindGroup( "IMAGE_1" );
+  if( !IMD.Find( "firstLineTime",Value,Image ) && !IMD.FindAnywhere( "firstLineTime",Value )) return Geometry;
+  if( !ParseJulianDate( IMDFile::Unquote( Value ),Geometry.FirstLineJulianDate )) return Geometry;
+  if( !IMD.Find( "avgLineRate",Value,Image ) && !IMD.FindAnywhere( "avgLineRate",Value )) return Geometry;
+  if( !IMDFile::ParseDouble( Value,Geometry.LineRate ) || !( Geometry.LineRate>0.0 )) return Geometry;
+
+  const char* Latitudes[4]  = { "ULLat","URLat","LRLat","LLLat" };
+  const char* Longitudes[4] = { "ULLon","URLon","LRLon","LLLon" };
+  const std::vector<IMDGroup>& Groups = IMD.GetGroups();
+  for( size_t g=0; g<Groups.size(); g++ ) {
+    if( Groups[g].Parent != IMD_ROOT || Groups[g].Name.compare( 0,5,"BAND_" ) != 0 ) continue;
+    bool Found = true;
+    for( int k=0; k<4 && Found; k++ ) {
+      Found = IMD.Find( Latitudes[k],Value,(int)g ) && IMDFile::ParseDouble( Value,Geometry.CornerLatitude[k] ) &&
+        IMD.Find( Longitudes[k],Value,(int)g ) && IMDFile::ParseDouble( Value,Geometry.CornerLongitude[k] );
+    }
+    if( !Found ) continue;
+
+    // keep the corners on the same side of the antimeridian as UL
+    for( int k=1; k<4; k++ ) {
+      if( Geometry.CornerLongitude[k]-Geometry.CornerLongitude[0]>180.0 )  Geometry.CornerLongitude[k] -= 360.0;
+      if( Geometry.CornerLongitude[k]-Geometry.CornerLongitude[0]<-180.0 ) Geometry.CornerLongitude[k] += 360.0;
+    }
+    Geometry.Valid = true;
+    break;
+  }
+  return Geometry;
+}
+
+double SolarZenithAngle( double JulianDate, double Latitude, double Longitude ) {
+  /* *********************************************************************
+   * Solar zenith angle (degrees) from the NOAA solar position equations
+   * (after Meeus): the sun's declination and the equation of time at the
+   * Julian date, then the hour angle at the longitude (east positive).
+   * Good to about 0.01 degree; the grid only uses its variation across
+   * a scene.
+   */
+  const double Radians = M_PI/180.0;
+  double T  = ( JulianDate-2451545.0 )/36525.0;
+  double L0 = fmod( 280.46646+T*( 36000.76983+T*0.0003032 ),360.0 );
+  double M  = 357.52911+T*( 35999.05029-0.0001537*T );
+  double e  = 0.016708634-T*( 0.000042037+0.0000001267*T );
+  double C  = sin( M*Radians )*( 1.914602-T*( 0.004817+0.000014*T ))+
+    sin( 2*M*Radians )*( 0.019993-0.000101*T )+sin( 3*M*Radians )*0.000289;
+  double Omega  = 125.04-1934.136*T;
+  double Lambda = L0+C-0.00569-0.00478*sin( Omega*Radians );
+  double Epsilon = 23.0+( 26.0+( 21.448-T*( 46.815+T*( 0.00059-T*0.001813 )))/60.0 )/60.0+
+    0.00256*cos( Omega*Radians );
+  double Declination = asin( sin( Epsilon*Radians )*sin( Lambda*Radians ));
+
+  double y = tan( Epsilon*Radians/2.0 );
+  y *= y;
+  double EquationOfTime = 4.0/Radians*( y*sin( 2*L0*Radians )-2*e*sin( M*Radians )+
+    4*e*y*sin( M*Radians )*cos( 2*L0*Radians )-0.5*y*y*sin( 4*L0*Radians )-
+    1.25*e*e*sin( 2*M*Radians ));
+  double Minutes   = ( JulianDate+0.5-floor( JulianDate+0.5 ))*1440.0;
+  double SolarTime = Minutes+EquationOfTime+4.0*Longitude;
+  double HourAngle = SolarTime/4.0-180.0;
+
+  double CosZenith = sin( Latitude*Radians )*sin( Declination )+
+    cos( Latitude*Radians )*cos( Declination )*cos( HourAngle*Radians );
+  CosZenith = std::max( -1.0,std::min( 1.0,CosZenith ));
+  return acos( CosZenith )/Radians;
+}
+
+static double SceneZenithAngle( const SolarGeometry& Geometry, int SceneRows, int SceneCols,
+  double Row, double Col ) {
+  /* zenith at a pixel of the product: corners interpolated bilinearly,
+   * time from the first line and the line rate */
+  double u = ( SceneCols>1 ) ? Col/( SceneCols-1 ) : 0.0;
+  double v = ( SceneRows>1 ) ? Row/( SceneRows-1 ) : 0.0;
+  const double* Lat = Geometry.CornerLatitude;
+  const double* Lon = Geometry.CornerLongitude;
+  double Latitude  = ( 1-v )*(( 1-u )*Lat[0]+u*Lat[1] )+v*(( 1-u )*Lat[3]+u*Lat[2] );
+  double Longitude = ( 1-v )*(( 1-u )*Lon[0]+u*Lon[1] )+v*(( 1-u )*Lon[3]+u*Lon[2] );
+  double JulianDate = Geometry.FirstLineJulianDate+Row/Geometry.LineRate/86400.0;
+  return SolarZenithAngle( JulianDate,Latitude,Longitude );
+}
+
+SolarZenithGrid BuildSolarZenithGrid( const SolarMetadata& Metadata, int Rows, int Cols ) {
+  /* *********************************************************************
+   * Reflectance scale factors on nodes every SOLAR_GRID_SPACING pixels
+   * of the image, covering it. The zenith at each node is the IMD's
+   * mean (90 - meanSunEl) plus the computed zenith there minus the one
+   * at the product's centre, so the grid agrees with the scene-mean
+   * mode at the centre and only adds the variation across the scene:
+   *
+   *   scale = cos(mean zenith) / cos(zenith)
+   *
+   * The Earth-sun distance changes by less than 1e-7 AU over a strip
+   * and stays in the fused gain. Rows are taken as scan lines, which
+   * holds approximately for map-projected products too.
+   */
+  const SolarGeometry& Geometry = Metadata.Geometry;
+  if( !Geometry.Valid ) {
+    throw std::runtime_error( "  ERROR (fatal): IMD file has no firstLineTime, avgLineRate or corner "
+      "coordinates for per-pixel solar geometry" );
+  }
+  int SceneRows = ( Geometry.SceneRows>0 ) ? Geometry.SceneRows : Rows;
+  int SceneCols = ( Geometry.SceneCols>0 ) ? Geometry.SceneCols : Cols;
+  double Center = SceneZenithAngle( Geometry,SceneRows,SceneCols,0.5*( SceneRows-1 ),0.5*( SceneCols-1 ));
+  double CosMean = cos( Metadata.solarZenithAngle*M_PI/180.0 );
+
+  SolarZenithGrid Grid;
+  Grid.Spacing  = SOLAR_GRID_SPACING;
+  Grid.NodeRows = std::max( 2,( Rows-1 )/Grid.Spacing+2 );
+  Grid.NodeCols = std::max( 2,( Cols-1 )/Grid.Spacing+2 );
+  Grid.Scale.resize( (size_t)Grid.NodeRows*Grid.NodeCols );
+  for( int r=0; r<Grid.NodeRows; r++ ) {
+    for( int c=0; c<Grid.NodeCols; c++ ) {
+      double Zenith = Metadata.solarZenithAngle-Center+SceneZenithAngle( Geometry,SceneRows,SceneCols,
+        (double)( Geometry.RowOffset+r*Grid.Spacing ),(double)( Geometry.ColOffset+c*Grid.Spacing ));
+      double CosZenith = std::max( 0.01,cos( Zenith*M_PI/180.0 ));
+      Grid.Scale[(size_t)r*Grid.NodeCols+c] = (float)( CosMean/CosZenith );
+    }
+  }
+  return Grid;
 }
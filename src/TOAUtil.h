@@ -1,7 +1,30 @@
 #ifndef TOAUTIL_H_
 #define TOAUTIL_H_
-#define NODATA -9999
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include "KernelUtil.h"
 typedef std::string String;
+class IMDFile;
+
+// pixels between the nodes of a SolarZenithGrid
+#define SOLAR_GRID_SPACING 512
+
+// acquisition geometry of a scene from the IMD, for per-pixel solar
+// zenith angles: the UTC of the first line, the line rate and the
+// corner coordinates of the product. A tile of a multi-tile delivery
+// sets its offset and the size of the full product (0 = the image's).
+struct SolarGeometry {
+  bool Valid = false;
+  double FirstLineJulianDate = 0.0;
+  double LineRate = 0.0;           // lines per second (avgLineRate)
+  double CornerLatitude[4];        // UL, UR, LR, LL, degrees
+  double CornerLongitude[4];
+  int SceneRows = 0;
+  int SceneCols = 0;
+  int RowOffset = 0;
+  int ColOffset = 0;
+};
 
 // define strucutre in header file ... appropriate
 // to define it here instead of the implementation file
@@ -9,14 +32,86 @@ typedef std::string String;
 struct SolarMetadata {
   double earthSunDistance;
   double solarZenithAngle;
+  int bitsPerPixel;          // DN bit depth from the IMD (e.g. 11 or 16)
+  SolarGeometry Geometry;    // for BuildSolarZenithGrid()
+};
+
+// spectral bands of the supported satellites, named BAND_P ... BAND_RE
+// in the XML and IMD files
+enum SpectralBand {
+  SPECTRAL_P = 0,     // PAN
+  SPECTRAL_C,         // COASTAL
+  SPECTRAL_B,         // BLUE
+  SPECTRAL_G,         // GREEN
+  SPECTRAL_Y,         // YELLOW
+  SPECTRAL_R,         // RED
+  SPECTRAL_N,         // NIR
+  SPECTRAL_N2,        // NIR2
+  SPECTRAL_RE,        // REDEDGE
+  SPECTRAL_BAND_COUNT
+};
+
+// calibration of one band of a scene, parsed from the XML
+struct BandCalibration {
+  String Name;                 // e.g. BAND_C
+  SpectralBand ID;
+  double AbsCalFactor;
+  double EffectiveBandwidth;
+  double SolarIrradiance;      // -9999 if the satellite has no such band
+};
+
+// calibration of every band of a scene. Bands are kept in the order of
+// the XML, which is the order of the image's bands, so GDAL band i is
+// Bands[i-1].
+struct SceneCalibration {
+  String SatelliteID;
+  std::vector<BandCalibration> Bands;
+
+  int GetBandCount() const { return (int)Bands.size(); }
+  const BandCalibration& GetBand( int GDALBandIndex ) const {
+    if( GDALBandIndex<1 || GDALBandIndex>(int)Bands.size() ) {
+      throw std::out_of_range( "ERROR (fatal): no calibration in XML for band "+
+        std::to_string( GDALBandIndex ));
+    }
+    return Bands[GDALBandIndex-1];
+  }
 };
 
-// method to return std::map containing effective calibration and bandwidth for each band
-std::map<String,String> SetCalibrationAndBandWidth( const char*, const char*, const char* );
+// parse the satellite ID and band calibrations from the XML file, from
+// the text of an XML (named in errors by the second argument), or from
+// an indexed IMD file (see IMDUtil.h)
+SceneCalibration ReadSceneCalibration( const char* );
+SceneCalibration ReadSceneCalibrationText( const String&, const String& );
+SceneCalibration ReadSceneCalibration( const IMDFile& );
+
+// one band's calibration for a satellite, band name (BAND_C, ...),
+// absolute calibration factor and effective bandwidth; throws for an
+// unknown band name
+BandCalibration MakeBandCalibration( const String&, const String&, double, double );
+bool HasBandCalibration( const IMDFile& );
+
+// band name (BAND_C, ...) to SpectralBand; false if not a known band
+bool ParseSpectralBand( const String&, SpectralBand& );
 
-// function to get the solar zenith angle for the dataset
-double SolarZenithAngle( const char* );
+// exo-atmospheric solar irradiance of a band of a satellite (e.g. "WV02")
+double SolarIrradiance( const String&, SpectralBand );
 
-// function to set Earth-sun distance (in AU)
+// function to get the solar zenith angle from the mean sun elevation
+double SolarZenithAngle( double );
+
+// function to set Earth-sun distance (in AU), solar zenith angle and bit
+// depth from the IMD file, by name or already indexed
 void EarthSunDistance( const char*, SolarMetadata* );
+void EarthSunDistance( const IMDFile&, SolarMetadata* );
+
+// the acquisition geometry of the IMD (Valid is false if incomplete)
+SolarGeometry ReadSolarGeometry( const IMDFile& );
+
+// solar zenith angle (degrees) at a Julian date (UTC) and a position
+double SolarZenithAngle( double, double, double );
+
+// reflectance scale factors for an image of Rows x Cols pixels from the
+// scene's geometry, anchored on its mean sun elevation (throws if the
+// IMD had no usable geometry)
+SolarZenithGrid BuildSolarZenithGrid( const SolarMetadata&, int, int );
 #endif
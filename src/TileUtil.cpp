@@ -0,0 +1,235 @@
+#include <iostream>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <stdexcept>
+#include <stdio.h>
+#include "TileUtil.h"
+#include "IMDUtil.h"
+#include "SceneUtil.h"
+#include "PipelineUtil.h"
+using namespace std;
+
+static String ResolveTileFilename( const String& TILFilename, const String& Filename ) {
+  /* tile filenames in a .TIL are relative to the .TIL's directory */
+  if( Filename.empty() || Filename[0] == '/' ) return Filename;
+  size_t Slash = TILFilename.find_last_of( '/' );
+  if( Slash == String::npos ) return Filename;
+  return TILFilename.substr( 0,Slash+1 )+Filename;
+}
+
+TileLayout ReadTileLayout( const String& TILFilename ) {
+  /* *********************************************************************
+   * Read the tiles of a multi-tile delivery from its .TIL file, which
+   * has the syntax of an IMD:
+   *
+   *   BEGIN_GROUP = TILE_1
+   *     filename = "15FEB12161256-M2AS_R1C1-054424530010_01_P001.TIF";
+   *     ULColOffset = 0;
+   *     ULRowOffset = 0;
+   *     LRColOffset = 8191;
+   *     LRRowOffset = 8191;
+   *     ...
+   *   END_GROUP = TILE_1
+   *
+   * The LR offsets are inclusive, and the full scene spans the largest
+   * of them. Throws if the file has no tiles or a tile is incomplete.
+   */
+  if( !file_exists( TILFilename )) {
+    throw std::runtime_error( "  ERROR (fatal): file does not exist: "+TILFilename );
+  }
+  IMDFile TIL( TILFilename );
+  TileLayout Layout;
+  Layout.TILFilename = TILFilename;
+
+  const std::vector<IMDGroup>& Groups = TIL.GetGroups();
+  for( size_t g=0; g<Groups.size(); g++ ) {
+    if( Groups[g].Parent != IMD_ROOT || Groups[g].Name.compare( 0,5,"TILE_" ) != 0 ) continue;
+    std::string_view Filename;
+    if( !TIL.Find( "filename",Filename,(int)g )) {
+      throw std::runtime_error( "  ERROR (fatal): no filename for "+String( Groups[g].Name )+
+        " in TIL file: "+TILFilename );
+    }
+    SceneTile Tile;
+    Tile.Filename   = ResolveTileFilename( TILFilename,String( IMDFile::Unquote( Filename )));
+    Tile.ColOffset  = TIL.GetInt( "ULColOffset",(int)g );
+    Tile.RowOffset  = TIL.GetInt( "ULRowOffset",(int)g );
+    Tile.Cols       = TIL.GetInt( "LRColOffset",(int)g )-Tile.ColOffset+1;
+    Tile.Rows       = TIL.GetInt( "LRRowOffset",(int)g )-Tile.RowOffset+1;
+    if( Tile.ColOffset<0 || Tile.RowOffset<0 || Tile.Cols<1 || Tile.Rows<1 ) {
+      throw std::runtime_error( "  ERROR (fatal): invalid offsets for "+String( Groups[g].Name )+
+        " in TIL file: "+TILFilename );
+    }
+    Layout.Cols = std::max( Layout.Cols,Tile.ColOffset+Tile.Cols );
+    Layout.Rows = std::max( Layout.Rows,Tile.RowOffset+Tile.Rows );
+    Layout.Tiles.push_back( Tile );
+  }
+  if( Layout.Tiles.empty() ) {
+    throw std::runtime_error( "  ERROR (fatal): no tiles in TIL file: "+TILFilename );
+  }
+  return Layout;
+}
+
+static GDALDataset* CreateMosaicOutput( const String& Filename, const TileLayout& Layout,
+  ImageUtil& First, const SceneTile& FirstTile ) {
+  /* *********************************************************************
+   * One output of a mosaic: the full scene's size, the first tile's band
+   * count, creation options and projection, and its geotransform moved
+   * back from the tile's offset to the scene's origin.
+   */
+  if( file_exists( Filename ) && std::remove( Filename.c_str() ) != 0 ) {
+    throw std::runtime_error( "  ERROR (fatal): unable to remove file: "+Filename );
+  }
+  GDALDriver *DriverTiff = GetGDALDriverManager()->GetDriverByName("GTiff");
+  char **TiffOptions = First.GetCreationOptions();
+  GDALDataset *Dataset = DriverTiff->Create( Filename.c_str(),Layout.Cols,Layout.Rows,
+    First.GetDimensions()[2],GDT_Float32,TiffOptions );
+  CSLDestroy( TiffOptions );
+  if( Dataset == nullptr ) {
+    throw std::runtime_error( "  ERROR (fatal): unable to create mosaic Geotiff: "+Filename );
+  }
+  double GeoTransform[6];
+  const double* TileTransform = First.GetGeoTransform();
+  for( int i=0; i<6; i++ ) GeoTransform[i] = TileTransform[i];
+  GeoTransform[0] -= FirstTile.ColOffset*TileTransform[1]+FirstTile.RowOffset*TileTransform[2];
+  GeoTransform[3] -= FirstTile.ColOffset*TileTransform[4]+FirstTile.RowOffset*TileTransform[5];
+  Dataset->SetGeoTransform( GeoTransform );
+  Dataset->SetProjection( First.GetProjection() );
+  return Dataset;
+}
+
+int ConvertTiledScene( const String& TILFilename, const String& IMDFilename,
+  const String& XMLFilename, const SceneOptions& Options, const BatchBudget& Budget,
+  TileOutput Output, const String& RadiancesFilename, const String& ReflectancesFilename ) {
+  /* *********************************************************************
+   * Convert the tiles of a multi-tile delivery (R1C1, R1C2, ...) listed
+   * in its .TIL file. The IMD and XML are parsed once for all tiles;
+   * each tile opens only its own image, once (the first tile of a
+   * mosaic when the mosaic is laid out). Tiles run at once and share the
+   * thread and memory budgets the way the scenes of a batch do (see
+   * ShareBatchBudget()).
+   *
+   * With TILE_OUTPUT_TILES each tile gets its own pair of Geotiffs next
+   * to it. With TILE_OUTPUT_MOSAIC all tiles write into one pair the
+   * size of the full scene, at their offsets from the .TIL (default
+   * <TIL>_TOA_RADIANCES.TIF etc.); a mosaic with a failed tile is
+   * removed. Progress (-l) is reported per tile, or for a mosaic once
+   * for the whole scene. Returns the number of failed tiles.
+   */
+  InitializeGDAL();
+  TileLayout Layout    = ReadTileLayout( TILFilename );
+  SceneMetadata Shared = LoadSharedSceneMetadata( IMDFilename,XMLFilename );
+
+  int Threads = ( Budget.Threads>0 ) ? Budget.Threads : HardwareThreads();
+  int Tiles   = ( Budget.Scenes>0 ) ? Budget.Scenes : std::max( 1,Threads/4 );
+  Tiles = std::max( 1,std::min( Tiles,(int)Layout.Tiles.size() ));
+  SceneOptions PerTile = ShareBatchBudget( Options,Budget,Tiles );
+  printf("  tiled scene: %zu tiles (%d x %d pixels), %d at a time, %d threads each\n",
+    Layout.Tiles.size(),Layout.Cols,Layout.Rows,Tiles,PerTile.ComputeThreads );
+
+  // the mosaic outputs, laid out from the first tile, whose image stays
+  // open for its conversion
+  GDALDatasetPtr MosaicRadiances, MosaicReflectances;
+  SceneMetadata FirstScene;
+  std::unique_ptr<ImageUtil> FirstImage;
+  std::unique_ptr<PrintedProgress> MosaicProgress;
+  String MosaicRadiancesFilename    = RadiancesFilename;
+  String MosaicReflectancesFilename = ReflectancesFilename;
+  if( Output == TILE_OUTPUT_MOSAIC ) {
+    if( Options.CloudOptimized ) {
+      throw std::runtime_error( "  ERROR (fatal): Cloud-Optimized output is not supported for mosaics" );
+    }
+    String Base = TILFilename.substr( 0,TILFilename.length()-4 );
+    if( MosaicRadiancesFilename.empty() )    MosaicRadiancesFilename    = Base+"_TOA_RADIANCES.TIF";
+    if( MosaicReflectancesFilename.empty() ) MosaicReflectancesFilename = Base+"_TOA_REFLECTANCES.TIF";
+
+    FirstScene = LoadTileMetadata( Layout.Tiles[0].Filename,Shared );
+    FirstImage.reset( new ImageUtil( FirstScene ));
+    ApplySceneOptions( *FirstImage,PerTile );
+    MosaicRadiances.reset( CreateMosaicOutput( MosaicRadiancesFilename,Layout,*FirstImage,
+      Layout.Tiles[0] ));
+    MosaicReflectances.reset( CreateMosaicOutput( MosaicReflectancesFilename,Layout,*FirstImage,
+      Layout.Tiles[0] ));
+    printf("  creating the following top-of-atmosphere radiances mosaic:\n   %s\n",
+      MosaicRadiancesFilename.c_str() );
+    printf("  creating the following top-of-atmosphere reflectances mosaic:\n   %s\n",
+      MosaicReflectancesFilename.c_str() );
+
+    // one progress for the whole mosaic, which every tile advances
+    if( PerTile.Progress != PROGRESS_NONE ) {
+      int Bands = FirstImage->GetDimensions()[2];
+      uint64_t Pixels = 0;
+      for( const SceneTile& Tile: Layout.Tiles ) Pixels += (uint64_t)Tile.Rows*Tile.Cols*Bands;
+      MosaicProgress.reset( new PrintedProgress( PerTile.Progress,PerTile.ProgressStream,TILFilename ));
+      MosaicProgress->Start( Pixels,Bands );
+    }
+  }
+
+  std::mutex MosaicLock;
+  std::mutex ConsoleLock;
+  std::atomic<size_t> NextTile( 0 );
+  std::atomic<int> Failed( 0 );
+  auto Runner = [&]() {
+    for( size_t i=NextTile++; i<Layout.Tiles.size(); i=NextTile++ ) {
+      const SceneTile& Tile = Layout.Tiles[i];
+      String Message = "";
+      auto Timer = std::chrono::steady_clock::now();
+      try {
+        // the first tile of a mosaic was opened to lay the mosaic out
+        SceneMetadata Scene;
+        std::unique_ptr<ImageUtil> Image;
+        if( i == 0 && FirstImage ) {
+          Scene = std::move( FirstScene );
+          Image = std::move( FirstImage );
+        } else {
+          Scene = LoadTileMetadata( Tile.Filename,Shared );
+          Image.reset( new ImageUtil( Scene ));
+          ApplySceneOptions( *Image,PerTile );
+        }
+        Scene.Solar.Geometry.SceneRows = Layout.Rows;
+        Scene.Solar.Geometry.SceneCols = Layout.Cols;
+        Scene.Solar.Geometry.RowOffset = Tile.RowOffset;
+        Scene.Solar.Geometry.ColOffset = Tile.ColOffset;
+        std::unique_ptr<PrintedProgress> Progress;
+        if( Output == TILE_OUTPUT_MOSAIC ) {
+          Image->SetProgress( MosaicProgress.get() );
+        } else if( PerTile.Progress != PROGRESS_NONE ) {
+          Progress.reset( new PrintedProgress( PerTile.Progress,PerTile.ProgressStream,Tile.Filename ));
+          Image->SetProgress( Progress.get() );
+        }
+        if( Output == TILE_OUTPUT_MOSAIC ) {
+          Image->SetOutputFilenames( MosaicRadiancesFilename,MosaicReflectancesFilename );
+          Image->SetMosaicOutputs( MosaicRadiances.get(),MosaicReflectances.get(),
+            Tile.ColOffset,Tile.RowOffset,&MosaicLock );
+        }
+        Image->WriteRadianceAndReflectanceGeotiffs( &Scene.Solar,Scene.Calibration );
+      } catch( const std::exception& e ) {
+        Message = trim( String( e.what() ));
+        Failed++;
+      }
+      double Seconds = std::chrono::duration<double>( std::chrono::steady_clock::now()-Timer ).count();
+      std::lock_guard<std::mutex> Guard( ConsoleLock );
+      printf("  tile %zu of %zu %s (%.1f s): %s\n",i+1,Layout.Tiles.size(),
+        Message.empty() ? "done" : "FAILED",Seconds,Tile.Filename.c_str() );
+      if( !Message.empty() ) printf("    %s\n",Message.c_str() );
+    }
+  };
+
+  std::vector<std::thread> Runners;
+  for( int t=0; t<Tiles; t++ ) Runners.emplace_back( Runner );
+  for( std::thread& Thread: Runners ) Thread.join();
+
+  if( Output == TILE_OUTPUT_MOSAIC ) {
+    if( MosaicProgress && Failed == 0 ) MosaicProgress->Finish();
+    MosaicRadiances.reset();
+    MosaicReflectances.reset();
+    if( Failed>0 ) {
+      std::remove( MosaicRadiancesFilename.c_str() );
+      std::remove( MosaicReflectancesFilename.c_str() );
+    }
+  }
+  printf("  tiled scene finished: %zu tiles, %d failed\n",Layout.Tiles.size(),(int)Failed );
+  return Failed;
+}
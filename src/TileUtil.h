@@ -0,0 +1,40 @@
+#ifndef TILEUTIL_H_
+#define TILEUTIL_H_
+#include <string>
+#include <vector>
+#include "BatchUtil.h"
+typedef std::string String;
+
+// one R{n}C{m} tile of a scene, placed in the full scene by its offsets
+struct SceneTile {
+  String Filename;
+  int ColOffset;
+  int RowOffset;
+  int Cols;
+  int Rows;
+};
+
+// the tiles of a multi-tile delivery, read from its .TIL file
+struct TileLayout {
+  String TILFilename;
+  int Cols = 0;              // size of the full scene
+  int Rows = 0;
+  std::vector<SceneTile> Tiles;
+};
+
+// outputs of a tiled scene: a pair of Geotiffs per tile, or one pair
+// for the whole scene
+enum TileOutput {
+  TILE_OUTPUT_TILES  = 0,
+  TILE_OUTPUT_MOSAIC = 1
+};
+
+// read the tile filenames and offsets of a .TIL file (throws on error)
+TileLayout ReadTileLayout( const String& );
+
+// convert every tile of a scene with shared metadata; returns the number
+// of tiles that failed. Output names ("" = default) apply to mosaics.
+int ConvertTiledScene( const String&, const String&, const String&, const SceneOptions&,
+  const BatchBudget&, TileOutput, const String& RadiancesFilename="",
+  const String& ReflectancesFilename="" );
+#endif
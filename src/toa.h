@@ -0,0 +1,86 @@
+#ifndef TOA_H_
+#define TOA_H_
+#include <stddef.h>
+
+/* ***********************************************************************
+ * The plain C API of libtoa (the C++ one is LibTOA.h): convert a
+ * caller-owned buffer of DNs into caller-owned buffers of top-of-
+ * atmosphere radiances and reflectances, with no file I/O. Functions
+ * return TOA_OK or a negative status, or NULL, and toa_last_error()
+ * then describes the error of the calling thread.
+ *
+ *   toa_scene *scene = toa_scene_parse( imd_text,NULL );
+ *   toa_converter *converter = toa_converter_new( scene,0,0 );
+ *   toa_buffer dn = { pixels,0,0 }, rad = { radiances,0,0 }, refl = { reflectances,0,0 };
+ *   if( toa_convert( converter,1,TOA_UINT16,width,height,&dn,&rad,&refl,NULL,0,0 ) != TOA_OK )
+ *     fprintf( stderr,"%s\n",toa_last_error() );
+ *   toa_converter_free( converter );
+ *   toa_scene_free( scene );
+ */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TOA_OK               0
+#define TOA_ERROR_ARGUMENT  -1    /* bad buffer, band number or pixel type */
+#define TOA_ERROR_METADATA  -2    /* IMD/XML text or scene unusable */
+#define TOA_ERROR_MEMORY    -3
+
+/* radiance and reflectance written for NoData DNs */
+#define TOA_NODATA       -9999
+
+/* pixel types of a DN buffer (the values of the matching GDALDataType) */
+typedef enum {
+  TOA_BYTE    = 1,
+  TOA_UINT16  = 2,
+  TOA_INT16   = 3,
+  TOA_UINT32  = 4,
+  TOA_FLOAT32 = 6
+} toa_data_type;
+
+/* a caller-owned image. Strides are in bytes, 0 = packed; a NULL data
+ * pointer skips that output. */
+typedef struct {
+  void *data;
+  size_t row_stride;
+  size_t pixel_stride;
+} toa_buffer;
+
+typedef struct toa_scene toa_scene;
+typedef struct toa_converter toa_converter;
+
+/* a scene from the text of its IMD and, if the IMD has no band
+ * calibrations, of its XML (NULL for none) */
+toa_scene* toa_scene_parse( const char *imd_text, const char *xml_text );
+
+/* a scene filled in by the caller: satellite ID (e.g. WV03), Earth-sun
+ * distance (AU), mean sun elevation (degrees) and DN bit depth, then its
+ * bands in order by name (BAND_C, ...), calibration and bandwidth */
+toa_scene* toa_scene_new( const char *satellite_id, double earth_sun_distance,
+  double sun_elevation, int bits_per_pixel );
+int toa_scene_add_band( toa_scene *scene, const char *band_name, double abs_cal_factor,
+  double effective_bandwidth );
+int toa_scene_band_count( const toa_scene *scene );
+void toa_scene_free( toa_scene *scene );
+
+/* the converter of a scene, which may be freed afterwards. image_rows x
+ * image_cols > 0 uses per-pixel solar zenith angles over an image of that
+ * size (the IMD must have the geometry); 0 uses the scene's mean angle. */
+toa_converter* toa_converter_new( const toa_scene *scene, int image_rows, int image_cols );
+void toa_converter_free( toa_converter *converter );
+
+/* convert width x height DNs of band (from 1) at position (x,y) of the
+ * image. The DNs are not modified. nodata points to the band's NoData
+ * value, or is NULL; those DNs become TOA_NODATA. Safe to call from
+ * several threads at once. */
+int toa_convert( const toa_converter *converter, int band, toa_data_type type,
+  int width, int height, const toa_buffer *dn, const toa_buffer *radiances,
+  const toa_buffer *reflectances, const double *nodata, int x, int y );
+
+/* the message of the last error of the calling thread ("" if none) */
+const char* toa_last_error( void );
+
+#ifdef __cplusplus
+}
+#endif
+#endif